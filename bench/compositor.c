@@ -0,0 +1,330 @@
+/*!
+ * @file compositor.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of the video compositor
+ *
+ * Builds synthetic scenes of sprites held in memory and composites every
+ * strip of a frame with videoComposeRows(), timing each strip with the DWT
+ * cycle counter. The scenes sweep the number of layers, doubling up to
+ * MAX_LAYERS, the sprite size, the bits per pixel of the sprites, how much
+ * the sprites overlap, the share of transparent pixels and the number of rows
+ * per strip. The LCD bus is not
+ * used, so the frame rate reported is the most the compositor can keep up
+ * with.
+ *
+ * Each scene is one CSV line:
+ *
+ * layers,size,bpp,overlap,transparent,rows,strips,strip_avg,strip_max,
+ * frame,update,fps
+ *
+ * update is the cycles taken by updateSprites(), which sorts the sprites into
+ * the row buckets used by the compositor.
+ *
+ * Cycle counts are the best of BENCH_REPEATS frames, so interrupts that land
+ * in a frame do not skew the result.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "clock.h"
+#include "led.h"
+#include "lcd.h"
+#include "sprite.h"
+#include "video.h"
+#include "profiler.h"
+
+// Frames timed for each scene, the fastest one is reported
+#define BENCH_REPEATS 5
+
+// Colors used by the sprites, index 0 of the pixel data is transparent. 2bpp
+// sprites only use the first 3.
+#define BENCH_COLORS 15
+
+// Side of the square sprites in pixels
+static const uint16_t benchSizes[] = {8, 16, 32, 64};
+
+// Bits per pixel of the sprites, every depth compiled in
+static const uint8_t benchDepths[] = {
+#if SPRITE_2BPP
+	2,
+#endif
+	4,
+#if SPRITE_8BPP
+	8,
+#endif
+};
+
+// Share of its side each sprite overlaps the previous one with, in percent
+static const uint8_t benchOverlaps[] = {0, 50, 100};
+
+// Share of transparent pixels in the sprites, in percent
+static const uint8_t benchTransparent[] = {0, 25, 50, 75};
+
+// Static function prototypes
+static void benchFillFrame(uint8_t *frame, uint16_t size, uint8_t bpp,
+                           uint8_t transparent);
+static void benchPlace(sprite *spr, uint16_t index, uint16_t size,
+                       uint8_t overlap);
+static void benchScene(uint16_t numLayers, uint16_t size, uint8_t bpp,
+                       uint8_t overlap, uint8_t transparent, uint8_t *frame);
+static void benchReport(uint16_t numLayers, uint16_t size, uint8_t bpp,
+                        uint8_t overlap, uint8_t transparent, uint8_t rows,
+                        uint32_t stripMax, uint32_t frameCycles,
+                        uint32_t updateCycles);
+
+// Sprites of the scene being timed
+static sprite benchSprites[MAX_LAYERS];
+
+// Palette shared by every sprite
+static uint16_t benchPalette[BENCH_COLORS];
+
+int main(void) {
+	uint8_t *frame;
+	uint16_t numLayers;
+	uint8_t s;
+	uint8_t d;
+	uint8_t o;
+	uint8_t t;
+	uint8_t i;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+	initLcd();
+
+	// Frame updating stays off, strips are only composited
+	if (initVideo()) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	// Pixel data of the largest sprite at 8bpp, reused by every scene
+	frame = (uint8_t *)malloc(benchSizes[ARRAY_COUNT(benchSizes) - 1]
+	                          * benchSizes[ARRAY_COUNT(benchSizes) - 1]);
+	if (frame == NULL) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	for (i = 0; i < BENCH_COLORS; i++) {
+		benchPalette[i] = COLOR_888_TO_565(0x102030 * (i + 1));
+	}
+
+	profilerSwoSendString("layers,size,bpp,overlap,transparent,rows,strips,"
+	                      "strip_avg,strip_max,frame,update,fps\n");
+
+	for (s = 0; s < ARRAY_COUNT(benchSizes); s++) {
+		for (d = 0; d < ARRAY_COUNT(benchDepths); d++) {
+			for (t = 0; t < ARRAY_COUNT(benchTransparent); t++) {
+				benchFillFrame(frame, benchSizes[s], benchDepths[d],
+				               benchTransparent[t]);
+
+				for (o = 0; o < ARRAY_COUNT(benchOverlaps); o++) {
+					for (numLayers = 1; ; numLayers *= 2) {
+						if (numLayers > MAX_LAYERS) numLayers = MAX_LAYERS;
+						benchScene(numLayers, benchSizes[s], benchDepths[d],
+						           benchOverlaps[o], benchTransparent[t], frame);
+						if (numLayers == MAX_LAYERS) break;
+					}
+				}
+			}
+		}
+	}
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Fill a sprite frame with random colors and transparent pixels
+ *
+ * @param frame Pixel data to fill
+ * @param size Side of the square sprite
+ * @param bpp Bits per pixel of the frame
+ * @param transparent Share of transparent pixels in percent
+ */
+static void benchFillFrame(uint8_t *frame, uint16_t size, uint8_t bpp,
+                           uint8_t transparent) {
+	uint32_t rand = 87;
+	uint32_t i;
+	uint8_t colors = (BENCH_COLORS < (1 << bpp) - 1)
+	                 ? BENCH_COLORS : (1 << bpp) - 1;
+	uint8_t index;
+	uint8_t n;
+
+	for (i = 0; i < (uint32_t)size * size * bpp / 8; i++) {
+		frame[i] = 0;
+		for (n = 0; n < 8; n += bpp) {
+			rand = rand * 1664525 + 1013904223;
+			if ((rand >> 16) % 100 < transparent) {
+				index = 0;
+			} else {
+				index = (rand >> 8) % colors + 1;
+			}
+			frame[i] |= index << n;
+		}
+	}
+}
+
+/*!
+ * @brief Place a sprite of a scene
+ *
+ * Sprites are laid out left to right then top to bottom, each one moved by
+ * the part of its side that does not overlap the previous one, starting over
+ * at the top left once the LCD is full. At 100% they are all stacked on the
+ * same spot.
+ *
+ * @param spr Sprite to place
+ * @param index Index of the sprite in the scene
+ * @param size Side of the square sprite
+ * @param overlap Share of the side overlapping the previous sprite in percent
+ */
+static void benchPlace(sprite *spr, uint16_t index, uint16_t size,
+                       uint8_t overlap) {
+	uint16_t step = size * (100 - overlap) / 100;
+	uint16_t columns;
+	uint16_t rows;
+
+	if (step == 0) {
+		spriteSetPos(spr, (LCD_WIDTH - size) / 2, (LCD_HEIGHT - size) / 2);
+		return;
+	}
+
+	columns = (LCD_WIDTH - size) / step + 1;
+	rows = (LCD_HEIGHT - size) / step + 1;
+	index %= columns * rows;
+	spriteSetPos(spr, (index % columns) * step, (index / columns) * step);
+}
+
+/*!
+ * @brief Time a scene for every number of rows per strip
+ *
+ * @param numLayers Number of sprites in the scene
+ * @param size Side of the square sprites
+ * @param bpp Bits per pixel of the sprites
+ * @param overlap Share of the side overlapping the previous sprite in percent
+ * @param transparent Share of transparent pixels in percent
+ * @param frame Pixel data shared by every sprite
+ */
+static void benchScene(uint16_t numLayers, uint16_t size, uint8_t bpp,
+                       uint8_t overlap, uint8_t transparent, uint8_t *frame) {
+	uint16_t i;
+	uint8_t rows;
+	uint8_t repeat;
+	int16_t y;
+	uint32_t start;
+	uint32_t cycles;
+	uint32_t frameCycles;
+	uint32_t stripMax;
+	uint32_t bestFrame;
+	uint32_t bestStripMax;
+	uint32_t updateCycles;
+	int8_t result;
+
+	// The first sprite holds the data, the rest are copies of it
+	for (i = 0; i < numLayers; i++) {
+		if (i == 0) {
+			result = initSpriteFromMemory(&benchSprites[0], size, size, 1, bpp,
+			                              benchPalette, BENCH_COLORS, frame);
+		} else {
+			result = copySprite(&benchSprites[0], &benchSprites[i]);
+		}
+		if (result || spriteLayersAdd(&benchSprites[i])) {
+			ledError(LED_ERROR);
+			while(1);
+		}
+		benchPlace(&benchSprites[i], i, size, overlap);
+	}
+
+	// Sort the sprites into their row buckets, as each frame does
+	start = DWT->CYCCNT;
+	updateSprites();
+	updateCycles = DWT->CYCCNT - start;
+
+	// Every strip height that fits in a strip of the ring and divides the LCD
+	for (rows = 1; rows <= LCD_TRANSFER_ROWS; rows <<= 1) {
+		if (LCD_HEIGHT % rows) continue;
+
+		bestFrame = 0xFFFFFFFF;
+		bestStripMax = 0;
+		for (repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+			frameCycles = 0;
+			stripMax = 0;
+			for (y = 0; y < LCD_HEIGHT; y += rows) {
+				start = DWT->CYCCNT;
+				videoComposeRows(y, rows);
+				cycles = DWT->CYCCNT - start;
+
+				frameCycles += cycles;
+				if (cycles > stripMax) stripMax = cycles;
+			}
+
+			if (frameCycles < bestFrame) {
+				bestFrame = frameCycles;
+				bestStripMax = stripMax;
+			}
+		}
+
+		benchReport(numLayers, size, bpp, overlap, transparent, rows,
+		            bestStripMax, bestFrame, updateCycles);
+	}
+
+	// Destroy the copies before the sprite holding their data
+	while (numLayers--) destroySprite(&benchSprites[numLayers]);
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param numLayers Number of sprites in the scene
+ * @param size Side of the square sprites
+ * @param bpp Bits per pixel of the sprites
+ * @param overlap Share of the side overlapping the previous sprite in percent
+ * @param transparent Share of transparent pixels in percent
+ * @param rows Rows per strip
+ * @param stripMax Most cycles taken by a strip
+ * @param frameCycles Cycles taken by every strip of the frame
+ * @param updateCycles Cycles taken by updateSprites()
+ */
+static void benchReport(uint16_t numLayers, uint16_t size, uint8_t bpp,
+                        uint8_t overlap, uint8_t transparent, uint8_t rows,
+                        uint32_t stripMax, uint32_t frameCycles,
+                        uint32_t updateCycles) {
+	uint16_t strips = LCD_HEIGHT / rows;
+
+	profilerSwoSendInt(numLayers);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(size);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(bpp);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(overlap);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(transparent);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(rows);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(strips);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(frameCycles / strips);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(stripMax);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(frameCycles);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(updateCycles);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(frameCycles ? SystemCoreClock / frameCycles : 0);
+	profilerSwoSendString("\n");
+}
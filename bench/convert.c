@@ -0,0 +1,250 @@
+/*!
+ * @file convert.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of the sample conversions of the audio output
+ *
+ * Mixes CONVERT_BLOCKS halves of the output ring from a 16 bit voice, an 8
+ * bit voice and both together, at the rate of the output and at two volumes,
+ * and converts each block for the DAC with mixerToDac() as the DMA interrupt
+ * does. The mix and the conversion are timed apart with the DWT cycle
+ * counter, and every sample converted is checked against a reference
+ * computed one sample at a time.
+ *
+ * Each source and volume is one CSV line:
+ *
+ * source,volume,samples,mix_cycles,convert_cycles,mix_per_sample_x100,
+ * convert_per_sample_x100,errors
+ *
+ * The cycles add up every block, the cycles per sample are in hundredths of
+ * a cycle, and errors counts the samples that differ from the reference.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "clock.h"
+#include "led.h"
+#include "mixer.h"
+#include "waveplayer.h"
+#include "profiler.h"
+
+// Blocks mixed and converted for each source, each one half of the ring
+#define CONVERT_BLOCKS 64
+#define CONVERT_BLOCK_SAMPLES (WAV_MIX_SAMPLES / 2)
+
+// Samples the voices loop over, odd so blocks start at any alignment
+#define CONVERT_SOURCE16_SAMPLES 4093
+#define CONVERT_SOURCE8_SAMPLES 4091
+
+// Sources mixed
+#define CONVERT_16 0x01
+#define CONVERT_8 0x02
+
+static const uint8_t convertSources[] = {
+	CONVERT_16, CONVERT_8, CONVERT_16 | CONVERT_8
+};
+
+// Volumes of the voices
+static const uint16_t convertVolumes[] = {MIX_VOLUME_MAX, MIX_VOLUME_MAX / 2};
+
+// Static function prototypes
+static void convertSourceInit(void);
+static void convertVoice(uint8_t voice, const void *data, uint32_t length,
+                         uint8_t bits, uint16_t volume);
+static void convertTime(uint8_t sources, uint16_t volume);
+static uint16_t convertReference(uint8_t sources, uint16_t volume,
+                                 uint32_t sample);
+static void convertReport(uint8_t sources, uint16_t volume,
+                          uint32_t mixCycles, uint32_t convertCycles,
+                          uint32_t errors);
+
+// Samples played, loud enough for the mix to saturate
+static int16_t convertSource16[CONVERT_SOURCE16_SAMPLES];
+static uint8_t convertSource8[CONVERT_SOURCE8_SAMPLES];
+
+// Output of the mixer, converted in place
+static int16_t convertOut[CONVERT_BLOCK_SAMPLES] __attribute__((aligned(4)));
+
+int main(void) {
+	uint8_t s;
+	uint8_t v;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	convertSourceInit();
+
+	profilerSwoSendString("source,volume,samples,mix_cycles,convert_cycles,"
+	                      "mix_per_sample_x100,convert_per_sample_x100,"
+	                      "errors\n");
+
+	for (s = 0; s < ARRAY_COUNT(convertSources); s++) {
+		for (v = 0; v < ARRAY_COUNT(convertVolumes); v++) {
+			convertTime(convertSources[s], convertVolumes[v]);
+		}
+	}
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Fill the samples played with noise
+ */
+static void convertSourceInit(void) {
+	uint32_t rand = 87;
+	uint16_t i;
+
+	for (i = 0; i < CONVERT_SOURCE16_SAMPLES; i++) {
+		rand = rand * 1664525 + 1013904223;
+		convertSource16[i] = (int16_t)(rand >> 16);
+	}
+	for (i = 0; i < CONVERT_SOURCE8_SAMPLES; i++) {
+		rand = rand * 1664525 + 1013904223;
+		convertSource8[i] = (uint8_t)(rand >> 24);
+	}
+}
+
+/*!
+ * @brief Start a voice looping over samples at the rate of the output
+ *
+ * @param voice Index of the voice
+ * @param data Samples
+ * @param length Number of samples
+ * @param bits Bits per sample, 8 or 16
+ * @param volume Volume, up to MIX_VOLUME_MAX
+ */
+static void convertVoice(uint8_t voice, const void *data, uint32_t length,
+                         uint8_t bits, uint16_t volume) {
+	mixVoice *v = &mixVoices[voice];
+
+	v->data = data;
+	v->length = length;
+	v->position = 0;
+	v->phase = 0;
+	v->step = MIX_STEP_ONE;
+	v->loops = MIX_LOOP_ALWAYS;
+	v->volume = volume;
+	v->bits = bits;
+	v->halfPlayed = NULL;
+	v->owner = NULL;
+	v->active = 1;
+}
+
+/*!
+ * @brief Time and check the blocks of a source at a volume
+ *
+ * @param sources Voices mixed, CONVERT_16 and CONVERT_8
+ * @param volume Volume of the voices
+ */
+static void convertTime(uint8_t sources, uint16_t volume) {
+	uint32_t mixCycles = 0;
+	uint32_t convertCycles = 0;
+	uint32_t errors = 0;
+	uint32_t start;
+	uint32_t sample;
+	uint16_t i;
+	uint8_t b;
+
+	mixerInit();
+	if (sources & CONVERT_16) {
+		convertVoice(0, convertSource16, CONVERT_SOURCE16_SAMPLES, 16, volume);
+	}
+	if (sources & CONVERT_8) {
+		convertVoice(1, convertSource8, CONVERT_SOURCE8_SAMPLES, 8, volume);
+	}
+
+	for (b = 0; b < CONVERT_BLOCKS; b++) {
+		start = DWT->CYCCNT;
+		mixerRender(convertOut, CONVERT_BLOCK_SAMPLES);
+		mixCycles += DWT->CYCCNT - start;
+
+		start = DWT->CYCCNT;
+		mixerToDac(convertOut, CONVERT_BLOCK_SAMPLES);
+		convertCycles += DWT->CYCCNT - start;
+
+		for (i = 0; i < CONVERT_BLOCK_SAMPLES; i++) {
+			sample = (uint32_t)b * CONVERT_BLOCK_SAMPLES + i;
+			if ((uint16_t)convertOut[i]
+			    != convertReference(sources, volume, sample)) {
+				errors++;
+			}
+		}
+	}
+
+	convertReport(sources, volume, mixCycles, convertCycles, errors);
+}
+
+/*!
+ * @brief Compute a sample of the output one sample at a time
+ *
+ * @param sources Voices mixed, CONVERT_16 and CONVERT_8
+ * @param volume Volume of the voices
+ * @param sample Index of the output sample
+ *
+ * @return The sample as the DAC takes it, 12 bit left aligned
+ */
+static uint16_t convertReference(uint8_t sources, uint16_t volume,
+                                 uint32_t sample) {
+	int32_t mix = 0;
+
+	if (sources & CONVERT_16) {
+		mix += (convertSource16[sample % CONVERT_SOURCE16_SAMPLES] * volume)
+		       >> 8;
+	}
+	if (sources & CONVERT_8) {
+		mix += ((int32_t)convertSource8[sample % CONVERT_SOURCE8_SAMPLES] - 128)
+		       * volume;
+	}
+
+	if (mix > 32767) mix = 32767;
+	if (mix < -32768) mix = -32768;
+
+	return (uint16_t)((mix + 32768) & 0xFFF0);
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param sources Voices mixed, CONVERT_16 and CONVERT_8
+ * @param volume Volume of the voices
+ * @param mixCycles Cycles taken by mixerRender() for every block
+ * @param convertCycles Cycles taken by mixerToDac() for every block
+ * @param errors Samples that differ from the reference
+ */
+static void convertReport(uint8_t sources, uint16_t volume,
+                          uint32_t mixCycles, uint32_t convertCycles,
+                          uint32_t errors) {
+	uint32_t samples = CONVERT_BLOCKS * CONVERT_BLOCK_SAMPLES;
+
+	if (sources == CONVERT_16) profilerSwoSendString("s16");
+	else if (sources == CONVERT_8) profilerSwoSendString("u8");
+	else profilerSwoSendString("s16+u8");
+	profilerSwoSendString(",");
+	profilerSwoSendInt(volume);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(samples);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(mixCycles);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(convertCycles);
+	profilerSwoSendString(",");
+	profilerSwoSendInt((uint32_t)((uint64_t)mixCycles * 100 / samples));
+	profilerSwoSendString(",");
+	profilerSwoSendInt((uint32_t)((uint64_t)convertCycles * 100
+	                             / samples));
+	profilerSwoSendString(",");
+	profilerSwoSendInt(errors);
+	profilerSwoSendString("\n");
+}
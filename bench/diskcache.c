@@ -0,0 +1,210 @@
+/*!
+ * @file diskcache.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of the SD sector cache on the reads of a real frame
+ *
+ * Loads the scene of the game from the SD card, two colorTest.spr and a
+ * dog.spr read from their files, and composites DISK_FRAMES frames of it with
+ * videoComposeRows(), strip by strip, so the sectors are read in the order the
+ * video renderer reads them. The frames are timed with the DWT cycle counter
+ * for every size of the sector cache and of the reads ahead swept, starting
+ * from an empty cache each time.
+ *
+ * Each cache and read ahead size is one CSV line:
+ *
+ * cache,read_ahead,frames,first,frame_avg,hits,misses,read_aheads,
+ * read_ahead_sectors
+ *
+ * first is the cycles of the first frame, read from an empty cache, and
+ * frame_avg the average of the other frames. The counters add up every frame.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "ff_gen_drv.h"
+#include "sd_diskio.h"
+#include "clock.h"
+#include "led.h"
+#include "lcd.h"
+#include "sprite.h"
+#include "video.h"
+#include "profiler.h"
+
+// Frames timed for each cache and read ahead size
+#define DISK_FRAMES 8
+
+// Sectors of the cache used, up to SD_CACHE_SECTORS
+static const uint8_t diskCacheSizes[] = {0, 4, 8, 16};
+
+// Most sectors read ahead at once, up to SD_READ_AHEAD_SECTORS
+static const uint8_t diskReadAheads[] = {0, 1, 2, 4};
+
+// Static function prototypes
+static void diskScene(void);
+static void diskTime(uint8_t cacheSectors, uint8_t readAhead);
+static uint32_t diskFrame(void);
+static void diskReport(uint8_t cacheSectors, uint8_t readAhead,
+                       uint32_t first, uint32_t rest,
+                       const SD_CacheStats *stats);
+
+FATFS diskFatFs;  // File system object of the SD card
+char diskPath[4]; // Logical drive path of the SD card
+
+// Sprites of the scene, as the game places them
+static sprite diskRain1;
+static sprite diskDog;
+static sprite diskRain2;
+
+int main(void) {
+	uint8_t c;
+	uint8_t r;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+	initLcd();
+
+	// Frame updating stays off, strips are only composited
+	if (initVideo()) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	if (FATFS_LinkDriver(&SD_Driver, diskPath)
+	    || f_mount(&diskFatFs, (TCHAR const*)diskPath, 1) != FR_OK) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	diskScene();
+
+	profilerSwoSendString("cache,read_ahead,frames,first,frame_avg,hits,"
+	                      "misses,read_aheads,read_ahead_sectors\n");
+
+	for (c = 0; c < ARRAY_COUNT(diskCacheSizes); c++) {
+		if (diskCacheSizes[c] > SD_CACHE_SECTORS) break;
+
+		for (r = 0; r < ARRAY_COUNT(diskReadAheads); r++) {
+			// A read ahead is never larger than the cache
+			if (diskReadAheads[r] > SD_READ_AHEAD_SECTORS
+			    || diskReadAheads[r] > diskCacheSizes[c]) break;
+
+			diskTime(diskCacheSizes[c], diskReadAheads[r]);
+		}
+	}
+
+	// Back to the cache the game runs with
+	SD_SetCache(SD_CACHE_SECTORS, SD_READ_AHEAD_SECTORS);
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Load and place the sprites of the scene of the game
+ */
+static void diskScene(void) {
+	if (initSprite(&diskRain1, "colorTest.spr")
+	    || initSprite(&diskDog, "dog.spr")
+	    || initSprite(&diskRain2, "colorTest.spr")) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	diskRain1.ypos = (LCD_HEIGHT - diskRain1.height)/2;
+	diskRain1.xpos = (LCD_WIDTH - diskRain1.width)/2;
+	diskDog.xpos = 220;
+	diskDog.ypos = 170;
+	diskRain2.xpos = 20;
+	diskRain2.ypos = 20;
+
+	if (spriteLayersAdd(&diskRain1)
+	    || spriteLayersAdd(&diskDog)
+	    || spriteLayersAdd(&diskRain2)) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	updateSprites();
+}
+
+/*!
+ * @brief Time the frames of the scene with a cache and read ahead size
+ *
+ * @param cacheSectors Sectors of the cache used, 0 for none
+ * @param readAhead Most sectors read ahead at once, 0 for none
+ */
+static void diskTime(uint8_t cacheSectors, uint8_t readAhead) {
+	SD_CacheStats stats;
+	uint32_t first;
+	uint32_t rest = 0;
+	uint8_t i;
+
+	SD_SetCache(cacheSectors, readAhead);
+	SD_ResetCacheStats();
+
+	first = diskFrame();
+	for (i = 1; i < DISK_FRAMES; i++) rest += diskFrame();
+
+	SD_GetCacheStats(&stats);
+	diskReport(cacheSectors, readAhead, first, rest, &stats);
+}
+
+/*!
+ * @brief Composite every strip of a frame
+ *
+ * @return Cycles taken by the frame
+ */
+static uint32_t diskFrame(void) {
+	uint32_t start = DWT->CYCCNT;
+	int16_t y;
+
+	for (y = 0; y < LCD_HEIGHT; y += LCD_TRANSFER_ROWS) {
+		videoComposeRows(y, LCD_TRANSFER_ROWS);
+	}
+
+	return DWT->CYCCNT - start;
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param cacheSectors Sectors of the cache used
+ * @param readAhead Most sectors read ahead at once
+ * @param first Cycles taken by the first frame
+ * @param rest Cycles taken by the other frames
+ * @param stats Counters of the cache over every frame
+ */
+static void diskReport(uint8_t cacheSectors, uint8_t readAhead,
+                       uint32_t first, uint32_t rest,
+                       const SD_CacheStats *stats) {
+	profilerSwoSendInt(cacheSectors);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(readAhead);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(DISK_FRAMES);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(first);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(rest / (DISK_FRAMES - 1));
+	profilerSwoSendString(",");
+	profilerSwoSendInt(stats->Hits);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(stats->Misses);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(stats->ReadAheads);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(stats->ReadAheadSectors);
+	profilerSwoSendString("\n");
+}
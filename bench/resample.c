@@ -0,0 +1,188 @@
+/*!
+ * @file resample.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of the mixer resampling voices to the rate of the output
+ *
+ * Mixes RESAMPLE_BLOCKS halves of the output ring from voices looping over
+ * samples held in memory, for each source rate and sample size swept, with
+ * one voice and with every voice of the mixer, then with every voice at a
+ * different rate. The blocks are timed with the DWT cycle counter, straight
+ * through mixerRender() as the DMA interrupt calls it.
+ *
+ * Each rate, sample size and number of voices is one CSV line:
+ *
+ * rate,bits,voices,samples,cycles,cycles_per_sample_x100
+ *
+ * samples is the number of output samples mixed and cycles_per_sample_x100
+ * the hundredths of a cycle per output sample, every voice included. A voice at MIX_RATE takes
+ * the copy path, every other rate is interpolated.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "clock.h"
+#include "led.h"
+#include "mixer.h"
+#include "waveplayer.h"
+#include "profiler.h"
+
+// Blocks mixed for each rate, each one half of the output ring
+#define RESAMPLE_BLOCKS 64
+#define RESAMPLE_BLOCK_SAMPLES (WAV_MIX_SAMPLES / 2)
+
+// Samples the voices loop over
+#define RESAMPLE_SOURCE_SAMPLES 4096
+
+// Source rates swept
+static const uint32_t resampleRates[] = {
+	8000, 11025, 16000, 22050, 32000, 44100, 48000, 96000
+};
+
+// Rates of the voices mixed together, the last line of results
+static const uint32_t resampleMixedRates[MIX_VOICES] = {
+	11025, 22050, 32000, 44100
+};
+
+// Static function prototypes
+static void resampleSourceInit(void);
+static void resampleVoice(uint8_t voice, uint32_t rate, uint8_t bits);
+static uint32_t resampleTime(void);
+static void resampleReport(uint32_t rate, uint8_t bits, uint8_t voices,
+                           uint32_t cycles);
+
+// Samples played, a ramp, as 16 bit signed and 8 bit unsigned
+static int16_t resampleSource16[RESAMPLE_SOURCE_SAMPLES];
+static uint8_t resampleSource8[RESAMPLE_SOURCE_SAMPLES];
+
+// Output of the mixer
+static int16_t resampleOut[RESAMPLE_BLOCK_SAMPLES] __attribute__((aligned(4)));
+
+int main(void) {
+	uint8_t bits;
+	uint8_t r;
+	uint8_t v;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	resampleSourceInit();
+
+	profilerSwoSendString("rate,bits,voices,samples,cycles,"
+	                      "cycles_per_sample_x100\n");
+
+	for (bits = 8; bits <= 16; bits += 8) {
+		for (r = 0; r < ARRAY_COUNT(resampleRates); r++) {
+			// One voice, then every voice
+			mixerInit();
+			resampleVoice(0, resampleRates[r], bits);
+			resampleReport(resampleRates[r], bits, 1, resampleTime());
+
+			for (v = 1; v < MIX_VOICES; v++) {
+				resampleVoice(v, resampleRates[r], bits);
+			}
+			resampleReport(resampleRates[r], bits, MIX_VOICES,
+			               resampleTime());
+		}
+	}
+
+	// Every voice at its own rate, a rate of 0 in the results
+	mixerInit();
+	for (v = 0; v < MIX_VOICES; v++) {
+		resampleVoice(v, resampleMixedRates[v], 16);
+	}
+	resampleReport(0, 16, MIX_VOICES, resampleTime());
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Fill the samples played
+ */
+static void resampleSourceInit(void) {
+	uint16_t i;
+
+	for (i = 0; i < RESAMPLE_SOURCE_SAMPLES; i++) {
+		resampleSource16[i] = (int16_t)(i * (0x10000 / RESAMPLE_SOURCE_SAMPLES)
+		                                - 0x8000);
+		resampleSource8[i] = resampleSource16[i] / 256 + 128;
+	}
+}
+
+/*!
+ * @brief Start a voice looping over the samples
+ *
+ * @param voice Index of the voice
+ * @param rate Rate of the samples
+ * @param bits Bits per sample, 8 or 16
+ */
+static void resampleVoice(uint8_t voice, uint32_t rate, uint8_t bits) {
+	mixVoice *v = &mixVoices[voice];
+
+	v->data = bits == 16 ? (const void*)resampleSource16
+	                     : (const void*)resampleSource8;
+	v->length = RESAMPLE_SOURCE_SAMPLES;
+	v->position = 0;
+	v->phase = 0;
+	v->step = (uint32_t)(((uint64_t)rate << 16) / MIX_RATE);
+	v->loops = MIX_LOOP_ALWAYS;
+	v->volume = MIX_VOLUME_MAX / 2;
+	v->bits = bits;
+	v->halfPlayed = NULL;
+	v->owner = NULL;
+	v->active = 1;
+}
+
+/*!
+ * @brief Mix the blocks from the active voices
+ *
+ * @return Cycles taken by every block
+ */
+static uint32_t resampleTime(void) {
+	uint32_t start = DWT->CYCCNT;
+	uint8_t i;
+
+	for (i = 0; i < RESAMPLE_BLOCKS; i++) {
+		mixerRender(resampleOut, RESAMPLE_BLOCK_SAMPLES);
+	}
+
+	return DWT->CYCCNT - start;
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param rate Rate of the voices, 0 for voices at different rates
+ * @param bits Bits per sample
+ * @param voices Number of voices mixed
+ * @param cycles Cycles taken by every block
+ */
+static void resampleReport(uint32_t rate, uint8_t bits, uint8_t voices,
+                           uint32_t cycles) {
+	uint32_t samples = RESAMPLE_BLOCKS * RESAMPLE_BLOCK_SAMPLES;
+
+	profilerSwoSendInt(rate);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(bits);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(voices);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(samples);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(cycles);
+	profilerSwoSendString(",");
+	profilerSwoSendInt((uint32_t)((uint64_t)cycles * 100 / samples));
+	profilerSwoSendString("\n");
+}
@@ -0,0 +1,239 @@
+/*!
+ * @file seek.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of seeking in fragmented files, with and without a map
+ *
+ * Writes two files of SEEK_CLUSTERS clusters each on the SD card, a few
+ * clusters of one then a few of the other, so each file ends up in as many
+ * fragments as there are runs. Then it seeks the first file to random offsets,
+ * first the normal way and then through the cluster link map built by
+ * fastSeekMap(), timing each seek with the DWT cycle counter. Every seek is
+ * followed by a one byte read, so the sector at the offset is read as a sprite
+ * or WAV loader would.
+ *
+ * Each layout and map is one CSV line:
+ *
+ * map,fragments,seeks,seek_avg,seek_max,table_bytes
+ *
+ * The files are deleted at the end.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "ff_gen_drv.h"
+#include "sd_diskio.h"
+#include "clock.h"
+#include "led.h"
+#include "fastseek.h"
+#include "profiler.h"
+
+// Size of each file in clusters
+#define SEEK_CLUSTERS 64
+
+// Seeks timed for each layout and map
+#define SEEK_COUNT 256
+
+// Files written by the benchmark
+#define SEEK_FILE "seek.bin"
+#define SEEK_FILLER "filler.bin"
+
+// Clusters written to a file before switching to the other, one layout each
+static const uint8_t seekRuns[] = {SEEK_CLUSTERS, 16, 4, 1};
+
+// Static function prototypes
+static uint32_t seekClusterBytes(void);
+static uint8_t seekWriteFiles(uint8_t run);
+static void seekTime(uint8_t map, uint16_t fragments);
+static void seekReport(uint8_t map, uint16_t fragments, uint32_t seekTotal,
+                       uint32_t seekMax, uint32_t tableBytes);
+
+FATFS seekFatFs;  // File system object of the SD card
+char seekPath[4]; // Logical drive path of the SD card
+
+// Sector written to the files
+static uint8_t seekSector[_MAX_SS];
+
+int main(void) {
+	uint8_t r;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	if (FATFS_LinkDriver(&SD_Driver, seekPath)
+	    || f_mount(&seekFatFs, (TCHAR const*)seekPath, 1) != FR_OK) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	profilerSwoSendString("map,fragments,seeks,seek_avg,seek_max,"
+	                      "table_bytes\n");
+
+	for (r = 0; r < ARRAY_COUNT(seekRuns); r++) {
+		if (seekWriteFiles(seekRuns[r])) {
+			ledError(LED_ERROR);
+			while(1);
+		}
+
+		seekTime(0, SEEK_CLUSTERS / seekRuns[r]);
+		seekTime(1, SEEK_CLUSTERS / seekRuns[r]);
+	}
+
+	f_unlink(SEEK_FILE);
+	f_unlink(SEEK_FILLER);
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Get the size of a cluster of the SD card
+ *
+ * @return Bytes per cluster
+ */
+static uint32_t seekClusterBytes(void) {
+#if _MAX_SS != _MIN_SS
+	return (uint32_t)seekFatFs.csize * seekFatFs.ssize;
+#else
+	return (uint32_t)seekFatFs.csize * _MAX_SS;
+#endif
+}
+
+/*!
+ * @brief Write the timed file and the filler interleaved with it
+ *
+ * Both files are written again from empty, taking turns every run clusters,
+ * which leaves the timed file in SEEK_CLUSTERS / run fragments on a card with
+ * enough free space after them.
+ *
+ * @param run Clusters written to a file before switching to the other
+ *
+ * @return 0 on success, !0 on failure
+ */
+static uint8_t seekWriteFiles(uint8_t run) {
+	FIL files[2];
+	uint32_t runBytes = run * seekClusterBytes();
+	uint32_t sectorBytes = seekClusterBytes() / seekFatFs.csize;
+	uint32_t bytes;
+	uint32_t i;
+	uint16_t c;
+	uint8_t f;
+	UINT written;
+
+	for (i = 0; i < sizeof(seekSector); i++) seekSector[i] = i;
+
+	if (f_open(&files[0], SEEK_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		return 1;
+	}
+	if (f_open(&files[1], SEEK_FILLER, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		f_close(&files[0]);
+		return 1;
+	}
+
+	// The files only get new clusters when they are written past their end
+	for (c = 0; c < SEEK_CLUSTERS; c += run) {
+		for (f = 0; f < 2; f++) {
+			for (bytes = 0; bytes < runBytes; bytes += sectorBytes) {
+				if (f_write(&files[f], seekSector, sectorBytes, &written) != FR_OK
+				    || written != sectorBytes) {
+					f_close(&files[0]);
+					f_close(&files[1]);
+					return 1;
+				}
+			}
+		}
+	}
+
+	f_close(&files[0]);
+	f_close(&files[1]);
+	return 0;
+}
+
+/*!
+ * @brief Time random seeks in the timed file
+ *
+ * The offsets are the same with and without the map.
+ *
+ * @param map Whether to seek through a cluster link map
+ * @param fragments Number of fragments of the file
+ */
+static void seekTime(uint8_t map, uint16_t fragments) {
+	FIL file;
+	uint32_t rand = 87;
+	uint32_t size = SEEK_CLUSTERS * seekClusterBytes();
+	uint32_t tableBytes = 0;
+	uint32_t seekTotal = 0;
+	uint32_t seekMax = 0;
+	uint32_t start;
+	uint32_t cycles;
+	uint16_t i;
+	uint8_t byte;
+	UINT read;
+
+	if (f_open(&file, SEEK_FILE, FA_READ) != FR_OK) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	if (map) {
+		if (fastSeekMap(&file)) {
+			f_close(&file);
+			ledError(LED_ERROR);
+			while(1);
+		}
+		tableBytes = file.cltbl[0] * sizeof(DWORD);
+	}
+
+	for (i = 0; i < SEEK_COUNT; i++) {
+		rand = rand * 1664525 + 1013904223;
+
+		start = DWT->CYCCNT;
+		f_lseek(&file, (rand >> 8) % size);
+		f_read(&file, &byte, 1, &read);
+		cycles = DWT->CYCCNT - start;
+
+		seekTotal += cycles;
+		if (cycles > seekMax) seekMax = cycles;
+	}
+
+	f_close(&file);
+	fastSeekFree(&file);
+
+	seekReport(map, fragments, seekTotal, seekMax, tableBytes);
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param map Whether the seeks went through a cluster link map
+ * @param fragments Number of fragments of the file
+ * @param seekTotal Cycles taken by every seek
+ * @param seekMax Most cycles taken by a seek
+ * @param tableBytes Size of the cluster link map, 0 without one
+ */
+static void seekReport(uint8_t map, uint16_t fragments, uint32_t seekTotal,
+                       uint32_t seekMax, uint32_t tableBytes) {
+	profilerSwoSendInt(map);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(fragments);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(SEEK_COUNT);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(seekTotal / SEEK_COUNT);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(seekMax);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(tableBytes);
+	profilerSwoSendString("\n");
+}
@@ -0,0 +1,183 @@
+/*!
+ * @file trigger.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Benchmark of the latency from WAV_Play() to the sound out of the DAC
+ *
+ * Plays a short clip held in memory TRIGGER_COUNT times, each after a random
+ * pause so the triggers land anywhere in a half of the output ring. Each play
+ * times the WAV_Play() call itself and the cycles until the DAC outputs the
+ * first sample of the clip, both with the DWT cycle counter, then waits for
+ * the clip to end.
+ *
+ * Each trigger is one CSV line:
+ *
+ * trigger,pause,call,latency,latency_us
+ *
+ * pause is the cycles waited before the trigger, call the cycles WAV_Play()
+ * took and latency the cycles until the clip was heard.
+ */
+
+#include "stm32f4xx_hal.h"
+#include "clock.h"
+#include "led.h"
+#include "waveplayer.h"
+#include "profiler.h"
+
+// Clips played
+#define TRIGGER_COUNT 32
+
+// Samples of the clip, all at TRIGGER_LEVEL, long enough not to be missed
+// between two reads of the DAC
+#define TRIGGER_SAMPLES 256
+#define TRIGGER_LEVEL 0x4000
+
+// Output register of the DAC while nothing plays, and while the clip plays
+#define TRIGGER_SILENCE 0x800
+#define TRIGGER_HEARD ((TRIGGER_LEVEL + 0x8000) >> 4)
+
+// Longest wait for the clip, in milliseconds
+#define TRIGGER_TIMEOUT 1000
+
+// Static function prototypes
+static void triggerClipInit(void);
+static void triggerTime(uint8_t trigger, uint32_t pause);
+static uint8_t triggerWaitDac(uint8_t heard);
+static void triggerReport(uint8_t trigger, uint32_t pause, uint32_t call,
+                          uint32_t latency);
+
+// Clip played, as WAV_Import() would leave it
+static int16_t triggerSamples[TRIGGER_SAMPLES];
+static WAV_Format triggerClip;
+
+int main(void) {
+	uint32_t rand = 87;
+	uint32_t ringCycles;
+	uint8_t i;
+
+	HAL_Init();
+	initSystemClock();
+	initLeds();
+	WAV_Init();
+
+	profilerSwoInit(PROFILER_SWO_BAUD);
+
+	triggerClipInit();
+
+	profilerSwoSendString("trigger,pause,call,latency,latency_us\n");
+
+	// Pauses spread the triggers over a whole ring
+	ringCycles = SystemCoreClock / MIX_RATE * WAV_MIX_SAMPLES;
+	for (i = 0; i < TRIGGER_COUNT; i++) {
+		rand = rand * 1664525 + 1013904223;
+		triggerTime(i, (rand >> 8) % ringCycles);
+	}
+
+	WAV_Stop(NULL);
+
+	profilerSwoSendString("# done\n");
+	ledMap(0xFF);
+
+#ifdef SPARKBOX_HOST
+	hostExit(0);
+#endif
+
+	while(1);
+	return 1;
+}
+
+/*!
+ * @brief Fill the clip and its WAV_Format struct
+ */
+static void triggerClipInit(void) {
+	uint16_t i;
+
+	for (i = 0; i < TRIGGER_SAMPLES; i++) triggerSamples[i] = TRIGGER_LEVEL;
+
+	strcpy(triggerClip.Filename, "trigger");
+	triggerClip.FormatTag = WAVE_FORMAT_PCM;
+	triggerClip.NumChannels = CHANNEL_MONO;
+	triggerClip.SampleRate = MIX_RATE;
+	triggerClip.Step = MIX_STEP_ONE;
+	triggerClip.BitsPerSample = BITS_PER_SAMPLE_16;
+	triggerClip.BlockAlign = 2;
+	triggerClip.ByteRate = MIX_RATE * 2;
+	triggerClip.DataSize = sizeof(triggerSamples);
+	triggerClip.Data = (uint8_t*)triggerSamples;
+	triggerClip.Volume = MIX_VOLUME_MAX;
+	triggerClip.Streamed = 0;
+	triggerClip.Error = Valid_WAVE_File;
+}
+
+/*!
+ * @brief Time one play of the clip
+ *
+ * @param trigger Index of the play
+ * @param pause Cycles to wait before the trigger
+ */
+static void triggerTime(uint8_t trigger, uint32_t pause) {
+	uint32_t start = DWT->CYCCNT;
+	uint32_t call;
+	uint32_t latency;
+
+	while (DWT->CYCCNT - start < pause);
+
+	start = DWT->CYCCNT;
+	WAV_Play(&triggerClip, 1);
+	call = DWT->CYCCNT - start;
+
+	if (triggerWaitDac(1)) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+	latency = DWT->CYCCNT - start;
+
+	// The next trigger starts from silence
+	if (triggerWaitDac(0)) {
+		ledError(LED_ERROR);
+		while(1);
+	}
+
+	triggerReport(trigger, pause, call, latency);
+}
+
+/*!
+ * @brief Wait for the DAC to output the clip, or silence
+ *
+ * @param heard 1 to wait for the clip, 0 for silence
+ *
+ * @return 0 on success, !0 on timeout
+ */
+static uint8_t triggerWaitDac(uint8_t heard) {
+	uint32_t start = HAL_GetTick();
+	uint32_t level = heard ? TRIGGER_HEARD : TRIGGER_SILENCE;
+
+	while (DAC->DOR1 != level) {
+		if (HAL_GetTick() - start > TRIGGER_TIMEOUT) return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief Send one line of results
+ *
+ * @param trigger Index of the play
+ * @param pause Cycles waited before the trigger
+ * @param call Cycles taken by WAV_Play()
+ * @param latency Cycles until the DAC output the clip
+ */
+static void triggerReport(uint8_t trigger, uint32_t pause, uint32_t call,
+                          uint32_t latency) {
+	profilerSwoSendInt(trigger);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(pause);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(call);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(latency);
+	profilerSwoSendString(",");
+	profilerSwoSendInt(latency / (SystemCoreClock / 1000000));
+	profilerSwoSendString("\n");
+}
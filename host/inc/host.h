@@ -0,0 +1,170 @@
+/*!
+ * @file host.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Simulator that runs the Sparkbox on a Linux host
+ *
+ * The Sparkbox sources are built unchanged for the host, with main() renamed
+ * to sparkboxMain(). Peripheral registers are memory mapped at their real
+ * addresses, and a clock thread plays the part of the hardware: it counts
+ * SysTick, TIM6, TIM7 and TIM10, clocks the DAC DMA, refreshes the LCD and
+ * presses the buttons from a script. Interrupts are raised by signalling the
+ * main thread, which runs the highest priority pending handler the way the
+ * NVIC would.
+ *
+ * Virtual time counts cycles of the 168 MHz core and runs at a multiple of
+ * real time. The DWT cycle counter counts the real time taken on the host
+ * instead, scaled to the same clock, so the profiler measures the host.
+ */
+
+#ifndef SPARK_HOST
+#define SPARK_HOST
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stm32f4xx.h"
+
+// Core clock emulated by the simulator
+#define HOST_CORE_CLOCK 168000000ULL
+
+// First bank of the FSMC, where the LCD sits
+#define HOST_FSMC_BANK1 0x60000000UL
+
+// Cycles of the core to send one pixel to the LCD over the FSMC
+#define HOST_LCD_PIXEL_CYCLES 8
+
+// Oscillator of the LCD controller and lines per refresh, with porches
+#define HOST_LCD_OSC 615000ULL
+#define HOST_LCD_LINES 324
+
+// Number of DMA streams over both controllers
+#define HOST_DMA_STREAMS 16
+
+// Size of the blocks of the SD card image
+#define HOST_SD_BLOCK 512
+
+// Cycles of the core for the SD card to start a DMA transfer, then to move
+// each byte over its 4 bit bus at 24 MHz
+#define HOST_SD_ACCESS_CYCLES 16800
+#define HOST_SD_BYTE_CYCLES 14
+
+/*!
+ * @brief Options of the simulator, set from the command line
+ */
+typedef struct {
+	const char *sdImage;	/*!< FAT image used as the SD card */
+	const char *script;	/*!< Script of button presses and dumps */
+	const char *ppmDir;	/*!< Directory for a PPM of every new frame */
+	const char *wavFile;	/*!< WAV file of the DAC output */
+	FILE *swo;	/*!< Output of ITM stimulus port 0 */
+	uint32_t speed;	/*!< Virtual time per unit of real time */
+	uint32_t timeLimit;	/*!< Virtual ms to run for, 0 to run forever */
+} hostOptions;
+
+extern hostOptions hostOpts;
+
+/*
+ * Simulator (host.c)
+ */
+uint64_t hostNow(void);
+void hostExit(int status);
+
+/*
+ * Interrupts (nvic.c)
+ */
+void initHostNvic(void);
+uint32_t hostGetPrimask(void);
+void hostSetPrimask(uint32_t primask);
+void hostNvicEnableIrq(IRQn_Type irq);
+void hostNvicDisableIrq(IRQn_Type irq);
+void hostNvicSetPendingIrq(IRQn_Type irq);
+void hostNvicClearPendingIrq(IRQn_Type irq);
+void hostNvicPend(IRQn_Type irq);
+extern volatile uint32_t hostPended;
+void hostExtiTrigger(uint8_t line, uint8_t rising);
+void hostDispatch(void);
+void hostWaitForInterrupt(void);
+DWT_Type *hostDwt(void);
+uint32_t hostItmSendChar(uint32_t ch);
+
+/*!
+ * @brief Count the leading zeros like the CLZ instruction
+ */
+static inline uint32_t hostClz(uint32_t value) {
+	return value ? (uint32_t)__builtin_clz(value) : 32;
+}
+
+/*!
+ * @brief Saturate to a signed range like the SSAT instruction
+ */
+static inline int32_t hostSsat(int32_t value, uint32_t bits) {
+	int32_t max = (1 << (bits - 1)) - 1;
+
+	if (value > max) return max;
+	if (value < -max - 1) return -max - 1;
+	return value;
+}
+
+/*!
+ * @brief Add both halfwords with signed saturation like QADD16
+ */
+static inline uint32_t hostQadd16(uint32_t a, uint32_t b) {
+	int32_t low = hostSsat((int16_t)a + (int16_t)b, 16);
+	int32_t high = hostSsat((int16_t)(a >> 16) + (int16_t)(b >> 16), 16);
+
+	return ((uint32_t)low & 0xFFFF) | ((uint32_t)high << 16);
+}
+
+/*!
+ * @brief Pack the bottom halfword of low with the shifted high like PKHBT
+ */
+static inline uint32_t hostPkhbt(uint32_t low, uint32_t high, uint32_t shift) {
+	return (low & 0xFFFF) | ((high << shift) & 0xFFFF0000);
+}
+
+/*!
+ * @brief Add both halfwords modulo 2^16 like UADD16
+ */
+static inline uint32_t hostUadd16(uint32_t a, uint32_t b) {
+	return ((a + b) & 0xFFFF) | (((a >> 16) + (b >> 16)) << 16);
+}
+
+/*!
+ * @brief Multiply both signed halfwords and add the products like SMLAD
+ */
+static inline uint32_t hostSmlad(uint32_t a, uint32_t b, uint32_t sum) {
+	return sum + (int16_t)a * (int16_t)b
+	       + (int16_t)(a >> 16) * (int16_t)(b >> 16);
+}
+
+/*
+ * DMA streams and the DAC (hal.c)
+ */
+void hostDmaRun(DMA_Stream_TypeDef *instance, uint64_t cycles);
+void hostDmaFinish(uint8_t index);
+uint8_t hostDmaNext(uint64_t *at);
+void hostDacTrigger(void);
+void hostWavClose(void);
+
+/*
+ * LCD controller (ili9341.c)
+ */
+void hostLcdWriteCmd(uint16_t cmd);
+void hostLcdWriteData(uint16_t data);
+uint16_t hostLcdReadData(void);
+void hostLcdWritePixels(const uint16_t *pixels, uint32_t count);
+uint64_t hostLcdRefreshCycles(void);
+uint16_t hostLcdScanline(void);
+uint8_t hostLcdRefresh(void);
+int hostLcdDump(const char *name);
+
+/*
+ * SD card image (bsp_sd.c)
+ */
+int hostSdOpen(const char *name);
+void DMA2_Stream3_IRQHandler(void);
+void DMA2_Stream6_IRQHandler(void);
+
+#endif
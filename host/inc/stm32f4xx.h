@@ -0,0 +1,72 @@
+/*!
+ * @file stm32f4xx.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Device header of the host build
+ *
+ * Found before the real header by the host build. The real header still
+ * gives every register layout and bit definition, the peripherals themselves
+ * are plain memory mapped at their real addresses by the simulator. Only the
+ * parts of the core that cannot be memory are replaced here: interrupt
+ * masking, the NVIC set and clear registers, the cycle counter and the ITM.
+ */
+
+#ifndef SPARK_HOST_STM32F4XX
+#define SPARK_HOST_STM32F4XX
+
+#include "../../lib/system/inc/stm32f4xx.h"
+#include "core_cm4_simd.h"
+
+// Interrupt masking runs the interrupts that were held back
+#undef __enable_irq
+#undef __disable_irq
+#undef __get_PRIMASK
+#undef __set_PRIMASK
+#define __enable_irq() hostSetPrimask(0)
+#define __disable_irq() hostSetPrimask(1)
+#define __get_PRIMASK() hostGetPrimask()
+#define __set_PRIMASK(primask) hostSetPrimask(primask)
+
+// Instructions with a portable equivalent
+#undef __NOP
+#undef __WFI
+#undef __DSB
+#undef __ISB
+#undef __DMB
+#undef __CLZ
+#undef __REV
+#define __NOP() do {} while (0)
+#define __WFI() hostWaitForInterrupt()
+#define __DSB() __sync_synchronize()
+#define __ISB() __sync_synchronize()
+#define __DMB() __sync_synchronize()
+#define __CLZ(value) hostClz(value)
+#define __REV(value) __builtin_bswap32(value)
+
+// SIMD and saturating instructions, in C
+#undef __SSAT
+#undef __PKHBT
+#define __SSAT(value, bits) hostSsat(value, bits)
+#define __QADD16(a, b) hostQadd16(a, b)
+#define __PKHBT(low, high, shift) hostPkhbt(low, high, shift)
+#define __SMLAD(a, b, sum) hostSmlad(a, b, sum)
+#define __UADD16(a, b) hostUadd16(a, b)
+
+// Set and clear registers of the NVIC
+#define NVIC_EnableIRQ(IRQn) hostNvicEnableIrq(IRQn)
+#define NVIC_DisableIRQ(IRQn) hostNvicDisableIrq(IRQn)
+#define NVIC_SetPendingIRQ(IRQn) hostNvicSetPendingIrq(IRQn)
+#define NVIC_ClearPendingIRQ(IRQn) hostNvicClearPendingIrq(IRQn)
+
+// The cycle counter follows the clock of the host
+#undef DWT
+#define DWT (hostDwt())
+
+// Stimulus port 0 of the ITM goes to the SWO output of the simulator
+#define ITM_SendChar(ch) hostItmSendChar(ch)
+
+#include "host.h"
+
+#endif
@@ -0,0 +1,135 @@
+/*!
+ * @file bsp_sd.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief SD card of the host build
+ *
+ * Stands in for the SD card driver of the evaluation board under
+ * sd_diskio.c. The card is an image file of HOST_SD_BLOCK byte blocks, which
+ * can be made with mkcard.
+ *
+ * DMA transfers move the data right away and run the DMA stream of the board
+ * for as long as the card would take, so the transfer complete callbacks come
+ * from the stream interrupts, at the priority the board gives them.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "host.h"
+#include "stm324xg_eval_sd.h"
+
+// Image file of the card, -1 if there is no card
+static int sdFile = -1;
+static uint32_t sdBlocks;
+
+/*!
+ * @brief Open the image used as the SD card
+ *
+ * @param name Name of the image file
+ *
+ * @return 0 on success, -1 if the image could not be opened
+ */
+int hostSdOpen(const char *name) {
+	struct stat info;
+
+	sdFile = open(name, O_RDWR);
+	if (sdFile < 0 || fstat(sdFile, &info) != 0) {
+		perror(name);
+		return -1;
+	}
+
+	sdBlocks = info.st_size / HOST_SD_BLOCK;
+	return 0;
+}
+
+uint8_t BSP_SD_Init(void) {
+	if (sdFile < 0) return MSD_ERROR;
+
+	// Set up like BSP_SD_MspInit() on the board
+	HAL_NVIC_SetPriority(SD_DMAx_Rx_IRQn, SD_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(SD_DMAx_Rx_IRQn);
+	HAL_NVIC_SetPriority(SD_DMAx_Tx_IRQn, SD_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(SD_DMAx_Tx_IRQn);
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_ITConfig(void) {
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_IsDetected(void) {
+	return (sdFile < 0) ? SD_NOT_PRESENT : SD_PRESENT;
+}
+
+uint8_t BSP_SD_ReadBlocks(uint32_t *pData, uint32_t ReadAddr,
+                          uint32_t NumOfBlocks, uint32_t Timeout) {
+	size_t bytes = (size_t)NumOfBlocks * HOST_SD_BLOCK;
+
+	(void)Timeout;
+	if (pread(sdFile, pData, bytes, (off_t)ReadAddr * HOST_SD_BLOCK)
+	    != (ssize_t)bytes) return MSD_ERROR;
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_WriteBlocks(uint32_t *pData, uint32_t WriteAddr,
+                           uint32_t NumOfBlocks, uint32_t Timeout) {
+	size_t bytes = (size_t)NumOfBlocks * HOST_SD_BLOCK;
+
+	(void)Timeout;
+	if (pwrite(sdFile, pData, bytes, (off_t)WriteAddr * HOST_SD_BLOCK)
+	    != (ssize_t)bytes) return MSD_ERROR;
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint32_t ReadAddr,
+                              uint32_t NumOfBlocks) {
+	if (BSP_SD_ReadBlocks(pData, ReadAddr, NumOfBlocks, 0) != MSD_OK)
+		return MSD_ERROR;
+	hostDmaRun(SD_DMAx_Rx_STREAM, HOST_SD_ACCESS_CYCLES
+	           + (uint64_t)NumOfBlocks * HOST_SD_BLOCK * HOST_SD_BYTE_CYCLES);
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint32_t WriteAddr,
+                               uint32_t NumOfBlocks) {
+	if (BSP_SD_WriteBlocks(pData, WriteAddr, NumOfBlocks, 0) != MSD_OK)
+		return MSD_ERROR;
+	hostDmaRun(SD_DMAx_Tx_STREAM, HOST_SD_ACCESS_CYCLES
+	           + (uint64_t)NumOfBlocks * HOST_SD_BLOCK * HOST_SD_BYTE_CYCLES);
+	return MSD_OK;
+}
+
+/*!
+ * @brief DMA stream of SD reads, the transfer is done
+ */
+void BSP_SD_DMA_Rx_IRQHandler(void) {
+	BSP_SD_ReadCpltCallback();
+}
+
+/*!
+ * @brief DMA stream of SD writes, the transfer is done
+ */
+void BSP_SD_DMA_Tx_IRQHandler(void) {
+	BSP_SD_WriteCpltCallback();
+}
+
+uint8_t BSP_SD_Erase(uint32_t StartAddr, uint32_t EndAddr) {
+	(void)StartAddr;
+	(void)EndAddr;
+	return MSD_OK;
+}
+
+uint8_t BSP_SD_GetCardState(void) {
+	return SD_TRANSFER_OK;
+}
+
+void BSP_SD_GetCardInfo(HAL_SD_CardInfoTypeDef *CardInfo) {
+	CardInfo->CardType = CARD_SDHC_SDXC;
+	CardInfo->BlockNbr = sdBlocks;
+	CardInfo->BlockSize = HOST_SD_BLOCK;
+	CardInfo->LogBlockNbr = sdBlocks;
+	CardInfo->LogBlockSize = HOST_SD_BLOCK;
+}
@@ -0,0 +1,602 @@
+/*!
+ * @file hal.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief HAL functions of the host build
+ *
+ * Stands in for the parts of the STM32 HAL used by the Sparkbox. Functions
+ * that only configure a peripheral write its registers, which are plain
+ * memory, and return HAL_OK. The DMA streams copy their data when started:
+ * transfers to the FSMC go to the LCD controller, and the stream of the DAC
+ * is clocked by TIM6 from the clock thread, writing every sample to a WAV
+ * file.
+ */
+
+#include <string.h>
+#include "host.h"
+
+// Flags of a finished half or whole transfer
+#define HOST_DMA_HALF 0x01
+#define HOST_DMA_DONE 0x02
+
+// Clock of TIM6 and TIM7
+#define HOST_APB1_TIMER_CLOCK 84000000UL
+
+/*!
+ * @brief State of a DMA stream
+ */
+typedef struct {
+	DMA_Stream_TypeDef *regs;	/*!< Registers of a circular stream */
+	const uint8_t *src;	/*!< Memory read by a circular stream */
+	uint32_t length;	/*!< Number of items of the transfer */
+	uint32_t item;	/*!< Next item of a circular stream */
+	uint8_t size;	/*!< Bytes per item */
+	volatile uint8_t running;	/*!< 1 while the stream is enabled */
+	volatile uint32_t flags;	/*!< HOST_DMA flags not handled yet */
+	volatile uint64_t finishAt;	/*!< Virtual time a one shot transfer ends */
+} hostDmaStream;
+
+// Static function prototypes
+static uint8_t dmaIndex(DMA_Stream_TypeDef *instance);
+static IRQn_Type dmaIrq(uint8_t index);
+static void dacDmaHalf(DMA_HandleTypeDef *hdma);
+static void dacDmaDone(DMA_HandleTypeDef *hdma);
+static void wavWriteSample(int16_t sample);
+
+uint32_t SystemCoreClock = HOST_CORE_CLOCK;
+
+// Milliseconds counted by SysTick
+static volatile uint32_t uwTick;
+
+// Every DMA stream, indexed by controller * 8 + stream
+static hostDmaStream dmaStreams[HOST_DMA_STREAMS];
+
+// Stream and data alignment feeding channel 1 of the DAC
+static hostDmaStream *volatile dacStream;
+static uint32_t dacAlignment;
+
+// WAV file of the DAC output
+static FILE *wavFile;
+static uint32_t wavSamples;
+
+/*
+ * Core
+ */
+
+HAL_StatusTypeDef HAL_Init(void) {
+	HAL_NVIC_SetPriorityGrouping(NVIC_PRIORITYGROUP_4);
+	HAL_InitTick(TICK_INT_PRIORITY);
+	HAL_MspInit();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority) {
+	SysTick_Config(SystemCoreClock / 1000);
+	HAL_NVIC_SetPriority(SysTick_IRQn, TickPriority, 0);
+	return HAL_OK;
+}
+
+void HAL_IncTick(void) {
+	uwTick++;
+}
+
+uint32_t HAL_GetTick(void) {
+	return uwTick;
+}
+
+void HAL_Delay(uint32_t Delay) {
+	uint32_t start = HAL_GetTick();
+
+	while (HAL_GetTick() - start < Delay) hostWaitForInterrupt();
+}
+
+uint32_t HAL_GetREVID(void) {
+	return DBGMCU->IDCODE >> 16;
+}
+
+__weak void HAL_MspInit(void) {
+}
+
+/*
+ * Clocks
+ */
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct) {
+	(void)RCC_OscInitStruct;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct,
+                                      uint32_t FLatency) {
+	(void)RCC_ClkInitStruct;
+	(void)FLatency;
+	SystemCoreClock = HOST_CORE_CLOCK;
+	return HAL_OK;
+}
+
+/*
+ * NVIC and SysTick
+ */
+
+void HAL_NVIC_SetPriorityGrouping(uint32_t PriorityGroup) {
+	NVIC_SetPriorityGrouping(PriorityGroup);
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority,
+                          uint32_t SubPriority) {
+	NVIC_SetPriority(IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(),
+	                                           PreemptPriority, SubPriority));
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+	NVIC_EnableIRQ(IRQn);
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {
+	NVIC_DisableIRQ(IRQn);
+}
+
+void HAL_SYSTICK_CLKSourceConfig(uint32_t CLKSource) {
+	if (CLKSource == SYSTICK_CLKSOURCE_HCLK)
+		SysTick->CTRL |= SYSTICK_CLKSOURCE_HCLK;
+	else
+		SysTick->CTRL &= ~SYSTICK_CLKSOURCE_HCLK;
+}
+
+/*
+ * GPIO
+ */
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+	(void)GPIOx;
+	(void)GPIO_Init;
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin) {
+	(void)GPIOx;
+	(void)GPIO_Pin;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin,
+                       GPIO_PinState PinState) {
+	if (PinState == GPIO_PIN_SET)
+		__atomic_fetch_or(&GPIOx->ODR, GPIO_Pin, __ATOMIC_SEQ_CST);
+	else
+		__atomic_fetch_and(&GPIOx->ODR, ~(uint32_t)GPIO_Pin, __ATOMIC_SEQ_CST);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	__atomic_fetch_xor(&GPIOx->ODR, GPIO_Pin, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * DMA
+ */
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma) {
+	hdma->State = HAL_DMA_STATE_READY;
+	hdma->ErrorCode = HAL_DMA_ERROR_NONE;
+	__HAL_UNLOCK(hdma);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_DeInit(DMA_HandleTypeDef *hdma) {
+	dmaStreams[dmaIndex(hdma->Instance)].running = 0;
+	hdma->State = HAL_DMA_STATE_RESET;
+	__HAL_UNLOCK(hdma);
+	return HAL_OK;
+}
+
+/*!
+ * @brief Runs a one shot transfer
+ *
+ * The data is copied right away, a transfer to the FSMC goes to the LCD
+ * controller. The stream finishes and interrupts once the time the transfer
+ * would take has passed.
+ */
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef *hdma, uint32_t SrcAddress,
+                                   uint32_t DstAddress, uint32_t DataLength) {
+	hostDmaStream *stream = &dmaStreams[dmaIndex(hdma->Instance)];
+	uint8_t size = (hdma->Init.PeriphDataAlignment == DMA_PDATAALIGN_WORD) ? 4
+	             : (hdma->Init.PeriphDataAlignment == DMA_PDATAALIGN_HALFWORD) ? 2
+	             : 1;
+	uint8_t *src = (uint8_t *)(uintptr_t)SrcAddress;
+	uint8_t *dst = (uint8_t *)(uintptr_t)DstAddress;
+	uint64_t cycles = DataLength;
+	uint32_t i;
+
+	if (hdma->State != HAL_DMA_STATE_READY) return HAL_BUSY;
+	hdma->State = HAL_DMA_STATE_BUSY;
+
+	if ((DstAddress & 0xF0000000) == HOST_FSMC_BANK1) {
+		// The LCD is the only device on the first bank of the FSMC
+		hostLcdWritePixels((const uint16_t *)src, DataLength);
+		cycles *= HOST_LCD_PIXEL_CYCLES;
+	} else {
+		// Memory to memory, each side increments or not
+		for (i = 0; i < DataLength; i++) {
+			memcpy(dst, src, size);
+			if (hdma->Init.PeriphInc == DMA_PINC_ENABLE) src += size;
+			if (hdma->Init.MemInc == DMA_MINC_ENABLE) dst += size;
+		}
+	}
+
+	stream->flags = 0;
+	stream->running = 1;
+	__atomic_store_n(&stream->finishAt, hostNow() + cycles, __ATOMIC_SEQ_CST);
+	return HAL_OK;
+}
+
+void HAL_DMA_IRQHandler(DMA_HandleTypeDef *hdma) {
+	hostDmaStream *stream = &dmaStreams[dmaIndex(hdma->Instance)];
+	uint32_t flags = __atomic_exchange_n(&stream->flags, 0, __ATOMIC_SEQ_CST);
+
+	if ((flags & HOST_DMA_HALF) && hdma->XferHalfCpltCallback)
+		hdma->XferHalfCpltCallback(hdma);
+
+	if (flags & HOST_DMA_DONE) {
+		if (hdma->Init.Mode != DMA_CIRCULAR) {
+			hdma->State = HAL_DMA_STATE_READY;
+			__HAL_UNLOCK(hdma);
+		}
+		if (hdma->XferCpltCallback) hdma->XferCpltCallback(hdma);
+	}
+}
+
+/*!
+ * @brief Runs a stream for a transfer of a device not modeled by the HAL
+ *
+ * The device has moved the data already. The stream finishes and pends its
+ * interrupt once the time the transfer would take has passed.
+ *
+ * @param instance Registers of the stream
+ * @param cycles Cycles of the core the transfer takes
+ */
+void hostDmaRun(DMA_Stream_TypeDef *instance, uint64_t cycles) {
+	hostDmaStream *stream = &dmaStreams[dmaIndex(instance)];
+
+	stream->flags = 0;
+	stream->running = 1;
+	__atomic_store_n(&stream->finishAt, hostNow() + cycles, __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * @brief Ends the one shot transfer of a stream and pends its interrupt
+ *
+ * @note Called by the clock thread once hostNow() reaches the end time
+ *
+ * @param index Stream to finish, from controller * 8 + stream
+ */
+void hostDmaFinish(uint8_t index) {
+	hostDmaStream *stream = &dmaStreams[index];
+
+	stream->finishAt = 0;
+	stream->running = 0;
+	__atomic_fetch_or(&stream->flags, HOST_DMA_DONE, __ATOMIC_SEQ_CST);
+	hostNvicPend(dmaIrq(index));
+}
+
+/*!
+ * @brief Get the stream whose one shot transfer ends first
+ *
+ * @param at Set to the virtual time the transfer ends
+ *
+ * @return Index of the stream, HOST_DMA_STREAMS if none is running
+ */
+uint8_t hostDmaNext(uint64_t *at) {
+	uint8_t next = HOST_DMA_STREAMS;
+	uint64_t finishAt;
+	uint8_t i;
+
+	for (i = 0; i < HOST_DMA_STREAMS; i++) {
+		finishAt = __atomic_load_n(&dmaStreams[i].finishAt, __ATOMIC_SEQ_CST);
+		if (finishAt && (next == HOST_DMA_STREAMS || finishAt < *at)) {
+			next = i;
+			*at = finishAt;
+		}
+	}
+	return next;
+}
+
+/*
+ * DAC
+ */
+
+HAL_StatusTypeDef HAL_DAC_Init(DAC_HandleTypeDef *hdac) {
+	if (hdac->State == HAL_DAC_STATE_RESET) HAL_DAC_MspInit(hdac);
+	hdac->State = HAL_DAC_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_DeInit(DAC_HandleTypeDef *hdac) {
+	HAL_DAC_MspDeInit(hdac);
+	hdac->State = HAL_DAC_STATE_RESET;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_ConfigChannel(DAC_HandleTypeDef *hdac,
+                                        DAC_ChannelConfTypeDef *sConfig,
+                                        uint32_t Channel) {
+	(void)hdac;
+	(void)sConfig;
+	(void)Channel;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_Start(DAC_HandleTypeDef *hdac, uint32_t Channel) {
+	hdac->Instance->CR |= DAC_CR_EN1 << Channel;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_Stop(DAC_HandleTypeDef *hdac, uint32_t Channel) {
+	hdac->Instance->CR &= ~(DAC_CR_EN1 << Channel);
+	return HAL_OK;
+}
+
+/*!
+ * @brief Feeds the DAC from a DMA stream, one item per TIM6 update
+ */
+HAL_StatusTypeDef HAL_DAC_Start_DMA(DAC_HandleTypeDef *hdac, uint32_t Channel,
+                                    uint32_t *pData, uint32_t Length,
+                                    uint32_t Alignment) {
+	DMA_HandleTypeDef *hdma = hdac->DMA_Handle1;
+	hostDmaStream *stream = &dmaStreams[dmaIndex(hdma->Instance)];
+
+	if (Channel != DAC_CHANNEL_1) return HAL_ERROR;
+
+	hdma->XferHalfCpltCallback = dacDmaHalf;
+	hdma->XferCpltCallback = dacDmaDone;
+	hdma->State = HAL_DMA_STATE_BUSY;
+
+	dacStream = NULL;
+	stream->regs = hdma->Instance;
+	stream->regs->NDTR = Length;
+	stream->src = (const uint8_t *)pData;
+	stream->length = Length;
+	stream->item = 0;
+	stream->size = (hdma->Init.MemDataAlignment == DMA_MDATAALIGN_WORD) ? 4
+	             : (hdma->Init.MemDataAlignment == DMA_MDATAALIGN_HALFWORD) ? 2
+	             : 1;
+	stream->flags = 0;
+	stream->running = 1;
+	dacAlignment = Alignment;
+	__atomic_store_n(&dacStream, stream, __ATOMIC_SEQ_CST);
+
+	hdac->Instance->CR |= (DAC_CR_EN1 | DAC_CR_DMAEN1) << Channel;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DAC_Stop_DMA(DAC_HandleTypeDef *hdac, uint32_t Channel) {
+	hostDmaStream *stream = __atomic_exchange_n(&dacStream, NULL,
+	                                            __ATOMIC_SEQ_CST);
+
+	if (stream) stream->running = 0;
+	if (hdac->DMA_Handle1) hdac->DMA_Handle1->State = HAL_DMA_STATE_READY;
+	hdac->Instance->CR &= ~((DAC_CR_EN1 | DAC_CR_DMAEN1) << Channel);
+	return HAL_OK;
+}
+
+/*!
+ * @brief The DAC never underruns on the host, so there is nothing to clear
+ */
+void HAL_DAC_IRQHandler(DAC_HandleTypeDef *hdac) {
+	(void)hdac;
+}
+
+__weak void HAL_DAC_ConvCpltCallbackCh1(DAC_HandleTypeDef *hdac) {
+	(void)hdac;
+}
+
+__weak void HAL_DAC_ConvHalfCpltCallbackCh1(DAC_HandleTypeDef *hdac) {
+	(void)hdac;
+}
+
+__weak void HAL_DAC_MspInit(DAC_HandleTypeDef *hdac) {
+	(void)hdac;
+}
+
+__weak void HAL_DAC_MspDeInit(DAC_HandleTypeDef *hdac) {
+	(void)hdac;
+}
+
+/*!
+ * @brief A TIM6 update, converts the next sample of channel 1
+ *
+ * @note Called by the clock thread
+ */
+void hostDacTrigger(void) {
+	hostDmaStream *stream = __atomic_load_n(&dacStream, __ATOMIC_SEQ_CST);
+	uint32_t value;
+
+	if (!(DAC->CR & DAC_CR_EN1)) return;
+
+	if (stream && stream->running && stream->length) {
+		value = 0;
+		memcpy(&value, stream->src + stream->item * stream->size, stream->size);
+
+		// Move to the next item, raising the half and full interrupts
+		stream->item = (stream->item + 1) % stream->length;
+		stream->regs->NDTR = stream->length - stream->item;
+		if (stream->item == stream->length / 2) {
+			__atomic_fetch_or(&stream->flags, HOST_DMA_HALF, __ATOMIC_SEQ_CST);
+			hostNvicPend(dmaIrq(stream - dmaStreams));
+		}
+		if (stream->item == 0) {
+			__atomic_fetch_or(&stream->flags, HOST_DMA_DONE, __ATOMIC_SEQ_CST);
+			hostNvicPend(dmaIrq(stream - dmaStreams));
+		}
+
+		// Keep the 12 bits the DAC would see
+		if (dacAlignment == DAC_ALIGN_12B_L) value = (value >> 4) & 0xFFF;
+		else if (dacAlignment == DAC_ALIGN_8B_R) value = (value & 0xFF) << 4;
+		else value &= 0xFFF;
+		DAC->DOR1 = value;
+	}
+
+	wavWriteSample((int16_t)((DAC->DOR1 - 2048) << 4));
+}
+
+/*!
+ * @brief Finish the WAV file of the DAC output
+ *
+ * The sample rate in the header is the one TIM6 runs at when the simulator
+ * stops, so a run should play sounds of a single rate.
+ */
+void hostWavClose(void) {
+	uint32_t rate;
+	uint32_t header[11];
+
+	if (wavFile == NULL) return;
+
+	rate = HOST_APB1_TIMER_CLOCK / ((TIM6->PSC + 1) * (TIM6->ARR + 1));
+
+	// RIFF header of 16-bit mono PCM
+	memcpy(&header[0], "RIFF", 4);
+	header[1] = 36 + wavSamples * 2;
+	memcpy(&header[2], "WAVE", 4);
+	memcpy(&header[3], "fmt ", 4);
+	header[4] = 16;
+	header[5] = 1 | (1 << 16);	// PCM, 1 channel
+	header[6] = rate;
+	header[7] = rate * 2;
+	header[8] = 2 | (16 << 16);	// 2 bytes per frame, 16 bits per sample
+	memcpy(&header[9], "data", 4);
+	header[10] = wavSamples * 2;
+
+	fseek(wavFile, 0, SEEK_SET);
+	fwrite(header, sizeof(header), 1, wavFile);
+	fclose(wavFile);
+	wavFile = NULL;
+}
+
+/*
+ * Timers
+ */
+
+HAL_StatusTypeDef HAL_TIM_Base_Init(TIM_HandleTypeDef *htim) {
+	if (htim->State == HAL_TIM_STATE_RESET) HAL_TIM_Base_MspInit(htim);
+	htim->Instance->PSC = htim->Init.Prescaler;
+	htim->Instance->ARR = htim->Init.Period;
+	htim->Instance->CNT = 0;
+	htim->State = HAL_TIM_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_DeInit(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 &= ~TIM_CR1_CEN;
+	HAL_TIM_Base_MspDeInit(htim);
+	htim->State = HAL_TIM_STATE_RESET;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 |= TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 &= ~TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim) {
+	htim->Instance->DIER |= TIM_DIER_UIE;
+	htim->Instance->CR1 |= TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT(TIM_HandleTypeDef *htim) {
+	htim->Instance->DIER &= ~TIM_DIER_UIE;
+	htim->Instance->CR1 &= ~TIM_CR1_CEN;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIMEx_MasterConfigSynchronization(
+	TIM_HandleTypeDef *htim, TIM_MasterConfigTypeDef *sMasterConfig) {
+	htim->Instance->CR2 = (htim->Instance->CR2 & ~TIM_CR2_MMS)
+	                      | sMasterConfig->MasterOutputTrigger;
+	return HAL_OK;
+}
+
+void HAL_TIM_IRQHandler(TIM_HandleTypeDef *htim) {
+	if ((htim->Instance->SR & TIM_SR_UIF) && (htim->Instance->DIER & TIM_DIER_UIE)) {
+		__atomic_fetch_and(&htim->Instance->SR, ~TIM_SR_UIF, __ATOMIC_SEQ_CST);
+		HAL_TIM_PeriodElapsedCallback(htim);
+	}
+}
+
+__weak void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
+	(void)htim;
+}
+
+__weak void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim) {
+	(void)htim;
+}
+
+__weak void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef *htim) {
+	(void)htim;
+}
+
+/*!
+ * @brief Get the index of a stream from its registers
+ */
+static uint8_t dmaIndex(DMA_Stream_TypeDef *instance) {
+	uintptr_t address = (uintptr_t)instance;
+
+	return ((address >= DMA2_BASE) ? 8 : 0) + ((address & 0xFF) - 0x10) / 0x18;
+}
+
+/*!
+ * @brief Get the interrupt of a stream
+ */
+static IRQn_Type dmaIrq(uint8_t index) {
+	static const IRQn_Type irqs[HOST_DMA_STREAMS] = {
+		DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn,
+		DMA1_Stream3_IRQn, DMA1_Stream4_IRQn, DMA1_Stream5_IRQn,
+		DMA1_Stream6_IRQn, DMA1_Stream7_IRQn,
+		DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn,
+		DMA2_Stream3_IRQn, DMA2_Stream4_IRQn, DMA2_Stream5_IRQn,
+		DMA2_Stream6_IRQn, DMA2_Stream7_IRQn
+	};
+
+	return irqs[index];
+}
+
+/*!
+ * @brief Half of the buffer of the DAC was converted
+ */
+static void dacDmaHalf(DMA_HandleTypeDef *hdma) {
+	HAL_DAC_ConvHalfCpltCallbackCh1((DAC_HandleTypeDef *)hdma->Parent);
+}
+
+/*!
+ * @brief All of the buffer of the DAC was converted
+ */
+static void dacDmaDone(DMA_HandleTypeDef *hdma) {
+	HAL_DAC_ConvCpltCallbackCh1((DAC_HandleTypeDef *)hdma->Parent);
+}
+
+/*!
+ * @brief Append a sample to the WAV file, opening it on the first sample
+ */
+static void wavWriteSample(int16_t sample) {
+	if (wavFile == NULL) {
+		if (hostOpts.wavFile == NULL || wavSamples) return;
+		wavFile = fopen(hostOpts.wavFile, "wb");
+		if (wavFile == NULL) {
+			perror(hostOpts.wavFile);
+			hostOpts.wavFile = NULL;
+			return;
+		}
+		fseek(wavFile, 44, SEEK_SET);
+	}
+
+	fwrite(&sample, sizeof(sample), 1, wavFile);
+	wavSamples++;
+}
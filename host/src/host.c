@@ -0,0 +1,495 @@
+/*!
+ * @file host.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Simulator that runs the Sparkbox on a Linux host
+ *
+ * Maps the peripheral registers at their real addresses, then runs
+ * sparkboxMain() on the main thread while a clock thread plays the hardware.
+ * The clock thread moves virtual time along with real time, counts the
+ * timers, ends DMA transfers, refreshes the LCD and runs the script, pending
+ * the matching interrupts.
+ *
+ * Script lines hold a virtual time in ms and an action:
+ *   <ms> press <button>     Push START, A, B, X, Y, UP, DOWN, LEFT or RIGHT
+ *   <ms> release <button>   Let go of a button
+ *   <ms> dump <file.ppm>    Save what the LCD shows
+ *   <ms> quit               Stop the simulator
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "host.h"
+
+// Longest line of a script
+#define HOST_LINE 512
+
+// Real time between two steps of the clock thread in ns
+#define HOST_STEP_NS 50000
+
+// Clock of TIM6 and TIM7 in cycles of the core
+#define HOST_APB1_TIMER_CYCLES 2
+
+/*!
+ * @brief Actions of a script
+ */
+typedef enum {
+	HOST_PRESS = 0,
+	HOST_RELEASE,
+	HOST_DUMP,
+	HOST_QUIT
+} HOST_ACTION;
+
+/*!
+ * @brief One line of a script
+ */
+typedef struct {
+	uint64_t time;	/*!< Virtual time of the action in cycles */
+	HOST_ACTION action;	/*!< What to do */
+	GPIO_TypeDef *port;	/*!< Port of the button pressed or released */
+	uint8_t portIndex;	/*!< Index of the port for SYSCFG->EXTICR */
+	uint8_t pin;	/*!< Pin of the button pressed or released */
+	char *file;	/*!< Name of the PPM to dump */
+} hostEvent;
+
+/*!
+ * @brief A timer counted by the clock thread
+ */
+typedef struct {
+	TIM_TypeDef *tim;	/*!< Registers of the timer */
+	IRQn_Type irq;	/*!< Update interrupt */
+	uint8_t clockCycles;	/*!< Core cycles per cycle of the timer clock */
+	uint64_t residue;	/*!< Core cycles counted towards the next tick */
+} hostTimer;
+
+/*!
+ * @brief A region of the memory map
+ */
+typedef struct {
+	uintptr_t base;	/*!< First address */
+	size_t size;	/*!< Bytes mapped */
+} hostRegion;
+
+// Sparkbox main(), renamed by the host build
+int sparkboxMain(void);
+
+// Static function prototypes
+static void usage(const char *name);
+static void mapPeripherals(void);
+static void loadScript(const char *name);
+static void *clockThread(void *arg);
+static uint64_t realNs(void);
+static uint64_t timerCycles(hostTimer *timer);
+static void timerAdvance(hostTimer *timer, uint64_t cycles);
+static void runEvent(hostEvent *event);
+static void pinEdge(uint8_t portIndex, uint8_t pin, uint8_t rising);
+
+hostOptions hostOpts;
+
+// Virtual time in cycles of the core
+static volatile uint64_t virtualCycles;
+
+// Thread running the Sparkbox
+static pthread_t mainThread;
+
+// Timers counted by the clock thread
+static hostTimer timers[] = {
+	{TIM6, TIM6_DAC_IRQn, HOST_APB1_TIMER_CYCLES, 0},
+	{TIM7, TIM7_IRQn, HOST_APB1_TIMER_CYCLES, 0},
+	{TIM10, TIM1_UP_TIM10_IRQn, 1, 0}
+};
+
+// Regions holding every register the Sparkbox touches
+static const hostRegion regions[] = {
+	{PERIPH_BASE, 0x80000},	// APB1, APB2, AHB1
+	{AHB2PERIPH_BASE, 0x61000},	// AHB2
+	{HOST_FSMC_BANK1, 0x100000},	// LCD
+	{FSMC_R_BASE, 0x1000},	// FSMC registers
+	{SCS_BASE - 0xE000, 0x100000}	// Core peripherals
+};
+
+// Script sorted by time
+static hostEvent *events;
+static uint32_t numEvents;
+
+int main(int argc, char **argv) {
+	pthread_t thread;
+	sigset_t blocked;
+	int i;
+
+	hostOpts.swo = stdout;
+	hostOpts.speed = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--sd")) {
+			hostOpts.sdImage = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--script")) {
+			hostOpts.script = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--ppm")) {
+			hostOpts.ppmDir = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--wav")) {
+			hostOpts.wavFile = argv[++i];
+		} else if (i + 1 < argc && !strcmp(argv[i], "--swo")) {
+			hostOpts.swo = fopen(argv[++i], "w");
+			if (hostOpts.swo == NULL) {
+				perror(argv[i]);
+				return 1;
+			}
+		} else if (i + 1 < argc && !strcmp(argv[i], "--speed")) {
+			hostOpts.speed = strtoul(argv[++i], NULL, 0);
+		} else if (i + 1 < argc && !strcmp(argv[i], "--time")) {
+			hostOpts.timeLimit = strtoul(argv[++i], NULL, 0);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (hostOpts.speed == 0) hostOpts.speed = 1;
+
+	// DMA addresses are 32 bits, keep every allocation in the low 4 GB
+	mallopt(M_MMAP_MAX, 0);
+
+	mapPeripherals();
+	if (hostOpts.sdImage && hostSdOpen(hostOpts.sdImage) != 0) return 1;
+	if (hostOpts.script) loadScript(hostOpts.script);
+
+	// Interrupts run on this thread only
+	mainThread = pthread_self();
+	initHostNvic();
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+	if (pthread_create(&thread, NULL, clockThread, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+	pthread_sigmask(SIG_UNBLOCK, &blocked, NULL);
+
+	sparkboxMain();
+
+	// The Sparkbox never returns, but keep the interrupts going if it does
+	for (;;) hostWaitForInterrupt();
+}
+
+/*!
+ * @brief Get the virtual time
+ *
+ * @return Cycles of the core since the simulator started
+ */
+uint64_t hostNow(void) {
+	return __atomic_load_n(&virtualCycles, __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * @brief Finish the outputs and stop the simulator
+ *
+ * @param status Exit status of the process
+ */
+void hostExit(int status) {
+	hostWavClose();
+	if (hostOpts.swo) fflush(hostOpts.swo);
+	fprintf(stderr, "sparkbox: stopped at %lu ms\n",
+	        (unsigned long)(hostNow() * 1000 / HOST_CORE_CLOCK));
+	exit(status);
+}
+
+/*!
+ * @brief Print the options of the simulator
+ */
+static void usage(const char *name) {
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "  --sd IMAGE     FAT image used as the SD card\n"
+	        "  --script FILE  button presses, dumps and quit, by time in ms\n"
+	        "  --ppm DIR      save every new frame of the LCD as a PPM\n"
+	        "  --wav FILE     save the DAC output\n"
+	        "  --swo FILE     save the SWO output instead of printing it\n"
+	        "  --speed N      run N times faster than real time\n"
+	        "  --time MS      stop after MS ms of virtual time\n",
+	        name);
+}
+
+/*!
+ * @brief Map zeroed memory over every peripheral address
+ */
+static void mapPeripherals(void) {
+	uint8_t i;
+	void *map;
+
+	for (i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+		map = mmap((void *)regions[i].base, regions[i].size,
+		           PROT_READ | PROT_WRITE,
+		           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (map != (void *)regions[i].base) {
+			fprintf(stderr, "sparkbox: cannot map 0x%08lx: %s\n",
+			        (unsigned long)regions[i].base, strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+/*!
+ * @brief Read a script into events
+ *
+ * @param name Name of the script file
+ */
+static void loadScript(const char *name) {
+	static const char *const buttonNames[] = {
+		"A", "B", "X", "Y", "DOWN", "UP", "RIGHT", "LEFT"
+	};
+	char line[HOST_LINE];
+	char action[HOST_LINE];
+	char arg[HOST_LINE];
+	unsigned long ms;
+	uint32_t lineNumber = 0;
+	hostEvent *event;
+	FILE *file;
+	int fields;
+	uint8_t i;
+
+	file = fopen(name, "r");
+	if (file == NULL) {
+		perror(name);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		fields = sscanf(line, "%lu %s %s", &ms, action, arg);
+		if (fields <= 0 || line[0] == '#') continue;
+
+		events = realloc(events, (numEvents + 1) * sizeof(hostEvent));
+		event = &events[numEvents];
+		memset(event, 0, sizeof(hostEvent));
+		event->time = (uint64_t)ms * (HOST_CORE_CLOCK / 1000);
+
+		if (fields == 3 && (!strcmp(action, "press") || !strcmp(action, "release"))) {
+			event->action = strcmp(action, "press") ? HOST_RELEASE : HOST_PRESS;
+			if (!strcmp(arg, "START")) {
+				event->port = GPIOA;
+				event->portIndex = 0;
+				event->pin = 0;
+			} else {
+				event->port = GPIOF;
+				event->portIndex = 5;
+				for (i = 0; i < 8 && strcmp(arg, buttonNames[i]); i++);
+				event->pin = i;
+			}
+		} else if (fields == 3 && !strcmp(action, "dump")) {
+			event->action = HOST_DUMP;
+			event->file = strdup(arg);
+		} else if (fields == 2 && !strcmp(action, "quit")) {
+			event->action = HOST_QUIT;
+		} else {
+			event->pin = 8;
+		}
+
+		if (event->pin >= 8 || (numEvents && event->time < events[numEvents - 1].time)) {
+			fprintf(stderr, "%s:%lu: bad line\n", name, (unsigned long)lineNumber);
+			exit(1);
+		}
+		numEvents++;
+	}
+
+	fclose(file);
+}
+
+/*!
+ * @brief Plays the hardware
+ *
+ * Moves virtual time along with real time. Each step runs to the next thing
+ * that happens, so the timers, the DMA and the LCD see every event at its
+ * exact virtual time.
+ */
+static void *clockThread(void *arg) {
+	struct timespec wait = {0, HOST_STEP_NS};
+	uint64_t startNs = realNs();
+	uint64_t limit = (uint64_t)hostOpts.timeLimit * (HOST_CORE_CLOCK / 1000);
+	uint64_t sysTickCount = 0;
+	uint64_t lcdCount = 0;
+	uint32_t nextEvent = 0;
+	uint64_t target;
+	uint64_t step;
+	uint64_t cycles;
+	uint64_t period;
+	uint64_t dmaAt;
+	uint8_t dma;
+	uint8_t i;
+
+	(void)arg;
+
+	for (;;) {
+		target = (realNs() - startNs) * hostOpts.speed
+		         * (HOST_CORE_CLOCK / 1000000) / 1000;
+
+		while (virtualCycles < target) {
+			// Run up to the first thing that happens
+			step = target - virtualCycles;
+
+			for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++) {
+				cycles = timerCycles(&timers[i]);
+				if (cycles < step) step = cycles;
+			}
+
+			period = (SysTick->LOAD + 1) * ((SysTick->CTRL & SysTick_CTRL_CLKSOURCE_Msk) ? 1 : 8);
+			if ((SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) && period - sysTickCount < step)
+				step = period - sysTickCount;
+
+			if (hostLcdRefreshCycles() - lcdCount < step)
+				step = hostLcdRefreshCycles() - lcdCount;
+
+			dma = hostDmaNext(&dmaAt);
+			if (dma != HOST_DMA_STREAMS && dmaAt < virtualCycles + step)
+				step = (dmaAt > virtualCycles) ? dmaAt - virtualCycles : 0;
+
+			if (nextEvent < numEvents && events[nextEvent].time < virtualCycles + step)
+				step = (events[nextEvent].time > virtualCycles)
+				       ? events[nextEvent].time - virtualCycles : 0;
+
+			if (limit && limit < virtualCycles + step)
+				step = (limit > virtualCycles) ? limit - virtualCycles : 0;
+
+			__atomic_store_n(&virtualCycles, virtualCycles + step, __ATOMIC_SEQ_CST);
+
+			// Timers
+			for (i = 0; i < sizeof(timers) / sizeof(timers[0]); i++)
+				timerAdvance(&timers[i], step);
+
+			// SysTick
+			if (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) {
+				sysTickCount += step;
+				if (sysTickCount >= period) {
+					sysTickCount = 0;
+					SysTick->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+					if (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk)
+						hostNvicPend(SysTick_IRQn);
+				}
+			}
+
+			// LCD refresh, the tearing effect line pulses on PB8
+			lcdCount += step;
+			if (lcdCount >= hostLcdRefreshCycles()) {
+				lcdCount = 0;
+				if (hostLcdRefresh()) {
+					GPIOB->IDR |= GPIO_IDR_IDR_8;
+					pinEdge(1, 8, 1);
+					GPIOB->IDR &= ~GPIO_IDR_IDR_8;
+				}
+			}
+
+			// DMA transfers
+			while ((dma = hostDmaNext(&dmaAt)) != 16 && dmaAt <= virtualCycles)
+				hostDmaFinish(dma);
+
+			// Script
+			while (nextEvent < numEvents && events[nextEvent].time <= virtualCycles)
+				runEvent(&events[nextEvent++]);
+
+			if (limit && virtualCycles >= limit) hostExit(0);
+		}
+
+		// Run the interrupts that were pended
+		if (__atomic_exchange_n(&hostPended, 0, __ATOMIC_SEQ_CST))
+			pthread_kill(mainThread, SIGUSR1);
+
+		nanosleep(&wait, NULL);
+	}
+
+	return NULL;
+}
+
+/*!
+ * @brief Get the real time of the host in ns
+ */
+static uint64_t realNs(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*!
+ * @brief Get the number of core cycles to the next update of a timer
+ */
+static uint64_t timerCycles(hostTimer *timer) {
+	TIM_TypeDef *tim = timer->tim;
+	uint64_t tick = (uint64_t)(tim->PSC + 1) * timer->clockCycles;
+	uint32_t ticks;
+
+	if (!(tim->CR1 & TIM_CR1_CEN)) return UINT64_MAX;
+
+	ticks = (tim->CNT < tim->ARR) ? tim->ARR - tim->CNT + 1 : 1;
+	return ticks * tick - timer->residue;
+}
+
+/*!
+ * @brief Count a timer, raising the update flag when it wraps
+ */
+static void timerAdvance(hostTimer *timer, uint64_t cycles) {
+	TIM_TypeDef *tim = timer->tim;
+	uint64_t tick = (uint64_t)(tim->PSC + 1) * timer->clockCycles;
+	uint64_t count;
+
+	if (!(tim->CR1 & TIM_CR1_CEN)) {
+		timer->residue = 0;
+		return;
+	}
+
+	timer->residue += cycles;
+	count = tim->CNT + timer->residue / tick;
+	timer->residue %= tick;
+
+	if (count <= tim->ARR) {
+		tim->CNT = count;
+		return;
+	}
+
+	// Update event
+	tim->CNT = 0;
+	__atomic_fetch_or(&tim->SR, TIM_SR_UIF, __ATOMIC_SEQ_CST);
+	if (tim->DIER & TIM_DIER_UIE) hostNvicPend(timer->irq);
+	if (tim == TIM6) hostDacTrigger();
+}
+
+/*!
+ * @brief Run one line of the script
+ */
+static void runEvent(hostEvent *event) {
+	uint32_t bit;
+
+	switch (event->action) {
+	case HOST_PRESS:
+	case HOST_RELEASE:
+		// Buttons read high when pushed
+		bit = 1UL << event->pin;
+		if (event->action == HOST_PRESS)
+			__atomic_fetch_or(&event->port->IDR, bit, __ATOMIC_SEQ_CST);
+		else
+			__atomic_fetch_and(&event->port->IDR, ~bit, __ATOMIC_SEQ_CST);
+		pinEdge(event->portIndex, event->pin, event->action == HOST_PRESS);
+		break;
+	case HOST_DUMP:
+		hostLcdDump(event->file);
+		break;
+	case HOST_QUIT:
+		hostExit(0);
+		break;
+	}
+}
+
+/*!
+ * @brief An edge on a pin, passed to EXTI if the line selects its port
+ */
+static void pinEdge(uint8_t portIndex, uint8_t pin, uint8_t rising) {
+	if (((SYSCFG->EXTICR[pin >> 2] >> ((pin & 3) * 4)) & 0xF) != portIndex) return;
+	hostExtiTrigger(pin, rising);
+}
@@ -0,0 +1,285 @@
+/*!
+ * @file ili9341.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief ILI9341 LCD controller of the host build
+ *
+ * Receives the commands and data the Sparkbox sends over the FSMC. The
+ * window set by COLUMN_ADDRESS_SET and PAGE_ADDRESS_SET is filled left to
+ * right then top to bottom by MEMORY_WRITE, in the landscape orientation
+ * the Sparkbox sets with MEMORY_ACCESS_CTRL. The panel shows the memory
+ * through the vertical scroll, which moves the x axis in landscape, and the
+ * inversion, and can be saved as a PPM image.
+ */
+
+#include <string.h>
+#include "host.h"
+#include "lcd.h"
+
+// Most parameters taken by a command
+#define HOST_LCD_PARAMS 8
+
+// Static function prototypes
+static void lcdCommandDone(void);
+static void lcdPixel(uint16_t color);
+
+// Memory of the controller, row by row in landscape
+static uint16_t lcdMemory[LCD_HEIGHT][LCD_WIDTH];
+
+// Command being received and its parameters so far
+static uint8_t lcdCmd;
+static uint8_t lcdParams[HOST_LCD_PARAMS];
+static uint8_t lcdParamCount;
+
+// Window and position of the next pixel
+static uint16_t colStart, colEnd = LCD_WIDTH - 1;
+static uint16_t pageStart, pageEnd = LCD_HEIGHT - 1;
+static uint16_t col, page;
+static uint8_t writing;
+
+// Vertical scroll, in columns of the landscape orientation
+static uint16_t scrollTop, scrollHeight = LCD_WIDTH, scrollStart;
+
+// Display state
+static uint8_t displayOn;
+static uint8_t inverted;
+static volatile uint8_t tearingOn;
+static volatile uint8_t rtna = 0x1B;	// Reset value, 70 Hz
+static volatile uint8_t diva;
+
+// Data returned by the next reads
+static uint16_t readData[4];
+static uint8_t readCount;
+static uint8_t readIndex;
+
+// Counts every change of what the panel shows
+static volatile uint32_t changes;
+static uint32_t dumpedChanges;
+
+/*!
+ * @brief A write to the command address of the LCD
+ */
+void hostLcdWriteCmd(uint16_t cmd) {
+	lcdCmd = cmd & 0xFF;
+	lcdParamCount = 0;
+	readCount = 0;
+	readIndex = 0;
+	writing = 0;
+
+	switch (lcdCmd) {
+	case MEMORY_WRITE:
+		col = colStart;
+		page = pageStart;
+		writing = 1;
+		break;
+	case WRITE_MEMORY_CONTINUE:
+		writing = 1;
+		break;
+	case DISPLAY_ON:
+		displayOn = 1;
+		changes++;
+		break;
+	case DISPLAY_OFF:
+		displayOn = 0;
+		changes++;
+		break;
+	case INVERSION_ON:
+		inverted = 1;
+		changes++;
+		break;
+	case INVERSION_OFF:
+		inverted = 0;
+		changes++;
+		break;
+	case TEARING_LINE_OFF:
+		tearingOn = 0;
+		break;
+	case GET_SCANLINE:
+		// Dummy read, then GTS[9..8] and GTS[7..0]
+		readData[0] = 0;
+		readData[1] = hostLcdScanline() >> 8;
+		readData[2] = hostLcdScanline() & 0xFF;
+		readCount = 3;
+		break;
+	default:
+		break;
+	}
+}
+
+/*!
+ * @brief A write to the data address of the LCD
+ */
+void hostLcdWriteData(uint16_t data) {
+	if (writing) {
+		lcdPixel(data);
+		return;
+	}
+
+	if (lcdParamCount < HOST_LCD_PARAMS) lcdParams[lcdParamCount] = data & 0xFF;
+	lcdParamCount++;
+	lcdCommandDone();
+}
+
+/*!
+ * @brief A read of the data address of the LCD
+ */
+uint16_t hostLcdReadData(void) {
+	if (readIndex < readCount) return readData[readIndex++];
+	return 0;
+}
+
+/*!
+ * @brief A DMA transfer of pixels to the data address of the LCD
+ *
+ * @param pixels Pixels to write
+ * @param count Number of pixels
+ */
+void hostLcdWritePixels(const uint16_t *pixels, uint32_t count) {
+	if (!writing) return;
+	while (count--) lcdPixel(*pixels++);
+}
+
+/*!
+ * @brief Get the length of a refresh of the panel
+ *
+ * @return Virtual cycles between two refreshes
+ */
+uint64_t hostLcdRefreshCycles(void) {
+	return HOST_CORE_CLOCK * rtna * HOST_LCD_LINES * (1 << diva) / HOST_LCD_OSC;
+}
+
+/*!
+ * @brief Get the line being refreshed, from the virtual time
+ *
+ * Line 0 is the first line after the vertical blanking, which starts at
+ * LCD_WIDTH.
+ */
+uint16_t hostLcdScanline(void) {
+	uint64_t period = hostLcdRefreshCycles();
+
+	return (LCD_WIDTH + (hostNow() % period) * HOST_LCD_LINES / period)
+	       % HOST_LCD_LINES;
+}
+
+/*!
+ * @brief Start of the vertical blanking, called by the clock thread
+ *
+ * @return 1 if the tearing effect output gives a pulse
+ */
+uint8_t hostLcdRefresh(void) {
+	char name[512];
+	uint32_t now = changes;
+
+	// Save every frame that changed, named after the virtual time in ms
+	if (hostOpts.ppmDir && now != dumpedChanges) {
+		snprintf(name, sizeof(name), "%s/frame%07lu.ppm", hostOpts.ppmDir,
+		         (unsigned long)(hostNow() * 1000 / HOST_CORE_CLOCK));
+		dumpedChanges = now;
+		hostLcdDump(name);
+	}
+
+	return tearingOn;
+}
+
+/*!
+ * @brief Save what the panel shows as a binary PPM
+ *
+ * @param name Name of the file to write
+ *
+ * @return 0 on success, -1 if the file could not be written
+ */
+int hostLcdDump(const char *name) {
+	static uint8_t rgb[LCD_HEIGHT][LCD_WIDTH][3];
+	uint16_t color;
+	uint16_t x;
+	uint16_t y;
+	uint16_t memX;
+	FILE *file;
+
+	for (y = 0; y < LCD_HEIGHT; y++) {
+		for (x = 0; x < LCD_WIDTH; x++) {
+			// The scrolling area shows memory from the start line on
+			memX = x;
+			if (x >= scrollTop && x < scrollTop + scrollHeight) {
+				memX = scrollTop
+				       + (x - scrollTop + scrollStart - scrollTop + scrollHeight)
+				       % scrollHeight;
+			}
+
+			color = displayOn ? lcdMemory[y][memX] : 0;
+			if (inverted) color = ~color;
+
+			rgb[y][x][0] = ((color >> 11) & 0x1F) * 255 / 31;
+			rgb[y][x][1] = ((color >> 5) & 0x3F) * 255 / 63;
+			rgb[y][x][2] = (color & 0x1F) * 255 / 31;
+		}
+	}
+
+	file = fopen(name, "wb");
+	if (file == NULL) {
+		perror(name);
+		return -1;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+	fwrite(rgb, sizeof(rgb), 1, file);
+	fclose(file);
+	return 0;
+}
+
+/*!
+ * @brief Apply a parameter of the command being received
+ */
+static void lcdCommandDone(void) {
+	uint8_t *p = lcdParams;
+
+	switch (lcdCmd) {
+	case COLUMN_ADDRESS_SET:
+		if (lcdParamCount == 2) colStart = (p[0] << 8) | p[1];
+		if (lcdParamCount == 4) colEnd = (p[2] << 8) | p[3];
+		break;
+	case PAGE_ADDRESS_SET:
+		if (lcdParamCount == 2) pageStart = (p[0] << 8) | p[1];
+		if (lcdParamCount == 4) pageEnd = (p[2] << 8) | p[3];
+		break;
+	case VERTSCROLL_DEF:
+		if (lcdParamCount == 6) {
+			scrollTop = (p[0] << 8) | p[1];
+			scrollHeight = (p[2] << 8) | p[3];
+			if (scrollTop >= LCD_WIDTH) scrollTop = 0;
+			if (scrollHeight == 0 || scrollTop + scrollHeight > LCD_WIDTH)
+				scrollHeight = LCD_WIDTH - scrollTop;
+			changes++;
+		}
+		break;
+	case VERTSCROLL_START_ADDR:
+		if (lcdParamCount == 2) {
+			scrollStart = ((p[0] << 8) | p[1]) % LCD_WIDTH;
+			changes++;
+		}
+		break;
+	case TEARING_LINE_ON:
+		tearingOn = 1;
+		break;
+	case FRAME_RATE_NORMAL:
+		if (lcdParamCount == 1) diva = p[0] & 0x03;
+		if (lcdParamCount == 2 && (p[1] & 0x1F) >= 0x10) rtna = p[1] & 0x1F;
+		break;
+	default:
+		break;
+	}
+}
+
+/*!
+ * @brief Write a pixel at the position in the window and move to the next
+ */
+static void lcdPixel(uint16_t color) {
+	if (col < LCD_WIDTH && page < LCD_HEIGHT) lcdMemory[page][col] = color;
+	changes++;
+
+	if (col++ >= colEnd) {
+		col = colStart;
+		if (page++ >= pageEnd) page = pageStart;
+	}
+}
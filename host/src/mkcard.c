@@ -0,0 +1,139 @@
+/*!
+ * @file mkcard.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Makes an SD card image for the host build
+ *
+ * Formats a new image with the same FatFs and SD driver the Sparkbox uses,
+ * then copies every file given into its root directory. The simulator is not
+ * linked in, so the few parts of it the driver uses are stood in for here.
+ *
+ * Usage: mkcard <image> <size in MB> <file>...
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "host.h"
+#include "ff_gen_drv.h"
+#include "sd_diskio.h"
+
+// Bytes copied at a time
+#define MKCARD_CHUNK 4096
+
+// Static function prototypes
+static int copyFile(const char *name);
+
+int main(int argc, char **argv) {
+	FATFS fs;
+	char path[4];
+	uint8_t work[_MAX_SS];
+	unsigned long megabytes;
+	int file;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <image> <size in MB> <file>...\n", argv[0]);
+		return 1;
+	}
+
+	// Make an empty image of the given size
+	megabytes = strtoul(argv[2], NULL, 0);
+	file = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0 || ftruncate(file, (off_t)megabytes << 20) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	close(file);
+
+	if (hostSdOpen(argv[1]) != 0) return 1;
+	FATFS_LinkDriver(&SD_Driver, path);
+
+	if (f_mkfs(path, FM_ANY, 0, work, sizeof(work)) != FR_OK
+	    || f_mount(&fs, path, 1) != FR_OK) {
+		fprintf(stderr, "%s: cannot format\n", argv[1]);
+		return 1;
+	}
+
+	for (i = 3; i < argc; i++) {
+		if (copyFile(argv[i]) != 0) return 1;
+	}
+
+	f_mount(NULL, path, 0);
+	return 0;
+}
+
+/*!
+ * @brief Copy a file into the root directory of the card
+ *
+ * @param name Name of the file on the host
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int copyFile(const char *name) {
+	const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+	uint8_t buffer[MKCARD_CHUNK];
+	size_t bytes;
+	UINT written;
+	FILE *in;
+	FIL out;
+
+	in = fopen(name, "rb");
+	if (in == NULL) {
+		perror(name);
+		return -1;
+	}
+
+	if (f_open(&out, base, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		fprintf(stderr, "%s: cannot create on the card\n", base);
+		fclose(in);
+		return -1;
+	}
+
+	while ((bytes = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		if (f_write(&out, buffer, bytes, &written) != FR_OK || written != bytes) {
+			fprintf(stderr, "%s: card is full\n", base);
+			f_close(&out);
+			fclose(in);
+			return -1;
+		}
+	}
+
+	f_close(&out);
+	fclose(in);
+	return 0;
+}
+
+/*
+ * Stand-ins for the simulator
+ */
+
+/*!
+ * @brief Finishes a DMA transfer of the SD driver as soon as it starts
+ */
+void hostDmaRun(DMA_Stream_TypeDef *instance, uint64_t cycles) {
+	(void)cycles;
+	if (instance == SD_DMAx_Rx_STREAM) BSP_SD_DMA_Rx_IRQHandler();
+	else BSP_SD_DMA_Tx_IRQHandler();
+}
+
+/*!
+ * @brief Time does not pass, transfers finish before any timeout is checked
+ */
+uint32_t HAL_GetTick(void) {
+	return 0;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority,
+                          uint32_t SubPriority) {
+	(void)IRQn;
+	(void)PreemptPriority;
+	(void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+	(void)IRQn;
+}
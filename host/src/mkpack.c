@@ -0,0 +1,142 @@
+/*!
+ * @file mkpack.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Makes a sprite pack out of .spr files
+ *
+ * Writes the header and the directory, then every file given in order, so the
+ * sprites of a pack are read from start to end when they are initialized in
+ * the same order. Each sprite is named after its file, without the directory.
+ * See sprite.h for the layout.
+ *
+ * Usage: mkpack <pack> <file>...
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// Must match SPRITE_PACK_NAME and spritePackEntry in sprite.h
+#define MKPACK_NAME 16
+#define MKPACK_HEADER_BYTES 8
+#define MKPACK_ENTRY_BYTES (MKPACK_NAME + 8)
+
+// Bytes copied at a time
+#define MKPACK_CHUNK 4096
+
+// Static function prototypes
+static void putLittle(uint8_t *dst, uint32_t value, uint8_t bytes);
+static int copyFile(FILE *out, const char *name);
+
+int main(int argc, char **argv) {
+	uint8_t header[MKPACK_HEADER_BYTES] = {'S', 'P', 'A', 'K'};
+	uint8_t entry[MKPACK_ENTRY_BYTES];
+	uint32_t offset;
+	const char *base;
+	FILE *in;
+	FILE *out;
+	long size;
+	int i;
+
+	if (argc < 3 || argc - 2 > 0xFFFF) {
+		fprintf(stderr, "usage: %s <pack> <file>...\n", argv[0]);
+		return 1;
+	}
+
+	out = fopen(argv[1], "wb");
+	if (out == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	putLittle(&header[4], argc - 2, 2);
+	fwrite(header, 1, sizeof(header), out);
+
+	// Files follow the directory in the order they are given
+	offset = MKPACK_HEADER_BYTES + (uint32_t)(argc - 2) * MKPACK_ENTRY_BYTES;
+	for (i = 2; i < argc; i++) {
+		base = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+		if (strlen(base) >= MKPACK_NAME) {
+			fprintf(stderr, "%s: name longer than %d characters\n", base,
+			        MKPACK_NAME - 1);
+			fclose(out);
+			return 1;
+		}
+
+		in = fopen(argv[i], "rb");
+		if (in == NULL || fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0) {
+			perror(argv[i]);
+			if (in != NULL) fclose(in);
+			fclose(out);
+			return 1;
+		}
+		fclose(in);
+
+		memset(entry, 0, sizeof(entry));
+		memcpy(entry, base, strlen(base));
+		putLittle(&entry[MKPACK_NAME], offset, 4);
+		putLittle(&entry[MKPACK_NAME + 4], size, 4);
+		fwrite(entry, 1, sizeof(entry), out);
+
+		offset += size;
+	}
+
+	for (i = 2; i < argc; i++) {
+		if (copyFile(out, argv[i]) != 0) {
+			fclose(out);
+			return 1;
+		}
+	}
+
+	if (fclose(out) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief Store a value little endian, like the Cortex-M4
+ *
+ * @param dst First byte to write
+ * @param value Value to store
+ * @param bytes Number of bytes of the value
+ */
+static void putLittle(uint8_t *dst, uint32_t value, uint8_t bytes) {
+	uint8_t i;
+
+	for (i = 0; i < bytes; i++) dst[i] = value >> (8 * i);
+}
+
+/*!
+ * @brief Append a file to the pack
+ *
+ * @param out Pack being written
+ * @param name Name of the file on the host
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int copyFile(FILE *out, const char *name) {
+	uint8_t buffer[MKPACK_CHUNK];
+	size_t bytes;
+	FILE *in;
+
+	in = fopen(name, "rb");
+	if (in == NULL) {
+		perror(name);
+		return -1;
+	}
+
+	while ((bytes = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		if (fwrite(buffer, 1, bytes, out) != bytes) {
+			perror(name);
+			fclose(in);
+			return -1;
+		}
+	}
+
+	fclose(in);
+	return 0;
+}
@@ -0,0 +1,411 @@
+/*!
+ * @file nvic.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Interrupts of the host build
+ *
+ * Pending and enable bits live in the memory mapped NVIC registers, PendSV
+ * in SCB->ICSR and priorities in NVIC->IP and SCB->SHP, like on the chip.
+ * Whenever an interrupt may have become runnable, the dispatcher runs the
+ * handlers with a higher priority than the one running, from the highest
+ * down. The clock thread pends interrupts and signals the main thread, whose
+ * signal handler calls the dispatcher, so handlers preempt the main loop and
+ * each other at any point.
+ */
+
+#include <signal.h>
+#include <time.h>
+#include "host.h"
+
+// Priority of thread mode, below every interrupt
+#define HOST_THREAD_PRIORITY 16
+
+// Returned when no interrupt can run
+#define HOST_NO_IRQ (-16)
+
+// Number of external interrupts
+#define HOST_IRQS 82
+
+// Handlers linked from the Sparkbox sources, zero if not defined
+#define HOST_WEAK __attribute__((weak))
+extern void PendSV_Handler(void) HOST_WEAK;
+extern void SysTick_Handler(void) HOST_WEAK;
+extern void EXTI0_IRQHandler(void) HOST_WEAK;
+extern void EXTI1_IRQHandler(void) HOST_WEAK;
+extern void EXTI2_IRQHandler(void) HOST_WEAK;
+extern void EXTI3_IRQHandler(void) HOST_WEAK;
+extern void EXTI4_IRQHandler(void) HOST_WEAK;
+extern void EXTI9_5_IRQHandler(void) HOST_WEAK;
+extern void EXTI15_10_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream0_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream1_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream2_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream3_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream4_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream5_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream6_IRQHandler(void) HOST_WEAK;
+extern void DMA1_Stream7_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream0_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream1_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream2_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream3_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream4_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream5_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream6_IRQHandler(void) HOST_WEAK;
+extern void DMA2_Stream7_IRQHandler(void) HOST_WEAK;
+extern void TIM1_UP_TIM10_IRQHandler(void) HOST_WEAK;
+extern void TIM6_DAC_IRQHandler(void) HOST_WEAK;
+extern void TIM7_IRQHandler(void) HOST_WEAK;
+extern void SDIO_IRQHandler(void) HOST_WEAK;
+
+// Vector table, indexed by IRQn + 16
+static void (*const hostVectors[HOST_IRQS + 16])(void) = {
+	[PendSV_IRQn + 16] = PendSV_Handler,
+	[SysTick_IRQn + 16] = SysTick_Handler,
+	[EXTI0_IRQn + 16] = EXTI0_IRQHandler,
+	[EXTI1_IRQn + 16] = EXTI1_IRQHandler,
+	[EXTI2_IRQn + 16] = EXTI2_IRQHandler,
+	[EXTI3_IRQn + 16] = EXTI3_IRQHandler,
+	[EXTI4_IRQn + 16] = EXTI4_IRQHandler,
+	[EXTI9_5_IRQn + 16] = EXTI9_5_IRQHandler,
+	[EXTI15_10_IRQn + 16] = EXTI15_10_IRQHandler,
+	[DMA1_Stream0_IRQn + 16] = DMA1_Stream0_IRQHandler,
+	[DMA1_Stream1_IRQn + 16] = DMA1_Stream1_IRQHandler,
+	[DMA1_Stream2_IRQn + 16] = DMA1_Stream2_IRQHandler,
+	[DMA1_Stream3_IRQn + 16] = DMA1_Stream3_IRQHandler,
+	[DMA1_Stream4_IRQn + 16] = DMA1_Stream4_IRQHandler,
+	[DMA1_Stream5_IRQn + 16] = DMA1_Stream5_IRQHandler,
+	[DMA1_Stream6_IRQn + 16] = DMA1_Stream6_IRQHandler,
+	[DMA1_Stream7_IRQn + 16] = DMA1_Stream7_IRQHandler,
+	[DMA2_Stream0_IRQn + 16] = DMA2_Stream0_IRQHandler,
+	[DMA2_Stream1_IRQn + 16] = DMA2_Stream1_IRQHandler,
+	[DMA2_Stream2_IRQn + 16] = DMA2_Stream2_IRQHandler,
+	[DMA2_Stream3_IRQn + 16] = DMA2_Stream3_IRQHandler,
+	[DMA2_Stream4_IRQn + 16] = DMA2_Stream4_IRQHandler,
+	[DMA2_Stream5_IRQn + 16] = DMA2_Stream5_IRQHandler,
+	[DMA2_Stream6_IRQn + 16] = DMA2_Stream6_IRQHandler,
+	[DMA2_Stream7_IRQn + 16] = DMA2_Stream7_IRQHandler,
+	[TIM1_UP_TIM10_IRQn + 16] = TIM1_UP_TIM10_IRQHandler,
+	[TIM6_DAC_IRQn + 16] = TIM6_DAC_IRQHandler,
+	[TIM7_IRQn + 16] = TIM7_IRQHandler,
+	[SDIO_IRQn + 16] = SDIO_IRQHandler
+};
+
+// Static function prototypes
+static void hostSignal(int sig);
+static int nextIrq(uint8_t *priority);
+static uint8_t takeIrq(int irq);
+static uint32_t extiLines(int irq);
+static uint32_t realCycles(void);
+
+// PRIMASK of the core
+static volatile uint32_t primask;
+
+// Priority of the handler running, HOST_THREAD_PRIORITY in thread mode
+static volatile uint8_t activePriority = HOST_THREAD_PRIORITY;
+
+// Set while the dispatcher picks a handler, signals arriving then are retried
+static volatile sig_atomic_t picking;
+static volatile sig_atomic_t missed;
+
+// SysTick is pended by the clock thread, SCB->ICSR is written by the target
+static volatile uint32_t sysTickPending;
+
+// Set when an interrupt is pended, the clock thread then signals
+volatile uint32_t hostPended;
+
+// EXTI lines with an edge that was not handled yet
+static volatile uint32_t extiPending;
+
+/*!
+ * @brief Installs the signal that runs pending interrupts on this thread
+ *
+ * @note Must be called from the thread that runs the Sparkbox
+ */
+void initHostNvic(void) {
+	struct sigaction action;
+
+	action.sa_handler = hostSignal;
+	action.sa_flags = SA_NODEFER | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+/*!
+ * @brief Get PRIMASK
+ */
+uint32_t hostGetPrimask(void) {
+	return primask;
+}
+
+/*!
+ * @brief Set PRIMASK, clearing it runs every interrupt held back
+ */
+void hostSetPrimask(uint32_t mask) {
+	primask = mask & 1;
+	if (!primask) hostDispatch();
+}
+
+/*!
+ * @brief Enable an external interrupt
+ */
+void hostNvicEnableIrq(IRQn_Type irq) {
+	__atomic_fetch_or(&NVIC->ISER[irq >> 5], 1UL << (irq & 0x1F),
+	                  __ATOMIC_SEQ_CST);
+	hostDispatch();
+}
+
+/*!
+ * @brief Disable an external interrupt, it stays pending
+ */
+void hostNvicDisableIrq(IRQn_Type irq) {
+	__atomic_fetch_and(&NVIC->ISER[irq >> 5], ~(1UL << (irq & 0x1F)),
+	                   __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * @brief Pend an interrupt from the Sparkbox, it runs right away if it can
+ */
+void hostNvicSetPendingIrq(IRQn_Type irq) {
+	hostNvicPend(irq);
+	hostDispatch();
+}
+
+/*!
+ * @brief Clear a pending external interrupt
+ */
+void hostNvicClearPendingIrq(IRQn_Type irq) {
+	__atomic_fetch_and(&NVIC->ISPR[irq >> 5], ~(1UL << (irq & 0x1F)),
+	                   __ATOMIC_SEQ_CST);
+}
+
+/*!
+ * @brief Pend an interrupt without running it
+ *
+ * Can be called from any thread. The main thread runs it when it next
+ * dispatches, the clock thread signals it after pending.
+ *
+ * @param irq Interrupt to pend, SysTick, PendSV or an external interrupt
+ */
+void hostNvicPend(IRQn_Type irq) {
+	hostPended = 1;
+	if (irq == SysTick_IRQn) {
+		__atomic_store_n(&sysTickPending, 1, __ATOMIC_SEQ_CST);
+	} else if (irq == PendSV_IRQn) {
+		__atomic_fetch_or(&SCB->ICSR, SCB_ICSR_PENDSVSET_Msk, __ATOMIC_SEQ_CST);
+	} else {
+		__atomic_fetch_or(&NVIC->ISPR[irq >> 5], 1UL << (irq & 0x1F),
+		                  __ATOMIC_SEQ_CST);
+	}
+}
+
+/*!
+ * @brief An edge on an EXTI line
+ *
+ * Pends the interrupt of the line if the line is unmasked and the edge is
+ * selected in EXTI->RTSR or EXTI->FTSR.
+ *
+ * @param line EXTI line, the pin number of the GPIO
+ * @param rising 1 for a rising edge, 0 for a falling edge
+ */
+void hostExtiTrigger(uint8_t line, uint8_t rising) {
+	uint32_t bit = 1UL << line;
+	IRQn_Type irq;
+
+	if (!(EXTI->IMR & bit)) return;
+	if (!((rising ? EXTI->RTSR : EXTI->FTSR) & bit)) return;
+
+	if (line <= 4) irq = EXTI0_IRQn + line;
+	else if (line <= 9) irq = EXTI9_5_IRQn;
+	else irq = EXTI15_10_IRQn;
+
+	__atomic_fetch_or(&extiPending, bit, __ATOMIC_SEQ_CST);
+	hostNvicPend(irq);
+}
+
+/*!
+ * @brief Runs every pending interrupt that can preempt the running code
+ *
+ * Handlers nest like on the core: while a handler runs, only interrupts of
+ * a strictly higher priority are dispatched.
+ */
+void hostDispatch(void) {
+	uint8_t priority;
+	uint8_t saved;
+	uint32_t lines;
+	int irq;
+
+	for (;;) {
+		picking = 1;
+		missed = 0;
+		irq = primask ? HOST_NO_IRQ : nextIrq(&priority);
+
+		if (irq != HOST_NO_IRQ && takeIrq(irq)) {
+			saved = activePriority;
+			activePriority = priority;
+			picking = 0;
+
+			// The pending register shows the lines of this vector only, every
+			// one of them is cleared when the handler returns
+			lines = extiLines(irq);
+			if (lines) {
+				EXTI->PR = __atomic_fetch_and(&extiPending, ~lines,
+				                              __ATOMIC_SEQ_CST) & lines;
+			}
+
+			// Something higher may have been pended while picking
+			hostDispatch();
+			hostVectors[irq + 16]();
+
+			if (lines) EXTI->PR = 0;
+			activePriority = saved;
+			continue;
+		}
+
+		picking = 0;
+		if (!missed) return;
+	}
+}
+
+/*!
+ * @brief Waits a little for an interrupt
+ */
+void hostWaitForInterrupt(void) {
+	struct timespec wait = {0, 10000};
+
+	nanosleep(&wait, NULL);
+	hostDispatch();
+}
+
+/*!
+ * @brief Get the DWT registers with the cycle counter brought up to date
+ *
+ * The counter follows the real time of the host at HOST_CORE_CLOCK. Writes
+ * from the Sparkbox are seen on the next access and move the count.
+ */
+DWT_Type *hostDwt(void) {
+	static uint32_t returned;
+	static uint32_t offset;
+	DWT_Type *dwt = (DWT_Type *)DWT_BASE;
+	uint32_t now = realCycles();
+
+	if (dwt->CYCCNT != returned) offset = dwt->CYCCNT - now;
+	returned = now + offset;
+	dwt->CYCCNT = returned;
+	return dwt;
+}
+
+/*!
+ * @brief Sends a character out of ITM stimulus port 0
+ */
+uint32_t hostItmSendChar(uint32_t ch) {
+	if ((ITM->TCR & ITM_TCR_ITMENA_Msk) && (ITM->TER & 1) && hostOpts.swo) {
+		fputc((int)ch, hostOpts.swo);
+		if (ch == '\n') fflush(hostOpts.swo);
+	}
+	return ch;
+}
+
+/*!
+ * @brief Signal sent by the clock thread when it pended an interrupt
+ */
+static void hostSignal(int sig) {
+	(void)sig;
+
+	// The dispatcher on this thread tries again once it is done picking
+	if (picking) {
+		missed = 1;
+		return;
+	}
+	hostDispatch();
+}
+
+/*!
+ * @brief Find the pending interrupt with the highest priority
+ *
+ * @param priority Set to the priority of the interrupt found
+ *
+ * @return Interrupt that can preempt the running code, or HOST_NO_IRQ
+ */
+static int nextIrq(uint8_t *priority) {
+	int best = HOST_NO_IRQ;
+	uint8_t bestPriority = activePriority;
+	uint32_t pending;
+	uint8_t p;
+	int irq;
+	int word;
+
+	// Lower exception numbers win ties, so the order of the checks matters
+	if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) {
+		p = SCB->SHP[(((uint32_t)PendSV_IRQn) & 0xF) - 4] >> 4;
+		if (p < bestPriority) {
+			best = PendSV_IRQn;
+			bestPriority = p;
+		}
+	}
+	if (sysTickPending) {
+		p = SCB->SHP[(((uint32_t)SysTick_IRQn) & 0xF) - 4] >> 4;
+		if (p < bestPriority) {
+			best = SysTick_IRQn;
+			bestPriority = p;
+		}
+	}
+	for (word = 0; word < (HOST_IRQS + 31) / 32; word++) {
+		pending = NVIC->ISPR[word] & NVIC->ISER[word];
+		while (pending) {
+			irq = word * 32 + __builtin_ctz(pending);
+			pending &= pending - 1;
+			p = NVIC->IP[irq] >> 4;
+			if (p < bestPriority) {
+				best = irq;
+				bestPriority = p;
+			}
+		}
+	}
+
+	*priority = bestPriority;
+	return best;
+}
+
+/*!
+ * @brief Clear the pending bit of an interrupt about to run
+ *
+ * @return 1 if the interrupt was still pending
+ */
+static uint8_t takeIrq(int irq) {
+	uint32_t bit;
+
+	if (irq == SysTick_IRQn)
+		return __atomic_exchange_n(&sysTickPending, 0, __ATOMIC_SEQ_CST);
+	if (irq == PendSV_IRQn)
+		return (__atomic_fetch_and(&SCB->ICSR, ~SCB_ICSR_PENDSVSET_Msk,
+		                           __ATOMIC_SEQ_CST)
+		        & SCB_ICSR_PENDSVSET_Msk) != 0;
+
+	bit = 1UL << (irq & 0x1F);
+	return (__atomic_fetch_and(&NVIC->ISPR[irq >> 5], ~bit, __ATOMIC_SEQ_CST)
+	        & bit) != 0;
+}
+
+/*!
+ * @brief Get the EXTI lines sharing an interrupt
+ */
+static uint32_t extiLines(int irq) {
+	if (irq >= EXTI0_IRQn && irq <= EXTI4_IRQn) return 1UL << (irq - EXTI0_IRQn);
+	if (irq == EXTI9_5_IRQn) return 0x03E0;
+	if (irq == EXTI15_10_IRQn) return 0xFC00;
+	return 0;
+}
+
+/*!
+ * @brief Get the real time of the host in cycles of the core
+ */
+static uint32_t realCycles(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)(((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec)
+	                  * (HOST_CORE_CLOCK / 1000000) / 1000);
+}
@@ -0,0 +1,61 @@
+/*!
+ * @file adpcm.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Decoder of IMA ADPCM audio, as found in .WAV files
+ *
+ * Each block of a mono IMA ADPCM .WAV file starts with a header of 4 bytes:
+ * its first sample as a signed 16 bit value, the index in the table of steps
+ * and a reserved byte. The other samples follow as 4 bit codes, two per
+ * byte, low nibble first, each moving the previous sample by a step that
+ * adapts to the codes. Blocks decode on their own, so a file is decoded one
+ * block at a time, a few samples per call.
+ */
+
+#ifndef SPARK_ADPCM
+#define SPARK_ADPCM
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+/*! Bytes of the header of a block */
+#define ADPCM_HEADER_BYTES 4
+
+/*! Number of samples in a block of bytes, header included */
+#define ADPCM_BLOCK_SAMPLES(bytes) (((bytes) - ADPCM_HEADER_BYTES) * 2 + 1)
+
+/*!
+ * @brief Decoding state of a block
+ */
+typedef struct {
+	const uint8_t *data;	/*!< Byte holding the next code */
+	uint16_t left;	/*!< Samples of the block not decoded yet */
+	int16_t predictor;	/*!< Last sample decoded */
+	uint8_t index;	/*!< Index of the step of the next code */
+	uint8_t high;	/*!< 1 if the next code is the high nibble of data */
+	uint8_t header;	/*!< 1 until the sample of the header is decoded */
+} adpcmState;
+
+/*!
+ * @brief Start decoding a block
+ *
+ * @param state Decoding state
+ * @param block First byte of the block, its header
+ * @param bytes Size of the block, at least ADPCM_HEADER_BYTES
+ */
+void adpcmBlock(adpcmState *state, const uint8_t *block, uint16_t bytes);
+
+/*!
+ * @brief Decode the next samples of the block
+ *
+ * @param state Decoding state, from adpcmBlock()
+ * @param out Decoded samples, signed 16 bit
+ * @param count Most samples to decode
+ *
+ * @return Number of samples decoded, less than count at the end of the block
+ */
+uint32_t adpcmDecode(adpcmState *state, int16_t *out, uint32_t count);
+
+#endif
@@ -0,0 +1,56 @@
+/*!
+ * @file fastseek.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Cluster link maps for seeking in files without walking the FAT
+ *
+ * Without a map, every f_lseek() backwards, or past the current cluster,
+ * follows the cluster chain of the file through the FAT from its start. A
+ * map lists each fragment of the chain, so FatFs finds the cluster of any
+ * offset in RAM, for f_lseek() and for the cluster changes of f_read().
+ *
+ * A map takes 2 words plus 2 per fragment, 16 bytes for a contiguous file.
+ *
+ * @note Needs _USE_FASTSEEK in ffconf.h. A file with a map cannot grow, so
+ * only map files opened for reading.
+ */
+
+#ifndef SPARK_FASTSEEK
+#define SPARK_FASTSEEK
+
+#include <stdint.h>
+#include "ff.h"
+
+/*!
+ * @brief Number of items of the table used to size a map
+ *
+ * Maps of files in at most (FASTSEEK_PROBE_ITEMS - 2) / 2 fragments are built
+ * in a single pass, longer ones take a second pass once their size is known.
+ */
+#define FASTSEEK_PROBE_ITEMS 10
+
+/*!
+ * @brief Build the cluster link map of an open file
+ *
+ * The map is sized to the fragments of the file and owned by the file until
+ * fastSeekFree(). If it cannot be built, the file seeks the normal way.
+ *
+ * @param file Open file to map
+ *
+ * @return 0 on success, !0 on failure
+ */
+uint8_t fastSeekMap(FIL *file);
+
+/*!
+ * @brief Free the cluster link map of a file
+ *
+ * The file seeks the normal way afterwards. Call before or after f_close(),
+ * which does not free the map.
+ *
+ * @param file File whose map to free, may have none
+ */
+void fastSeekFree(FIL *file);
+
+#endif
@@ -71,6 +71,12 @@
 /*! Total number of pixels in the LCD */
 #define LCD_PIXELS LCD_WIDTH*LCD_HEIGHT
 
+/*! Clocks per line set at startup, refreshes the LCD at 79 Hz */
+#define LCD_RTNA_79HZ 0x18
+
+/*! Clocks per line that refresh the LCD at 61 Hz */
+#define LCD_RTNA_61HZ 0x1F
+
 /*!
  * @name LCD sample colors (565 Format)
  * @{
@@ -234,6 +240,56 @@ void LcdExitSleep(void);
  */
 void LcdSetPos(uint16_t x0, uint16_t x1, uint16_t y0, uint16_t y1);
 
+/*!
+ * @brief Sets the area of the LCD moved by the hardware scroll
+ *
+ * The ILI9341 scrolls along its 320 pixel side, which is the x axis of the
+ * LCD in the landscape orientation used by the Sparkbox. The three values
+ * must add up to LCD_WIDTH.
+ *
+ * @param top Number of fixed columns on the left side
+ * @param height Number of columns that scroll
+ * @param bottom Number of fixed columns on the right side
+ */
+void LcdSetScrollArea(uint16_t top, uint16_t height, uint16_t bottom);
+
+/*!
+ * @brief Sets the first memory column shown in the scrolling area
+ *
+ * After this, LCD column x shows the column (x + line) of the LCD memory,
+ * wrapping inside the scrolling area.
+ *
+ * @param line Memory column shown at the left side of the scrolling area
+ */
+void LcdSetScrollStart(uint16_t line);
+
+/*!
+ * @brief Sets the refresh rate of the LCD
+ *
+ * @param rtna Clocks per line, such as LCD_RTNA_79HZ or LCD_RTNA_61HZ
+ */
+void LcdSetFrameRate(uint8_t rtna);
+
+/*!
+ * @brief Turn the tearing effect output of the LCD on or off
+ *
+ * When on, the TE line of the LCD is high during the vertical blanking
+ * period of every refresh.
+ *
+ * @param enable 1 to turn the output on, 0 to turn it off
+ */
+void LcdTearingEffect(uint8_t enable);
+
+/*!
+ * @brief Read the line the LCD is currently refreshing
+ *
+ * @note This uses the FSMC, it cannot be called while a DMA transfer to the
+ * LCD is running
+ *
+ * @return Current scanline
+ */
+uint16_t LcdGetScanline(void);
+
 /*!
  * @brief Draws a single pixel at (x, y)
  *
@@ -0,0 +1,161 @@
+/*!
+ * @file mixer.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Software mixer summing the voices of the audio output
+ *
+ * Each voice plays samples from RAM at its own volume and rate. mixerRender()
+ * sums every active voice into a block of the output with saturating adds,
+ * two samples at a time with the QADD16 instruction of the Cortex-M4. Voices
+ * at another rate than MIX_RATE are resampled as they are mixed, by linear
+ * interpolation with the SMLAD multiply accumulate instruction. The
+ * wave player renders each half of the DAC ring as soon as the DMA has played
+ * it, so voices start and stop without touching the DAC, TIM6 or the DMA.
+ *
+ * Samples are signed 16 bit, or unsigned 8 bit as in .WAV files. The output
+ * is signed 16 bit, which mixerToDac() converts for the DAC.
+ */
+
+#ifndef SPARK_MIXER
+#define SPARK_MIXER
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+// The CMSIS headers leave the SIMD intrinsics out for GCC
+#include "core_cm4_simd.h"
+
+/*! Number of voices played at once */
+#ifndef MIX_VOICES
+#define MIX_VOICES 4
+#endif
+
+/*! Rate of the output in samples per second, TIM6 runs at it */
+#ifndef MIX_RATE
+#define MIX_RATE 22050
+#endif
+
+/*! Volume of a voice playing its samples as they are */
+#define MIX_VOLUME_MAX 256
+
+/*! Step of a voice playing at the rate of the output, 16.16 fixed point */
+#define MIX_STEP_ONE 0x10000UL
+
+/*!
+ * @brief Bits of the weights of the two samples a voice at another rate is
+ * interpolated between
+ *
+ * The weights and the samples fit in the halfwords SMLAD multiplies.
+ */
+#define MIX_FRACTION_BITS 14
+
+/*! Loops of a voice repeating until stopped */
+#define MIX_LOOP_ALWAYS -1
+
+typedef struct mixVoice mixVoice;
+
+/*!
+ * @brief Called as a voice is done with a half of its samples
+ *
+ * Called from mixerRender(). The voice goes on with the other half, and
+ * loops over its samples until the callback stops it.
+ *
+ * @param voice Voice playing the samples
+ * @param half Half of the samples played, 0 for the first
+ */
+typedef void (*mixHalfCallback)(mixVoice *voice, uint8_t half);
+
+/*!
+ * @brief A sound played by the mixer
+ */
+struct mixVoice {
+	const void *data;	/*!< Samples, int16_t, or uint8_t if bits is 8 */
+	uint32_t length;	/*!< Number of samples */
+	uint32_t position;	/*!< Next sample played */
+	uint32_t phase;	/*!< Fraction of a sample past position, 16 bits */
+	uint32_t step;	/*!< Samples per output sample, 16.16 fixed point */
+	int32_t loops;	/*!< Plays left after this one, MIX_LOOP_ALWAYS */
+	uint16_t volume;	/*!< Volume, up to MIX_VOLUME_MAX */
+	uint8_t bits;	/*!< Bits per sample, 8 or 16 */
+	volatile uint8_t active;	/*!< 1 while playing */
+	mixHalfCallback halfPlayed;	/*!< Called after each half, NULL if none */
+	const void *owner;	/*!< What the voice plays, set by the user */
+};
+
+/*!
+ * @brief The voices of the mixer, indexed from 0 to MIX_VOICES - 1
+ */
+extern mixVoice mixVoices[MIX_VOICES];
+
+/*!
+ * @brief Stop every voice
+ */
+void mixerInit(void);
+
+/*!
+ * @brief Find a voice to play a sound on
+ *
+ * The voice already playing owner is preferred, so a sound started again
+ * restarts, then a voice that is not playing. If every voice is playing, the
+ * one with the fewest samples left to play is taken, among the voices that
+ * neither loop nor have a callback.
+ *
+ * @note The voices should not be rendered until the one returned is set up,
+ * so call with the audio interrupts masked
+ *
+ * @param owner What the voice will play
+ *
+ * @return The voice, stopped, NULL if every voice loops or has a callback
+ */
+mixVoice *mixerTake(const void *owner);
+
+/*!
+ * @brief Stop the voices playing something
+ *
+ * @param owner What the voices play, NULL for every voice
+ */
+void mixerStop(const void *owner);
+
+/*!
+ * @brief Sum the active voices into a block of the output
+ *
+ * Each voice is scaled to its volume and added with saturation, and moves on
+ * by count output samples at its step. Voices stop at the end of their last
+ * loop.
+ *
+ * @param out Output samples, overwritten
+ * @param count Number of output samples, even
+ *
+ * @return Number of voices that were playing, 0 if the output is silence
+ */
+uint8_t mixerRender(int16_t *out, uint32_t count);
+
+/*!
+ * @brief Add one voice into a block of the output already mixed
+ *
+ * As mixerRender() does for each voice, the voice moves on by count output
+ * samples and stops at the end of its last loop.
+ *
+ * @param voice Voice added, nothing is done if it is not active
+ * @param out Output samples
+ * @param count Number of output samples, even
+ *
+ * @return 1 if the voice was playing, else 0
+ */
+uint8_t mixerAdd(mixVoice *voice, int16_t *out, uint32_t count);
+
+/*!
+ * @brief Convert mixed samples in place to the layout of the DAC
+ *
+ * Signed 16 bit samples become unsigned 12 bit ones, left aligned in their
+ * halfword, two at a time with the UADD16 instruction.
+ *
+ * Converting samples again gives them back signed, short of 4 bits.
+ *
+ * @param out Mixed samples, word aligned
+ * @param count Number of samples, even
+ */
+void mixerToDac(int16_t *out, uint32_t count);
+
+#endif
@@ -0,0 +1,170 @@
+/*!
+ * @file profiler.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Functions to time parts of the Sparkbox with the DWT cycle counter
+ *
+ * Each zone keeps the number of times it ran, the minimum, average and
+ * maximum number of cycles it took, and a histogram of its times. Bin i of a
+ * histogram counts the times below 2^(i + PROFILER_BIN_SHIFT + 1) cycles, the
+ * last bin also counts every longer time.
+ *
+ * The table can be drawn on the LCD or sent out of the SWO pin (PB3) through
+ * stimulus port 0 of the ITM.
+ *
+ * The benchmarks of bench/ send their CSV results the same way.
+ *
+ * @note Set PROFILER_ON to 0 to remove every zone from the build
+ */
+
+#ifndef SPARK_PROFILER
+#define SPARK_PROFILER
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+// Time the zones, 0 compiles the profiling calls out
+#ifndef PROFILER_ON
+#define PROFILER_ON 1
+#endif
+
+// Number of bins in the histogram of each zone
+#define PROFILER_BINS 16
+
+// Times below 2^(PROFILER_BIN_SHIFT + 1) cycles land in the first bin
+#define PROFILER_BIN_SHIFT 6
+
+// Default SWO baud rate, must divide SystemCoreClock
+#define PROFILER_SWO_BAUD 2000000
+
+// Number of elements of an array, the benchmarks sweep such tables
+#ifndef ARRAY_COUNT
+#define ARRAY_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+#endif
+
+/*!
+ * @brief Zones of code timed by the profiler
+ */
+typedef enum {
+	PROFILE_UPDATE_FRAME = 0,	/*!< Start of a frame in updateFrame() */
+	PROFILE_GET_NEXT_ROWS,	/*!< Compositing one strip */
+	PROFILE_SD_READ,	/*!< Each f_read() of sprite or audio data */
+	PROFILE_UPDATE_SPRITES,	/*!< Moving and animating every sprite */
+	PROFILE_DMA_WAIT,	/*!< LCD bus idle, waiting on the renderer */
+	PROFILE_AUDIO,	/*!< Audio DMA interrupt */
+	PROFILE_ZONES	/*!< Number of zones */
+} PROFILE_ZONE;
+
+/*!
+ * @brief Statistics of one zone
+ */
+typedef struct {
+	uint32_t count;	/*!< Number of times the zone ran */
+	uint32_t min;	/*!< Fewest cycles taken */
+	uint32_t max;	/*!< Most cycles taken */
+	uint64_t total;	/*!< Cycles taken over every run */
+	uint32_t bins[PROFILER_BINS];	/*!< Histogram of the cycles taken */
+} profileZone;
+
+#if PROFILER_ON
+/*!
+ * @brief Get the cycle count at the start of a zone
+ */
+#define PROFILE_START() (DWT->CYCCNT)
+
+/*!
+ * @brief Record a zone that started at the given cycle count
+ */
+#define PROFILE_END(zone, start) profileAdd((zone), DWT->CYCCNT - (start))
+
+/*!
+ * @brief Record a zone timed some other way
+ */
+#define PROFILE_ADD(zone, cycles) profileAdd((zone), (cycles))
+#else
+#define PROFILE_START() 0
+#define PROFILE_END(zone, start) ((void)(start))
+#define PROFILE_ADD(zone, cycles) ((void)(cycles))
+#endif
+
+/*!
+ * @brief Initializes the cycle counter and clears every zone
+ *
+ * @note Safe to call more than once, the cycle counter keeps running
+ */
+void initProfiler(void);
+
+/*!
+ * @brief Clears the statistics of every zone
+ */
+void profilerReset(void);
+
+/*!
+ * @brief Record one run of a zone
+ *
+ * Can be called from any interrupt.
+ *
+ * @param zone Zone that ran
+ * @param cycles Number of cycles it took
+ */
+void profileAdd(PROFILE_ZONE zone, uint32_t cycles);
+
+/*!
+ * @brief Get a copy of the statistics of a zone
+ *
+ * @param zone Zone to copy
+ * @param out Struct to copy the statistics into
+ */
+void profilerGetZone(PROFILE_ZONE zone, profileZone *out);
+
+/*!
+ * @brief Get the name of a zone
+ *
+ * @param zone Zone to name
+ *
+ * @return Null terminated name of the zone
+ */
+const char *profilerZoneName(PROFILE_ZONE zone);
+
+/*!
+ * @brief Draw the minimum, average and maximum of each zone in microseconds
+ *
+ * Draws directly on the LCD, so frame updates must be off.
+ *
+ * @param x x position of the top left corner of the table
+ * @param y y position of the top left corner of the table
+ */
+void profilerDraw(uint16_t x, uint16_t y);
+
+/*!
+ * @brief Set up the SWO pin to send ITM stimulus port 0 as NRZ serial
+ *
+ * @param baud Baud rate of the SWO pin
+ */
+void profilerSwoInit(uint32_t baud);
+
+/*!
+ * @brief Send every zone out of the SWO pin as one line of text each
+ *
+ * Each line is the zone name, count, minimum, average and maximum in cycles,
+ * then the histogram bins, separated by commas.
+ */
+void profilerSwoReport(void);
+
+/*!
+ * @brief Send a string out of ITM stimulus port 0
+ *
+ * @param str Null terminated string to send
+ */
+void profilerSwoSendString(const char *str);
+
+/*!
+ * @brief Send an unsigned integer out of ITM stimulus port 0 in decimal
+ *
+ * @param num Integer to send
+ */
+void profilerSwoSendInt(uint32_t num);
+
+#endif
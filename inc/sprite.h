@@ -14,12 +14,49 @@
  * |:----------|:----------:|:------------------------------------------------:|
  * | Width     |  16-bits   | Width of the sprite                              |
  * | Height    |  16-bits   | Height of the sprite                             |
- * | numColors |   4-bits   | Number of colors in the palette                  |
- * | Reserved  |   4-bits   | Reserved                                         |
  * | numFrames |   8-bits   | Number of frames in the sprite                   |
- * |Reserved[4]|16-bits each| Reserved                                         |
+ * | Version   |   4-bits   | Format of the pixel data, 0 or 1 for v1, 2 for v2|
+ * | numColors |   4-bits   | Number of colors in the palette                  |
+ * | Depth     |   8-bits   | Bits per pixel, 2, 4 or 8, 0 in older 4bpp files |
+ * | Bank      |   8-bits   | Shared palette bank used, 0 for the own palette  |
+ * | Colors8   |   8-bits   | Number of colors in the palette of an 8bpp sprite|
+ * |Reserved[5]|8-bits each | Reserved                                         |
  * |Palette[15]|16-bits each| RGB565 colors in the palette                     |
- * |ColorMap[x]|4-bits each | Map of each pixel to the color in the palette    |
+ * |Palette8[x]|16-bits each| Colors past the 15th of an 8bpp palette          |
+ * |ColorMap[x]|Depth each  | Map of each pixel to the color in the palette    |
+ *
+ * Index 0 of the ColorMap is transparent at every depth. Pixels are packed
+ * from the low bits of each byte, and rows must fill whole bytes: the width
+ * of a 4bpp sprite is even and that of a 2bpp sprite a multiple of 4.
+ *
+ * A sprite using a bank ignores the palette of its file and uses the colors
+ * set with spritePaletteBankSet() instead.
+ *
+ * A v2 file run-length encodes its rows in place of the ColorMap
+ * | Name      | Size       | Description                                      |
+ * |:----------|:----------:|:------------------------------------------------:|
+ * |RowStart[x]|16-bits each| Height + 1 offsets for each frame, from the start|
+ * |           |            | of the frame's runs to each row, then to its end |
+ * | Runs[x]   |8-bits each | Runs of every row of every frame                 |
+ *
+ * Each run starts with a control byte holding its number of pixels minus one
+ * in SPRITE_RUN_LENGTH. If SPRITE_RUN_PIXELS is set, the pixels follow packed
+ * as in a ColorMap, starting on a new byte. Otherwise the pixels
+ * are transparent and nothing follows. Transparent pixels at the end of a row
+ * are not stored, so an empty row takes no bytes.
+ *
+ * Layout of a Sparkbox .pak sprite pack, made with bin/mkpack
+ * | Name      | Size       | Description                                      |
+ * |:----------|:----------:|:------------------------------------------------:|
+ * | Magic     |  32-bits   | "SPAK"                                           |
+ * | numEntries|  16-bits   | Number of sprites in the pack                    |
+ * | Reserved  |  16-bits   | Reserved                                         |
+ * | Entries[x]|  24 bytes  | Name, offset and size of each sprite, see        |
+ * |           |            | spritePackEntry                                  |
+ * | Files[x]  |            | Each .spr file as is, at the offset of its entry |
+ *
+ * Every sprite of a pack reads through the one file of the pack, so a sprite
+ * does not hold a FatFs file and its sector buffer of its own.
  *
  * @todo Include code examples
  */
@@ -36,33 +73,195 @@
 
 /*!
  * @brief Limits the number of layers available for sprites
+ *
+ * @note Set at build time, for example with CONFIG="-DMAX_LAYERS=128". The
+ * compositor only looks at the sprites on each row, so many small sprites
+ * cost little more than a few large ones.
  */
+#ifndef MAX_LAYERS
 #define MAX_LAYERS 8
+#endif
 
 /*!
  * @brief Limits the number of sprites that can be allocated at once
+ *
+ * @note Set at build time like MAX_LAYERS. Copies made with copySprite()
+ * count as sprites.
  */
+#ifndef MAX_SPRITES
 #define MAX_SPRITES 32
+#endif
 
+#if (MAX_LAYERS > 0x7FFF) || (MAX_SPRITES > 0x7FFF)
+#error "MAX_LAYERS and MAX_SPRITES must be below 32768."
+#endif
 
 /*!
- * @brief The sprite struct itself
+ * @brief Pixel depths compiled in besides 4bpp, 0 to leave one out
+ *
+ * Each depth has its own painting loop in the compositor. With both left out
+ * every sprite is painted by the 4bpp loop without checking its depth, and
+ * files of other depths are refused.
+ */
+#ifndef SPRITE_2BPP
+#define SPRITE_2BPP 1
+#endif
+
+#ifndef SPRITE_8BPP
+#define SPRITE_8BPP 1
+#endif
+
+/*!
+ * @brief Bits per pixel of a sprite, a constant when only 4bpp is compiled in
+ */
+#if SPRITE_2BPP || SPRITE_8BPP
+#define SPRITE_BPP(spr) ((spr)->bpp)
+#else
+#define SPRITE_BPP(spr) 4
+#endif
+
+/*!
+ * @brief Number of shared palette banks, numbered from 1
+ */
+#ifndef SPRITE_PALETTE_BANKS
+#define SPRITE_PALETTE_BANKS 4
+#endif
+
+/*!
+ * @brief Number of LCD rows in each bucket of sprites
+ *
+ * Every frame, the sprites shown are sorted into buckets of this many rows,
+ * so each row of the LCD only goes through the sprites that can cover it.
+ */
+#define SPRITE_BUCKET_ROWS 8
+
+/*!
+ * @brief Number of buckets covering the LCD
+ */
+#define SPRITE_BUCKETS ((LCD_HEIGHT + SPRITE_BUCKET_ROWS - 1) / SPRITE_BUCKET_ROWS)
+
+/*!
+ * @brief Value of prevFrame for a sprite that is not on the LCD
+ */
+#define SPRITE_NOT_DRAWN 0xFF
+
+/*!
+ * @brief Bytes of CCMRAM reserved for caching sprite frames, 0 to disable
+ *
+ * @note CCMRAM is 64K and only reachable by the CPU, which is all the
+ * compositor needs. It can never be used as a DMA source. The SD sector cache
+ * of sd_diskio.c takes another 8K of it.
+ */
+#ifndef SPRITE_CACHE_BYTES
+#define SPRITE_CACHE_BYTES (48 * 1024)
+#endif
+
+#if SPRITE_CACHE_BYTES > 0x10000
+#error "SPRITE_CACHE_BYTES does not fit in CCMRAM"
+#endif
+
+/*!
+ * @brief Bits of a pixel pair mask, set if that pixel is opaque
+ *
+ * A pair code is a byte of 4bpp pixels, a nibble of 2bpp pixels or a single
+ * 8bpp pixel, which only uses the first pixel of its pair.
+ */
+#define SPRITE_PAIR_LOW 0x01	/*!< First pixel, in the low bits */
+#define SPRITE_PAIR_HIGH 0x02	/*!< Second pixel, in the high bits */
+#define SPRITE_PAIR_BOTH 0x03	/*!< Both pixels */
+
+/*!
+ * @brief Versions of the .spr format
+ *
+ * @note Files written before the version existed hold 0 and are read as v1
+ */
+#define SPRITE_VERSION_1 1	/*!< Raw 4bpp frames */
+#define SPRITE_VERSION_2 2	/*!< Run-length encoded rows with a row table */
+
+/*!
+ * @brief Bits of the control byte starting each run of a v2 row
+ */
+#define SPRITE_RUN_PIXELS 0x80	/*!< Set if pixels follow, clear if transparent */
+#define SPRITE_RUN_LENGTH 0x7F	/*!< Number of pixels of the run minus one */
+
+/*!
+ * @brief Most bytes the runs of one row of a v2 frame may take
+ *
+ * Fits an 8bpp row as wide as the LCD with its control bytes. A row never has
+ * to be read in pieces, longer rows are refused when the sprite is
+ * initialized.
+ */
+#define SPRITE_MAX_RUN_BYTES (LCD_WIDTH + LCD_WIDTH / 8)
+
+/*!
+ * @brief Word that can be stored at any halfword address
+ */
+typedef struct __attribute__((packed)) {
+	uint32_t pixels;	/*!< Two RGB565 pixels */
+} spritePairStore;
+
+/*!
+ * @brief Store a pixel pair as two RGB565 pixels with one 32-bit store
+ *
+ * @note The Cortex-M4 allows unaligned word stores to RAM
+ */
+#define SPRITE_STORE_PAIR(dst, pair) (((spritePairStore *)(dst))->pixels = (pair))
+
+/*!
+ * @brief Longest name of a sprite in a pack, with its terminating 0
+ */
+#define SPRITE_PACK_NAME 16
+
+/*!
+ * @brief Entry of the directory of a sprite pack, as stored in the file
  */
 typedef struct {
-	FIL file;	/*!< File struct used by FatFS */ 
+	char name[SPRITE_PACK_NAME];	/*!< Name of the sprite, 0 terminated */
+	uint32_t offset;	/*!< Offset of the .spr file in the pack */
+	uint32_t size;	/*!< Size of the .spr file */
+} spritePackEntry;
+
+/*!
+ * @brief Sprite pack whose file is shared by all of its sprites
+ */
+typedef struct spritePack {
+	FIL file;	/*!< File struct used by FatFS, shared by the sprites */
+	spritePackEntry *entries;	/*!< Directory of the pack */
+	uint16_t numEntries;	/*!< Number of sprites in the pack */
+	uint16_t users;	/*!< Number of sprites initialized from the pack */
+} spritePack;
+
+/*!
+ * @brief The sprite struct itself
+ */
+typedef struct sprite {
+	FIL *file;	/*!< File struct used by FatFS, NULL if made from memory */
+	spritePack *pack;	/*!< Pack the file belongs to, NULL if the file is its own */
+	struct sprite *source;	/*!< Sprite whose data is shared, NULL if not a copy */
 	uint16_t width;	/*!< Width of the sprite */
 	uint16_t height;	/*!< Height of the sprite */
 	int16_t xpos;	/*!< x position of the sprite */
 	int16_t ypos;	/*!< y position of the sprite */
 	int16_t xvelocity;	/*!< x velocity of the sprite */
 	int16_t yvelocity;	/*!< y velocity of the sprite */
+	int16_t prevXpos;	/*!< x position when last drawn */
+	int16_t prevYpos;	/*!< y position when last drawn */
 	uint16_t numColors;	/*!< Number of colors in the palette */
 	uint16_t *palette;	/*!< Array of RGB565 colors */
+	uint8_t bpp;	/*!< Bits per pixel, 2, 4 or 8 */
+	uint8_t paletteBank;	/*!< Shared palette bank used, 0 if the palette is owned */
+	uint8_t *cache;	/*!< Frames loaded in RAM, NULL if read from the file */
+	uint32_t *pairs;	/*!< Two pixels for each pair code, first pixel in the low half */
+	uint8_t *pairMasks;	/*!< Opaque pixels of each pair code */
+	uint32_t *frameStarts;	/*!< Offset of the runs of each frame, NULL if not v2 */
+	uint16_t *rowStarts;	/*!< Offset of each row from the start of its frame */
+	uint32_t dataStart;	/*!< Offset of the first frame in the file */
 	uint8_t numFrames;	/*!< Total number of frames in the sprite sheet */
 	uint8_t curFrame;	/*!< Current frame index */
+	uint8_t prevFrame;	/*!< Frame index when last drawn */
 	uint8_t flags;	/*!< Flags of the sprite */
-	uint8_t tag;	/*!< Index of the sprite in the spritesAllocated list */
-	int8_t layer;	/*!< Current layer of the sprite */
+	uint16_t tag;	/*!< Index of the sprite in the spritesAllocated list */
+	int16_t layer;	/*!< Current layer of the sprite */
 } sprite;
 
 /*!
@@ -70,7 +269,7 @@ typedef struct {
  */
 typedef struct {
 	sprite **spr;	/*!< Array of pointers to sprites stored */
-	uint8_t size;	/*!< Number of sprites stored */
+	uint16_t size;	/*!< Number of sprites stored */
 } spriteList;
 
 /*!
@@ -79,7 +278,7 @@ typedef struct {
 typedef enum {
 	HIDE = 0x80,	/*!< If set, will not draw the sprite on the LCD */
 	ANIMATED = 0x40,	/*!< If set, the sprite will cycle through its frames */
-//	reserved = 0x20,
+	READ_ERROR = 0x20,	/*!< Set when a row could not be read and was left out */
 //	reserved = 0x10,
 //	reserved = 0x08,
 //	reserved = 0x04,
@@ -95,6 +294,8 @@ typedef enum {
 	NO_FILE_ACCESS = 2, /*!< Cannot access the file on the SD card */
 	TOO_MANY_SPRITES = 3, /*!< Too many sprites either allocated or on layers */
 	FILE_ERROR = 4, /*!< Misc file error */
+	NO_PALETTE = 5, /*!< Palette bank not set, or set while in use */
+	PACK_IN_USE = 6, /*!< Sprites of the sprite pack are not destroyed */
 } SPRITE_ERROR;
 
 // sprite functions
@@ -128,13 +329,60 @@ typedef enum {
  */
 int8_t initSprite(sprite *targetSprite, char *filename);
 
+/*!
+ * @brief Populates a sprite struct from a sprite in a pack
+ *
+ * Works like initSprite(), with the sprite reading through the file of the
+ * pack instead of opening its own. Sprites initialized in the order of the
+ * pack read it from start to end.
+ *
+ * @param targetSprite Pointer to a sprite struct with allocated memory
+ * @param pack Pack opened with initSpritePack()
+ * @param name Name of the sprite in the pack
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpriteFromPack(sprite *targetSprite, spritePack *pack, char *name);
+
+/*!
+ * @brief Populates a sprite struct from pixel data already in memory
+ *
+ * The sprite is drawn straight from the given frames, the same way as a
+ * cached sprite, and never reads the SD card.
+ *
+ * @note The frames are not copied and must stay valid until the sprite is
+ * destroyed
+ *
+ * @param targetSprite Pointer to a sprite struct with allocated memory
+ * @param width Width of the sprite
+ * @param height Height of the sprite
+ * @param numFrames Number of frames in the sprite sheet
+ * @param bpp Bits per pixel of the frames, 2, 4 or 8
+ * @param palette RGB565 colors of the palette, copied into the sprite
+ * @param numColors Number of colors in the palette, at most 2^bpp - 1
+ * @param frames Pixel data of every frame, laid out as in a v1 .spr file
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpriteFromMemory(sprite *targetSprite, uint16_t width,
+                            uint16_t height, uint8_t numFrames, uint8_t bpp,
+                            const uint16_t *palette, uint16_t numColors,
+                            uint8_t *frames);
+
 /*!
  * @brief Copy one sprite to another
  *
+ * The copy shares the frames, palette, pixel pairs and file of the original,
+ * so it only takes the memory of the sprite struct. It starts at the same
+ * position and frame with its own velocity, flags and layer.
+ *
+ * @note Destroy every copy before the original. Changing the palette of one
+ * changes it for all of them.
+ *
  * @param inSprite Sprite to copy data from
  * @param targetSprite Sprite to copy data to
  *
- * @warning This function has not been written yet
+ * @return 0 on success, !0 on failure
  */
 int8_t copySprite(sprite *inSprite, sprite *targetSprite);
 
@@ -143,7 +391,8 @@ int8_t copySprite(sprite *inSprite, sprite *targetSprite);
  * 
  * Destroys the sprite by freeing memory of the palette and closing the file on
  * the SD card. The sprite is also removed from both spritesAllocated and
- * spriteLayers list.
+ * spriteLayers list. A copy made with copySprite() is only removed from the
+ * lists, its data stays with the original.
  * 
  * @param inSprite Sprite struct to destroy
  */
@@ -168,6 +417,10 @@ uint32_t drawSprite(sprite *inSprite);
  * xvelocity, and the y position will move at the speed of the sprite's
  * yvelocity.
  *
+ * The area a sprite was last drawn at and the area it now covers are marked
+ * as damaged whenever its position or frame changes. The sprites on the LCD
+ * are then sorted into buckets of SPRITE_BUCKET_ROWS rows for the compositor.
+ *
  * @note Only sprites that are at an assigned layer will be updated with this
  * function
  */
@@ -236,12 +489,66 @@ void spriteAnimate(sprite *inSprite, uint8_t animationEnable);
 /*!
  * @brief Set a palette color of a sprite to a new given color
  *
+ * The pixel pairs using the color are updated as well. The color of a shared
+ * palette bank changes for every sprite using the bank.
+ *
  * @param inSprite Pointer to the sprite struct to change
- * @param index Index of the palette color to change, 0 <= index <= 14 
+ * @param index Index of the palette color to change, below numColors
  * @param color New color to place in the palette (RGB565 format)
  */
 void spriteSetPaletteColor(sprite *inSprite, uint8_t index, uint16_t color);
 
+// palette bank functions
+/*!
+ * @brief Set the colors of a shared palette bank
+ *
+ * Sprites whose file names the bank use these colors instead of a palette of
+ * their own, and share its pixel pairs. The colors are copied.
+ *
+ * @note A bank cannot be set while sprites use it, change its colors with
+ * spriteSetPaletteColor() instead
+ *
+ * @param bank Bank to set, 1 to SPRITE_PALETTE_BANKS
+ * @param colors RGB565 colors of the palette
+ * @param numColors Number of colors in the palette, at most 255
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t spritePaletteBankSet(uint8_t bank, const uint16_t *colors,
+                            uint16_t numColors);
+
+/*!
+ * @brief Free the colors and pixel pairs of a shared palette bank
+ *
+ * @param bank Bank to free, 1 to SPRITE_PALETTE_BANKS
+ *
+ * @return 0 on success, !0 if sprites still use the bank
+ */
+int8_t spritePaletteBankClear(uint8_t bank);
+
+// sprite pack functions
+/*!
+ * @brief Open a sprite pack and read its directory
+ *
+ * @note This function does not allocate memory for the pack struct itself,
+ * which holds the file and must stay valid while its sprites are used
+ *
+ * @param pack Pointer to a pack struct with allocated memory
+ * @param filename Name of the .pak file on the SD card
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpritePack(spritePack *pack, char *filename);
+
+/*!
+ * @brief Close a sprite pack and free its directory
+ *
+ * @param pack Pack to close
+ *
+ * @return 0 on success, !0 if sprites of the pack are not destroyed
+ */
+int8_t destroySpritePack(spritePack *pack);
+
 // spriteLayers functions
 /*!
  * @brief Add a sprite pointer to the spriteLayer list at the given position
@@ -251,7 +558,7 @@ void spriteSetPaletteColor(sprite *inSprite, uint8_t index, uint16_t color);
  *
  * @return 0 on success, !0 on failure
  */
-uint8_t spriteLayersInsert(sprite *inSprite, uint8_t layer);
+uint8_t spriteLayersInsert(sprite *inSprite, uint16_t layer);
 
 /*!
  * @brief Append a sprite pointer to the spriteLayer list
@@ -274,12 +581,115 @@ uint8_t spriteLayersAdd(sprite *inSprite);
 uint8_t spriteLayersRemove(sprite *inSprite);
 
 /*!
- * @brief For every sprite in the spriteLayers, move their file pointers to
- * beginning of their current frame
+ * @brief Move the file pointer of a sprite to a pixel of its current frame
+ *
+ * The compositor seeks each row it reads this way, skipping the rows and
+ * columns clipped off the LCD, rather than every layer once per frame.
+ *
+ * @param inSprite Pointer to the sprite to seek
+ * @param row Row of the current frame the next read will start on
+ * @param col Column of the row the next read will start on, rounded down to
+ * a byte. The runs of a v2 row are always read from its start.
  *
  * @return 0 on success, !0 on failure
  */
-uint8_t seekStartOfFrames(void);
+uint8_t spriteSeekRow(sprite *inSprite, uint16_t row, uint16_t col);
+
+/*!
+ * @brief Check if any pixel of a sprite lands on the LCD
+ *
+ * @param inSprite Pointer to the sprite to check
+ *
+ * @return 0 if the sprite is hidden or completely off the LCD, !0 otherwise
+ */
+uint8_t spriteOnScreen(sprite *inSprite);
+
+/*!
+ * @brief Get the sprites that can cover a row of the LCD
+ *
+ * The list comes from the buckets built by updateSprites() and is in layer
+ * order. Each sprite still has to be checked against the row. When layers
+ * changed since the buckets were built, every layer is returned instead.
+ *
+ * @param row Row of the LCD
+ *
+ * @return List of sprites, only valid until the next updateSprites()
+ */
+spriteList spriteGetRowSprites(int16_t row);
+
+/*!
+ * @brief Get a span of palette indexes from a row of the current frame
+ *
+ * If the sprite is cached, a pointer into the cache is returned and nothing
+ * is read. Otherwise only the bytes of the span are read from the file into
+ * the given buffer, seeking only if the file pointer is not already there.
+ *
+ * The runs of a v2 sprite are expanded into the buffer, use spriteReadRuns()
+ * to draw them without expanding.
+ *
+ * @param inSprite Pointer to the sprite to read
+ * @param row Row of the current frame to read
+ * @param first First byte of the row to read
+ * @param bytes Number of bytes to read
+ * @param buffer Buffer of at least bytes bytes used when not cached
+ *
+ * @return Pointer to the first byte of the span, NULL on a file error
+ */
+const uint8_t *spriteReadRow(sprite *inSprite, uint16_t row, uint16_t first,
+                             uint16_t bytes, uint8_t *buffer);
+
+/*!
+ * @brief Get the runs of a row of the current frame of a v2 sprite
+ *
+ * Works like spriteReadRow(), with the whole row read at once. The row table
+ * is kept in RAM, so a row of a sprite that is not cached takes a single seek,
+ * and none when rows are read in order. An empty row reads nothing.
+ *
+ * @param inSprite Pointer to the sprite to read
+ * @param row Row of the current frame to read
+ * @param buffer Buffer of at least SPRITE_MAX_RUN_BYTES bytes used when not
+ * cached
+ * @param bytes Set to the number of bytes of runs in the row
+ *
+ * @return Pointer to the runs, NULL on a file error or if the sprite is not v2
+ */
+const uint8_t *spriteReadRuns(sprite *inSprite, uint16_t row, uint8_t *buffer,
+                              uint16_t *bytes);
+
+// sprite cache functions
+/*!
+ * @brief Cache the frames of every sprite initialized from now on
+ *
+ * @note The cache is off by default
+ */
+void spriteCacheOn(void);
+
+/*!
+ * @brief Stop caching newly initialized sprites
+ *
+ * Sprites already in the cache stay there until they are released or evicted.
+ */
+void spriteCacheOff(void);
+
+/*!
+ * @brief Load every frame of a sprite into the CCMRAM cache
+ *
+ * If the cache is full, the least recently shown sprites that are not on a
+ * layer, directly or through a copy, are evicted until the frames fit. Evicted sprites fall back to
+ * reading from the SD card.
+ *
+ * @param inSprite Pointer to the sprite to cache
+ *
+ * @return 0 on success, !0 on failure
+ */
+uint8_t spriteCacheLoad(sprite *inSprite);
+
+/*!
+ * @brief Remove a sprite from the cache and give its space back
+ *
+ * @param inSprite Pointer to the sprite to release
+ */
+void spriteCacheRelease(sprite *inSprite);
 
 // test functions
 void drawSpriteDebug(sprite *inSprite);
@@ -0,0 +1,111 @@
+/*!
+ * @file tilemap.h
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Functions to interact with the tile-map background
+ *
+ * A tile map is drawn under every sprite in place of the plain background
+ * color. The tiles come from a .spr file, where each frame of the sprite is
+ * one tile, and the layout of the tiles comes from a .map file.
+ *
+ * Layout of a Sparkbox .map file
+ * | Name      | Size       | Description                                      |
+ * |:----------|:----------:|:------------------------------------------------:|
+ * | Width     |  16-bits   | Width of the map in tiles                        |
+ * | Height    |  16-bits   | Height of the map in tiles                       |
+ * | Tiles[x]  | 8-bits each| Frame of the tileset at each cell, row by row    |
+ *
+ * The map wraps around in both directions when scrolled past its edges.
+ * Pixels with a palette index of 0 show VIDEO_BG.
+ *
+ * @note Tiles must be 4bpp with an even width, and neither width nor height
+ * can be 0
+ */
+
+#ifndef SPARK_TILEMAP
+#define SPARK_TILEMAP
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "ff.h"
+#include "sprite.h"
+
+/*!
+ * @brief The tilemap struct itself
+ */
+typedef struct {
+	sprite tiles;	/*!< Tileset, each frame is one tile */
+	uint8_t *tileData;	/*!< Pixels of every tile, loaded in RAM */
+	uint8_t *map;	/*!< Tile of each cell of the map, row by row */
+	uint16_t mapWidth;	/*!< Width of the map in tiles */
+	uint16_t mapHeight;	/*!< Height of the map in tiles */
+	int16_t xscroll;	/*!< x position in the map of the left of the LCD */
+	int16_t yscroll;	/*!< y position in the map of the top of the LCD */
+	int16_t drawnXscroll;	/*!< xscroll of the frame being drawn */
+	int16_t drawnYscroll;	/*!< yscroll of the frame being drawn */
+} tilemap;
+
+/*!
+ * @brief Populates a tilemap struct
+ *
+ * Loads every tile of the tileset and the whole map into RAM, so drawing the
+ * background never reads from the SD card.
+ *
+ * @note This function does not allocate memory for the tilemap struct itself.
+ * It is up to the user to allocate the memory.
+ *
+ * @param targetMap Pointer to a tilemap struct with allocated memory
+ * @param tileFile Name of the .spr file holding the tiles
+ * @param mapFile Name of the .map file holding the layout
+ *
+ * @return 0 on success, a SPRITE_ERROR on failure
+ */
+int8_t initTilemap(tilemap *targetMap, char *tileFile, char *mapFile);
+
+/*!
+ * @brief Frees memory allocated by a tilemap
+ *
+ * @note The tilemap must not be the video background anymore
+ *
+ * @param inMap Tilemap struct to destroy
+ */
+void destroyTilemap(tilemap *inMap);
+
+/*!
+ * @brief Set the position in the map shown at the top left of the LCD
+ *
+ * The new position is used starting from the next frame.
+ *
+ * @param inMap Pointer to the tilemap struct to change
+ * @param x New x position in pixels
+ * @param y New y position in pixels
+ */
+void tilemapSetScroll(tilemap *inMap, int16_t x, int16_t y);
+
+/*!
+ * @brief Change the tile of a cell of the map
+ *
+ * Every area of the LCD showing the cell is marked as damaged.
+ *
+ * @param inMap Pointer to the tilemap struct to change
+ * @param col Column of the cell in tiles
+ * @param row Row of the cell in tiles
+ * @param tile Frame of the tileset to show in the cell
+ */
+void tilemapSetTile(tilemap *inMap, uint16_t col, uint16_t row, uint8_t tile);
+
+/*!
+ * @brief Draw a row of the tilemap into a buffer
+ *
+ * @param inMap Pointer to the tilemap to draw
+ * @param dst Buffer of at least x1 - x0 pixels
+ * @param x0 First LCD column to draw (inclusive)
+ * @param x1 Last LCD column to draw (exclusive)
+ * @param y LCD row to draw
+ */
+void tilemapDrawRow(tilemap *inMap, uint16_t *dst, int16_t x0, int16_t x1,
+                    int16_t y);
+
+#endif
@@ -16,8 +16,10 @@
 #include "ff.h"
 #include "lcd.h"
 #include "sprite.h"
+#include "tilemap.h"
 #include "waveplayer.h"
 #include "led.h"
+#include "profiler.h"
 
 /*!
  * @brief Size of LCD in bytes, not pixels
@@ -29,7 +31,9 @@
  *
  * @note Use a multiple of 2
  */
+#ifndef LCD_TRANSFER_ROWS
 #define LCD_TRANSFER_ROWS 8
+#endif
 
 /*!
  * @brief Number of buffer transfers to fill LCD
@@ -39,7 +43,7 @@
 /*!
  * @brief Throw compile error for an invalid number of row transfers
  */
-#if (LCD_SIZE_BYTES % NUM_TRANSFERS)
+#if (LCD_HEIGHT % LCD_TRANSFER_ROWS)
 #error "LCD_TRANSFER_ROWS must evenly divide LCD_HEIGHT."
 #endif
 
@@ -51,24 +55,36 @@
 #define VID_BUF_BYTES (LCD_SIZE_BYTES / NUM_TRANSFERS)
 
 /*!
- * @brief Default background color
+ * @brief Number of strips in the video ring
+ *
+ * The compositor can run up to this many strips ahead of the DMA. The ring
+ * takes VIDEO_RING_SLOTS * VID_BUF_BYTES of RAM.
+ *
+ * @note Use videoGetRingStats() to find how many a game needs
  */
-#define VIDEO_BG COLOR_888_TO_565(0x00A591)
+#ifndef VIDEO_RING_SLOTS
+#define VIDEO_RING_SLOTS 4
+#endif
+
+#if (VIDEO_RING_SLOTS < 2)
+#error "VIDEO_RING_SLOTS must be at least 2."
+#endif
 
 /*!
- * @brief Calculate timer values based on number of rows being transferred
- * at a time
+ * @brief Default background color
  */
-#define TIM7PSC 99
-#define TIM7ARR (75 * LCD_TRANSFER_ROWS - 1)
+#define VIDEO_BG COLOR_888_TO_565(0x00A591)
 
 /*!
  * @brief Frames per second at which the video updates
  *
  * @note If the video cannot process a new frame in time,
- * that frame will be "skipped" and not updated
+ * that frame will be "skipped" and not updated. With sprites in the CCMRAM
+ * cache no SD reads are made during a frame, so 30 can be used.
  */
+#ifndef FPS
 #define FPS 20
+#endif
 
 /*!
  * @brief Prescaler and ARR value of the frame update timer determined
@@ -77,6 +93,81 @@
 #define TIM10PSC 4199
 #define TIM10ARR (40000 / FPS - 1)
 
+/*!
+ * @brief Rate at which the scanline is polled in VSYNC_SCANLINE mode
+ */
+#define VSYNC_POLL_HZ 1000
+#define VSYNC_POLL_ARR (40000 / VSYNC_POLL_HZ - 1)
+
+/*!
+ * @brief Refresh rate of the LCD while vsync is on
+ *
+ * @note Frame rates of 60, 30 and 20 FPS come from divisors of 1, 2 and 3
+ */
+#define VSYNC_PANEL_HZ 61
+#define VSYNC_PANEL_RTNA LCD_RTNA_61HZ
+
+/*!
+ * @brief Sources used to start frames
+ */
+typedef enum {
+	VSYNC_OFF = 0,	/*!< Frames are started by Timer 10 at FPS */
+	VSYNC_TE = 1,	/*!< Frames start on the TE output of the LCD on PB8 */
+	VSYNC_SCANLINE = 2,	/*!< Frames start when the polled scanline wraps */
+} VSYNC_MODE;
+
+
+/*!
+ * @brief Maximum number of damaged rectangles tracked between frames
+ *
+ * @note Each sprite that changes can damage two rectangles, the area it left
+ * and the area it now covers. Rectangles beyond this limit are merged, so
+ * scenes with many sprites do not need a longer list.
+ */
+#ifndef MAX_DAMAGE_RECTS
+#define MAX_DAMAGE_RECTS 16
+#endif
+
+// Split rectangles of a frame are indexed by the int8_t window of a strip
+#if (MAX_DAMAGE_RECTS > 63)
+#error "MAX_DAMAGE_RECTS must be below 64."
+#endif
+
+/*!
+ * @brief Rectangle of the LCD, end coordinates are exclusive
+ */
+typedef struct {
+	int16_t x0;	/*!< Left side of the rectangle */
+	int16_t y0;	/*!< Top side of the rectangle */
+	int16_t x1;	/*!< One past the right side of the rectangle */
+	int16_t y1;	/*!< One past the bottom side of the rectangle */
+} videoRect;
+
+/*!
+ * @brief Strip of pixels in the video ring
+ */
+typedef struct {
+	uint16_t *pixels;	/*!< VID_BUF_BYTES of pixel data */
+	uint16_t length;	/*!< Number of pixels to send */
+	int8_t window;	/*!< Rectangle starting with this strip, -1 if none */
+} videoStrip;
+
+/*!
+ * @brief Statistics of the video ring
+ */
+typedef struct {
+	uint8_t highWater;	/*!< Most strips that were ready at once */
+	uint32_t underruns;	/*!< Times the DMA waited for the compositor */
+	uint32_t strips;	/*!< Number of strips sent */
+} videoRingStats;
+
+/*!
+ * @brief Time taken by a frame
+ */
+typedef struct {
+	uint32_t transferUs;	/*!< Time from the start of the frame to its last strip sent */
+	uint32_t idleUs;	/*!< Time the LCD bus waited for strips during the frame */
+} videoFrameTime;
 
 /*!
  * @brief Variable containing address to write pixel data
@@ -92,10 +183,10 @@ extern spriteList layers;
  * @brief Initializes video peripherals
  *
  * This function allocates required memory and initializes video peripherals.
- * These peripherals include Timers 7 and 10 as well as DMA transfers. 
+ * These peripherals include Timer 10, the PendSV renderer and DMA transfers.
  *
- * @note This function allocates memory for both video buffers and a buffer
- * for reading sprite pixels from the FatFs file system
+ * @note This function allocates memory for the VIDEO_RING_SLOTS strips of the
+ * ring and a buffer for reading sprite pixels from the FatFs file system
  *
  * @return 0 on success, -1 on failure
  */
@@ -104,10 +195,12 @@ int8_t initVideo(void);
 /*!
  * @brief Updates a frame using sprite data and reading from FatFs file system
  *
- * This function is used to update the frame on screen using two buffers.
- * While one buffer is filling with new pixel data, the other is sent with DMA
- * to the LCD. Timer 7 is used to generate interrupts that will read new data if
- * neccessary.
+ * This function is used to update the frame on screen using a ring of
+ * VIDEO_RING_SLOTS strips. The compositor fills strips at the head of the ring
+ * while the DMA sends them to the LCD from the tail, so the compositor can run
+ * several strips ahead and absorb slow reads. Each finished DMA transfer
+ * starts the next strip right away and wakes the renderer, which runs in the
+ * PendSV interrupt below every other interrupt, to fill the freed strip.
  *
  * @note This function will set up interrupts to trigger that will periodically
  * read from the FatFs file system. The user should not be accessing the FatFs
@@ -133,4 +226,133 @@ void frameUpdateOn(void);
  */
 void frameUpdateOff(void);
 
+/*!
+ * @brief Start frames in sync with the refresh of the LCD
+ *
+ * Frames start at the beginning of a refresh of the LCD instead of on Timer
+ * 10, so the data sent follows the refresh instead of tearing through it.
+ * The LCD refreshes at VSYNC_PANEL_HZ while vsync is on.
+ *
+ * With VSYNC_TE, the TE output of the LCD must be wired to PB8. With
+ * VSYNC_SCANLINE, Timer 10 polls the scanline of the LCD while no frame is
+ * being sent.
+ *
+ * @note Frames are still only drawn while frame updating is on
+ *
+ * @param mode Source of the vsync, VSYNC_TE or VSYNC_SCANLINE
+ * @param divisor Number of LCD refreshes per frame
+ */
+void videoVsyncOn(VSYNC_MODE mode, uint8_t divisor);
+
+/*!
+ * @brief Go back to starting frames on Timer 10 at FPS
+ */
+void videoVsyncOff(void);
+
+/*!
+ * @brief Get the number of frames that were not done by their vsync
+ *
+ * The count starts at 0 when videoVsyncOn() is called.
+ *
+ * @return Number of missed vsyncs
+ */
+uint32_t videoGetMissedVsyncs(void);
+
+/*!
+ * @brief Get the statistics of the strip ring
+ *
+ * A high water mark below VIDEO_RING_SLOTS with no underruns means the ring
+ * can be made smaller. Underruns mean the compositor fell behind even with
+ * the whole ring.
+ *
+ * @param stats Pointer to the struct to copy the statistics to
+ */
+void videoGetRingStats(videoRingStats *stats);
+
+/*!
+ * @brief Reset the statistics of the strip ring to 0
+ */
+void videoResetRingStats(void);
+
+/*!
+ * @brief Get the time taken by the last frame
+ *
+ * The frame starts when updateFrame() hands it to the renderer. An idle time
+ * of 0 means the LCD bus was busy back to back for the whole frame.
+ *
+ * @param time Pointer to the struct to copy the times to
+ */
+void videoGetFrameTime(videoFrameTime *time);
+
+/*!
+ * @brief Handles the tearing effect signal of the LCD
+ *
+ * @note Called by the EXTI line 8 interrupt
+ */
+void videoTearingEffect(void);
+
+/*!
+ * @brief Turn on damage tracking
+ *
+ * While damage tracking is on, each frame only sends the rectangles of the
+ * LCD that changed since the previous frame instead of the full screen. The
+ * whole screen is redrawn on the next frame.
+ */
+void videoDamageOn(void);
+
+/*!
+ * @brief Turn off damage tracking
+ *
+ * Every frame sends the full screen to the LCD
+ */
+void videoDamageOff(void);
+
+/*!
+ * @brief Mark an area of the LCD to be redrawn on the next frame
+ *
+ * The area is clipped to the LCD and merged with any damaged rectangle it
+ * overlaps. If the list of rectangles is full, it is merged with the
+ * rectangle that grows the least.
+ *
+ * @note updateSprites() calls this for every sprite that moved or changed
+ * frames, so this is only needed for changes the sprites do not know about
+ *
+ * @param x x position of the left side of the area
+ * @param y y position of the top side of the area
+ * @param width Width of the area in pixels
+ * @param height Height of the area in pixels
+ */
+void videoAddDamage(int16_t x, int16_t y, uint16_t width, uint16_t height);
+
+/*!
+ * @brief Mark the whole LCD to be redrawn on the next frame
+ */
+void videoDamageAll(void);
+
+/*!
+ * @brief Composite rows of the LCD without sending them
+ *
+ * Runs the compositor used by updateFrame() on its own, so its cost can be
+ * measured apart from the LCD bus. The rows are written to a strip of the
+ * ring, LCD_WIDTH pixels per row.
+ *
+ * @note Frame updating must be off and no frame may be in progress
+ *
+ * @param y First LCD row to composite
+ * @param rows Number of rows, at most LCD_TRANSFER_ROWS
+ *
+ * @return Pointer to the composited pixels
+ */
+const uint16_t *videoComposeRows(int16_t y, uint8_t rows);
+
+/*!
+ * @brief Sets the tilemap drawn under the sprites
+ *
+ * Scrolling the tilemap along x while damage tracking is on uses the hardware
+ * scroll of the LCD, so only the newly exposed columns are sent.
+ *
+ * @param map Pointer to the tilemap to draw, NULL for the plain VIDEO_BG
+ */
+void videoSetTilemap(tilemap *map);
+
 #endif
@@ -8,6 +8,30 @@
  *
  * These functions are used to play a .WAV file using the FatFs library.
  *
+ * A file is either imported, read whole into the audio buffer, or streamed:
+ * the mixer then plays a ring of WAV_STREAM_BYTES in a loop, and each half of
+ * the ring is read again from the file once it has been played, so files of
+ * any length play in a few KB of RAM. The refills run in the TIM6_DAC
+ * interrupt, at the priority of the video renderer, so they never read the SD
+ * card while the renderer does.
+ *
+ * The DAC, TIM6 and the DMA run from WAV_Init() on, at MIX_RATE, playing an
+ * output ring of WAV_MIX_SAMPLES. Each half of it is mixed from the voices
+ * of the mixer once the DAC played it, so up to MIX_VOICES files play at
+ * once, and WAV_Play() only hands a file to a voice.
+ *
+ * WAV_Play(), WAV_Stop() and WAV_SetVolume() queue a command that the DMA
+ * interrupt applies before it mixes the next half, through a queue with no
+ * lock: they return in a few microseconds and never mask interrupts. The
+ * queue has one writer, so these functions are called from the main loop
+ * only, not from interrupts.
+ *
+ * Files are 8 or 16 bit PCM, or IMA ADPCM at 4 bits per sample. ADPCM data
+ * stays compressed in the audio buffer, or on the SD card when streamed, and
+ * is decoded a block at a time as it plays: by the DMA interrupt into a ring
+ * of WAV_DECODE_SAMPLES per voice for imported files, and by the refills of
+ * the ring for the streamed file.
+ *
  * Pins in use:
  *
  * | Name | Pin | Use               |
@@ -26,25 +50,120 @@
 #include "clock.h"
 #include "video.h"
 #include "ff.h"
+#include "mixer.h"
+#include "adpcm.h"
 
-/*! 6ksps ensures no distortion of 3kHz audio (specification max) */
-#define SAMPLE_RATE_MIN 6000
-/*! DVDs have rate of 48000, rounded to 50000 to support this */
-#define SAMPLE_RATE_MAX 50000
+/*! Files are resampled to MIX_RATE as they play, from any rate in range */
+#define SAMPLE_RATE_MIN 4000
+/*! Highest rate of common .WAV files */
+#define SAMPLE_RATE_MAX 192000
 
-/*! Constant for repeating until WAV_Pause() is called */
+/*! Constant for repeating until WAV_Stop() is called */
 #define REPEAT_ALWAYS -1
 
 /*! Clock frequency of Timer 6 */
 #define TIM6FREQ 84000000UL
 
 /*! Size of the buffer allocated for audio files */
+#ifndef AUD_BUF_BYTES
 #define AUD_BUF_BYTES 30000
+#endif
 #define AUD_BUF_SAMPLES (AUD_BUF_BYTES / 2)
 
-/*! 16 bit data, left align. 8 bit data, right align */
-#define DAC_ADDR (transferSize==BITS_PER_SAMPLE_8 ? \
-DAC_ALIGN_12B_R: DAC_ALIGN_12B_L)
+/*!
+ * @brief Size of the ring streamed files are played from
+ *
+ * Half the ring is read from the SD card at a time, and must be read before
+ * the other half has played: 20 ms of 16 bit audio at 50 ksps for 4 KB.
+ */
+#ifndef WAV_STREAM_BYTES
+#define WAV_STREAM_BYTES 4096
+#endif
+
+#if WAV_STREAM_BYTES % 8
+#error "WAV_STREAM_BYTES must be a multiple of 8."
+#endif
+
+/*! Priority of the TIM6_DAC interrupt refilling the ring, the one of PendSV */
+#define WAV_STREAM_PRIORITY 0x0F
+
+/*!
+ * @brief Samples of the output ring the DAC plays
+ *
+ * Half the ring is mixed at a time, 11.6 ms at 22.05 ksps for 512 samples.
+ * A file played is added to the samples already mixed, see WAV_PLAY_LEAD.
+ */
+#ifndef WAV_MIX_SAMPLES
+#define WAV_MIX_SAMPLES 512
+#endif
+
+#if WAV_MIX_SAMPLES % 4
+#error "WAV_MIX_SAMPLES must be a multiple of 4."
+#endif
+
+/*!
+ * @brief Samples past the one the DAC plays a file played is mixed from
+ *
+ * Leaves the DMA interrupt time to start the file and mix its first samples
+ * before the DAC gets to them, and sets the latency of WAV_Play(): 363 us at
+ * 22.05 ksps for 8 samples.
+ */
+#ifndef WAV_PLAY_LEAD
+#define WAV_PLAY_LEAD 8
+#endif
+
+#if WAV_PLAY_LEAD >= WAV_MIX_SAMPLES / 2
+#error "WAV_PLAY_LEAD must be less than half of WAV_MIX_SAMPLES."
+#endif
+
+/*! Samples a file played is mixed into the output ring at a time, even */
+#define WAV_PLAY_BLOCK 32
+
+/*!
+ * @brief Highest sample rate of a streamed file of 16 bit or ADPCM samples
+ *
+ * Each half of the output ring plays half of the ring of the file at most,
+ * so a half is read again before it plays: 88.2 ksps for the default sizes,
+ * twice that for 8 bit samples.
+ */
+#define WAV_STREAM_RATE_MAX ((uint32_t)((uint64_t)MIX_RATE \
+	* (WAV_STREAM_BYTES / 4) / (WAV_MIX_SAMPLES / 2)))
+
+/*!
+ * @brief Largest block of IMA ADPCM files
+ *
+ * A block of a streamed file is read whole before it is decoded. Encoders
+ * write blocks of 256 to 1024 bytes for mono files.
+ */
+#ifndef WAV_ADPCM_BLOCK_BYTES
+#define WAV_ADPCM_BLOCK_BYTES 1024
+#endif
+
+/*!
+ * @brief Samples decoded ahead for each voice playing an imported ADPCM file
+ *
+ * Half the ring is decoded at a time, as the mixer plays the other half.
+ */
+#ifndef WAV_DECODE_SAMPLES
+#define WAV_DECODE_SAMPLES 256
+#endif
+
+#if WAV_DECODE_SAMPLES % 4
+#error "WAV_DECODE_SAMPLES must be a multiple of 4."
+#endif
+
+/*!
+ * @brief Commands queued to the DMA interrupt at most
+ *
+ * Queuing one more waits for the next half of the output ring.
+ */
+#ifndef WAV_COMMANDS
+#define WAV_COMMANDS 8
+#endif
+
+#if WAV_COMMANDS < 1 || WAV_COMMANDS > 128 || WAV_COMMANDS & (WAV_COMMANDS - 1)
+#error "WAV_COMMANDS must be a power of 2 up to 128."
+#endif
 
 /*!
  * @name Defines and Enumerations from STM's waveplayer demo for STM32072B-EVAL,
@@ -74,10 +193,14 @@ typedef struct
 	uint16_t  BlockAlign; /*!< Number of bytes for one sample */
 	uint16_t  BitsPerSample; /*!< Bits per sample */
 	uint32_t  DataSize; /*!< Size of the data in bytes */
-	uint32_t  TIM6ARRValue; /*!< ARR value for Timer 6 based on sample rate */
+	uint32_t  Step; /*!< Samples per sample of the output, 16.16 fixed point */
 	uint32_t  SpeechDataOffset; /*!< Offset from beginning of file to data */
 	char      Filename[64]; /*!< Filename associated with the WAV file */
 	uint16_t  Error; /*!< Current error status of the WAV file */
+	uint8_t   Streamed; /*!< 1 if opened with WAV_Stream(), 0 if imported */
+	uint8_t   *Data; /*!< Imported data in the audio buffer, NULL if streamed */
+	uint16_t  Volume; /*!< Volume, up to MIX_VOLUME_MAX */
+	uint16_t  SamplesPerBlock; /*!< Samples per block of IMA ADPCM data */
 } WAV_Format;
 
 /*!
@@ -89,15 +212,16 @@ typedef enum
 	Bad_RIFF_ID, /*!< "RIFF" text invalid */
 	Bad_WAVE_Format, /*!< "WAVE" text invalid */
 	Bad_FormatChunk_ID, /*!< "fmt" text invalid */
-	Bad_FormatTag, /*!< Compressed audio not supported */
+	Bad_FormatTag, /*!< Only PCM and IMA ADPCM are supported */
 	Bad_Number_Of_Channel, /*!< Only mono audio is supported */
-	Bad_Sample_Rate, /*!< Sample rate out*/
+	Bad_Sample_Rate, /*!< Sample rate out of range */
 	Bad_Bits_Per_Sample, /*!< */
 	Bad_DataChunk_ID, /*!< */
 	Bad_ExtraFormatBytes, /*!< */
 	Bad_FactChunk_ID, /*!< "FACT" text invalid */
-	Bad_DataSize, /*!< Data cannot fit in allocated memory */
-	Bad_FileRead /*!< Error reading file */
+	Bad_DataSize, /*!< No sample, or imported data cannot fit in memory */
+	Bad_FileRead, /*!< Error reading file */
+	Bad_BlockAlign /*!< IMA ADPCM block size invalid or too large */
 } ErrorCode;
 
 /* Correspond to the letters 'RIFF' */
@@ -112,6 +236,8 @@ typedef enum
 #define FACT_ID 0x66616374
 /* PCM of 1 indicates no compression of the data */
 #define WAVE_FORMAT_PCM 0x01
+/* IMA ADPCM, 4 bits per sample */
+#define WAVE_FORMAT_IMA_ADPCM 0x11
 /* The format chunk size is 16 for PCM of 1 */
 #define FORMAT_CHNUK_SIZE 0x10
 /* Mono and Stereo */
@@ -119,12 +245,17 @@ typedef enum
 #define CHANNEL_STEREO 0x02
 #define BITS_PER_SAMPLE_8 8
 #define BITS_PER_SAMPLE_16 16
+#define BITS_PER_SAMPLE_4 4
 
 /* @} */
 
 
 /*!
  * @brief Initializes wave player and allocates memory for audio buffer
+ *
+ * The DAC, TIM6 and the DMA are set up once, at MIX_RATE, and play the
+ * output ring from then on. Playing a file only hands it to a voice of the
+ * mixer.
  */
 void WAV_Init(void);
 
@@ -132,8 +263,10 @@ void WAV_Init(void);
  * @brief Import a .WAV file from a FatFs file system
  *
  * This function reads a .WAV file header into WAVE_Format struct
- * to which W points. With no errors and a size of less than 25 kB,
- * the full audio data is read into memory
+ * to which W points. With no errors and a size of at most AUD_BUF_BYTES,
+ * the full audio data is read into memory, after the files imported before.
+ * Once the audio buffer is full, the next file is read to its start again,
+ * and every file imported until then stops and must be imported again.
  *
  * @param FileName Full path to the specified .WAV file
  * @param W Pointer to corresponding WAVE_Format struct
@@ -142,12 +275,44 @@ void WAV_Init(void);
  */
 uint8_t WAV_Import(const char* FileName, WAV_Format* W);
 
+/*!
+ * @brief Open a .WAV file from a FatFs file system to be streamed
+ *
+ * This function reads a .WAV file header into the WAVE_Format struct to
+ * which W points, and the start of its data into the ring, so WAV_Play()
+ * starts right away. The file stays open and is read while it plays, so its
+ * data may be of any size, at a rate up to WAV_STREAM_RATE_MAX, or twice
+ * that for 8 bit samples. Only one file is streamed at a time, opening
+ * another one closes the previous one.
+ *
+ * @note While a streamed file plays, its ring is refilled from an interrupt.
+ * Like while frames are updating, the user should not be accessing the FatFs
+ * file system then.
+ *
+ * @param FileName Full path to the specified .WAV file
+ * @param W Pointer to corresponding WAVE_Format struct
+ *
+ * @return Error code specified by the ErrorCode enum
+ */
+uint8_t WAV_Stream(const char* FileName, WAV_Format* W);
+
 /*!
  * @brief Play a .WAV file that has been successfully imported
  *
- * This function plays a .WAV file imported with WAV_Import(). If numPlays is
- * 0, nothing will happen. If numPlays is negative, the .WAV file will repeat
- * until WAV_Pause() or WAV_Destroy() are called.
+ * This function plays a .WAV file imported with WAV_Import() or opened with
+ * WAV_Stream() on a voice of the mixer, over the files already playing. If
+ * numPlays is 0, nothing will happen. If numPlays is negative, the .WAV file
+ * will repeat until WAV_Stop() or WAV_Destroy() are called.
+ *
+ * A file already playing starts again, over the samples of the previous play
+ * already mixed. With every voice busy, the one closest to its end is taken,
+ * never one that repeats, streams or decodes ADPCM; if every voice does, the
+ * file is not played. It only queues a command and pends the DMA interrupt,
+ * which mixes the file into the output ring from WAV_PLAY_LEAD samples past
+ * the one the DAC plays, so it can be called as often as needed.
+ *
+ * A streamed file played again starts once half the ring has played, while
+ * its start is read in the background.
  *
  * @param W Pointer to a WAVE_Format previously imported
  * @param numPlays Number of times to repeat the .WAV file
@@ -156,17 +321,36 @@ uint8_t WAV_Import(const char* FileName, WAV_Format* W);
 void WAV_Play(WAV_Format* W, int numPlays);
 
 /*!
- * @brief Pauses the currently playing .WAV file and turns off the audio amp
+ * @brief Stops playing a .WAV file
+ *
+ * @param W Pointer to the WAVE_Format to stop, NULL to stop every file
+ */
+void WAV_Stop(WAV_Format* W);
+
+/*!
+ * @brief Sets the volume a .WAV file plays at
+ *
+ * Takes effect right away if the file is playing, and for its next plays.
+ *
+ * @param W Pointer to a WAVE_Format previously imported
+ * @param volume Volume, from 0 to MIX_VOLUME_MAX for the file as it is
+ */
+void WAV_SetVolume(WAV_Format* W, uint16_t volume);
+
+/*!
+ * @brief Pauses every playing .WAV file and turns off the audio amp
  */
 void WAV_Pause(void);
 
 /*!
- * @brief Resumes playing the imported .WAV file and turns on the audio amp
+ * @brief Resumes playing the paused .WAV files and turns on the audio amp
  */
 void WAV_Resume(void);
 
 /*!
- * @brief Stops playing the .WAV file and deinitializes the .WAV peripherals
+ * @brief Stops playing the .WAV files and deinitializes the .WAV peripherals
+ *
+ * A streamed file is closed as well.
  */
 void WAV_Destroy(void);
 
@@ -51,10 +51,55 @@
 /* Includes ------------------------------------------------------------------*/
 #include  "stm324xg_eval_sd.h"
 /* Exported types ------------------------------------------------------------*/
+/**
+  * @brief  Called from the SD interrupt when a transfer started with
+  *         SD_ReadAsync() is done
+  * @param  result: RES_OK, or RES_ERROR if the transfer failed
+  * @param  context: Pointer given to SD_ReadAsync()
+  */
+typedef void (*SD_Callback)(DRESULT result, void *context);
+
+/**
+  * @brief  Counters of the sector cache, see SD_GetCacheStats()
+  */
+typedef struct
+{
+  uint32_t Hits;              /* Sectors read from the cache */
+  uint32_t Misses;            /* Sectors read from the card */
+  uint32_t ReadAheads;        /* Reads ahead started */
+  uint32_t ReadAheadSectors;  /* Sectors read ahead */
+} SD_CacheStats;
+
 /* Exported constants --------------------------------------------------------*/
+/* Sectors of the cache, 512 bytes of CCM RAM each */
+#ifndef SD_CACHE_SECTORS
+#define SD_CACHE_SECTORS 16
+#endif
+
+#if SD_CACHE_SECTORS < 1
+#error "SD_CACHE_SECTORS must be at least 1, use SD_SetCache() to turn it off"
+#endif
+
+/* Most sectors read ahead at once, 512 bytes of RAM each */
+#ifndef SD_READ_AHEAD_SECTORS
+#define SD_READ_AHEAD_SECTORS 4
+#endif
+
+#if SD_READ_AHEAD_SECTORS < 1
+#error "SD_READ_AHEAD_SECTORS must be at least 1, use SD_SetCache() to turn it off"
+#endif
+
 /* Exported functions ------------------------------------------------------- */
 extern const Diskio_drvTypeDef  SD_Driver;
 
+DRESULT SD_ReadAsync(BYTE *buff, DWORD sector, UINT count,
+                     SD_Callback done, void *context);
+uint8_t SD_IsBusy(void);
+DRESULT SD_Wait(void);
+void SD_SetCache(UINT sectors, UINT readAhead);
+void SD_GetCacheStats(SD_CacheStats *stats);
+void SD_ResetCacheStats(void);
+
 #endif /* __SD_DISKIO_H */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -108,6 +108,10 @@
 #define BSP_SD_DMA_Rx_IRQHandler          DMA2_Stream3_IRQHandler
 #define SD_DetectIRQHandler()             HAL_GPIO_EXTI_IRQHandler(SD_DETECT_PIN)
 
+/* SDIO and DMA interrupts end the transfers sd_diskio.c waits on, including
+   from the PendSV renderer of video.c, so they must preempt PendSV (0x0F) */
+#define SD_IRQ_PRIORITY                   0x0E
+
 /**
   * @}
   */
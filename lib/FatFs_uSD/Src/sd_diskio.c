@@ -44,11 +44,27 @@
   */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "ff_gen_drv.h"
 #include "sd_diskio.h"
 
+/*
+ * Sectors move by DMA while the caller waits for the SD interrupt that ends
+ * the transfer, so the interrupts of higher priority keep running.
+ *
+ * Sectors read a few at a time go through a cache in the CCM RAM, least
+ * recently used sectors out first, so the rows a sprite reads frame after
+ * frame, and the FAT and directory sectors, are read from the card once. A
+ * read that goes on from where an earlier one ended, as a file read from
+ * start to end does, also starts reading the next sectors ahead in a single
+ * multi-block read, which lands while the caller works on the data it got.
+ * The video renderer composites a strip while the next sectors of its sprites
+ * are fetched that way.
+ *
+ * SD_ReadAsync() starts a read and returns, calling back from the SD
+ * interrupt when it is done. The driver moves one transfer at a time.
+ */
 
-/* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* use the default SD timout as defined in the platform BSP driver*/
 #if defined(SDMMC_DATATIMEOUT)
@@ -61,6 +77,31 @@
 
 #define SD_DEFAULT_BLOCK_SIZE 512
 
+/*
+ * DMA2 moves words and cannot reach the CCM RAM, other buffers are bounced
+ * through a buffer it can reach one sector at a time
+ */
+#define SD_CCMRAM_START 0x10000000UL
+#define SD_CCMRAM_END   0x10010000UL
+#define SD_DMA_REACHABLE(p) \
+  (((uintptr_t)(p) & 0x3) == 0 \
+   && ((uintptr_t)(p) < SD_CCMRAM_START || (uintptr_t)(p) >= SD_CCMRAM_END))
+
+/* Sector of an empty cache line */
+#define SD_NO_SECTOR 0xFFFFFFFFUL
+
+/* Streams of sequential reads followed at once */
+#ifndef SD_STREAMS
+#define SD_STREAMS 4
+#endif
+
+/*
+ * Reads in a row a stream makes before it is read ahead. Reading ahead a
+ * sector nobody asks for holds up the next read until it lands, so a read
+ * crossing into the next sector alone does not count as a stream.
+ */
+#define SD_READ_AHEAD_RUN 3
+
 /*
  * Depending on the usecase, the SD card initialization could be done at the
  * application level, if it is the case define the flag below to disable
@@ -69,12 +110,72 @@
 
 /* #define DISABLE_SD_INIT */
 
+/* Private typedef -----------------------------------------------------------*/
+/* Line of the sector cache, its data is in CacheData */
+typedef struct
+{
+  DWORD Sector;   /* Sector held, or SD_NO_SECTOR */
+  uint32_t Used;  /* Value of CacheClock when last used, the least goes first */
+} SD_CacheLine;
+
+/* Stream of sequential reads */
+typedef struct
+{
+  DWORD Next;     /* Sector after the last one the stream read */
+  uint8_t Run;    /* Reads in a row, up to SD_READ_AHEAD_RUN */
+} SD_Stream;
+
 /* Private variables ---------------------------------------------------------*/
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+/* Number of sectors of the card, nothing is read ahead past them */
+static DWORD CardSectors;
+
+/* Transfer in flight */
+static volatile uint8_t Busy;
+static volatile DRESULT Result;   /* Result of the last transfer */
+static BYTE *volatile BounceTo;   /* Buffer of a bounced read, NULL if none */
+static volatile SD_Callback Callback;
+static void *volatile CallbackContext;
+
+/* Sector moved for buffers the DMA cannot reach */
+static uint32_t Bounce[SD_DEFAULT_BLOCK_SIZE / 4];
+
+/* Sector cache, not cleared at startup, and the lines and sectors in use */
+static uint32_t CacheData[SD_CACHE_SECTORS][SD_DEFAULT_BLOCK_SIZE / 4]
+  __attribute__((section(".ccmbss"), aligned(4)));
+static SD_CacheLine Cache[SD_CACHE_SECTORS];
+static UINT CacheSectors = SD_CACHE_SECTORS;
+static UINT ReadAheadSectors = SD_READ_AHEAD_SECTORS;
+static uint32_t CacheClock;
+static SD_CacheStats CacheStats;
+
+/*
+ * Sectors read ahead land here by DMA, and go to the cache on the next read.
+ * StagedCount is dropped to 0 if the read fails.
+ */
+static uint32_t Staging[SD_READ_AHEAD_SECTORS][SD_DEFAULT_BLOCK_SIZE / 4];
+static DWORD StagedSector;
+static volatile UINT StagedCount;
+static volatile uint8_t ReadingAhead;
+
+/* Streams followed, and the next one to give a new stream */
+static SD_Stream Streams[SD_STREAMS];
+static uint8_t NextStream;
+
 /* Private function prototypes -----------------------------------------------*/
 static DSTATUS SD_CheckStatus(BYTE lun);
+static DRESULT SD_WaitCard(void);
+static DRESULT SD_Start(uint8_t write, BYTE *buff, DWORD sector, UINT count,
+                        SD_Callback done, void *context);
+static DRESULT SD_Transfer(uint8_t write, BYTE *buff, DWORD sector, UINT count);
+static void SD_Complete(DRESULT result);
+static SD_CacheLine *SD_CacheFind(DWORD sector);
+static void SD_CachePut(DWORD sector, const BYTE *data);
+static void SD_CacheStaged(void);
+static void SD_ReadAhead(DWORD sector);
+static void SD_ResetCache(void);
 DSTATUS SD_initialize (BYTE);
 DSTATUS SD_status (BYTE);
 DRESULT SD_read (BYTE, BYTE*, DWORD, UINT);
@@ -104,7 +205,8 @@ static DSTATUS SD_CheckStatus(BYTE lun)
 {
   Stat = STA_NOINIT;
 
-  if(BSP_SD_GetCardState() == MSD_OK)
+  /* The card cannot take commands during a transfer */
+  if(SD_Wait() == RES_OK && BSP_SD_GetCardState() == MSD_OK)
   {
     Stat &= ~STA_NOINIT;
   }
@@ -112,6 +214,285 @@ static DSTATUS SD_CheckStatus(BYTE lun)
   return Stat;
 }
 
+/**
+  * @brief  Waits for the card to be ready for the next transfer
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_WaitCard(void)
+{
+  uint32_t timer = HAL_GetTick();
+
+  while(BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if(HAL_GetTick() - timer >= SD_TIMEOUT)
+    {
+      return RES_ERROR;
+    }
+  }
+
+  return RES_OK;
+}
+
+/**
+  * @brief  Starts the DMA transfer of sector(s)
+  * @param  write: 1 to write the sectors, 0 to read them
+  * @param  *buff: Data buffer, only a single sector when out of DMA reach
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors
+  * @param  done: Called when the transfer is done, may be NULL
+  * @param  *context: Passed to done
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_Start(uint8_t write, BYTE *buff, DWORD sector, UINT count,
+                        SD_Callback done, void *context)
+{
+  BYTE *dma = buff;
+  uint8_t status;
+
+  if(Busy)
+  {
+    return RES_NOTRDY;
+  }
+
+  if(!SD_DMA_REACHABLE(buff))
+  {
+    if(count != 1)
+    {
+      return RES_PARERR;
+    }
+    dma = (BYTE*)Bounce;
+    if(write)
+    {
+      memcpy(Bounce, buff, SD_DEFAULT_BLOCK_SIZE);
+    }
+  }
+
+  /* A write may still be programming */
+  if(SD_WaitCard() != RES_OK)
+  {
+    return RES_ERROR;
+  }
+
+  BounceTo = (!write && dma != buff) ? buff : NULL;
+  Callback = done;
+  CallbackContext = context;
+  Result = RES_OK;
+  Busy = 1;
+
+  if(write)
+  {
+    status = BSP_SD_WriteBlocks_DMA((uint32_t*)dma, (uint32_t)sector, count);
+  }
+  else
+  {
+    status = BSP_SD_ReadBlocks_DMA((uint32_t*)dma, (uint32_t)sector, count);
+  }
+
+  if(status != MSD_OK)
+  {
+    Busy = 0;
+    return RES_ERROR;
+  }
+
+  return RES_OK;
+}
+
+/**
+  * @brief  Transfers sector(s) and waits until they are done
+  * @param  write: 1 to write the sectors, 0 to read them
+  * @param  *buff: Data buffer
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_Transfer(uint8_t write, BYTE *buff, DWORD sector, UINT count)
+{
+  DRESULT res = RES_OK;
+
+  /* All at once, or a sector at a time through the bounce buffer */
+  if(SD_DMA_REACHABLE(buff))
+  {
+    res = SD_Start(write, buff, sector, count, NULL, NULL);
+    if(res == RES_OK)
+    {
+      res = SD_Wait();
+    }
+    return res;
+  }
+
+  while(count-- && res == RES_OK)
+  {
+    res = SD_Start(write, buff, sector++, 1, NULL, NULL);
+    if(res == RES_OK)
+    {
+      res = SD_Wait();
+    }
+    buff += SD_DEFAULT_BLOCK_SIZE;
+  }
+
+  return res;
+}
+
+/**
+  * @brief  Ends the transfer in flight
+  * @param  result: Result of the transfer
+  * @note   Called from the SD interrupts. A transfer that failed may be
+  *         reported done after its error, or after timing out, only the
+  *         first report counts
+  */
+static void SD_Complete(DRESULT result)
+{
+  SD_Callback done = Callback;
+
+  if(!Busy)
+  {
+    return;
+  }
+
+  if(BounceTo != NULL)
+  {
+    memcpy(BounceTo, Bounce, SD_DEFAULT_BLOCK_SIZE);
+    BounceTo = NULL;
+  }
+
+  /* Sectors read ahead are only kept once they landed */
+  if(result != RES_OK && ReadingAhead)
+  {
+    StagedCount = 0;
+  }
+  ReadingAhead = 0;
+
+  /* The callback may start the next transfer */
+  Callback = NULL;
+  Result = result;
+  Busy = 0;
+
+  if(done != NULL)
+  {
+    done(result, CallbackContext);
+  }
+}
+
+/**
+  * @brief  Finds a sector in the cache
+  * @param  sector: Sector address (LBA)
+  * @retval Line holding the sector, NULL if it is not cached
+  */
+static SD_CacheLine *SD_CacheFind(DWORD sector)
+{
+  UINT i;
+
+  for(i = 0; i < CacheSectors; i++)
+  {
+    if(Cache[i].Sector == sector)
+    {
+      return &Cache[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  * @brief  Puts a sector in the cache, in place of the least recently used
+  * @param  sector: Sector address (LBA), not cached yet
+  * @param  *data: Data of the sector
+  */
+static void SD_CachePut(DWORD sector, const BYTE *data)
+{
+  SD_CacheLine *line;
+  UINT i;
+
+  if(CacheSectors == 0)
+  {
+    return;
+  }
+
+  line = &Cache[0];
+  for(i = 1; i < CacheSectors && line->Sector != SD_NO_SECTOR; i++)
+  {
+    if(Cache[i].Sector == SD_NO_SECTOR || Cache[i].Used < line->Used)
+    {
+      line = &Cache[i];
+    }
+  }
+
+  memcpy(CacheData[line - Cache], data, SD_DEFAULT_BLOCK_SIZE);
+  line->Sector = sector;
+  line->Used = ++CacheClock;
+}
+
+/**
+  * @brief  Moves the sectors read ahead to the cache once they landed
+  * @note   Call with no transfer in flight
+  */
+static void SD_CacheStaged(void)
+{
+  UINT i;
+
+  for(i = 0; i < StagedCount; i++)
+  {
+    if(SD_CacheFind(StagedSector + i) == NULL)
+    {
+      SD_CachePut(StagedSector + i, (const BYTE*)Staging[i]);
+    }
+  }
+  StagedCount = 0;
+}
+
+/**
+  * @brief  Starts reading ahead the sectors of a stream that are not cached
+  * @param  sector: First sector to read ahead (LBA)
+  * @note   Call with no transfer in flight
+  */
+static void SD_ReadAhead(DWORD sector)
+{
+  UINT count = 0;
+
+  /* One multi-block read, up to the first sector already cached */
+  while(count < ReadAheadSectors && sector + count < CardSectors
+        && SD_CacheFind(sector + count) == NULL)
+  {
+    count++;
+  }
+
+  if(count == 0
+     || SD_Start(0, (BYTE*)Staging, sector, count, NULL, NULL) != RES_OK)
+  {
+    return;
+  }
+
+  StagedSector = sector;
+  StagedCount = count;
+  ReadingAhead = 1;
+  CacheStats.ReadAheads++;
+  CacheStats.ReadAheadSectors += count;
+}
+
+/**
+  * @brief  Empties the cache and forgets the streams
+  */
+static void SD_ResetCache(void)
+{
+  UINT i;
+
+  for(i = 0; i < SD_CACHE_SECTORS; i++)
+  {
+    Cache[i].Sector = SD_NO_SECTOR;
+    Cache[i].Used = 0;
+  }
+  CacheClock = 0;
+  StagedCount = 0;
+  ReadingAhead = 0;
+
+  for(i = 0; i < SD_STREAMS; i++)
+  {
+    Streams[i].Next = SD_NO_SECTOR;
+    Streams[i].Run = 0;
+  }
+  NextStream = 0;
+}
+
 /**
   * @brief  Initializes a Drive
   * @param  lun : not used
@@ -119,7 +500,11 @@ static DSTATUS SD_CheckStatus(BYTE lun)
   */
 DSTATUS SD_initialize(BYTE lun)
 {
+  BSP_SD_CardInfo CardInfo;
+
   Stat = STA_NOINIT;
+  Busy = 0;
+  SD_ResetCache();
 #if !defined(DISABLE_SD_INIT)
 
   if(BSP_SD_Init() == MSD_OK)
@@ -130,6 +515,12 @@ DSTATUS SD_initialize(BYTE lun)
 #else
   Stat = SD_CheckStatus(lun);
 #endif
+
+  if(!(Stat & STA_NOINIT))
+  {
+    BSP_SD_GetCardInfo(&CardInfo);
+    CardSectors = CardInfo.LogBlockNbr;
+  }
   return Stat;
 }
 
@@ -153,17 +544,77 @@ DSTATUS SD_status(BYTE lun)
   */
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  DRESULT res = RES_OK;
+  DWORD end = sector + count;
+  SD_Stream *stream = NULL;
+  SD_CacheLine *line;
+  UINT run;
+  uint8_t i;
+
+  /* The transfer in flight may be sectors read ahead */
+  SD_Wait();
+  SD_CacheStaged();
+
+  /* Find the stream this read goes on with */
+  for(i = 0; i < SD_STREAMS; i++)
+  {
+    if(Streams[i].Next == sector)
+    {
+      stream = &Streams[i];
+      break;
+    }
+  }
 
-  if(BSP_SD_ReadBlocks((uint32_t*)buff,
-                       (uint32_t) (sector),
-                       count, SD_TIMEOUT) == MSD_OK)
+  /* Cached sectors are copied, each run of the others read at once */
+  while(sector < end && res == RES_OK)
   {
-    /* wait until the read operation is finished */
-    while(BSP_SD_GetCardState()!= MSD_OK)
+    line = SD_CacheFind(sector);
+    if(line != NULL)
     {
+      memcpy(buff, CacheData[line - Cache], SD_DEFAULT_BLOCK_SIZE);
+      line->Used = ++CacheClock;
+      CacheStats.Hits++;
+      buff += SD_DEFAULT_BLOCK_SIZE;
+      sector++;
+      continue;
     }
-    res = RES_OK;
+
+    for(run = 1; sector + run < end && SD_CacheFind(sector + run) == NULL;
+        run++);
+    CacheStats.Misses += run;
+    res = SD_Transfer(0, buff, sector, run);
+
+    /* Long reads go around the cache rather than flush it */
+    for(; run > 0; run--)
+    {
+      if(res == RES_OK && count <= CacheSectors / 2)
+      {
+        SD_CachePut(sector, buff);
+      }
+      buff += SD_DEFAULT_BLOCK_SIZE;
+      sector++;
+    }
+  }
+
+  /* A new stream takes the place of the oldest one */
+  if(stream == NULL)
+  {
+    stream = &Streams[NextStream];
+    NextStream = (NextStream + 1) % SD_STREAMS;
+    stream->Next = end;
+    stream->Run = 1;
+    return res;
+  }
+
+  /* Fetch the next sectors of the stream while the caller works on these */
+  stream->Next = end;
+  if(stream->Run < SD_READ_AHEAD_RUN)
+  {
+    stream->Run++;
+  }
+  if(res == RES_OK && stream->Run >= SD_READ_AHEAD_RUN)
+  {
+    SD_ReadAhead(end);
   }
 
   return res;
@@ -180,20 +631,20 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 #if _USE_WRITE == 1
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  UINT i;
 
-  if(BSP_SD_WriteBlocks((uint32_t*)buff,
-                        (uint32_t)(sector),
-                        count, SD_TIMEOUT) == MSD_OK)
+  /* Cached sectors are dropped once written over */
+  SD_Wait();
+  SD_CacheStaged();
+  for(i = 0; i < CacheSectors; i++)
   {
-	/* wait until the Write operation is finished */
-    while(BSP_SD_GetCardState() != MSD_OK)
+    if(Cache[i].Sector - sector < count)
     {
+      Cache[i].Sector = SD_NO_SECTOR;
     }
-    res = RES_OK;
   }
 
-  return res;
+  return SD_Transfer(1, (BYTE*)buff, sector, count);
 }
 #endif /* _USE_WRITE == 1 */
 
@@ -216,7 +667,8 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
   {
   /* Make sure that no pending write process */
   case CTRL_SYNC :
-    res = RES_OK;
+    res = SD_Wait();
+    if (res == RES_OK) res = SD_WaitCard();
     break;
 
   /* Get number of sectors on the disk (DWORD) */
@@ -248,5 +700,128 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 }
 #endif /* _USE_IOCTL == 1 */
 
-/************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
+/**
+  * @brief  Starts reading sector(s) without waiting for them
+  * @param  *buff: Data buffer to store read data, a single sector when it is
+  *         not word aligned or in the CCM RAM
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read (1..128)
+  * @param  done: Called from the SD interrupt once the sectors are in buff,
+  *         may be NULL to poll SD_IsBusy() or wait with SD_Wait() instead
+  * @param  *context: Passed to done
+  * @retval DRESULT: RES_OK once started, RES_NOTRDY while a transfer or a
+  *         read ahead is in flight
+  */
+DRESULT SD_ReadAsync(BYTE *buff, DWORD sector, UINT count,
+                     SD_Callback done, void *context)
+{
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+
+  return SD_Start(0, buff, sector, count, done, context);
+}
+
+/**
+  * @brief  Checks for a transfer in flight
+  * @retval 1 until the transfer in flight is done, 0 when idle
+  */
+uint8_t SD_IsBusy(void)
+{
+  return Busy;
+}
+
+/**
+  * @brief  Waits for the transfer in flight to be done
+  * @note   Must not be called with the SD interrupts masked, or from an
+  *         interrupt of the same or higher priority
+  * @retval DRESULT: RES_OK once idle, RES_ERROR if the last transfer failed
+  *         or timed out
+  */
+DRESULT SD_Wait(void)
+{
+  uint32_t timer = HAL_GetTick();
+
+  while(Busy)
+  {
+    if(HAL_GetTick() - timer >= SD_TIMEOUT)
+    {
+      if(ReadingAhead)
+      {
+        StagedCount = 0;
+        ReadingAhead = 0;
+      }
+      Callback = NULL;
+      BounceTo = NULL;
+      Busy = 0;
+      return RES_ERROR;
+    }
+  }
+
+  return Result;
+}
+
+/**
+  * @brief  Sizes the cache and the reads ahead, and empties the cache
+  * @param  sectors: Sectors of the cache used, up to SD_CACHE_SECTORS, 0 to
+  *         read every sector from the card
+  * @param  readAhead: Most sectors read ahead at once, up to
+  *         SD_READ_AHEAD_SECTORS and to sectors, 0 to not read ahead
+  * @note   Both start at their most. Not to be called while a file may be
+  *         read from an interrupt.
+  */
+void SD_SetCache(UINT sectors, UINT readAhead)
+{
+  SD_Wait();
 
+  CacheSectors = sectors < SD_CACHE_SECTORS ? sectors : SD_CACHE_SECTORS;
+  ReadAheadSectors = readAhead < SD_READ_AHEAD_SECTORS
+                     ? readAhead : SD_READ_AHEAD_SECTORS;
+  if(ReadAheadSectors > CacheSectors)
+  {
+    ReadAheadSectors = CacheSectors;
+  }
+
+  SD_ResetCache();
+}
+
+/**
+  * @brief  Gets the counters of the cache
+  * @param  *stats: Counters since startup or SD_ResetCacheStats()
+  */
+void SD_GetCacheStats(SD_CacheStats *stats)
+{
+  *stats = CacheStats;
+}
+
+/**
+  * @brief  Sets the counters of the cache back to 0
+  */
+void SD_ResetCacheStats(void)
+{
+  memset(&CacheStats, 0, sizeof(CacheStats));
+}
+
+/**
+  * @brief  Rx Transfer completed callback of the BSP
+  */
+void BSP_SD_ReadCpltCallback(void)
+{
+  SD_Complete(RES_OK);
+}
+
+/**
+  * @brief  Tx Transfer completed callback of the BSP
+  */
+void BSP_SD_WriteCpltCallback(void)
+{
+  SD_Complete(RES_OK);
+}
+
+/**
+  * @brief  Abort callback of the BSP, the transfer failed
+  */
+void BSP_SD_AbortCallback(void)
+{
+  SD_Complete(RES_ERROR);
+}
+
+/************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -120,14 +120,7 @@ void DebugMon_Handler(void)
 {
 }
 
-/**
-  * @brief  This function handles PendSVC exception.
-  * @param  None
-  * @retval None
-  */
-void PendSV_Handler(void)
-{
-}
+/* PendSV_Handler is defined in video.c, where it renders the video ring */
 
 /**
   * @brief  This function handles SysTick Handler.
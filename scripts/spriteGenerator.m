@@ -5,6 +5,9 @@ clear figures
 %% Input parameters
 inputPng = input('Input .png file to convert: ', 's');
 numFrames = input('Input the number of frames in the sprite sheet: ');
+version = input('Input the format version, 1 for raw or 2 for run-length encoded: ');
+bpp = input('Input the bits per pixel, 2, 4 or 8: ');
+bank = input('Input the palette bank, 0 for the own palette: ');
 outputFile = strrep(inputPng, '.png', '.spr');
 
 %% Parse png data
@@ -20,9 +23,44 @@ width = size(A, 2);
 sheetHeight = size(A, 1);
 frameHeight = sheetHeight/numFrames;
 
+if (~any(bpp == [2 4 8]))
+    error('Error: %d bits per pixel is not supported. Use 2, 4 or 8.', bpp)
+end
+if (mod(width*bpp, 8) ~= 0)
+    error('Error: Rows of %d pixels do not fill whole bytes at %d bits per pixel.', width, bpp)
+end
+
 %% Build the color palette
-palette = zeros(15, 3);
+% Index 0 is transparent, so a depth holds one color less than its indexes
+maxColors = 2^bpp - 1;
+palette = zeros(255, 3);
 pColors = 0;
+
+% A bank takes the palette of a sprite made before, so the indexes match the
+% colors set with spritePaletteBankSet()
+if (bank > 0)
+    bankFile = input('Input a .spr file with its own palette to take the bank colors from: ', 's');
+    fin = fopen(bankFile, 'r');
+    fseek(fin, 5, 'bof');
+    bankColors = double(bitsrl(fread(fin, 1, 'uint8=>uint8'), 4));
+    bankDepth = fread(fin, 1, 'uint8');
+    fseek(fin, 8, 'bof');
+    if (bankDepth == 8)
+        bankColors = fread(fin, 1, 'uint8');
+    end
+    fseek(fin, 14, 'bof');
+    bankPalette = fread(fin, min(bankColors, 15), 'uint16=>uint16');
+    if (bankColors > 15)
+        fseek(fin, 44, 'bof');
+        bankPalette = [bankPalette; fread(fin, bankColors - 15, 'uint16=>uint16')];
+    end
+    fclose(fin);
+    
+    pColors = bankColors;
+    palette(1:pColors, 1) = bitsrl(bankPalette, 11);
+    palette(1:pColors, 2) = bitand(bitsrl(bankPalette, 5), 63);
+    palette(1:pColors, 3) = bitand(bankPalette, 31);
+end
 for y = 1:sheetHeight
     for x = 1:width
     
@@ -47,6 +85,9 @@ for y = 1:sheetHeight
                 
                 % If the color is not on the palette add it
                 if (pnum == pColors)
+                    if (pColors == 255)
+                        error('Error: More than 255 colors in the image.')
+                    end
                     palette(pColors+1, 1) = R(y,x);
                     palette(pColors+1, 2) = G(y,x);
                     palette(pColors+1, 3) = B(y,x);
@@ -63,12 +104,15 @@ end
 finalPalette = bitsll(palette(:, 1), 11) ...
     + bitsll(palette(:, 2), 5) + palette(:, 3);
 
-if (size(finalPalette, 1) > 15)
-    error('Error: Too many colors in the palette (%d). Reduce the number of colors to 15 or less and try again.', size(finalPalette, 1))
+if (pColors > maxColors)
+    if (bank > 0)
+        error('Error: The image uses %d colors that are not in the bank palette.', pColors - bankColors)
+    end
+    error('Error: Too many colors in the palette (%d). Reduce the number of colors to %d or less, or use more bits per pixel, and try again.', pColors, maxColors)
 end
 
 % Convert the picture into seperate frame arrays
-converted = zeros(ceil(width*frameHeight/2)*2, numFrames);
+converted = zeros(width*frameHeight, numFrames);
 for f = 1:numFrames
     for y = 1:frameHeight
         for x = 1:width
@@ -94,6 +138,36 @@ for f = 1:numFrames
     end
 end
 
+%% Run-length encode the rows for the v2 format
+% Gaps shorter than minSkip pixels are kept in the runs of pixels, where they
+% take less space than starting new runs
+if (version == 2)
+    minSkip = ceil(16/bpp);
+    rowStarts = zeros(frameHeight+1, numFrames);
+    runs = [];
+    for f = 1:numFrames
+        frameRuns = [];
+        for y = 1:frameHeight
+            rowStarts(y, f) = length(frameRuns);
+            frameRuns = [frameRuns, ...
+                encodeRow(converted((y-1)*width + (1:width), f)', minSkip, bpp)];
+        end
+        rowStarts(frameHeight+1, f) = length(frameRuns);
+        
+        if (length(frameRuns) > 65535)
+            error('Error: Frame %d takes %d bytes, more than the 65535 of a v2 frame. Use version 1.', f, length(frameRuns))
+        end
+        runs = [runs, frameRuns];
+    end
+    
+    % Must match SPRITE_MAX_RUN_BYTES in sprite.h
+    if (max(max(diff(rowStarts))) > 360)
+        error('Error: A row takes more than 360 bytes in v2. Use version 1.')
+    end
+    fprintf('Pixel data takes %d bytes, %d in version 1\n', ...
+        numel(rowStarts)*2 + length(runs), width*frameHeight*bpp/8*numFrames);
+end
+
 %% Writing outputs
 % Open output file
 fout = fopen(outputFile, 'w');
@@ -108,29 +182,42 @@ fwrite(fout, frameHeight, 'uint16');
 % uint8: frames, palette
 fwrite(fout, numFrames, 'uint8');
 
-% ubit4: reserved
-fwrite(fout, 0, 'ubit4');
+% ubit4: version
+fwrite(fout, version, 'ubit4');
 
-% ubit4: numColors
-fwrite(fout, pColors, 'ubit4');
+% ubit4: numColors, the first 15 of an 8bpp palette
+fwrite(fout, min(pColors, 15), 'ubit4');
 
-% uint16: Reserved
-fwrite(fout, 0, 'uint16');
-fwrite(fout, 0, 'uint16');
-fwrite(fout, 0, 'uint16');
-fwrite(fout, 0, 'uint16');
+% uint8: depth, bank, numColors of an 8bpp palette
+fwrite(fout, bpp, 'uint8');
+fwrite(fout, bank, 'uint8');
+fwrite(fout, pColors*(bpp == 8), 'uint8');
 
-% uint16[16]: Palette colors
-fwrite(fout, finalPalette, 'uint16');
+% uint8: Reserved
+fwrite(fout, zeros(5, 1), 'uint8');
 
-% ubit4[?]: bitmap
-fwrite(fout, converted, 'ubit4');
+% uint16[15]: Palette colors
+fwrite(fout, finalPalette(1:15), 'uint16');
+
+% uint16[?]: Colors past the 15th of an 8bpp palette
+if (bpp == 8 && pColors > 15)
+    fwrite(fout, finalPalette(16:pColors), 'uint16');
+end
+
+% ubit[bpp][?]: bitmap, or the row table and the runs in version 2
+if (version == 2)
+    fwrite(fout, rowStarts, 'uint16');
+    fwrite(fout, runs, 'uint8');
+else
+    fwrite(fout, converted, sprintf('ubit%d', bpp));
+end
 
 % Close output file
 fclose(fout);
 
 %% DEBUGGING ONLY
-% Output c file
+% Output c file, only laid out for 4bpp
+if (bpp == 4)
 
 % Open file
 coutName = strrep(inputPng, '.png', '.c');
@@ -140,7 +227,7 @@ cout = fopen(coutName, 'w');
 fprintf(cout, 'const uint16_t fakeSpriteFile[] = {\n');
 fprintf(cout, '\t0x%04X,\t// Width = %d\n', width, width);
 fprintf(cout, '\t0x%04X,\t// Height = %d\n', frameHeight, frameHeight);
-fprintf(cout, '\t0x%02X%01X%01X,\t// numFrames = %d, 4 reserved bits, Colors = %d\n', numFrames, 0, pColors, numFrames, pColors);
+fprintf(cout, '\t0x%02X%01X%01X,\t// numFrames = %d, Version = 1, Colors = %d\n', numFrames, 1, pColors, numFrames, pColors);
 fprintf(cout, '\t0x%04X,\t// Reserved\n', 0);
 fprintf(cout, '\t0x%04X,\t// Reserved\n', 0);
 fprintf(cout, '\t0x%04X,\t// Reserved\n', 0);
@@ -165,3 +252,52 @@ fprintf(cout, '};\n');
 
 % Close file
 fclose(cout);
+
+end
+
+%% Functions
+function out = encodeRow(row, minSkip, bpp)
+% Run-length encode one row of palette indexes. Each run starts with a control
+% byte holding its number of pixels minus one in the low 7 bits. Bit 7 is set
+% if the pixels follow, packed bpp bits each from the low bits of a byte, and
+% clear if they are transparent. Transparent pixels at the end of the row are
+% dropped.
+perByte = 8/bpp;
+out = [];
+last = find(row, 1, 'last');
+x = 1;
+while (x <= last)
+    if (row(x) == 0)
+        % Skip the gap, at most 128 pixels per run
+        n = find(row(x:last), 1) - 1;
+        while (n > 0)
+            len = min(n, 128);
+            out = [out, len - 1];
+            n = n - len;
+            x = x + len;
+        end
+    else
+        % Take the pixels up to the next gap of at least minSkip pixels
+        e = x;
+        while (e <= last)
+            if (row(e) ~= 0)
+                e = e + 1;
+                continue;
+            end
+            gap = find(row(e:last), 1) - 1;
+            if (gap >= minSkip)
+                break;
+            end
+            e = e + gap;
+        end
+        len = min(e - x, 128);
+        pixels = [row(x:x+len-1), zeros(1, perByte - 1)];
+        packed = zeros(1, ceil(len/perByte));
+        for k = 1:perByte
+            packed = packed + pixels(k:perByte:end-perByte+k) * 2^(bpp*(k-1));
+        end
+        out = [out, 128 + len - 1, packed];
+        x = x + len;
+    end
+end
+end
@@ -0,0 +1,106 @@
+/*!
+ * @file adpcm.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Decoder of IMA ADPCM audio, as found in .WAV files
+ */
+
+#include "adpcm.h"
+
+// Last index of the table of steps
+#define ADPCM_INDEX_MAX 88
+
+// Steps of the codes, from the IMA recommendation
+static const uint16_t adpcmSteps[ADPCM_INDEX_MAX + 1] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// Change of the index of the step after each code, by its magnitude
+static const int8_t adpcmIndexChange[8] = {
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/*!
+ * @brief Start decoding a block
+ *
+ * @param state Decoding state
+ * @param block First byte of the block, its header
+ * @param bytes Size of the block, at least ADPCM_HEADER_BYTES
+ */
+void adpcmBlock(adpcmState *state, const uint8_t *block, uint16_t bytes) {
+	state->predictor = (int16_t)(block[0] | (block[1] << 8));
+	state->index = block[2] > ADPCM_INDEX_MAX ? ADPCM_INDEX_MAX : block[2];
+	state->data = block + ADPCM_HEADER_BYTES;
+	state->left = ADPCM_BLOCK_SAMPLES(bytes);
+	state->high = 0;
+	state->header = 1;
+}
+
+/*!
+ * @brief Decode the next samples of the block
+ *
+ * The first sample of a block is the one of its header, each other one is
+ * the sample before it moved by the step of its code.
+ *
+ * @param state Decoding state, from adpcmBlock()
+ * @param out Decoded samples, signed 16 bit
+ * @param count Most samples to decode
+ *
+ * @return Number of samples decoded, less than count at the end of the block
+ */
+uint32_t adpcmDecode(adpcmState *state, int16_t *out, uint32_t count) {
+	const uint8_t *data = state->data;
+	int32_t predictor = state->predictor;
+	int32_t index = state->index;
+	uint8_t high = state->high;
+	uint32_t step;
+	uint32_t diff;
+	uint8_t code;
+	uint32_t n;
+	uint32_t i = 0;
+
+	n = count < state->left ? count : state->left;
+
+	// The sample of the header comes first
+	if (n && state->header) {
+		out[i++] = predictor;
+		state->header = 0;
+	}
+
+	for (; i < n; i++) {
+		code = high ? *data++ >> 4 : *data & 0x0F;
+		high ^= 1;
+
+		step = adpcmSteps[index];
+		diff = step >> 3;
+		if (code & 4) diff += step;
+		if (code & 2) diff += step >> 1;
+		if (code & 1) diff += step >> 2;
+
+		predictor = __SSAT(code & 8 ? predictor - (int32_t)diff
+		                            : predictor + (int32_t)diff, 16);
+
+		index += adpcmIndexChange[code & 7];
+		if (index < 0) index = 0;
+		else if (index > ADPCM_INDEX_MAX) index = ADPCM_INDEX_MAX;
+
+		out[i] = predictor;
+	}
+
+	state->data = data;
+	state->predictor = predictor;
+	state->index = index;
+	state->high = high;
+	state->left -= n;
+	return n;
+}
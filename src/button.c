@@ -13,6 +13,7 @@
  */
 
 #include "button.h"
+#include "video.h"
 
 /*!
  * @brief Global variable with one bit storing the state of one button
@@ -158,6 +159,8 @@ void EXTI4_IRQHandler(void) {
 
 /*!
  * @brief External interrupt handler for pins 5-9
+ *
+ * Pin 8 is the tearing effect signal of the LCD when vsync is on
  */
 void EXTI9_5_IRQHandler(void){
     // ack correct interrupts, update button values
@@ -173,6 +176,11 @@ void EXTI9_5_IRQHandler(void){
         EXTI->PR |= EXTI_PR_PR7;
         // PF7, LEFT
     }
+    if (EXTI->PR & EXTI_PR_PR8) {
+        EXTI->PR = EXTI_PR_PR8;
+        // PB8, LCD TE
+        videoTearingEffect();
+    }
 
     buttons = (uint8_t)(GPIOF->IDR);
 }
@@ -0,0 +1,74 @@
+/*!
+ * @file fastseek.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Cluster link maps for seeking in files without walking the FAT
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fastseek.h"
+
+/*!
+ * @brief Build the cluster link map of an open file
+ *
+ * The map is sized to the fragments of the file and owned by the file until
+ * fastSeekFree(). If it cannot be built, the file seeks the normal way.
+ *
+ * @param file Open file to map
+ *
+ * @return 0 on success, !0 on failure
+ */
+uint8_t fastSeekMap(FIL *file) {
+#if _USE_FASTSEEK
+	DWORD probe[FASTSEEK_PROBE_ITEMS];
+	DWORD *table;
+	FRESULT result;
+
+	// FatFs sets the first item to the number of items needed, whether the
+	// table was large enough or not
+	probe[0] = FASTSEEK_PROBE_ITEMS;
+	file->cltbl = probe;
+	result = f_lseek(file, CREATE_LINKMAP);
+	file->cltbl = NULL;
+	if (result != FR_OK && result != FR_NOT_ENOUGH_CORE) return 1;
+
+	table = (DWORD *)malloc(probe[0] * sizeof(DWORD));
+	if (table == NULL) return 1;
+
+	// Short maps are already built, longer ones are walked again
+	if (result == FR_OK) {
+		memcpy(table, probe, probe[0] * sizeof(DWORD));
+	} else {
+		table[0] = probe[0];
+		file->cltbl = table;
+		if (f_lseek(file, CREATE_LINKMAP) != FR_OK) {
+			file->cltbl = NULL;
+			free(table);
+			return 1;
+		}
+	}
+
+	file->cltbl = table;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+/*!
+ * @brief Free the cluster link map of a file
+ *
+ * The file seeks the normal way afterwards. Call before or after f_close(),
+ * which does not free the map.
+ *
+ * @param file File whose map to free, may have none
+ */
+void fastSeekFree(FIL *file) {
+#if _USE_FASTSEEK
+	free(file->cltbl);
+	file->cltbl = NULL;
+#endif
+}
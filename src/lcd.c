@@ -12,6 +12,9 @@
  */
 
 #include "lcd.h"
+#ifdef SPARKBOX_HOST
+#include "host.h"
+#endif
 
 // Pointer to start address of FSMC
 volatile uint16_t * const fsmc_cmd = (uint16_t *)(0x60000000);
@@ -38,8 +41,12 @@ void initLcd(void) {
  */
 void LcdWriteCmd(uint16_t cmd) {
 
+#ifdef SPARKBOX_HOST
+	hostLcdWriteCmd(cmd);
+#else
 	// Set parallel data
 	*fsmc_cmd = cmd;
+#endif
 	
 }
 
@@ -50,8 +57,12 @@ void LcdWriteCmd(uint16_t cmd) {
  */
 void LcdWriteData(uint16_t data) {
 
+#ifdef SPARKBOX_HOST
+	hostLcdWriteData(data);
+#else
 	// Set parallel data
 	*fsmc_data = data;
+#endif
 	
 }
 
@@ -60,8 +71,12 @@ void LcdWriteData(uint16_t data) {
  */
 uint16_t LcdReadData(void) {
 
+#ifdef SPARKBOX_HOST
+	return hostLcdReadData();
+#else
 	// Read parallel data
 	return *fsmc_data;
+#endif
 
 }
 
@@ -115,6 +130,87 @@ void LcdSetPos(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
 	LcdWriteData(y1 & 0xFF);
 }
 
+/*!
+ * @brief Sets the area of the LCD moved by the hardware scroll
+ *
+ * The ILI9341 scrolls along its 320 pixel side, which is the x axis of the
+ * LCD in the landscape orientation used by the Sparkbox. The three values
+ * must add up to LCD_WIDTH.
+ *
+ * @param top Number of fixed columns on the left side
+ * @param height Number of columns that scroll
+ * @param bottom Number of fixed columns on the right side
+ */
+void LcdSetScrollArea(uint16_t top, uint16_t height, uint16_t bottom) {
+	LcdWriteCmd(VERTSCROLL_DEF);
+	LcdWriteData(top >> 8);
+	LcdWriteData(top & 0xFF);
+	LcdWriteData(height >> 8);
+	LcdWriteData(height & 0xFF);
+	LcdWriteData(bottom >> 8);
+	LcdWriteData(bottom & 0xFF);
+}
+
+/*!
+ * @brief Sets the first memory column shown in the scrolling area
+ *
+ * After this, LCD column x shows the column (x + line) of the LCD memory,
+ * wrapping inside the scrolling area.
+ *
+ * @param line Memory column shown at the left side of the scrolling area
+ */
+void LcdSetScrollStart(uint16_t line) {
+	LcdWriteCmd(VERTSCROLL_START_ADDR);
+	LcdWriteData(line >> 8);
+	LcdWriteData(line & 0xFF);
+}
+
+/*!
+ * @brief Sets the refresh rate of the LCD
+ *
+ * @param rtna Clocks per line, such as LCD_RTNA_79HZ or LCD_RTNA_61HZ
+ */
+void LcdSetFrameRate(uint8_t rtna) {
+	LcdWriteCmd(FRAME_RATE_NORMAL);
+	LcdWriteData(0x00);	// No clock division
+	LcdWriteData(rtna);
+}
+
+/*!
+ * @brief Turn the tearing effect output of the LCD on or off
+ *
+ * When on, the TE line of the LCD is high during the vertical blanking
+ * period of every refresh.
+ *
+ * @param enable 1 to turn the output on, 0 to turn it off
+ */
+void LcdTearingEffect(uint8_t enable) {
+	if (enable) {
+		LcdWriteCmd(TEARING_LINE_ON);
+		LcdWriteData(0x00);	// V-blanking only
+	} else {
+		LcdWriteCmd(TEARING_LINE_OFF);
+	}
+}
+
+/*!
+ * @brief Read the line the LCD is currently refreshing
+ *
+ * @note This uses the FSMC, it cannot be called while a DMA transfer to the
+ * LCD is running
+ *
+ * @return Current scanline
+ */
+uint16_t LcdGetScanline(void) {
+	uint16_t line;
+
+	LcdWriteCmd(GET_SCANLINE);
+	LcdReadData();	// Send dummy read signal
+	line = (LcdReadData() & 0x03) << 8;	// Get GTS[9..8]
+	line |= LcdReadData() & 0xFF;	// Get GTS[7..0]
+	return line;
+}
+
 /*!
  * @brief Draws a single pixel at (x, y)
  *
@@ -664,7 +760,7 @@ static void initILI9341(void) {
 
 	LcdWriteCmd(FRAME_RATE_NORMAL);
 	LcdWriteData(0x00);
-	LcdWriteData(0x18);
+	LcdWriteData(LCD_RTNA_79HZ);
  
 	LcdWriteCmd(DISPLAY_FUNCTION);	// Display Function Control 
 	LcdWriteData(0x08); 
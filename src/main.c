@@ -22,7 +22,7 @@ int main(void) {
 
  	lcdTest();
 
-	WAV_Pause();
+	WAV_Stop(NULL);
 
 	playGame();
 	
@@ -73,7 +73,6 @@ void playGame(void)
 			rain1.xpos = LCD_WIDTH + rand % 100;
 			rain1.xvelocity -= 1;
 			score++;
-			WAV_Pause();
 			WAV_Play(WAV, 1);
 		}
 		if (rain2.xpos < rain1.xvelocity) {
@@ -82,7 +81,6 @@ void playGame(void)
 			rain2.xpos = LCD_WIDTH + rand % 101;
 			rain2.xvelocity -= 1;
 			score++;
-			WAV_Pause();
 			WAV_Play(WAV, 1);
 		}
 
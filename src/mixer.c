@@ -0,0 +1,426 @@
+/*!
+ * @file mixer.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Software mixer summing the voices of the audio output
+ */
+
+#include <string.h>
+#include "mixer.h"
+
+// Static function prototypes
+static uint32_t mixVoiceBlock(mixVoice *voice, int16_t *out, uint32_t count);
+static uint32_t mixCopy16(const int16_t *src, int16_t *out, uint32_t count,
+                          uint16_t volume);
+static uint32_t mixCopy8(const uint8_t *src, int16_t *out, uint32_t count,
+                         uint16_t volume);
+static inline uint32_t mixScale(uint32_t pair, uint16_t volume);
+static uint32_t mixStep(mixVoice *voice, int16_t *out, uint32_t count,
+                        uint32_t end);
+static inline uint32_t mixPair(const mixVoice *voice, uint32_t position);
+static void mixBoundary(mixVoice *voice);
+static uint32_t mixBoundaryOf(const mixVoice *voice);
+
+mixVoice mixVoices[MIX_VOICES];
+
+/*!
+ * @brief Stop every voice
+ */
+void mixerInit(void) {
+	memset(mixVoices, 0, sizeof(mixVoices));
+}
+
+/*!
+ * @brief Find a voice to play a sound on
+ *
+ * The voice already playing owner is preferred, so a sound started again
+ * restarts, then a voice that is not playing. If every voice is playing, the
+ * one with the fewest samples left to play is taken, among the voices that
+ * neither loop nor have a callback.
+ *
+ * @param owner What the voice will play
+ *
+ * @return The voice, stopped, NULL if every voice loops or has a callback
+ */
+mixVoice *mixerTake(const void *owner) {
+	mixVoice *voice = NULL;
+	uint32_t left;
+	uint32_t fewest = 0xFFFFFFFF;
+	uint8_t i;
+
+	for (i = 0; i < MIX_VOICES && voice == NULL; i++) {
+		if (mixVoices[i].active && mixVoices[i].owner == owner) {
+			voice = &mixVoices[i];
+		}
+	}
+	for (i = 0; i < MIX_VOICES && voice == NULL; i++) {
+		if (!mixVoices[i].active) voice = &mixVoices[i];
+	}
+
+	// Voices that loop are never cut
+	for (i = 0; i < MIX_VOICES && voice == NULL; i++) {
+		if (mixVoices[i].loops || mixVoices[i].halfPlayed) continue;
+		left = mixVoices[i].length - mixVoices[i].position;
+		if (left < fewest) {
+			fewest = left;
+			voice = &mixVoices[i];
+		}
+	}
+	if (voice == NULL) return NULL;
+
+	voice->active = 0;
+	return voice;
+}
+
+/*!
+ * @brief Stop the voices playing something
+ *
+ * @param owner What the voices play, NULL for every voice
+ */
+void mixerStop(const void *owner) {
+	uint8_t i;
+
+	for (i = 0; i < MIX_VOICES; i++) {
+		if (owner == NULL || mixVoices[i].owner == owner) {
+			mixVoices[i].active = 0;
+		}
+	}
+}
+
+/*!
+ * @brief Sum the active voices into a block of the output
+ *
+ * Each voice is scaled to its volume and added with saturation, and moves on
+ * by count output samples at its step. Voices stop at the end of their last
+ * loop.
+ *
+ * @param out Output samples, overwritten
+ * @param count Number of output samples, even
+ *
+ * @return Number of voices that were playing, 0 if the output is silence
+ */
+uint8_t mixerRender(int16_t *out, uint32_t count) {
+	uint8_t playing = 0;
+	uint8_t i;
+
+	memset(out, 0, count * sizeof(int16_t));
+
+	for (i = 0; i < MIX_VOICES; i++) {
+		playing += mixerAdd(&mixVoices[i], out, count);
+	}
+
+	return playing;
+}
+
+/*!
+ * @brief Add one voice into a block of the output already mixed
+ *
+ * As mixerRender() does for each voice, the voice moves on by count output
+ * samples and stops at the end of its last loop.
+ *
+ * @param voice Voice added, nothing is done if it is not active
+ * @param out Output samples
+ * @param count Number of output samples, even
+ *
+ * @return 1 if the voice was playing, else 0
+ */
+uint8_t mixerAdd(mixVoice *voice, int16_t *out, uint32_t count) {
+	uint32_t done;
+
+	// A voice with no samples would never move on
+	if (!voice->length) voice->active = 0;
+	if (!voice->active) return 0;
+
+	// Each block ends at the end of the samples or a half of them
+	for (done = 0; done < count && voice->active; ) {
+		done += mixVoiceBlock(voice, out + done, count - done);
+	}
+
+	return 1;
+}
+
+/*!
+ * @brief Convert mixed samples in place to the layout of the DAC
+ *
+ * Signed 16 bit samples become unsigned 12 bit ones, left aligned in their
+ * halfword: UADD16 adds 0x8000 to both halfwords of a word at once, and the
+ * 4 bits the DAC ignores are cleared.
+ *
+ * Converting samples again gives them back signed, short of those 4 bits.
+ *
+ * @param out Mixed samples, word aligned
+ * @param count Number of samples, even
+ */
+void mixerToDac(int16_t *out, uint32_t count) {
+	uint32_t *pair = (uint32_t *)out;
+	uint32_t *end = pair + count / 2;
+
+	while (pair < end) {
+		*pair = __UADD16(*pair, 0x80008000) & 0xFFF0FFF0;
+		pair++;
+	}
+}
+
+/*!
+ * @brief Add samples of a voice to the output, up to its next boundary
+ *
+ * @param voice Active voice
+ * @param out Output samples to add to
+ * @param count Number of output samples left
+ *
+ * @return Number of output samples added to
+ */
+static uint32_t mixVoiceBlock(mixVoice *voice, int16_t *out, uint32_t count) {
+	uint32_t end = mixBoundaryOf(voice);
+	uint32_t n;
+
+	if (voice->step == MIX_STEP_ONE && !voice->phase) {
+		n = end - voice->position;
+		if (n > count) n = count;
+		if (voice->bits == 16) {
+			mixCopy16((const int16_t *)voice->data + voice->position, out, n,
+			          voice->volume);
+		} else {
+			mixCopy8((const uint8_t *)voice->data + voice->position, out, n,
+			         voice->volume);
+		}
+		voice->position += n;
+	} else {
+		n = mixStep(voice, out, count, end);
+	}
+
+	if (voice->position >= end) mixBoundary(voice);
+	return n;
+}
+
+/*!
+ * @brief Add 16 bit samples played at the rate of the output
+ *
+ * Two samples are scaled and added at a time, with the halfwords of a word
+ * packed by PKHBT and summed with saturation by QADD16.
+ *
+ * @param src First sample to add, may be unaligned
+ * @param out Output samples to add to
+ * @param count Number of samples
+ * @param volume Volume, up to MIX_VOLUME_MAX
+ *
+ * @return count
+ */
+static uint32_t mixCopy16(const int16_t *src, int16_t *out, uint32_t count,
+                          uint16_t volume) {
+	uint32_t *pair;
+	uint32_t word;
+	uint32_t i = 0;
+
+	// One sample to reach a whole word of the output
+	if (count && ((uintptr_t)out & 2)) {
+		out[0] = __SSAT(out[0] + ((src[0] * volume) >> 8), 16);
+		i = 1;
+	}
+
+	pair = (uint32_t *)(out + i);
+	if (volume == MIX_VOLUME_MAX) {
+		for (; i + 1 < count; i += 2) {
+			memcpy(&word, src + i, sizeof(word));
+			*pair = __QADD16(*pair, word);
+			pair++;
+		}
+	} else {
+		for (; i + 1 < count; i += 2) {
+			memcpy(&word, src + i, sizeof(word));
+			*pair = __QADD16(*pair, mixScale(word, volume));
+			pair++;
+		}
+	}
+
+	if (i < count) {
+		out[i] = __SSAT(out[i] + ((src[i] * volume) >> 8), 16);
+	}
+	return count;
+}
+
+/*!
+ * @brief Add 8 bit samples played at the rate of the output
+ *
+ * Four samples are read at a time and expanded to two words of signed 16 bit
+ * samples, which are scaled and added with QADD16 like 16 bit samples.
+ *
+ * @param src First sample to add
+ * @param out Output samples to add to
+ * @param count Number of samples
+ * @param volume Volume, up to MIX_VOLUME_MAX
+ *
+ * @return count
+ */
+static uint32_t mixCopy8(const uint8_t *src, int16_t *out, uint32_t count,
+                         uint16_t volume) {
+	uint32_t *pair;
+	uint32_t word;
+	uint32_t low;
+	uint32_t high;
+	uint32_t i = 0;
+
+	// One sample to reach a whole word of the output
+	if (count && ((uintptr_t)out & 2)) {
+		out[0] = __SSAT(out[0] + ((int32_t)src[0] - 128) * volume, 16);
+		i = 1;
+	}
+
+	pair = (uint32_t *)(out + i);
+	for (; i + 3 < count; i += 4) {
+		memcpy(&word, src + i, sizeof(word));
+
+		// Each byte to the top of a halfword, the sign bits flipped
+		low = (((word & 0x000000FF) << 8) | ((word & 0x0000FF00) << 16))
+		      ^ 0x80008000;
+		high = (((word & 0x00FF0000) >> 8) | (word & 0xFF000000))
+		       ^ 0x80008000;
+
+		if (volume != MIX_VOLUME_MAX) {
+			low = mixScale(low, volume);
+			high = mixScale(high, volume);
+		}
+		pair[0] = __QADD16(pair[0], low);
+		pair[1] = __QADD16(pair[1], high);
+		pair += 2;
+	}
+
+	for (; i < count; i++) {
+		out[i] = __SSAT(out[i] + ((int32_t)src[i] - 128) * volume, 16);
+	}
+	return count;
+}
+
+/*!
+ * @brief Scale both signed halfwords of a word by a volume
+ *
+ * @param pair Two samples
+ * @param volume Volume, up to MIX_VOLUME_MAX
+ *
+ * @return Both samples scaled, packed by PKHBT
+ */
+static inline uint32_t mixScale(uint32_t pair, uint16_t volume) {
+	int32_t low = ((int16_t)pair * volume) >> 8;
+	int32_t high = (((int32_t)pair >> 16) * volume) >> 8;
+
+	return __PKHBT(low, high, 16);
+}
+
+/*!
+ * @brief Add samples of a voice one at a time, at its step
+ *
+ * Plays rates other than the one of the output. Each output sample is
+ * interpolated between the two samples around the position of the voice:
+ * both are packed in a word, their weights scaled by the volume in another,
+ * and SMLAD multiplies and sums both halfwords in one instruction.
+ *
+ * @param voice Active voice
+ * @param out Output samples to add to
+ * @param count Number of output samples left
+ * @param end Position the voice stops at
+ *
+ * @return Number of output samples added to
+ */
+static uint32_t mixStep(mixVoice *voice, int16_t *out, uint32_t count,
+                        uint32_t end) {
+	uint32_t position = voice->position;
+	uint32_t phase = voice->phase;
+	uint32_t volume = voice->volume;
+	uint32_t fraction;
+	uint32_t weights;
+	uint32_t n;
+
+	for (n = 0; n < count && position < end; n++) {
+		// Weights of both samples add up to the volume, MIX_FRACTION_BITS
+		fraction = phase >> (16 - MIX_FRACTION_BITS);
+		weights = ((((1UL << MIX_FRACTION_BITS) - fraction) * volume) >> 8)
+		          | (((fraction * volume) >> 8) << 16);
+
+		out[n] = __SSAT((int32_t)__SMLAD(mixPair(voice, position), weights,
+		                                 out[n] * (1 << MIX_FRACTION_BITS))
+		                >> MIX_FRACTION_BITS, 16);
+
+		phase += voice->step;
+		position += phase >> 16;
+		phase &= 0xFFFF;
+	}
+
+	voice->position = position;
+	voice->phase = phase;
+	return n;
+}
+
+/*!
+ * @brief Pack a sample of a voice and the one after it, as 16 bit
+ *
+ * After the last sample comes the first one again for a voice that loops or
+ * plays a ring, else the last one is held.
+ *
+ * @param voice Voice playing the samples
+ * @param position Sample in the bottom halfword
+ *
+ * @return Both samples, the one at position in the bottom halfword
+ */
+static inline uint32_t mixPair(const mixVoice *voice, uint32_t position) {
+	const int16_t *data16 = (const int16_t *)voice->data;
+	const uint8_t *data8 = (const uint8_t *)voice->data;
+	uint32_t next = position + 1;
+	uint32_t pair;
+
+	if (next >= voice->length) {
+		next = voice->loops || voice->halfPlayed ? 0 : position;
+	}
+
+	if (voice->bits == 16) {
+		if (next == position + 1) {
+			memcpy(&pair, data16 + position, sizeof(pair));
+			return pair;
+		}
+		return (uint16_t)data16[position] | ((uint32_t)data16[next] << 16);
+	}
+
+	// 8 bit samples are unsigned
+	return (((uint32_t)data8[position] << 8) | ((uint32_t)data8[next] << 24))
+	       ^ 0x80008000;
+}
+
+/*!
+ * @brief Position the next block of a voice ends at
+ *
+ * @param voice Active voice
+ *
+ * @return The end of the samples, or their middle for a voice with a half
+ * callback that is still in the first half
+ */
+static uint32_t mixBoundaryOf(const mixVoice *voice) {
+	if (voice->halfPlayed && voice->position < voice->length / 2) {
+		return voice->length / 2;
+	}
+	return voice->length;
+}
+
+/*!
+ * @brief Move a voice past a half or the end of its samples
+ *
+ * @param voice Voice that reached mixBoundaryOf()
+ */
+static void mixBoundary(mixVoice *voice) {
+	// Done with the first half
+	if (voice->position < voice->length) {
+		voice->halfPlayed(voice, 0);
+		return;
+	}
+
+	voice->position -= voice->length;
+	if (voice->halfPlayed) {
+		voice->halfPlayed(voice, 1);
+	} else if (voice->loops == MIX_LOOP_ALWAYS) {
+		// Loops until stopped
+	} else if (voice->loops > 0) {
+		voice->loops--;
+	} else {
+		voice->active = 0;
+	}
+}
@@ -0,0 +1,235 @@
+/*!
+ * @file profiler.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Functions to time parts of the Sparkbox with the DWT cycle counter
+ *
+ * Each zone keeps the number of times it ran, the minimum, average and
+ * maximum number of cycles it took, and a histogram of its times.
+ */
+
+#include "profiler.h"
+#include "lcd.h"
+
+// Statistics of every zone, shared with every interrupt that is timed
+profileZone profileZones[PROFILE_ZONES];
+
+// Names used by the overlay and the SWO report
+static const char *const zoneNames[PROFILE_ZONES] = {
+	"frame",
+	"rows",
+	"sdread",
+	"sprites",
+	"dmawait",
+	"audio"
+};
+
+/*!
+ * @brief Initializes the cycle counter and clears every zone
+ *
+ * @note Safe to call more than once, the cycle counter keeps running
+ */
+void initProfiler(void) {
+	// Enable the cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	profilerReset();
+}
+
+/*!
+ * @brief Clears the statistics of every zone
+ */
+void profilerReset(void) {
+	uint8_t zone;
+	uint8_t bin;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	for (zone = 0; zone < PROFILE_ZONES; zone++) {
+		profileZones[zone].count = 0;
+		profileZones[zone].min = 0xFFFFFFFF;
+		profileZones[zone].max = 0;
+		profileZones[zone].total = 0;
+		for (bin = 0; bin < PROFILER_BINS; bin++) profileZones[zone].bins[bin] = 0;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/*!
+ * @brief Record one run of a zone
+ *
+ * Can be called from any interrupt.
+ *
+ * @param zone Zone that ran
+ * @param cycles Number of cycles it took
+ */
+void profileAdd(PROFILE_ZONE zone, uint32_t cycles) {
+	profileZone *z = &profileZones[zone];
+	uint32_t bin;
+	uint32_t primask;
+
+	// Highest set bit picks the bin, short times share the first one
+	bin = 32 - __CLZ(cycles >> PROFILER_BIN_SHIFT);
+	if (bin) bin--;
+	if (bin >= PROFILER_BINS) bin = PROFILER_BINS - 1;
+
+	// A higher priority zone may finish in the middle of the update
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	z->count++;
+	z->total += cycles;
+	if (cycles < z->min) z->min = cycles;
+	if (cycles > z->max) z->max = cycles;
+	z->bins[bin]++;
+
+	__set_PRIMASK(primask);
+}
+
+/*!
+ * @brief Get a copy of the statistics of a zone
+ *
+ * @param zone Zone to copy
+ * @param out Struct to copy the statistics into
+ */
+void profilerGetZone(PROFILE_ZONE zone, profileZone *out) {
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	*out = profileZones[zone];
+	__set_PRIMASK(primask);
+}
+
+/*!
+ * @brief Get the name of a zone
+ *
+ * @param zone Zone to name
+ *
+ * @return Null terminated name of the zone
+ */
+const char *profilerZoneName(PROFILE_ZONE zone) {
+	return zoneNames[zone];
+}
+
+/*!
+ * @brief Draw the minimum, average and maximum of each zone in microseconds
+ *
+ * Draws directly on the LCD, so frame updates must be off.
+ *
+ * @param x x position of the top left corner of the table
+ * @param y y position of the top left corner of the table
+ */
+void profilerDraw(uint16_t x, uint16_t y) {
+	uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+	profileZone z;
+	uint8_t zone;
+
+	// Clear the area and write the headers
+	LcdDrawRectangle(x, y, 7*36, 12*(PROFILE_ZONES + 1), LCD_COLOR_BLACK);
+	LcdDrawString(x, y, (uint8_t *)"ZONE   MIN    AVG    MAX (us)",
+	              LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+
+	for (zone = 0; zone < PROFILE_ZONES; zone++) {
+		profilerGetZone(zone, &z);
+		y += 12;
+
+		LcdDrawString(x, y, (uint8_t *)zoneNames[zone],
+		              LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+		if (!z.count) continue;
+
+		LcdDrawInt(x + 7*7, y, z.min / cyclesPerUs,
+		           LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+		LcdDrawInt(x + 7*14, y, (uint32_t)(z.total / z.count) / cyclesPerUs,
+		           LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+		LcdDrawInt(x + 7*21, y, z.max / cyclesPerUs,
+		           LCD_COLOR_WHITE, LCD_COLOR_BLACK);
+	}
+}
+
+/*!
+ * @brief Set up the SWO pin to send ITM stimulus port 0 as NRZ serial
+ *
+ * @param baud Baud rate of the SWO pin
+ */
+void profilerSwoInit(uint32_t baud) {
+	// Enable the trace pins in asynchronous mode, PB3 is TRACESWO after reset
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DBGMCU->CR = (DBGMCU->CR & ~DBGMCU_CR_TRACE_MODE) | DBGMCU_CR_TRACE_IOEN;
+
+	// NRZ encoding at the given baud rate without the formatter
+	TPI->SPPR = 2;
+	TPI->ACPR = SystemCoreClock / baud - 1;
+	TPI->FFCR = TPI_FFCR_TrigIn_Msk;
+
+	// Unlock the ITM and enable stimulus port 0
+	ITM->LAR = 0xC5ACCE55;
+	ITM->TCR = ITM_TCR_ITMENA_Msk | ITM_TCR_SWOENA_Msk
+	           | (1 << ITM_TCR_TraceBusID_Pos);
+	ITM->TPR = 0;
+	ITM->TER = 1;
+}
+
+/*!
+ * @brief Send every zone out of the SWO pin as one line of text each
+ *
+ * Each line is the zone name, count, minimum, average and maximum in cycles,
+ * then the histogram bins, separated by commas.
+ */
+void profilerSwoReport(void) {
+	profileZone z;
+	uint8_t zone;
+	uint8_t bin;
+
+	for (zone = 0; zone < PROFILE_ZONES; zone++) {
+		profilerGetZone(zone, &z);
+
+		profilerSwoSendString(zoneNames[zone]);
+		profilerSwoSendString(",");
+		profilerSwoSendInt(z.count);
+		profilerSwoSendString(",");
+		profilerSwoSendInt(z.count ? z.min : 0);
+		profilerSwoSendString(",");
+		profilerSwoSendInt(z.count ? (uint32_t)(z.total / z.count) : 0);
+		profilerSwoSendString(",");
+		profilerSwoSendInt(z.max);
+		for (bin = 0; bin < PROFILER_BINS; bin++) {
+			profilerSwoSendString(",");
+			profilerSwoSendInt(z.bins[bin]);
+		}
+		profilerSwoSendString("\n");
+	}
+}
+
+/*!
+ * @brief Send a string out of ITM stimulus port 0
+ *
+ * @param str Null terminated string to send
+ */
+void profilerSwoSendString(const char *str) {
+	while (*str != '\0') ITM_SendChar(*str++);
+}
+
+/*!
+ * @brief Send an unsigned integer out of ITM stimulus port 0 in decimal
+ *
+ * @param num Integer to send
+ */
+void profilerSwoSendInt(uint32_t num) {
+	uint32_t i = 1;
+
+	// Find number of digits
+	while (num/10 >= i) i*=10;
+
+	// Iterate through the digits from the top down
+	while (i) {
+		ITM_SendChar((num/i % 10) + '0');
+		i /= 10;
+	}
+}
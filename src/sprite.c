@@ -9,11 +9,90 @@
  * These functions are the basic functions that should be used to interact with
  * sprites.
  */
+#include <string.h>
 #include "sprite.h"
+#include "video.h"
+#include "fastseek.h"
 
 // Static function prototypes
 static uint8_t spritesAllocatedAdd(sprite *inSprite);
 static uint8_t spritesAllocatedRemove(sprite *inSprite);
+static uint32_t spriteFrameBytes(sprite *inSprite);
+static uint32_t spriteDataBytes(sprite *inSprite);
+static uint32_t spriteRowOffset(sprite *inSprite, uint16_t row);
+static uint8_t spriteLoadRowStarts(sprite *inSprite);
+static uint8_t spriteCheckRuns(const uint8_t *runs, uint16_t bytes,
+                               uint16_t width, uint8_t bpp);
+static void spriteExpandRuns(const uint8_t *runs, uint16_t bytes, uint8_t bpp,
+                             uint16_t first, uint16_t count, uint8_t *out);
+static int8_t spriteLoadFile(sprite *targetSprite, uint32_t start);
+static uint8_t spriteDepthSupported(uint8_t bpp);
+static uint8_t spriteLoadPalette(sprite *inSprite, uint32_t start);
+static void spriteFreePalette(sprite *inSprite);
+static uint32_t *spriteMakePairs(const uint16_t *palette, uint16_t numColors,
+                                 uint8_t bpp);
+static void spriteUpdatePairs(uint32_t *pairs, const uint16_t *palette,
+                              uint16_t numColors, uint8_t bpp, uint8_t index);
+static void spriteSetPair(uint32_t *pairs, const uint16_t *palette,
+                          uint16_t numColors, uint8_t bpp, uint8_t code);
+static sprite *spriteOwner(sprite *inSprite);
+static void spriteBuildBuckets(void);
+static uint8_t spriteReserveBuckets(uint16_t numLayers);
+#if SPRITE_CACHE_BYTES
+static int16_t spriteCacheFindGap(uint32_t size, uint32_t *start);
+static uint8_t spriteCacheEvict(void);
+static void spriteCacheTouch(sprite *inSprite);
+#endif
+
+/*!
+ * @brief Size of the .spr header, pixel data starts right after it
+ *
+ * 2 bytes  : width
+ * 2 bytes  : height
+ * 1 byte   : numFrames
+ * 1 byte   : version and numColors
+ * 1 byte   : depth
+ * 1 byte   : palette bank
+ * 1 byte   : numColors of an 8bpp palette
+ * 5 bytes  : reserved
+ * 30 bytes : palette
+ */
+#define SPRITE_HEADER_BYTES 44
+
+// Offset of the palette in the header
+#define SPRITE_PALETTE_START 14
+
+/*!
+ * @brief Size of the .pak header, the directory starts right after it
+ *
+ * 4 bytes : magic
+ * 2 bytes : numEntries
+ * 2 bytes : reserved
+ */
+#define SPRITE_PACK_HEADER_BYTES 8
+#define SPRITE_PACK_MAGIC "SPAK"
+
+// Pair codes of a depth, every byte except at 2bpp where a code is a nibble
+#define SPRITE_PAIR_CODES(bpp) (((bpp) == 2) ? 16 : 256)
+
+// Masks of a pair table, stored right after its pairs
+#define SPRITE_PAIR_MASKS(pairs, bpp) \
+	((uint8_t *)((pairs) + SPRITE_PAIR_CODES(bpp)))
+
+// Depths a palette bank may hold pairs for, 2, 4 and 8bpp
+#define SPRITE_DEPTHS 3
+#define SPRITE_DEPTH_INDEX(bpp) ((bpp) >> 2)
+#define SPRITE_DEPTH_BPP(index) (2 << (index))
+
+/*!
+ * @brief Palette shared by every sprite whose file names it
+ */
+typedef struct {
+	uint16_t *colors;	/*!< RGB565 colors, NULL if the bank is not set */
+	uint16_t numColors;	/*!< Number of colors */
+	uint16_t users;	/*!< Number of sprites using the bank */
+	uint32_t *pairs[SPRITE_DEPTHS];	/*!< Pixel pairs of each depth, NULL until used */
+} spritePaletteBank;
 
 /*!
  * @brief Global list to keep track of all initialized sprites
@@ -25,6 +104,48 @@ spriteList spritesAllocated = {NULL, 0};
  */
 spriteList layers = {NULL, 0};
 
+// Number of calls to updateSprites, used to find the least recently shown
+uint32_t spriteClock = 0;
+
+// 1 if newly initialized sprites are loaded into the cache
+uint8_t spriteCaching = 0;
+
+// Runs of a v2 row read by spriteReadRow() before they are expanded
+uint8_t spriteRunBuffer[SPRITE_MAX_RUN_BYTES];
+
+// Shared palettes, bank b is at index b - 1
+spritePaletteBank paletteBanks[SPRITE_PALETTE_BANKS];
+
+// Sprites shown on each bucket of LCD rows, in layer order, one bucket after
+// the other. Bucket b holds the sprites from bucketStart[b] to
+// bucketStart[b + 1].
+sprite **bucketSprites = NULL;
+uint32_t bucketCapacity = 0;
+uint32_t bucketStart[SPRITE_BUCKETS + 1];
+
+// 0 if the layers changed since the buckets were built
+uint8_t bucketsValid = 0;
+
+#if SPRITE_CACHE_BYTES
+/*!
+ * @brief Region of the cache pool used by one sprite
+ */
+typedef struct {
+	sprite *owner;	/*!< Sprite whose frames are stored in the region */
+	uint32_t start;	/*!< Offset of the region in the pool */
+	uint32_t size;	/*!< Size of the region in bytes */
+	uint32_t lastUsed;	/*!< Value of spriteClock when last shown */
+} spriteCacheEntry;
+
+// Pool of cached frames, not loaded from flash nor cleared at startup
+uint8_t spriteCachePool[SPRITE_CACHE_BYTES]
+	__attribute__((section(".ccmbss"), aligned(4)));
+
+// Regions of the pool in use, sorted by start offset
+spriteCacheEntry spriteCacheEntries[MAX_SPRITES];
+uint16_t spriteCacheSize = 0;
+#endif
+
 /*!
  * @brief Display helpful debugging information for the given sprite
  *
@@ -51,8 +172,8 @@ void drawSpriteDebug(sprite *inSprite) {
 	LcdDrawInt(278, 14, inSprite->height, LCD_COLOR_WHITE, LCD_COLOR_BLACK);
 	LcdDrawInt(278, 26, inSprite->numFrames, LCD_COLOR_WHITE, LCD_COLOR_BLACK);
 
-	// Display palette colors
-	for (i = 0; i < inSprite->numColors; i++) {
+	// Display palette colors, as many as fit beside the sprite
+	for (i = 0; i < inSprite->numColors && i < 15; i++) {
 		LcdDrawRectangle(245, 62 + 12*i, 10, 10, inSprite->palette[i]);
 		LcdDrawInt(260, 62 + 12*i, i+1, LCD_COLOR_WHITE, LCD_COLOR_BLACK);
 	}
@@ -108,71 +229,207 @@ void drawSpriteDebug(sprite *inSprite) {
  * @endcode
  */
 int8_t initSprite(sprite *targetSprite, char *filename) {
-	uint8_t buffer[32];
-	uint16_t i;
+	int8_t error;
 
 	// Open the sprite file
-	if (f_open(&targetSprite->file, filename, FA_READ) != FR_OK) {
+	targetSprite->file = (FIL *)malloc(sizeof(FIL));
+	if (targetSprite->file == NULL) {
+		return NOT_ENOUGH_MEMORY;
+	}
+	if (f_open(targetSprite->file, filename, FA_READ) != FR_OK) {
 		// If file open failed,
+		free(targetSprite->file);
 		return NO_FILE_ACCESS;
 	}
+	targetSprite->pack = NULL;
+
+	// Map the clusters so the seeks of each frame do not walk the FAT, the
+	// sprite still works without the map
+	fastSeekMap(targetSprite->file);
+
+	error = spriteLoadFile(targetSprite, 0);
+	if (error) {
+		f_close(targetSprite->file);
+		fastSeekFree(targetSprite->file);
+		free(targetSprite->file);
+		return error;
+	}
+
+	return 0;
+
+}
+
+/*!
+ * @brief Populates a sprite struct from a sprite in a pack
+ *
+ * Works like initSprite(), with the sprite reading through the file of the
+ * pack instead of opening its own. Sprites initialized in the order of the
+ * pack read it from start to end.
+ *
+ * @param targetSprite Pointer to a sprite struct with allocated memory
+ * @param pack Pack opened with initSpritePack()
+ * @param name Name of the sprite in the pack
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpriteFromPack(sprite *targetSprite, spritePack *pack, char *name) {
+	spritePackEntry *entry;
+	uint16_t i;
+	int8_t error;
+
+	// Find the sprite in the directory
+	for (i = 0; i < pack->numEntries; i++) {
+		if (strncmp(pack->entries[i].name, name, SPRITE_PACK_NAME) == 0) break;
+	}
+	if (i == pack->numEntries) return NO_FILE_ACCESS;
+	entry = &pack->entries[i];
+	if (entry->size < SPRITE_HEADER_BYTES) return FILE_ERROR;
+
+	targetSprite->file = &pack->file;
+	targetSprite->pack = pack;
+
+	error = spriteLoadFile(targetSprite, entry->offset);
+	if (error) return error;
+
+	// The pack stays open until its last sprite is destroyed
+	pack->users++;
+
+	return 0;
+}
+
+/*!
+ * @brief Populates a sprite struct from pixel data already in memory
+ *
+ * The sprite is drawn straight from the given frames, the same way as a
+ * cached sprite, and never reads the SD card.
+ *
+ * @note The frames are not copied and must stay valid until the sprite is
+ * destroyed
+ *
+ * @param targetSprite Pointer to a sprite struct with allocated memory
+ * @param width Width of the sprite
+ * @param height Height of the sprite
+ * @param numFrames Number of frames in the sprite sheet
+ * @param bpp Bits per pixel of the frames, 2, 4 or 8
+ * @param palette RGB565 colors of the palette, copied into the sprite
+ * @param numColors Number of colors in the palette, at most 2^bpp - 1
+ * @param frames Pixel data of every frame, laid out as in a v1 .spr file
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpriteFromMemory(sprite *targetSprite, uint16_t width,
+                            uint16_t height, uint8_t numFrames, uint8_t bpp,
+                            const uint16_t *palette, uint16_t numColors,
+                            uint8_t *frames) {
+	uint16_t i;
+
+	if (!spriteDepthSupported(bpp)) return FILE_ERROR;
 
 	// Get the tag for the sprite
 	if (spritesAllocatedAdd(targetSprite)) {
-		// If failed, free memory and break
-		f_close(&targetSprite->file);
 		return TOO_MANY_SPRITES;
 	}
 
-	// Initialize data that is not in file
+	// Nothing is read from the SD card
+	targetSprite->file = NULL;
+	targetSprite->pack = NULL;
+	targetSprite->source = NULL;
+	targetSprite->frameStarts = NULL;
+	targetSprite->rowStarts = NULL;
+	targetSprite->dataStart = 0;
+	targetSprite->paletteBank = 0;
+
+	// Initialize data that is not in the frames
 	targetSprite->xpos = 0;
 	targetSprite->ypos = 0;
 	targetSprite->xvelocity = 0;
 	targetSprite->yvelocity = 0;
 	targetSprite->curFrame = 0;
+	targetSprite->prevFrame = SPRITE_NOT_DRAWN;
 	targetSprite->flags = 0x00;
 	targetSprite->layer = -1;
+	targetSprite->cache = frames;
 
-	// Get header data
-	f_read(&targetSprite->file, buffer, 14, NULL);	// Fetch 16 bytes of data
-	targetSprite->width = (buffer[1] << 8) | buffer[0];	// 2 bytes : width
-	targetSprite->height = (buffer[3] << 8) | buffer[2];	// 2 bytes : height
-	targetSprite->numFrames = buffer[4];	// 1 byte : numFrames
-	targetSprite->numColors = (buffer[5] & 0x00F0) >> 4;	// 4 bits : nColors
-	// targetSprite->________ = buffer[5] & 0x000F;	// 4 bits : Reserved
+	targetSprite->width = width;
+	targetSprite->height = height;
+	targetSprite->numFrames = numFrames;
+	targetSprite->bpp = bpp;
+	targetSprite->numColors = (numColors > (1 << bpp) - 1)
+	                          ? (1 << bpp) - 1 : numColors;
 
 	// Allocate palette array
 	targetSprite->palette = (uint16_t *)malloc(
 		(targetSprite->numColors) * sizeof(uint16_t));
 	if (targetSprite->palette == NULL) {
 		spritesAllocatedRemove(targetSprite);
-		f_close(&targetSprite->file);
 		return NOT_ENOUGH_MEMORY;
 	}
-
-	// Bytes 7-14 : reserved
-
-	// Fetch 32 bytes of data
-	f_read(&targetSprite->file, buffer, 32, NULL);
-
-	// Save the palette from the file to the array and display them
 	for (i = 0; i < targetSprite->numColors; i++)
-		targetSprite->palette[i] = (buffer[i*2 + 1] << 8) | buffer[i*2];
+		targetSprite->palette[i] = palette[i];
 
-	return 0;
+	targetSprite->pairs = spriteMakePairs(targetSprite->palette,
+	                                      targetSprite->numColors, bpp);
+	if (targetSprite->pairs == NULL) {
+		free(targetSprite->palette);
+		spritesAllocatedRemove(targetSprite);
+		return NOT_ENOUGH_MEMORY;
+	}
+	targetSprite->pairMasks = SPRITE_PAIR_MASKS(targetSprite->pairs, bpp);
 
+	return 0;
 }
 
 /*!
  * @brief Copy one sprite to another
  *
+ * The copy shares the frames, palette, pixel pairs and file of the original,
+ * so it only takes the memory of the sprite struct. It starts at the same
+ * position and frame with its own velocity, flags and layer.
+ *
+ * @note Destroy every copy before the original. Changing the palette of one
+ * changes it for all of them.
+ *
  * @param inSprite Sprite to copy data from
  * @param targetSprite Sprite to copy data to
  *
- * @warning This function has not been written yet
+ * @return 0 on success, !0 on failure
  */
 int8_t copySprite(sprite *inSprite, sprite *targetSprite) {
-	// TODO
+	sprite *owner = spriteOwner(inSprite);
+
+	// Get the tag for the sprite
+	if (spritesAllocatedAdd(targetSprite)) {
+		return TOO_MANY_SPRITES;
+	}
+
+	// Share the data of the sprite that owns it, never of another copy
+	targetSprite->file = owner->file;
+	targetSprite->pack = owner->pack;
+	targetSprite->source = owner;
+	targetSprite->width = owner->width;
+	targetSprite->height = owner->height;
+	targetSprite->numFrames = owner->numFrames;
+	targetSprite->numColors = owner->numColors;
+	targetSprite->palette = owner->palette;
+	targetSprite->bpp = owner->bpp;
+	targetSprite->paletteBank = owner->paletteBank;
+	targetSprite->cache = NULL;	// Frames are read through the original
+	targetSprite->pairs = owner->pairs;
+	targetSprite->pairMasks = owner->pairMasks;
+	targetSprite->frameStarts = owner->frameStarts;
+	targetSprite->rowStarts = owner->rowStarts;
+	targetSprite->dataStart = owner->dataStart;
+
+	// Start where the original is, with nothing else in common
+	targetSprite->xpos = inSprite->xpos;
+	targetSprite->ypos = inSprite->ypos;
+	targetSprite->xvelocity = 0;
+	targetSprite->yvelocity = 0;
+	targetSprite->curFrame = inSprite->curFrame;
+	targetSprite->prevFrame = SPRITE_NOT_DRAWN;
+	targetSprite->flags = 0x00;
+	targetSprite->layer = -1;
+
 	return 0;
 }
 
@@ -181,7 +438,8 @@ int8_t copySprite(sprite *inSprite, sprite *targetSprite) {
  * 
  * Destroys the sprite by freeing memory of the palette and closing the file on
  * the SD card. The sprite is also removed from both spritesAllocated and
- * spriteLayers list.
+ * spriteLayers list. A copy made with copySprite() is only removed from the
+ * lists, its data stays with the original.
  * 
  * @param inSprite Sprite struct to destroy
  */
@@ -191,11 +449,24 @@ void destroySprite(sprite *inSprite) {
 	spritesAllocatedRemove(inSprite);
 	spriteLayersRemove(inSprite);
 
-	// Close file
-	f_close(&inSprite->file);
+	// Copies only borrow their data
+	if (inSprite->source != NULL) return;
 
-	// Free memory
-	free(inSprite->palette);
+	// Give back cache space
+	spriteCacheRelease(inSprite);
+
+	// Close file, the file of a pack stays open for its other sprites
+	if (inSprite->pack != NULL) {
+		inSprite->pack->users--;
+	} else if (inSprite->file != NULL) {
+		f_close(inSprite->file);
+		fastSeekFree(inSprite->file);
+		free(inSprite->file);
+	}
+
+	// Free memory, a bank keeps its palette
+	spriteFreePalette(inSprite);
+	free(inSprite->frameStarts);
 	
 }
 
@@ -208,37 +479,58 @@ void destroySprite(sprite *inSprite) {
  * @return Number of pixels drawn
  */
 uint32_t drawSprite(sprite *inSprite) {
-	uint8_t temp;
-	uint32_t i;
-	uint32_t offset;
-
-	// Find the offset of each frame for the file pointer
-	// If width*height is not a multiple of 2, rounds up before dividing
-	offset = ((inSprite->width * inSprite->height) + 1) / 2;
-
-	// Move file pointer to beginning of sprite frame
-	// Number of bytes to skip:
-	// 2 bytes  : width
-	// 2 bytes  : height
-	// 1 byte   : numFrames
-	// 1 byte   : numColors
-	// 8 bytes  : reserved
-	// 30 bytes : palette
-	f_lseek(&inSprite->file, 44 + inSprite->curFrame*offset);
+	uint8_t buffer[LCD_WIDTH + 1];
+	const uint8_t *src;
+	uint8_t bpp = inSprite->bpp;
+	uint8_t index;
+	uint16_t pixel;
+	uint32_t count = 0;
+	int16_t x0;
+	int16_t y0;
+	int16_t x1;
+	int16_t y1;
+	uint16_t first;
+	uint16_t col;
+	uint16_t row;
+	int16_t x;
+
+	if (!spriteOnScreen(inSprite)) return 0;
+
+	// Clip the sprite to the LCD
+	x0 = (inSprite->xpos < 0) ? 0 : inSprite->xpos;
+	y0 = (inSprite->ypos < 0) ? 0 : inSprite->ypos;
+	x1 = ((int32_t)inSprite->xpos + inSprite->width > LCD_WIDTH)
+	     ? LCD_WIDTH : inSprite->xpos + inSprite->width;
+	y1 = ((int32_t)inSprite->ypos + inSprite->height > LCD_HEIGHT)
+	     ? LCD_HEIGHT : inSprite->ypos + inSprite->height;
+
+	// Bytes of each row holding the visible columns
+	col = x0 - inSprite->xpos;
+	first = ((uint32_t)col * bpp) >> 3;
 
 	// Set drawing window on the LCD
-	LcdSetPos(inSprite->xpos, inSprite->ypos, inSprite->xpos + inSprite->width-1, inSprite->ypos + inSprite->height-1);
+	LcdSetPos(x0, y0, x1 - 1, y1 - 1);
 	LcdWriteCmd(MEMORY_WRITE);
 
-	// Write the rest of the pixels
-	for (i = 0 ; i < (inSprite->width * inSprite->height) - 2; i+=2) {
-		f_read(&inSprite->file, &temp, 1, NULL);	// Get 2 pixels of data
-		LcdWriteData(inSprite->palette[(temp & 0x0F)-1]);	// Draw a pixel
-		LcdWriteData(inSprite->palette[((temp & 0xF0)>>4)-1]);	// Draw a pixel
+	for (row = y0 - inSprite->ypos; row < y1 - inSprite->ypos; row++) {
+		// Get the visible span of a row of the current frame
+		src = spriteReadRow(inSprite, row, first,
+		                    ((((uint32_t)col + (x1 - x0)) * bpp + 7) >> 3) - first,
+		                    buffer);
+		if (src == NULL) break;
+
+		// Pixels are decoded one at a time straight from the palette
+		for (x = col; x < col + (x1 - x0); x++) {
+			pixel = (uint32_t)x * bpp - (first << 3);
+			index = (src[pixel >> 3] >> (pixel & 7)) & ((1 << bpp) - 1);
+			if (index == 0) LcdWriteData(VIDEO_BG);
+			else if (index > inSprite->numColors) LcdWriteData(LCD_COLOR_BLACK);
+			else LcdWriteData(inSprite->palette[index - 1]);
+		}
+		count += x1 - x0;
 	}
-	// Get tail set of pixels
 
-	return i;
+	return count;
 
 }
 
@@ -251,26 +543,68 @@ uint32_t drawSprite(sprite *inSprite) {
  * xvelocity, and the y position will move at the speed of the sprite's
  * yvelocity.
  *
+ * The area a sprite was last drawn at and the area it now covers are marked
+ * as damaged whenever its position or frame changes. The sprites on the LCD
+ * are then sorted into buckets of SPRITE_BUCKET_ROWS rows for the compositor.
+ *
  * @note Only sprites that are at an assigned layer will be updated with this
  * function
  */
 void updateSprites(void) {
-	uint8_t layer;
+	uint16_t layer;
+	sprite *spr;
+
+	spriteClock++;
 	
 	for (layer = 0; layer < layers.size; layer++) {
+		spr = layers.spr[layer];
+
+#if SPRITE_CACHE_BYTES
+		// Sprites being shown are the most recently used
+		if (spriteOwner(spr)->cache != NULL) spriteCacheTouch(spriteOwner(spr));
+#endif
 
 		// Update frames
-		layers.spr[layer]->curFrame++;
-		if (layers.spr[layer]->curFrame == layers.spr[layer]->numFrames) {
-			layers.spr[layer]->curFrame = 0;
+		spr->curFrame++;
+		if (spr->curFrame == spr->numFrames) {
+			spr->curFrame = 0;
 		}
 
 		// Update positions
-		layers.spr[layer]->xpos += layers.spr[layer]->xvelocity;
-		layers.spr[layer]->ypos += layers.spr[layer]->yvelocity;
+		spr->xpos += spr->xvelocity;
+		spr->ypos += spr->yvelocity;
+
+		// Hidden sprites only clear the area they were drawn in
+		if (spr->flags & HIDE) {
+			if (spr->prevFrame != SPRITE_NOT_DRAWN) {
+				videoAddDamage(spr->prevXpos, spr->prevYpos,
+				               spr->width, spr->height);
+				spr->prevFrame = SPRITE_NOT_DRAWN;
+			}
+			continue;
+		}
+
+		// Nothing to redraw if the sprite looks the same as last frame
+		if (spr->prevFrame == spr->curFrame &&
+		    spr->prevXpos == spr->xpos &&
+		    spr->prevYpos == spr->ypos) continue;
+
+		// Damage the previous and current bounding boxes
+		if (spr->prevFrame != SPRITE_NOT_DRAWN) {
+			videoAddDamage(spr->prevXpos, spr->prevYpos,
+			               spr->width, spr->height);
+		}
+		videoAddDamage(spr->xpos, spr->ypos, spr->width, spr->height);
+
+		spr->prevXpos = spr->xpos;
+		spr->prevYpos = spr->ypos;
+		spr->prevFrame = spr->curFrame;
 
 	}
 
+	// Sort the sprites by the rows they cover for the compositor
+	spriteBuildBuckets();
+
 }
 
 /*!
@@ -348,12 +682,187 @@ void spriteAnimate(sprite *inSprite, uint8_t animationEnable) {
 /*!
  * @brief Set a palette color of a sprite to a new given color
  *
+ * The pixel pairs using the color are updated as well. The color of a shared
+ * palette bank changes for every sprite using the bank.
+ *
  * @param inSprite Pointer to the sprite struct to change
- * @param index Index of the palette color to change, 0 <= index <= 14 
+ * @param index Index of the palette color to change, below numColors
  * @param color New color to place in the palette (RGB565 format)
  */
 void spriteSetPaletteColor(sprite *inSprite, uint8_t index, uint16_t color) {
+	spritePaletteBank *bank;
+	uint8_t depth;
+
 	inSprite->palette[index] = color;
+
+	if (inSprite->paletteBank == 0) {
+		spriteUpdatePairs(inSprite->pairs, inSprite->palette,
+		                  inSprite->numColors, inSprite->bpp, index);
+		return;
+	}
+
+	// Every depth the bank is used at has its own pairs
+	bank = &paletteBanks[inSprite->paletteBank - 1];
+	for (depth = 0; depth < SPRITE_DEPTHS; depth++) {
+		if (bank->pairs[depth] == NULL) continue;
+		spriteUpdatePairs(bank->pairs[depth], bank->colors, bank->numColors,
+		                  SPRITE_DEPTH_BPP(depth), index);
+	}
+}
+
+/*
+ * palette bank functions
+ */
+/*!
+ * @brief Set the colors of a shared palette bank
+ *
+ * Sprites whose file names the bank use these colors instead of a palette of
+ * their own, and share its pixel pairs. The colors are copied.
+ *
+ * @note A bank cannot be set while sprites use it, change its colors with
+ * spriteSetPaletteColor() instead
+ *
+ * @param bank Bank to set, 1 to SPRITE_PALETTE_BANKS
+ * @param colors RGB565 colors of the palette
+ * @param numColors Number of colors in the palette, at most 255
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t spritePaletteBankSet(uint8_t bank, const uint16_t *colors,
+                            uint16_t numColors) {
+	uint16_t *newColors;
+
+	if (numColors == 0 || numColors > 255) return NO_PALETTE;
+
+	// Free the colors it held, which also checks the bank
+	if (spritePaletteBankClear(bank)) return NO_PALETTE;
+
+	newColors = (uint16_t *)malloc(numColors * sizeof(uint16_t));
+	if (newColors == NULL) return NOT_ENOUGH_MEMORY;
+	memcpy(newColors, colors, numColors * sizeof(uint16_t));
+
+	// Pairs are built for each depth by the first sprite using it
+	paletteBanks[bank - 1].colors = newColors;
+	paletteBanks[bank - 1].numColors = numColors;
+
+	return 0;
+}
+
+/*!
+ * @brief Free the colors and pixel pairs of a shared palette bank
+ *
+ * @param bank Bank to free, 1 to SPRITE_PALETTE_BANKS
+ *
+ * @return 0 on success, !0 if sprites still use the bank
+ */
+int8_t spritePaletteBankClear(uint8_t bank) {
+	spritePaletteBank *target;
+	uint8_t depth;
+
+	if (bank == 0 || bank > SPRITE_PALETTE_BANKS) return NO_PALETTE;
+
+	target = &paletteBanks[bank - 1];
+	if (target->users) return NO_PALETTE;
+
+	free(target->colors);
+	target->colors = NULL;
+	target->numColors = 0;
+	for (depth = 0; depth < SPRITE_DEPTHS; depth++) {
+		free(target->pairs[depth]);
+		target->pairs[depth] = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * sprite pack functions
+ */
+/*!
+ * @brief Open a sprite pack and read its directory
+ *
+ * @note This function does not allocate memory for the pack struct itself,
+ * which holds the file and must stay valid while its sprites are used
+ *
+ * @param pack Pointer to a pack struct with allocated memory
+ * @param filename Name of the .pak file on the SD card
+ *
+ * @return 0 on success, !0 on failure
+ */
+int8_t initSpritePack(spritePack *pack, char *filename) {
+	uint8_t header[SPRITE_PACK_HEADER_BYTES];
+	uint32_t bytes;
+	uint16_t i;
+	UINT bytesRead;
+
+	pack->entries = NULL;
+	pack->numEntries = 0;
+	pack->users = 0;
+
+	if (f_open(&pack->file, filename, FA_READ) != FR_OK) {
+		return NO_FILE_ACCESS;
+	}
+
+	// Every sprite of the pack seeks through the same map
+	fastSeekMap(&pack->file);
+
+	// Get header data
+	if (f_read(&pack->file, header, SPRITE_PACK_HEADER_BYTES, &bytesRead) != FR_OK
+	    || bytesRead != SPRITE_PACK_HEADER_BYTES) {
+		f_close(&pack->file);
+		fastSeekFree(&pack->file);
+		return NO_FILE_ACCESS;
+	}
+	if (memcmp(header, SPRITE_PACK_MAGIC, 4) != 0) {
+		f_close(&pack->file);
+		fastSeekFree(&pack->file);
+		return FILE_ERROR;
+	}
+	pack->numEntries = (header[5] << 8) | header[4];	// 2 bytes : numEntries
+
+	// Bytes 7-8 : reserved
+
+	// The directory is little endian, like the Cortex-M4
+	bytes = (uint32_t)pack->numEntries * sizeof(spritePackEntry);
+	pack->entries = (spritePackEntry *)malloc(bytes);
+	if (pack->entries == NULL) {
+		f_close(&pack->file);
+		fastSeekFree(&pack->file);
+		return NOT_ENOUGH_MEMORY;
+	}
+	if (f_read(&pack->file, pack->entries, bytes, &bytesRead) != FR_OK
+	    || bytesRead != bytes) {
+		free(pack->entries);
+		f_close(&pack->file);
+		fastSeekFree(&pack->file);
+		return NO_FILE_ACCESS;
+	}
+
+	// Names that fill their entry are cut short rather than left unterminated
+	for (i = 0; i < pack->numEntries; i++) {
+		pack->entries[i].name[SPRITE_PACK_NAME - 1] = '\0';
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief Close a sprite pack and free its directory
+ *
+ * @param pack Pack to close
+ *
+ * @return 0 on success, !0 if sprites of the pack are not destroyed
+ */
+int8_t destroySpritePack(spritePack *pack) {
+	if (pack->users) return PACK_IN_USE;
+
+	f_close(&pack->file);
+	fastSeekFree(&pack->file);
+	free(pack->entries);
+	pack->entries = NULL;
+	pack->numEntries = 0;
+
+	return 0;
 }
 
 /*
@@ -375,7 +884,7 @@ static uint8_t spritesAllocatedAdd(sprite *inSprite) {
 	}
 	
 	// Reallocate memory for array of structs
-	newPointer = (sprite **)realloc(spritesAllocated.spr, spritesAllocated.size+1 * sizeof(sprite *));
+	newPointer = (sprite **)realloc(spritesAllocated.spr, (spritesAllocated.size + 1) * sizeof(sprite *));
 	if (newPointer == NULL) {
 		return NOT_ENOUGH_MEMORY;
 	}
@@ -401,11 +910,12 @@ static uint8_t spritesAllocatedAdd(sprite *inSprite) {
  * @return 0 on success, !0 on failure
  */
 static uint8_t spritesAllocatedRemove(sprite *inSprite) {
-	uint8_t i;
+	uint16_t i;
 	
 	// Remove the element and move the rest of the elements back
-	for (i = inSprite->tag; i < spritesAllocated.size - 1; i++) {
+	for (i = inSprite->tag; i + 1 < spritesAllocated.size; i++) {
 		spritesAllocated.spr[i] = spritesAllocated.spr[i + 1];
+		spritesAllocated.spr[i]->tag = i;
 	}
 
 	// Decrement size
@@ -426,25 +936,34 @@ static uint8_t spritesAllocatedRemove(sprite *inSprite) {
  *
  * @return 0 on success, !0 on failure
  */
-uint8_t spriteLayersInsert(sprite *inSprite, uint8_t layer) {
-	uint8_t i;
+uint8_t spriteLayersInsert(sprite *inSprite, uint16_t layer) {
+	uint16_t i;
 	sprite **newPointer;
 
 	// Check if too many sprites are already allocated
 	if (layers.size >= MAX_LAYERS) {
 		return TOO_MANY_SPRITES;
 	}
+
+	// The buckets are built from interrupts, they are grown here
+	if (spriteReserveBuckets(layers.size + 1)) {
+		return NOT_ENOUGH_MEMORY;
+	}
 	
 	// Reallocate memory for array of structs
-	newPointer = (sprite **)realloc(layers.spr, layers.size+1 * sizeof(sprite *));
+	newPointer = (sprite **)realloc(layers.spr, (layers.size + 1) * sizeof(sprite *));
 	if (newPointer == NULL) {
 		return NOT_ENOUGH_MEMORY;
 	}
 	layers.spr = newPointer;
 	
-	// Move the layers after the given index down
-	for (i = spritesAllocated.size; i > layer + 1; i--) {
+	// Past the top-most layer, append the sprite
+	if (layer > layers.size) layer = layers.size;
+
+	// Move the layers from the given index down
+	for (i = layers.size; i > layer; i--) {
 		layers.spr[i] = layers.spr[i-1];
+		layers.spr[i]->layer = i;
 	}
 
 	// Insert the sprite at the given index
@@ -452,10 +971,14 @@ uint8_t spriteLayersInsert(sprite *inSprite, uint8_t layer) {
 
 	// Keep track of tag in inSprite
 	inSprite->layer = layer;
+	inSprite->prevFrame = SPRITE_NOT_DRAWN;
 
 	// Increment size to reflect new size	
 	layers.size++;
 
+	// Draw every layer until the buckets are built again
+	bucketsValid = 0;
+
 	return 0;
 }
 
@@ -475,9 +998,14 @@ uint8_t spriteLayersAdd(sprite *inSprite) {
 	if (layers.size >= MAX_LAYERS) {
 		return TOO_MANY_SPRITES;
 	}
+
+	// The buckets are built from interrupts, they are grown here
+	if (spriteReserveBuckets(layers.size + 1)) {
+		return NOT_ENOUGH_MEMORY;
+	}
 	
 	// Reallocate memory for array of structs
-	newPointer = (sprite **)realloc(layers.spr, layers.size+1 * sizeof(sprite *));
+	newPointer = (sprite **)realloc(layers.spr, (layers.size + 1) * sizeof(sprite *));
 	if (newPointer == NULL) {
 		return NOT_ENOUGH_MEMORY;
 	}
@@ -488,10 +1016,14 @@ uint8_t spriteLayersAdd(sprite *inSprite) {
 
 	// Keep track of tag in inSprite
 	inSprite->layer = layers.size;
+	inSprite->prevFrame = SPRITE_NOT_DRAWN;
 
 	// Increment size to reflect new size	
 	layers.size++;
 
+	// Draw every layer until the buckets are built again
+	bucketsValid = 0;
+
 	return 0;
 }
 
@@ -503,11 +1035,18 @@ uint8_t spriteLayersAdd(sprite *inSprite) {
  * @return 0 on success, !0 on failure
  */
 uint8_t spriteLayersRemove(sprite *inSprite) {
-	uint8_t i;
+	uint16_t i;
 	
+	// Sprite is not on a layer
+	if (inSprite->layer < 0) return 0;
+
+	// The buckets may still point to the sprite
+	bucketsValid = 0;
+
 	// Remove the element and move the rest of the elements back
-	for (i = inSprite->layer; i < layers.size - 1; i++) {
+	for (i = inSprite->layer; i + 1 < layers.size; i++) {
 		layers.spr[i] = layers.spr[i + 1];
+		layers.spr[i]->layer = i;
 	}
 
 	// Decrement size
@@ -516,32 +1055,1025 @@ uint8_t spriteLayersRemove(sprite *inSprite) {
 	// Set the layers flag in the sprite
 	inSprite->layer = -1;
 
+	// Redraw the area the sprite was covering
+	if (inSprite->prevFrame != SPRITE_NOT_DRAWN) {
+		videoAddDamage(inSprite->prevXpos, inSprite->prevYpos,
+		               inSprite->width, inSprite->height);
+		inSprite->prevFrame = SPRITE_NOT_DRAWN;
+	}
+
 	return 0;
 }
 
 /*!
- * @brief For every sprite in the spriteLayers, move their file pointers to
- * beginning of their current frame
+ * @brief Move the file pointer of a sprite to a pixel of its current frame
+ *
+ * The compositor seeks each row it reads this way, skipping the rows and
+ * columns clipped off the LCD, rather than every layer once per frame.
+ *
+ * @param inSprite Pointer to the sprite to seek
+ * @param row Row of the current frame the next read will start on
+ * @param col Column of the row the next read will start on, rounded down to
+ * a byte. The runs of a v2 row are always read from its start.
  *
  * @return 0 on success, !0 on failure
  */
-uint8_t seekStartOfFrames(void) {
+uint8_t spriteSeekRow(sprite *inSprite, uint16_t row, uint16_t col) {
+	FIL *file = spriteOwner(inSprite)->file;
+
+	// Sprites made from memory have nothing to seek
+	if (file == NULL) return 0;
+
+	// Skip the header, previous frames, previous rows and clipped columns
+	if (f_lseek(file, inSprite->dataStart
+	            + spriteRowOffset(inSprite, row)
+	            + ((inSprite->frameStarts == NULL)
+	               ? ((uint32_t)col * inSprite->bpp) >> 3 : 0)) != FR_OK) {
+		return FILE_ERROR;
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief Check if any pixel of a sprite lands on the LCD
+ *
+ * @param inSprite Pointer to the sprite to check
+ *
+ * @return 0 if the sprite is hidden or completely off the LCD, !0 otherwise
+ */
+uint8_t spriteOnScreen(sprite *inSprite) {
+	if (inSprite->flags & HIDE) return 0;
+
+	// Positions are signed, compare in 32 bits so the sums cannot wrap
+	return ((int32_t)inSprite->xpos + inSprite->width > 0)
+	       && (inSprite->xpos < LCD_WIDTH)
+	       && ((int32_t)inSprite->ypos + inSprite->height > 0)
+	       && (inSprite->ypos < LCD_HEIGHT);
+}
+
+/*!
+ * @brief Get the sprites that can cover a row of the LCD
+ *
+ * The list comes from the buckets built by updateSprites() and is in layer
+ * order. Each sprite still has to be checked against the row. When layers
+ * changed since the buckets were built, every layer is returned instead.
+ *
+ * @param row Row of the LCD
+ *
+ * @return List of sprites, only valid until the next updateSprites()
+ */
+spriteList spriteGetRowSprites(int16_t row) {
+	spriteList list = {NULL, 0};
+	uint16_t bucket;
+
+	if (!bucketsValid) return layers;
+	if (row < 0 || row >= LCD_HEIGHT) return list;
+
+	bucket = row / SPRITE_BUCKET_ROWS;
+	list.spr = &bucketSprites[bucketStart[bucket]];
+	list.size = bucketStart[bucket + 1] - bucketStart[bucket];
+
+	return list;
+}
+
+/*!
+ * @brief Get a span of palette indexes from a row of the current frame
+ *
+ * If the sprite is cached, a pointer into the cache is returned and nothing
+ * is read. Otherwise only the bytes of the span are read from the file into
+ * the given buffer, seeking only if the file pointer is not already there.
+ *
+ * The runs of a v2 sprite are expanded into the buffer, use spriteReadRuns()
+ * to draw them without expanding.
+ *
+ * @param inSprite Pointer to the sprite to read
+ * @param row Row of the current frame to read
+ * @param first First byte of the row to read
+ * @param bytes Number of bytes to read
+ * @param buffer Buffer of at least bytes bytes used when not cached
+ *
+ * @return Pointer to the first byte of the span, NULL on a file error
+ */
+const uint8_t *spriteReadRow(sprite *inSprite, uint16_t row, uint16_t first,
+                             uint16_t bytes, uint8_t *buffer) {
 	uint32_t offset;
-	uint8_t layer;
-	uint32_t yAdjust = 0;
-
-	for (layer = 0; layer < layers.size; layer++){
-		// Move file pointer to beginning of sprite frame
-		offset = ((layers.spr[layer]->width * layers.spr[layer]->height) + 1) / 2;
-		
-		yAdjust = 0;
-		if (layers.spr[layer]->ypos < 0) {
-			yAdjust = (layers.spr[layer]->ypos * layers.spr[layer]->width) / 2;
-		}
+	uint8_t *cache;
+	sprite *owner;
+	UINT bytesRead;
+	FRESULT result;
+	uint32_t start;
+	const uint8_t *runs;
+	uint16_t runBytes;
+
+	// Runs are read whole, then only the span is expanded
+	if (inSprite->frameStarts != NULL) {
+		runs = spriteReadRuns(inSprite, row, spriteRunBuffer, &runBytes);
+		if (runs == NULL) return NULL;
+		spriteExpandRuns(runs, runBytes, inSprite->bpp, first, bytes, buffer);
+		return buffer;
+	}
 
-		f_lseek(&layers.spr[layer]->file, 
-		 44 + layers.spr[layer]->curFrame * offset - yAdjust);
+	// Offset of the span from the start of the pixel data
+	offset = spriteRowOffset(inSprite, row) + first;
+
+	// Copies read the data of their original, which owns the cache
+	owner = spriteOwner(inSprite);
+
+	// Read the pointer once, the cache may be evicted between calls
+	cache = owner->cache;
+	if (cache != NULL) return cache + offset;
+	if (owner->file == NULL) return NULL;
+
+	// Whole rows are usually read in order, so only seek when they are not,
+	// clipped rows seek past the bytes that are not shown
+	offset += inSprite->dataStart;
+	if (f_tell(owner->file) != offset
+	    && f_lseek(owner->file, offset) != FR_OK) {
+		return NULL;
 	}
 
-	return 0;
+	start = PROFILE_START();
+	result = f_read(owner->file, buffer, bytes, &bytesRead);
+	PROFILE_END(PROFILE_SD_READ, start);
+	if (result != FR_OK || bytesRead != bytes) {
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*!
+ * @brief Get the runs of a row of the current frame of a v2 sprite
+ *
+ * Works like spriteReadRow(), with the whole row read at once. The row table
+ * is kept in RAM, so a row of a sprite that is not cached takes a single seek,
+ * and none when rows are read in order. An empty row reads nothing.
+ *
+ * @param inSprite Pointer to the sprite to read
+ * @param row Row of the current frame to read
+ * @param buffer Buffer of at least SPRITE_MAX_RUN_BYTES bytes used when not
+ * cached
+ * @param bytes Set to the number of bytes of runs in the row
+ *
+ * @return Pointer to the runs, NULL on a file error or if the sprite is not v2
+ */
+const uint8_t *spriteReadRuns(sprite *inSprite, uint16_t row, uint8_t *buffer,
+                              uint16_t *bytes) {
+	uint16_t *rowStart;
+	uint32_t offset;
+	uint8_t *cache;
+	sprite *owner;
+	UINT bytesRead;
+	FRESULT result;
+	uint32_t start;
+
+	if (inSprite->frameStarts == NULL) return NULL;
+
+	// A row ends where the next one starts
+	rowStart = &inSprite->rowStarts[(uint32_t)inSprite->curFrame
+	                                * (inSprite->height + 1) + row];
+	*bytes = rowStart[1] - rowStart[0];
+	offset = spriteRowOffset(inSprite, row);
+
+	// Copies read the data of their original, which owns the cache
+	owner = spriteOwner(inSprite);
+
+	// Read the pointer once, the cache may be evicted between calls
+	cache = owner->cache;
+	if (cache != NULL) return cache + offset;
+	if (owner->file == NULL) return NULL;
+
+	// Nothing to read in a transparent row
+	if (*bytes == 0) return buffer;
+
+	// Rows are stored in order, so only seek when a row was skipped
+	offset += inSprite->dataStart;
+	if (f_tell(owner->file) != offset
+	    && f_lseek(owner->file, offset) != FR_OK) {
+		return NULL;
+	}
+
+	start = PROFILE_START();
+	result = f_read(owner->file, buffer, *bytes, &bytesRead);
+	PROFILE_END(PROFILE_SD_READ, start);
+	if (result != FR_OK || bytesRead != *bytes) {
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*!
+ * @brief Populates a sprite struct from a .spr file read through its file
+ *
+ * @param targetSprite Pointer to the sprite, with its file open
+ * @param start Offset of the .spr file in the file, 0 unless in a pack
+ *
+ * @return 0 on success, !0 on failure. The file is left open either way.
+ */
+static int8_t spriteLoadFile(sprite *targetSprite, uint32_t start) {
+	uint8_t buffer[14];
+	uint8_t version;
+	uint8_t error;
+	UINT bytesRead;
+
+	// Get the tag for the sprite
+	if (spritesAllocatedAdd(targetSprite)) {
+		return TOO_MANY_SPRITES;
+	}
+
+	// Initialize data that is not in file
+	targetSprite->xpos = 0;
+	targetSprite->ypos = 0;
+	targetSprite->xvelocity = 0;
+	targetSprite->yvelocity = 0;
+	targetSprite->curFrame = 0;
+	targetSprite->prevFrame = SPRITE_NOT_DRAWN;
+	targetSprite->flags = 0x00;
+	targetSprite->layer = -1;
+	targetSprite->cache = NULL;
+	targetSprite->source = NULL;
+	targetSprite->frameStarts = NULL;
+	targetSprite->rowStarts = NULL;
+
+	// Get header data
+	if (f_lseek(targetSprite->file, start) != FR_OK
+	    || f_read(targetSprite->file, buffer, 14, &bytesRead) != FR_OK
+	    || bytesRead != 14) {
+		spritesAllocatedRemove(targetSprite);
+		return NO_FILE_ACCESS;
+	}
+	targetSprite->width = (buffer[1] << 8) | buffer[0];	// 2 bytes : width
+	targetSprite->height = (buffer[3] << 8) | buffer[2];	// 2 bytes : height
+	targetSprite->numFrames = buffer[4];	// 1 byte : numFrames
+	targetSprite->numColors = (buffer[5] & 0x00F0) >> 4;	// 4 bits : nColors
+	version = buffer[5] & 0x000F;	// 4 bits : Version
+	targetSprite->bpp = buffer[6] ? buffer[6] : 4;	// 1 byte : Depth
+	targetSprite->paletteBank = buffer[7];	// 1 byte : Bank
+	if (targetSprite->bpp == 8)
+		targetSprite->numColors = buffer[8];	// 1 byte : 8bpp nColors
+
+	// Bytes 10-14 : reserved
+
+	// Only v1 and v2 pixel data at a compiled in depth can be drawn, and a
+	// sprite without frames, columns or rows has nothing to draw
+	if (version > SPRITE_VERSION_2 || !spriteDepthSupported(targetSprite->bpp)
+	    || targetSprite->numFrames == 0 || targetSprite->width == 0
+	    || targetSprite->height == 0) {
+		spritesAllocatedRemove(targetSprite);
+		return FILE_ERROR;
+	}
+
+	// Colors of an 8bpp palette past the 15th follow the header, even when
+	// a bank is used instead
+	targetSprite->dataStart = start + SPRITE_HEADER_BYTES;
+	if (targetSprite->bpp == 8 && targetSprite->numColors > 15) {
+		targetSprite->dataStart +=
+			(targetSprite->numColors - 15) * sizeof(uint16_t);
+	}
+
+	// Get the colors and pixel pairs, from the file or a bank
+	error = spriteLoadPalette(targetSprite, start);
+	if (error) {
+		spritesAllocatedRemove(targetSprite);
+		return error;
+	}
+
+	// Keep the row table of run-length encoded frames in RAM
+	if (version == SPRITE_VERSION_2) {
+		error = spriteLoadRowStarts(targetSprite);
+		if (error) {
+			spriteFreePalette(targetSprite);
+			spritesAllocatedRemove(targetSprite);
+			return error;
+		}
+	}
+
+	// Keep the frames in RAM if caching is on, the file is the fallback
+	if (spriteCaching) spriteCacheLoad(targetSprite);
+
+	return 0;
+}
+
+/*!
+ * @brief Check if pixel data of a depth can be drawn
+ *
+ * @param bpp Bits per pixel
+ *
+ * @return !0 if the depth is compiled in, 0 otherwise
+ */
+static uint8_t spriteDepthSupported(uint8_t bpp) {
+	return (bpp == 4) || (SPRITE_2BPP && bpp == 2) || (SPRITE_8BPP && bpp == 8);
+}
+
+/*!
+ * @brief Get the palette and pixel pairs of a sprite read from a file
+ *
+ * A sprite using a bank shares its colors and pairs, the pairs of the bank
+ * being built for the depth of the sprite the first time. Otherwise the
+ * palette is read from the file, the colors past the 15th from after the
+ * header.
+ *
+ * @param inSprite Pointer to the sprite, with its header read
+ * @param start Offset of the .spr file in the file of the sprite
+ *
+ * @return 0 on success, !0 on failure
+ */
+static uint8_t spriteLoadPalette(sprite *inSprite, uint32_t start) {
+	spritePaletteBank *bank;
+	uint16_t headerColors;
+	uint8_t depth;
+	UINT bytesRead;
+
+	if (inSprite->paletteBank) {
+		if (inSprite->paletteBank > SPRITE_PALETTE_BANKS) return NO_PALETTE;
+		bank = &paletteBanks[inSprite->paletteBank - 1];
+		if (bank->colors == NULL) return NO_PALETTE;
+
+		depth = SPRITE_DEPTH_INDEX(inSprite->bpp);
+		if (bank->pairs[depth] == NULL) {
+			bank->pairs[depth] = spriteMakePairs(bank->colors, bank->numColors,
+			                                     inSprite->bpp);
+			if (bank->pairs[depth] == NULL) return NOT_ENOUGH_MEMORY;
+		}
+
+		inSprite->palette = bank->colors;
+		inSprite->numColors = bank->numColors;
+		inSprite->pairs = bank->pairs[depth];
+		inSprite->pairMasks = SPRITE_PAIR_MASKS(inSprite->pairs, inSprite->bpp);
+		bank->users++;
+
+		return 0;
+	}
+
+	// Allocate palette array
+	inSprite->palette = (uint16_t *)malloc(
+		(inSprite->numColors) * sizeof(uint16_t));
+	if (inSprite->palette == NULL) return NOT_ENOUGH_MEMORY;
+
+	// The colors are little endian, like the Cortex-M4
+	headerColors = (inSprite->numColors > 15) ? 15 : inSprite->numColors;
+	if (f_lseek(inSprite->file, start + SPRITE_PALETTE_START) != FR_OK
+	    || f_read(inSprite->file, inSprite->palette,
+	              headerColors * sizeof(uint16_t), &bytesRead) != FR_OK
+	    || bytesRead != headerColors * sizeof(uint16_t)) {
+		free(inSprite->palette);
+		return NO_FILE_ACCESS;
+	}
+	if (inSprite->numColors > headerColors
+	    && (f_lseek(inSprite->file, start + SPRITE_HEADER_BYTES) != FR_OK
+	        || f_read(inSprite->file, &inSprite->palette[headerColors],
+	                  (inSprite->numColors - headerColors) * sizeof(uint16_t),
+	                  &bytesRead) != FR_OK
+	        || bytesRead != (inSprite->numColors - headerColors)
+	                        * sizeof(uint16_t))) {
+		free(inSprite->palette);
+		return NO_FILE_ACCESS;
+	}
+
+	inSprite->pairs = spriteMakePairs(inSprite->palette, inSprite->numColors,
+	                                  inSprite->bpp);
+	if (inSprite->pairs == NULL) {
+		free(inSprite->palette);
+		return NOT_ENOUGH_MEMORY;
+	}
+	inSprite->pairMasks = SPRITE_PAIR_MASKS(inSprite->pairs, inSprite->bpp);
+
+	return 0;
+}
+
+/*!
+ * @brief Give back the palette and pixel pairs of a sprite
+ *
+ * @param inSprite Pointer to the sprite, not a copy
+ */
+static void spriteFreePalette(sprite *inSprite) {
+	if (inSprite->paletteBank) {
+		paletteBanks[inSprite->paletteBank - 1].users--;
+		return;
+	}
+
+	free(inSprite->palette);
+	free(inSprite->pairs);
+}
+
+/*!
+ * @brief Allocate and fill the pixel pairs of a palette
+ *
+ * @param palette RGB565 colors of the palette
+ * @param numColors Number of colors in the palette
+ * @param bpp Bits per pixel of the pixel data decoded
+ *
+ * @return Pointer to the pairs with their masks after them, NULL if out of
+ * memory
+ */
+static uint32_t *spriteMakePairs(const uint16_t *palette, uint16_t numColors,
+                                 uint8_t bpp) {
+	uint32_t *pairs;
+	uint16_t i;
+
+	// Allocate the pixel pairs and their masks in one block
+	pairs = (uint32_t *)malloc(SPRITE_PAIR_CODES(bpp) * (sizeof(uint32_t) + 1));
+	if (pairs == NULL) return NULL;
+
+	// Decode every possible pair code once
+	for (i = 0; i < SPRITE_PAIR_CODES(bpp); i++) {
+		spriteSetPair(pairs, palette, numColors, bpp, i);
+	}
+
+	return pairs;
+}
+
+/*!
+ * @brief Decode again the pair codes using a palette color
+ *
+ * @param pairs Pixel pairs of the palette
+ * @param palette RGB565 colors of the palette
+ * @param numColors Number of colors in the palette
+ * @param bpp Bits per pixel the pairs decode
+ * @param index Index of the palette color that changed
+ */
+static void spriteUpdatePairs(uint32_t *pairs, const uint16_t *palette,
+                              uint16_t numColors, uint8_t bpp, uint8_t index) {
+	uint8_t pixel = index + 1;
+	uint8_t i;
+
+	switch (bpp) {
+	case 8:
+		spriteSetPair(pairs, palette, numColors, bpp, pixel);
+		break;
+	case 4:
+		// Update every pair with the color in either nibble
+		for (i = 0; i < 16; i++) {
+			spriteSetPair(pairs, palette, numColors, bpp, (i << 4) | pixel);
+			spriteSetPair(pairs, palette, numColors, bpp, (pixel << 4) | i);
+		}
+		break;
+	default:
+		for (i = 0; i < SPRITE_PAIR_CODES(bpp); i++) {
+			spriteSetPair(pairs, palette, numColors, bpp, i);
+		}
+		break;
+	}
+}
+
+/*!
+ * @brief Decode one pair code into its pixel pair and mask
+ *
+ * Transparent pixels are stored as VIDEO_BG so the pair can be drawn as is
+ * when nothing is under the sprite. The second pixel of an 8bpp code is
+ * always transparent.
+ *
+ * @param pairs Pixel pairs to write, with their masks after them
+ * @param palette RGB565 colors of the palette
+ * @param numColors Number of colors in the palette
+ * @param bpp Bits per pixel of the code
+ * @param code Pair code, first pixel in the low bits
+ */
+static void spriteSetPair(uint32_t *pairs, const uint16_t *palette,
+                          uint16_t numColors, uint8_t bpp, uint8_t code) {
+	uint8_t index[2];
+	uint16_t color[2];
+	uint8_t mask = 0;
+	uint8_t i;
+
+	// Split the code into the palette indexes of its pixels
+	switch (bpp) {
+	case 2:
+		index[0] = code & 0x03;
+		index[1] = (code >> 2) & 0x03;
+		break;
+	case 8:
+		index[0] = code;
+		index[1] = 0;
+		break;
+	default:
+		index[0] = code & 0x0F;
+		index[1] = code >> 4;
+		break;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (index[i] == 0) {
+			color[i] = VIDEO_BG;	// Transparent
+			continue;
+		}
+
+		// Colors past the end of the palette are drawn black
+		color[i] = (index[i] <= numColors)
+		           ? palette[index[i] - 1] : LCD_COLOR_BLACK;
+		mask |= SPRITE_PAIR_LOW << i;
+	}
+
+	pairs[code] = ((uint32_t)color[1] << 16) | color[0];
+	SPRITE_PAIR_MASKS(pairs, bpp)[code] = mask;
+}
+
+/*!
+ * @brief Size of one frame of a sprite in bytes
+ *
+ * If the pixels do not fill the last byte, rounds up
+ *
+ * @param inSprite Pointer to the sprite
+ *
+ * @return Number of bytes of a frame
+ */
+static uint32_t spriteFrameBytes(sprite *inSprite) {
+	return ((uint32_t)inSprite->width * inSprite->height * inSprite->bpp + 7) / 8;
+}
+
+/*!
+ * @brief Size of the pixel data of every frame of a sprite
+ *
+ * @param inSprite Pointer to the sprite
+ *
+ * @return Number of bytes from the first frame to the end of the last one
+ */
+static uint32_t spriteDataBytes(sprite *inSprite) {
+	if (inSprite->frameStarts == NULL) {
+		return spriteFrameBytes(inSprite) * inSprite->numFrames;
+	}
+
+	return inSprite->frameStarts[inSprite->numFrames];
+}
+
+/*!
+ * @brief Offset of a row of the current frame from the start of the pixel data
+ *
+ * @param inSprite Pointer to the sprite
+ * @param row Row of the current frame
+ *
+ * @return Offset of the first byte of the row
+ */
+static uint32_t spriteRowOffset(sprite *inSprite, uint16_t row) {
+	if (inSprite->frameStarts == NULL) {
+		return inSprite->curFrame * spriteFrameBytes(inSprite)
+		       + (uint32_t)row * inSprite->width * inSprite->bpp / 8;
+	}
+
+	return inSprite->frameStarts[inSprite->curFrame]
+	       + inSprite->rowStarts[(uint32_t)inSprite->curFrame
+	                             * (inSprite->height + 1) + row];
+}
+
+/*!
+ * @brief Read the row table of a v2 sprite into RAM
+ *
+ * The offset of each frame is the sum of the sizes of the frames before it.
+ * Every row is checked to fit in SPRITE_MAX_RUN_BYTES, and its runs to fit
+ * in the row and in the width of the sprite, so the compositor can trust
+ * them. The pixel data starts after the table.
+ *
+ * @param inSprite Pointer to the sprite, with its file open and the table at
+ * dataStart
+ *
+ * @return 0 on success, !0 on failure
+ */
+static uint8_t spriteLoadRowStarts(sprite *inSprite) {
+	uint32_t entries = (uint32_t)inSprite->numFrames * (inSprite->height + 1);
+	uint32_t *frameStarts;
+	uint16_t *rowStarts;
+	uint16_t *rows;
+	uint16_t row;
+	uint16_t bytes;
+	uint8_t runs[SPRITE_MAX_RUN_BYTES];
+	uint8_t frame;
+	UINT bytesRead;
+
+	// Allocate the frame offsets and the row table in one block
+	frameStarts = (uint32_t *)malloc((inSprite->numFrames + 1) * sizeof(uint32_t)
+	                                 + entries * sizeof(uint16_t));
+	if (frameStarts == NULL) return NOT_ENOUGH_MEMORY;
+	rowStarts = (uint16_t *)(frameStarts + inSprite->numFrames + 1);
+
+	// The table is little endian, like the Cortex-M4
+	if (f_lseek(inSprite->file, inSprite->dataStart) != FR_OK
+	    || f_read(inSprite->file, rowStarts, entries * sizeof(uint16_t),
+	              &bytesRead) != FR_OK
+	    || bytesRead != entries * sizeof(uint16_t)) {
+		free(frameStarts);
+		return NO_FILE_ACCESS;
+	}
+
+	frameStarts[0] = 0;
+	rows = rowStarts;
+	for (frame = 0; frame < inSprite->numFrames; frame++) {
+		for (row = 0; row < inSprite->height; row++) {
+			if (rows[row + 1] < rows[row]
+			    || rows[row + 1] - rows[row] > SPRITE_MAX_RUN_BYTES) {
+				free(frameStarts);
+				return FILE_ERROR;
+			}
+		}
+		frameStarts[frame + 1] = frameStarts[frame] + rows[inSprite->height];
+		rows += inSprite->height + 1;
+	}
+
+	// The runs are drawn as they are, so check them once here
+	rows = rowStarts;
+	for (frame = 0; frame < inSprite->numFrames; frame++) {
+		if (f_lseek(inSprite->file, inSprite->dataStart
+		            + entries * sizeof(uint16_t) + frameStarts[frame]
+		            + rows[0]) != FR_OK) {
+			free(frameStarts);
+			return NO_FILE_ACCESS;
+		}
+		for (row = 0; row < inSprite->height; row++) {
+			bytes = rows[row + 1] - rows[row];
+			if (f_read(inSprite->file, runs, bytes, &bytesRead) != FR_OK
+			    || bytesRead != bytes) {
+				free(frameStarts);
+				return NO_FILE_ACCESS;
+			}
+			if (spriteCheckRuns(runs, bytes, inSprite->width, inSprite->bpp)) {
+				free(frameStarts);
+				return FILE_ERROR;
+			}
+		}
+		rows += inSprite->height + 1;
+	}
+
+	inSprite->frameStarts = frameStarts;
+	inSprite->rowStarts = rowStarts;
+	inSprite->dataStart += entries * sizeof(uint16_t);
+
+	return 0;
+}
+
+/*!
+ * @brief Check that the runs of a v2 row can be drawn
+ *
+ * Each run of pixels must end within the bytes of the row, and the runs
+ * must not cover more columns than the sprite has. Transparent pixels at
+ * the end of a row are not stored, so fewer columns are fine.
+ *
+ * @param runs Runs of the row
+ * @param bytes Number of bytes of runs
+ * @param width Width of the sprite in pixels
+ * @param bpp Bits per pixel of the sprite
+ *
+ * @return 0 if the runs are valid, !0 otherwise
+ */
+static uint8_t spriteCheckRuns(const uint8_t *runs, uint16_t bytes,
+                               uint16_t width, uint8_t bpp) {
+	uint32_t offset = 0;	// Offset of the next control byte
+	uint32_t col = 0;	// Column of the sprite the run starts at
+	uint16_t length;
+	uint8_t control;
+
+	while (offset < bytes) {
+		control = runs[offset++];
+		length = (control & SPRITE_RUN_LENGTH) + 1;
+
+		if (control & SPRITE_RUN_PIXELS) {
+			offset += ((uint32_t)length * bpp + 7) >> 3;
+		}
+
+		col += length;
+	}
+
+	return (offset != bytes || col > width) ? FILE_ERROR : 0;
+}
+
+/*!
+ * @brief Expand a span of a v2 row into packed pixels like a v1 row
+ *
+ * @param runs Runs of the row
+ * @param bytes Number of bytes of runs
+ * @param bpp Bits per pixel of the sprite
+ * @param first First byte of the expanded row to write
+ * @param count Number of bytes to write
+ * @param out Buffer of at least count bytes
+ */
+static void spriteExpandRuns(const uint8_t *runs, uint16_t bytes, uint8_t bpp,
+                             uint16_t first, uint16_t count, uint8_t *out) {
+	const uint8_t *end = runs + bytes;
+	uint32_t col = 0;	// Column of the sprite the run starts at
+	uint32_t colFirst = ((uint32_t)first << 3) / bpp;
+	uint32_t colEnd = (((uint32_t)first + count) << 3) / bpp;
+	uint32_t pixel;
+	uint32_t bit;
+	uint16_t length;
+	uint16_t i;
+	uint8_t control;
+	uint8_t index;
+
+	// Pixels no run covers are transparent
+	memset(out, 0, count);
+
+	while (runs < end && col < colEnd) {
+		control = *runs++;
+		length = (control & SPRITE_RUN_LENGTH) + 1;
+
+		if (control & SPRITE_RUN_PIXELS) {
+			for (i = 0; i < length; i++) {
+				pixel = col + i;
+				if (pixel < colFirst || pixel >= colEnd) continue;
+				bit = (uint32_t)i * bpp;
+				index = (runs[bit >> 3] >> (bit & 7)) & ((1 << bpp) - 1);
+				bit = (pixel - colFirst) * bpp;
+				out[bit >> 3] |= index << (bit & 7);
+			}
+			runs += ((uint32_t)length * bpp + 7) >> 3;
+		}
+
+		col += length;
+	}
+}
+
+/*!
+ * @brief Get the sprite that owns the data of a sprite
+ *
+ * @param inSprite Pointer to the sprite
+ *
+ * @return The original of a copy, the sprite itself otherwise
+ */
+static sprite *spriteOwner(sprite *inSprite) {
+	return (inSprite->source != NULL) ? inSprite->source : inSprite;
+}
+
+/*!
+ * @brief Sort the sprites shown into the buckets of LCD rows they cover
+ *
+ * The buckets are filled in two passes, counting the sprites of each bucket
+ * first, so a sprite covering several buckets is listed in each of them and
+ * every bucket keeps the layer order. Called from the frame interrupts, so
+ * the list only fills the room spriteReserveBuckets() made for it.
+ */
+static void spriteBuildBuckets(void) {
+	uint32_t next[SPRITE_BUCKETS];
+	uint32_t total;
+	uint16_t layer;
+	uint16_t first;
+	uint16_t last;
+	uint16_t b;
+	sprite *spr;
+
+	bucketsValid = 0;
+
+	// Count the sprites of each bucket, one ahead so the sums give the starts
+	for (b = 0; b <= SPRITE_BUCKETS; b++) bucketStart[b] = 0;
+	for (layer = 0; layer < layers.size; layer++) {
+		spr = layers.spr[layer];
+		if (!spriteOnScreen(spr)) continue;
+
+		first = (spr->ypos < 0) ? 0 : spr->ypos / SPRITE_BUCKET_ROWS;
+		last = ((int32_t)spr->ypos + spr->height > LCD_HEIGHT)
+		       ? SPRITE_BUCKETS - 1
+		       : (spr->ypos + spr->height - 1) / SPRITE_BUCKET_ROWS;
+		for (b = first; b <= last; b++) bucketStart[b + 1]++;
+	}
+	for (b = 0; b < SPRITE_BUCKETS; b++) bucketStart[b + 1] += bucketStart[b];
+
+	// The list was grown by spriteReserveBuckets(), never from here
+	total = bucketStart[SPRITE_BUCKETS];
+	if (total > bucketCapacity) return;
+
+	// Fill the buckets in layer order
+	for (b = 0; b < SPRITE_BUCKETS; b++) next[b] = bucketStart[b];
+	for (layer = 0; layer < layers.size; layer++) {
+		spr = layers.spr[layer];
+		if (!spriteOnScreen(spr)) continue;
+
+		first = (spr->ypos < 0) ? 0 : spr->ypos / SPRITE_BUCKET_ROWS;
+		last = ((int32_t)spr->ypos + spr->height > LCD_HEIGHT)
+		       ? SPRITE_BUCKETS - 1
+		       : (spr->ypos + spr->height - 1) / SPRITE_BUCKET_ROWS;
+		for (b = first; b <= last; b++) bucketSprites[next[b]++] = spr;
+	}
+
+	bucketsValid = 1;
+}
+
+/*!
+ * @brief Grow the list of the buckets for a number of layers
+ *
+ * Each layer may cover every bucket. The list is only grown from the main
+ * loop, never from the frame interrupts that fill it, and swapped with
+ * interrupts masked so they never see it half replaced.
+ *
+ * @param numLayers Number of layers the list must hold
+ *
+ * @return 0 on success, !0 on failure
+ */
+static uint8_t spriteReserveBuckets(uint16_t numLayers) {
+	uint32_t capacity = (uint32_t)numLayers * SPRITE_BUCKETS;
+	sprite **newPointer;
+	sprite **oldPointer;
+
+	if (capacity <= bucketCapacity) return 0;
+
+	// The buckets are built again, nothing is copied
+	newPointer = (sprite **)malloc(capacity * sizeof(sprite *));
+	if (newPointer == NULL) return 1;
+
+	__disable_irq();
+	oldPointer = bucketSprites;
+	bucketSprites = newPointer;
+	bucketCapacity = capacity;
+	bucketsValid = 0;
+	__enable_irq();
+
+	free(oldPointer);
+	return 0;
+}
+
+/*
+ * sprite cache functions
+ */
+/*!
+ * @brief Cache the frames of every sprite initialized from now on
+ *
+ * @note The cache is off by default
+ */
+void spriteCacheOn(void) {
+	spriteCaching = 1;
+}
+
+/*!
+ * @brief Stop caching newly initialized sprites
+ *
+ * Sprites already in the cache stay there until they are released or evicted.
+ */
+void spriteCacheOff(void) {
+	spriteCaching = 0;
+}
+
+/*!
+ * @brief Load every frame of a sprite into the CCMRAM cache
+ *
+ * If the cache is full, the least recently shown sprites that are not on a
+ * layer are evicted until the frames fit. Evicted sprites fall back to
+ * reading from the SD card.
+ *
+ * @param inSprite Pointer to the sprite to cache
+ *
+ * @return 0 on success, !0 on failure
+ */
+uint8_t spriteCacheLoad(sprite *inSprite) {
+#if SPRITE_CACHE_BYTES
+	uint32_t bytes;
+	uint32_t size;
+	uint32_t start;
+	int16_t index;
+	uint16_t i;
+	UINT bytesRead;
+
+	// Copies share the cache of their original
+	inSprite = spriteOwner(inSprite);
+
+	// Already cached, or made from memory
+	if (inSprite->cache != NULL || inSprite->file == NULL) return 0;
+
+	// Keep regions word aligned
+	bytes = spriteDataBytes(inSprite);
+	size = (bytes + 3) & ~3;
+	if (size > SPRITE_CACHE_BYTES) return NOT_ENOUGH_MEMORY;
+
+	// Make room by evicting the least recently shown sprites
+	while ((index = spriteCacheFindGap(size, &start)) < 0) {
+		if (spriteCacheEvict()) return NOT_ENOUGH_MEMORY;
+	}
+
+	// Read every frame straight into the pool
+	if (f_lseek(inSprite->file, inSprite->dataStart) != FR_OK
+	    || f_read(inSprite->file, &spriteCachePool[start], bytes, &bytesRead) != FR_OK
+	    || bytesRead != bytes) {
+		return FILE_ERROR;
+	}
+
+	// Insert the region, keeping the list sorted
+	for (i = spriteCacheSize; i > index; i--) {
+		spriteCacheEntries[i] = spriteCacheEntries[i - 1];
+	}
+	spriteCacheEntries[index].owner = inSprite;
+	spriteCacheEntries[index].start = start;
+	spriteCacheEntries[index].size = size;
+	spriteCacheEntries[index].lastUsed = spriteClock;
+	spriteCacheSize++;
+
+	// The compositor uses the cache from now on
+	inSprite->cache = &spriteCachePool[start];
+
+	return 0;
+#else
+	return NOT_ENOUGH_MEMORY;
+#endif
+}
+
+/*!
+ * @brief Remove a sprite from the cache and give its space back
+ *
+ * @param inSprite Pointer to the sprite to release
+ */
+void spriteCacheRelease(sprite *inSprite) {
+#if SPRITE_CACHE_BYTES
+	uint16_t i;
+
+	if (inSprite->cache == NULL) return;
+
+	// Find the region, sprites made from memory do not have one
+	for (i = 0; i < spriteCacheSize; i++) {
+		if (spriteCacheEntries[i].owner == inSprite) break;
+	}
+	if (i == spriteCacheSize) return;
+
+	// Fall back to the file before the space can be reused
+	inSprite->cache = NULL;
+
+	// Remove the region and move the rest of the regions back
+	for (; i + 1 < spriteCacheSize; i++) {
+		spriteCacheEntries[i] = spriteCacheEntries[i + 1];
+	}
+	spriteCacheSize--;
+#endif
+}
+
+#if SPRITE_CACHE_BYTES
+/*!
+ * @brief Find the first free region of the pool that fits the given size
+ *
+ * @param size Number of bytes needed
+ * @param start Set to the offset of the free region in the pool
+ *
+ * @return Index in the region list to insert at, -1 if nothing fits
+ */
+static int16_t spriteCacheFindGap(uint32_t size, uint32_t *start) {
+	uint16_t i;
+	uint32_t end = 0;
+
+	// A region is also needed in the list
+	if (spriteCacheSize >= MAX_SPRITES) return -1;
+
+	// Look between regions, then after the last one
+	for (i = 0; i < spriteCacheSize; i++) {
+		if (spriteCacheEntries[i].start - end >= size) break;
+		end = spriteCacheEntries[i].start + spriteCacheEntries[i].size;
+	}
+	if (i == spriteCacheSize && SPRITE_CACHE_BYTES - end < size) return -1;
+
+	*start = end;
+	return i;
+}
+
+/*!
+ * @brief Check whether a cached sprite or any copy of it is on a layer
+ *
+ * @param owner Pointer to the sprite owning the cached frames
+ *
+ * @return 1 if the frames are shown by a layer, 0 otherwise
+ */
+static uint8_t spriteCacheOnLayer(sprite *owner) {
+	uint16_t i;
+
+	if (owner->layer >= 0) return 1;
+	for (i = 0; i < layers.size; i++) {
+		if (spriteOwner(layers.spr[i]) == owner) return 1;
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief Evict the least recently shown cached sprite that is not on a layer
+ *
+ * Sprites on layers, directly or through a copy, are never evicted, so the
+ * compositor is not forced back to the SD card in the middle of a scene.
+ *
+ * @return 0 on success, !0 if nothing can be evicted
+ */
+static uint8_t spriteCacheEvict(void) {
+	uint16_t i;
+	int16_t oldest = -1;
+
+	for (i = 0; i < spriteCacheSize; i++) {
+		if (spriteCacheOnLayer(spriteCacheEntries[i].owner)) continue;
+		if (oldest < 0 || spriteClock - spriteCacheEntries[i].lastUsed
+		                  > spriteClock - spriteCacheEntries[oldest].lastUsed) {
+			oldest = i;
+		}
+	}
+	if (oldest < 0) return NOT_ENOUGH_MEMORY;
+
+	spriteCacheRelease(spriteCacheEntries[oldest].owner);
+
+	return 0;
+}
+
+/*!
+ * @brief Mark a cached sprite as shown on the current frame
+ *
+ * @param inSprite Pointer to the cached sprite
+ */
+static void spriteCacheTouch(sprite *inSprite) {
+	uint16_t i;
+
+	for (i = 0; i < spriteCacheSize; i++) {
+		if (spriteCacheEntries[i].owner == inSprite) {
+			spriteCacheEntries[i].lastUsed = spriteClock;
+			return;
+		}
+	}
 }
+#endif
@@ -0,0 +1,274 @@
+/*!
+ * @file tilemap.c
+ * @author Mason Roach
+ * @author Patrick Roy
+ * @date Oct 18 2026
+ *
+ * @brief Functions to interact with the tile-map background
+ *
+ * A tile map is drawn under every sprite in place of the plain background
+ * color. The tiles come from a .spr file, where each frame of the sprite is
+ * one tile, and the layout of the tiles comes from a .map file.
+ */
+#include "tilemap.h"
+#include "video.h"
+
+// Static function prototypes
+static uint32_t tilemapWrap(int32_t value, uint32_t size);
+
+/*!
+ * @brief Populates a tilemap struct
+ *
+ * Loads every tile of the tileset and the whole map into RAM, so drawing the
+ * background never reads from the SD card.
+ *
+ * @note This function does not allocate memory for the tilemap struct itself.
+ * It is up to the user to allocate the memory.
+ *
+ * @param targetMap Pointer to a tilemap struct with allocated memory
+ * @param tileFile Name of the .spr file holding the tiles
+ * @param mapFile Name of the .map file holding the layout
+ *
+ * @return 0 on success, a SPRITE_ERROR on failure
+ */
+int8_t initTilemap(tilemap *targetMap, char *tileFile, char *mapFile) {
+	FIL file;
+	UINT bytesRead;
+	uint8_t header[4];
+	uint32_t frameBytes;
+	uint32_t cells;
+	uint32_t i;
+	uint16_t rowBytes;
+	uint16_t row;
+	uint8_t tile;
+	int8_t error;
+
+	// Open the tileset like any other sprite
+	error = initSprite(&targetMap->tiles, tileFile);
+	if (error) return error;
+
+	// The tiles get their own buffer, they are never evicted from the cache
+	spriteCacheRelease(&targetMap->tiles);
+
+	targetMap->tileData = NULL;
+	targetMap->map = NULL;
+	targetMap->xscroll = 0;
+	targetMap->yscroll = 0;
+	targetMap->drawnXscroll = 0;
+	targetMap->drawnYscroll = 0;
+
+	// Tiles are drawn by a 4bpp loop, and rows of a tile must start on a byte.
+	// The map wraps around its size in pixels, which must not be 0
+	if (targetMap->tiles.bpp != 4 || (targetMap->tiles.width & 1)
+	    || targetMap->tiles.width == 0 || targetMap->tiles.height == 0) {
+		destroyTilemap(targetMap);
+		return FILE_ERROR;
+	}
+
+	// Allocate and read every tile
+	rowBytes = targetMap->tiles.width / 2;
+	frameBytes = (uint32_t)rowBytes * targetMap->tiles.height;
+	targetMap->tileData = (uint8_t *)malloc(
+		frameBytes * targetMap->tiles.numFrames);
+	if (targetMap->tileData == NULL) {
+		destroyTilemap(targetMap);
+		return NOT_ENOUGH_MEMORY;
+	}
+
+	for (tile = 0; tile < targetMap->tiles.numFrames; tile++) {
+		targetMap->tiles.curFrame = tile;
+		for (row = 0; row < targetMap->tiles.height; row++) {
+			if (spriteReadRow(&targetMap->tiles, row, 0, rowBytes,
+			                  targetMap->tileData + tile * frameBytes
+			                  + row * rowBytes) == NULL) {
+				destroyTilemap(targetMap);
+				return FILE_ERROR;
+			}
+		}
+	}
+
+	// Open the map file
+	if (f_open(&file, mapFile, FA_READ) != FR_OK) {
+		destroyTilemap(targetMap);
+		return NO_FILE_ACCESS;
+	}
+
+	// Get header data
+	if (f_read(&file, header, 4, &bytesRead) != FR_OK || bytesRead != 4) {
+		f_close(&file);
+		destroyTilemap(targetMap);
+		return FILE_ERROR;
+	}
+	targetMap->mapWidth = (header[1] << 8) | header[0];	// 2 bytes : width
+	targetMap->mapHeight = (header[3] << 8) | header[2];	// 2 bytes : height
+
+	// Allocate and read the cells
+	cells = (uint32_t)targetMap->mapWidth * targetMap->mapHeight;
+	targetMap->map = (uint8_t *)malloc(cells);
+	if (targetMap->map == NULL) {
+		f_close(&file);
+		destroyTilemap(targetMap);
+		return NOT_ENOUGH_MEMORY;
+	}
+
+	if (cells == 0 || f_read(&file, targetMap->map, cells, &bytesRead) != FR_OK
+	    || bytesRead != cells) {
+		f_close(&file);
+		destroyTilemap(targetMap);
+		return FILE_ERROR;
+	}
+	f_close(&file);
+
+	// Every cell must point to an existing tile
+	for (i = 0; i < cells; i++) {
+		if (targetMap->map[i] >= targetMap->tiles.numFrames) {
+			destroyTilemap(targetMap);
+			return FILE_ERROR;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief Frees memory allocated by a tilemap
+ *
+ * @note The tilemap must not be the video background anymore
+ *
+ * @param inMap Tilemap struct to destroy
+ */
+void destroyTilemap(tilemap *inMap) {
+	destroySprite(&inMap->tiles);
+
+	// Free memory
+	free(inMap->tileData);
+	free(inMap->map);
+	inMap->tileData = NULL;
+	inMap->map = NULL;
+}
+
+/*!
+ * @brief Set the position in the map shown at the top left of the LCD
+ *
+ * The new position is used starting from the next frame.
+ *
+ * @param inMap Pointer to the tilemap struct to change
+ * @param x New x position in pixels
+ * @param y New y position in pixels
+ */
+void tilemapSetScroll(tilemap *inMap, int16_t x, int16_t y) {
+	inMap->xscroll = x;
+	inMap->yscroll = y;
+}
+
+/*!
+ * @brief Change the tile of a cell of the map
+ *
+ * Every area of the LCD showing the cell is marked as damaged.
+ *
+ * @param inMap Pointer to the tilemap struct to change
+ * @param col Column of the cell in tiles
+ * @param row Row of the cell in tiles
+ * @param tile Frame of the tileset to show in the cell
+ */
+void tilemapSetTile(tilemap *inMap, uint16_t col, uint16_t row, uint8_t tile) {
+	uint16_t tileWidth = inMap->tiles.width;
+	uint16_t tileHeight = inMap->tiles.height;
+	int32_t mapPixelWidth = (int32_t)inMap->mapWidth * tileWidth;
+	int32_t mapPixelHeight = (int32_t)inMap->mapHeight * tileHeight;
+	int32_t x;
+	int32_t y;
+
+	if (col >= inMap->mapWidth || row >= inMap->mapHeight
+	    || tile >= inMap->tiles.numFrames) return;
+
+	inMap->map[row * inMap->mapWidth + col] = tile;
+
+	// Position of the cell on the LCD as currently drawn, the damage is moved
+	// with the LCD contents if the map scrolls before the next frame
+	x = tilemapWrap((int32_t)col * tileWidth - inMap->drawnXscroll,
+	                mapPixelWidth);
+	y = tilemapWrap((int32_t)row * tileHeight - inMap->drawnYscroll,
+	                mapPixelHeight);
+
+	// The map repeats if it is smaller than the LCD, starting one map early
+	// catches a cell cut by the left or top side
+	for (y -= mapPixelHeight; y < LCD_HEIGHT; y += mapPixelHeight) {
+		for (x -= mapPixelWidth; x < LCD_WIDTH; x += mapPixelWidth) {
+			videoAddDamage(x, y, tileWidth, tileHeight);
+		}
+		x = tilemapWrap(x, mapPixelWidth);
+	}
+}
+
+/*!
+ * @brief Draw a row of the tilemap into a buffer
+ *
+ * @param inMap Pointer to the tilemap to draw
+ * @param dst Buffer of at least x1 - x0 pixels
+ * @param x0 First LCD column to draw (inclusive)
+ * @param x1 Last LCD column to draw (exclusive)
+ * @param y LCD row to draw
+ */
+void tilemapDrawRow(tilemap *inMap, uint16_t *dst, int16_t x0, int16_t x1,
+                    int16_t y) {
+	uint16_t tileWidth = inMap->tiles.width;
+	uint16_t tileHeight = inMap->tiles.height;
+	uint32_t *pairs = inMap->tiles.pairs;
+	uint16_t *end = dst + (x1 - x0);
+	uint32_t frameBytes;
+	uint32_t mapX;
+	uint32_t mapY;
+	uint16_t col;
+	uint16_t tileX;
+	const uint8_t *cells;
+	const uint8_t *src;
+
+	frameBytes = (uint32_t)tileWidth / 2 * tileHeight;
+
+	// Find the row of cells and the row of the tiles in them
+	mapY = tilemapWrap(y + inMap->drawnYscroll,
+	                   (uint32_t)inMap->mapHeight * tileHeight);
+	cells = inMap->map + (mapY / tileHeight) * inMap->mapWidth;
+
+	// Find the first cell and the column of the tile in it
+	mapX = tilemapWrap(x0 + inMap->drawnXscroll,
+	                   (uint32_t)inMap->mapWidth * tileWidth);
+	col = mapX / tileWidth;
+	tileX = mapX % tileWidth;
+
+	while (dst < end) {
+		src = inMap->tileData + cells[col] * frameBytes
+		      + (mapY % tileHeight) * (tileWidth / 2);
+
+		// Pairs hold VIDEO_BG for index 0, so no pixel needs a mask
+		if (tileX & 1) {
+			*dst++ = pairs[src[tileX >> 1]] >> 16;	// Leading high nibble
+			tileX++;
+		}
+
+		// Two pixels per byte with one lookup and one store
+		for (; tileX < tileWidth && dst + 1 < end; tileX += 2, dst += 2)
+			SPRITE_STORE_PAIR(dst, pairs[src[tileX >> 1]]);
+
+		// Trailing low nibble at the end of the buffer
+		if (tileX < tileWidth && dst < end) *dst++ = pairs[src[tileX >> 1]];
+
+		// Move to the next cell, wrapping around the map
+		tileX = 0;
+		if (++col == inMap->mapWidth) col = 0;
+	}
+}
+
+/*!
+ * @brief Wrap a position into the range [0, size)
+ *
+ * @param value Position to wrap, may be negative
+ * @param size Size of the range
+ *
+ * @return Wrapped position
+ */
+static uint32_t tilemapWrap(int32_t value, uint32_t size) {
+	value %= (int32_t)size;
+	return (value < 0) ? value + size : value;
+}
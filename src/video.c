@@ -15,88 +15,255 @@
 /*!
  * @brief Fills a video buffer with data to be sent to the LCD
  *
- * @note This function reads from the FatFs file system. On a read fail,
- * the error LED on the Sparkbox turns on and this program hangs in a 
- * dead loop
+ * @note Sprites that are not cached are read from the FatFs file system.
+ * On a read fail, the error LED on the Sparkbox turns on and this program
+ * hangs in a dead loop
+ *
+ * @param x0 First LCD column of the window (inclusive)
+ * @param x1 Last LCD column of the window (exclusive)
+ * @param y First LCD row to fill
+ * @param rows Number of rows to fill
  *
  * @return 0 on success
  */
-static uint8_t getNextRows(void);
+static uint8_t getNextRows(int16_t x0, int16_t x1, int16_t y, uint8_t rows);
 
 /*!
- * @brief Toggles the video buffers currently playing and reading
+ * @brief Paints packed pixels of a sprite over a row of the buffer with the
+ * loop of its depth
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low bits first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
  */
-static void toggleVideoBuffers(void);
+static void paintPixels(sprite *spr, const uint8_t *src, uint16_t col,
+                        uint16_t *dst, uint16_t count);
 
 /*!
- * @brief Fills a video buffer using the getNextRows function and
- * controls flags for read complete 
+ * @brief Paints 4bpp pixels of a sprite over a row of the buffer
  *
- * @return 0 on success
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low nibble first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels4(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count);
+
+#if SPRITE_2BPP
+/*!
+ * @brief Paints 2bpp pixels of a sprite over a row of the buffer
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low bits first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels2(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count);
+#endif
+
+#if SPRITE_8BPP
+/*!
+ * @brief Paints 8bpp pixels of a sprite over a row of the buffer
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src One palette index per byte
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels8(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count);
+#endif
+
+/*!
+ * @brief Paints the opaque pixels of a pair code on two pixels of the buffer
+ *
+ * @param spr Sprite the pair code belongs to
+ * @param code Pair code of the two pixels
+ * @param dst Pixel of the buffer to paint the first pixel on
+ */
+static inline void paintPair(sprite *spr, uint8_t code, uint16_t *dst);
+
+/*!
+ * @brief Paints the runs of a row of a v2 sprite over a row of the buffer
+ *
+ * @param spr Sprite the runs belong to
+ * @param runs Runs of the row
+ * @param bytes Number of bytes of runs
+ * @param col First column of the sprite to paint
+ * @param colEnd Column of the sprite past the last one to paint
+ * @param dst Pixel of the buffer to paint column col on
+ */
+static void paintRuns(sprite *spr, const uint8_t *runs, uint16_t bytes,
+                      uint16_t col, uint16_t colEnd, uint16_t *dst);
+
+/*!
+ * @brief Fills the strip at the head of the ring using the getNextRows
+ * function
+ *
+ * @return 0 on success, 1 if every rectangle of the frame has been read
+ */
+static uint8_t readToVideoBuffer(void);
+
+/*!
+ * @brief Fills every free strip of the ring, starting the DMA if it ran dry
+ */
+static void fillRing(void);
+
+/*!
+ * @brief Sets the LCD window if needed and starts the DMA transfer of the
+ * strip at the tail of the ring
+ */
+static void startTransfer(void);
+
+/*!
+ * @brief Stops the frame once every strip has been sent
+ */
+static void finishFrame(void);
+
+/*!
+ * @brief Asks the renderer to fill the free strips of the ring
+ */
+static void wakeRenderer(void);
+
+/*!
+ * @brief Applies the scroll of the background tilemap for the next frame
+ *
+ * Horizontal scrolling with damage tracking on moves the LCD contents with the
+ * hardware scroll, so only the newly exposed columns are drawn. Any other
+ * scroll redraws the whole LCD.
+ */
+static void scrollBackground(void);
+
+/*!
+ * @brief Adds a rectangle to the list of rectangles to send this frame
+ *
+ * The rectangle is split in two if its LCD memory columns wrap around the
+ * hardware scroll.
+ *
+ * @param r Rectangle to add, in LCD coordinates
+ */
+static void addFrameRect(const videoRect *r);
+
+/*!
+ * @brief Counts LCD refreshes and starts a frame every vsyncDivisor of them
+ *
+ * @param count Number of LCD refreshes since the last call
+ */
+static void vsync(uint16_t count);
+
+/*!
+ * @brief Polls the LCD scanline and detects the start of a refresh
  */
-static FRESULT readToVideoBuffer(void);
+static void pollScanline(void);
+
+// Ring of strips, filled at the head by the compositor and sent from the
+// tail by the DMA
+videoStrip strips[VIDEO_RING_SLOTS];
+uint8_t stripHead = 0;
+uint8_t stripTail = 0;
+volatile uint8_t stripsReady = 0;
+
+// Statistics of the ring
+videoRingStats ringStats = {0, 0, 0};
+
+// Cycle counts of the frame being sent and of the DMA waiting for strips,
+// which starts when the DMA runs out of strips
+uint32_t frameStartCycles = 0;
+uint32_t idleStartCycles = 0;
+uint32_t idleCycles = 0;
+
+// Cycle counts of the last frame sent
+uint32_t lastTransferCycles = 0;
+uint32_t lastIdleCycles = 0;
+
+// Visible span of a sprite row read from FatFs when a sprite is not cached,
+// up to a byte per pixel at 8bpp, or the runs of a whole v2 row
+uint8_t *fetched;
+#define FETCHED_BYTES ((LCD_WIDTH > SPRITE_MAX_RUN_BYTES) \
+                       ? LCD_WIDTH : SPRITE_MAX_RUN_BYTES)
+
+// Strip being filled by the compositor
+#define READ_BUFFER (strips[stripHead].pixels)
+
+// Two background pixels packed for 32-bit buffer fills
+#define VIDEO_BG_WORD (((uint32_t)VIDEO_BG << 16) | VIDEO_BG)
 
-// Video buffers containing data for the LCD
-uint16_t *videoBuffer1;
-uint16_t *videoBuffer2;
+// Rectangles damaged since the last frame, and those of the current frame
+videoRect damage[MAX_DAMAGE_RECTS];
+uint8_t numDamage = 0;
+videoRect frameRects[2 * MAX_DAMAGE_RECTS];
+uint8_t numFrameRects = 0;
 
-// 2D array storing sprite pallete indexes read from FatFs 
-uint32_t **fetched;
+// Tilemap drawn under the sprites, NULL for a plain background
+tilemap *background = NULL;
 
+// Memory column shown at the left of the LCD by the hardware scroll
+uint16_t hwScroll = 0;
 
-// 0 if currently playing buffer 2 (reading 1)
-// 1 if currently playing buffer 1 (reading 2)
-uint8_t videoBuffer = 0;
+// Source of the vsync and number of LCD refreshes per frame
+uint8_t vsyncMode = VSYNC_OFF;
+uint8_t vsyncDivisor = 1;
 
-uint8_t bufferTransfers = 0;
-// Define statements to select READ_BUFFER or PLAY_BUFFER
-// based on which is being played and which is being filled
-#define READ_BUFFER (videoBuffer ? videoBuffer2 : videoBuffer1)
-#define PLAY_BUFFER (videoBuffer ? videoBuffer1 : videoBuffer2)
+// LCD refreshes since the last frame and TE signals not handled yet
+uint8_t vsyncCount = 0;
+volatile uint8_t tearingEffects = 0;
+
+// Last scanline polled and polls since the last refresh started
+uint16_t lastScanline = 0;
+uint16_t scanlinePolls = 0;
+
+// Number of frames not done by their vsync
+volatile uint32_t missedVsyncs = 0;
+
+// Rectangle currently being read and the next row to read in it
+uint8_t rectIndex = 0;
+int16_t rectRow = 0;
 
 // Flags used to prevent data writing and reading errors
 uint8_t frameUpdate = 0;
-uint8_t transferComplete = 0;
-uint8_t frameComplete = 0;
-uint8_t readComplete = 0;
+uint8_t damageTracking = 0;
+volatile uint8_t transferComplete = 0;
+volatile uint8_t frameComplete = 0;
+uint8_t frameRead = 0;
 
 // Handles for initialization
 DMA_HandleTypeDef hdma_memtomem_dma2_stream5;
-TIM_HandleTypeDef htim7;
 TIM_HandleTypeDef htim10;
 
 /*!
  * @brief Initializes video peripherals
  *
  * This function allocates required memory and initializes video peripherals.
- * These peripherals include Timers 7 and 10 as well as DMA transfers. 
+ * These peripherals include Timer 10, the PendSV renderer and DMA transfers.
  *
- * @note This function allocates memory for both video buffers and a buffer
- * for reading sprite pixels from the FatFs file system
+ * @note This function allocates memory for the VIDEO_RING_SLOTS strips of the
+ * ring and a buffer for reading sprite pixels from the FatFs file system
  *
  * @return 0 on success, -1 on failure
  */
 int8_t initVideo(void)
 {
-	TIM_MasterConfigTypeDef sMasterConfig;
+	uint16_t *ring;
 	uint8_t i;
 
-	// Allocate memory for video buffers
-	videoBuffer1 = (uint16_t*)malloc(sizeof(uint8_t) * VID_BUF_BYTES);
-	videoBuffer2 = (uint16_t*)malloc(sizeof(uint8_t) * VID_BUF_BYTES);
-
-	// Allocate first dimension of 2D array
-	fetched = (uint32_t**)malloc(sizeof(uint32_t*) * MAX_LAYERS);
-
-	// Allocate second dimension of 2D array
-	for (i=0; i<MAX_LAYERS; i++) {
-		fetched[i] = (uint32_t*)malloc(sizeof(uint8_t) * (LCD_WIDTH / 2));
-		if (fetched[i] == NULL) return -1;
+	// Allocate memory for every strip of the ring at once
+	ring = (uint16_t*)malloc(sizeof(uint8_t) * VID_BUF_BYTES * VIDEO_RING_SLOTS);
+	for (i = 0; ring != NULL && i < VIDEO_RING_SLOTS; i++) {
+		strips[i].pixels = ring + i * (VID_BUF_BYTES / 2);
 	}
 
+	// Allocate a single sprite row, sprites are painted one at a time
+	fetched = (uint8_t*)malloc(sizeof(uint8_t) * FETCHED_BYTES);
+
 	// If memory allocation failed, stop here and return
-	if (videoBuffer1 == NULL
-		|| videoBuffer2 == NULL
+	if (ring == NULL
 		|| fetched == NULL
 	) return -1;
 
@@ -125,16 +292,12 @@ int8_t initVideo(void)
 	HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, 0, 0);
 	HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
 
-	// Initialize Timer 7 for DMA
-	htim7.Instance = TIM7;
-	htim7.Init.Prescaler = TIM7PSC;
-	htim7.Init.CounterMode = TIM_COUNTERMODE_UP;
-	htim7.Init.Period = TIM7ARR;
-	HAL_TIM_Base_Init(&htim7);
+	// The renderer runs below every other interrupt, and is woken by the DMA
+	NVIC_SetPriority(PendSV_IRQn, 0x0F);
 
-	sMasterConfig.MasterOutputTrigger = TIM_TRGO_ENABLE;
-	sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-	HAL_TIMEx_MasterConfigSynchronization(&htim7, &sMasterConfig);
+	// Count cycles to time frame transfers and profile zones
+	initProfiler();
+	DWT->CYCCNT = 0;
 
 	// Initialize TIM 10 to trigger at 20 Hz
 	htim10.Instance = TIM10;
@@ -147,12 +310,16 @@ int8_t initVideo(void)
 	// Turn off frame updating
 	frameUpdateOff();
 
+	// The whole width of the LCD moves with the hardware scroll
+	LcdSetScrollArea(0, LCD_WIDTH, 0);
+	LcdSetScrollStart(hwScroll);
+
 	// Start timer 10
 	HAL_TIM_Base_Start_IT(&htim10);
 
 	transferComplete = 1;
 	frameComplete = 1;
-	readComplete = 1;
+	frameRead = 1;
 	
 	return 0;
 }
@@ -163,11 +330,27 @@ int8_t initVideo(void)
  */
 void TIM1_UP_TIM10_IRQHandler(void)
 {
+	uint8_t count;
 
 	HAL_TIM_IRQHandler(&htim10);
 
-	// Update the frame if it is on
-	if (frameUpdate) updateFrame();
+	switch (vsyncMode) {
+	case VSYNC_TE:
+		// Pended by the TE interrupt
+		__disable_irq();
+		count = tearingEffects;
+		tearingEffects = 0;
+		__enable_irq();
+		if (count) vsync(count);
+		break;
+	case VSYNC_SCANLINE:
+		pollScanline();
+		break;
+	default:
+		// Update the frame if it is on
+		if (frameUpdate) updateFrame();
+		break;
+	}
 }
 
 /*!
@@ -195,32 +378,588 @@ void frameUpdateOff(void)
 }
 
 /*!
- * @brief Fills a video buffer using the getNextRows function and
- * controls flags for read complete 
+ * @brief Start frames in sync with the refresh of the LCD
  *
- * @return 0 on success
+ * Frames start at the beginning of a refresh of the LCD instead of on Timer
+ * 10, so the data sent follows the refresh instead of tearing through it.
+ * The LCD refreshes at VSYNC_PANEL_HZ while vsync is on.
+ *
+ * With VSYNC_TE, the TE output of the LCD must be wired to PB8. With
+ * VSYNC_SCANLINE, Timer 10 polls the scanline of the LCD while no frame is
+ * being sent.
+ *
+ * @note Frames are still only drawn while frame updating is on
+ *
+ * @param mode Source of the vsync, VSYNC_TE or VSYNC_SCANLINE
+ * @param divisor Number of LCD refreshes per frame
+ */
+void videoVsyncOn(VSYNC_MODE mode, uint8_t divisor)
+{
+	if (mode == VSYNC_OFF) {
+		videoVsyncOff();
+		return;
+	}
+
+	// Stop starting frames and let the current one finish, the LCD
+	// commands below share the FSMC with the DMA
+	HAL_TIM_Base_Stop_IT(&htim10);
+	while (!frameComplete);
+
+	vsyncMode = mode;
+	vsyncDivisor = divisor ? divisor : 1;
+	vsyncCount = 0;
+	tearingEffects = 0;
+	lastScanline = 0;
+	scanlinePolls = 0;
+	missedVsyncs = 0;
+
+	// Refresh rate that divides into the usual frame rates
+	LcdSetFrameRate(VSYNC_PANEL_RTNA);
+
+	if (mode == VSYNC_TE) {
+		LcdTearingEffect(1);
+
+		// Initialize TE (PB8) as input
+		RCC->AHB1ENR |= RCC_AHB1ENR_GPIOBEN;
+		RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+		GPIOB->MODER &= ~GPIO_MODER_MODER8; // GPIO Mode Input
+		GPIOB->PUPDR &= ~GPIO_PUPDR_PUPDR8; // GPIO PU/PD -> No Pull-up/down
+
+		// Select PORTB for EXTI8, interrupt on the start of blanking
+		SYSCFG->EXTICR[2] = (SYSCFG->EXTICR[2] & ~SYSCFG_EXTICR3_EXTI8)
+		                    | SYSCFG_EXTICR3_EXTI8_PB;
+		EXTI->RTSR |= EXTI_RTSR_TR8;
+		EXTI->FTSR &= ~EXTI_FTSR_TR8;
+		EXTI->PR = EXTI_PR_PR8;
+		EXTI->IMR |= EXTI_IMR_MR8;
+
+		// Shared with the buttons on pins 5-7
+		NVIC_SetPriority(EXTI9_5_IRQn, 0x25);
+		NVIC_EnableIRQ(EXTI9_5_IRQn);
+	} else {
+		// Poll the scanline with Timer 10
+		__HAL_TIM_SET_AUTORELOAD(&htim10, VSYNC_POLL_ARR);
+		__HAL_TIM_SET_COUNTER(&htim10, 0);
+		HAL_TIM_Base_Start_IT(&htim10);
+	}
+}
+
+/*!
+ * @brief Go back to starting frames on Timer 10 at FPS
+ */
+void videoVsyncOff(void)
+{
+	// Stop starting frames and let the current one finish
+	HAL_TIM_Base_Stop_IT(&htim10);
+	EXTI->IMR &= ~EXTI_IMR_MR8;
+	vsyncMode = VSYNC_OFF;
+	while (!frameComplete);
+
+	LcdTearingEffect(0);
+	LcdSetFrameRate(LCD_RTNA_79HZ);
+
+	// Start frames at FPS again
+	__HAL_TIM_SET_AUTORELOAD(&htim10, TIM10ARR);
+	__HAL_TIM_SET_COUNTER(&htim10, 0);
+	HAL_TIM_Base_Start_IT(&htim10);
+}
+
+/*!
+ * @brief Get the number of frames that were not done by their vsync
+ *
+ * The count starts at 0 when videoVsyncOn() is called.
+ *
+ * @return Number of missed vsyncs
+ */
+uint32_t videoGetMissedVsyncs(void)
+{
+	return missedVsyncs;
+}
+
+/*!
+ * @brief Get the statistics of the strip ring
+ *
+ * A high water mark below VIDEO_RING_SLOTS with no underruns means the ring
+ * can be made smaller. Underruns mean the compositor fell behind even with
+ * the whole ring.
+ *
+ * @param stats Pointer to the struct to copy the statistics to
+ */
+void videoGetRingStats(videoRingStats *stats)
+{
+	__disable_irq();
+	*stats = ringStats;
+	__enable_irq();
+}
+
+/*!
+ * @brief Reset the statistics of the strip ring to 0
+ */
+void videoResetRingStats(void)
+{
+	__disable_irq();
+	ringStats.highWater = 0;
+	ringStats.underruns = 0;
+	ringStats.strips = 0;
+	__enable_irq();
+}
+
+/*!
+ * @brief Get the time taken by the last frame
+ *
+ * The frame starts when updateFrame() hands it to the renderer. An idle time
+ * of 0 means the LCD bus was busy back to back for the whole frame.
+ *
+ * @param time Pointer to the struct to copy the times to
+ */
+void videoGetFrameTime(videoFrameTime *time)
+{
+	uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+
+	__disable_irq();
+	time->transferUs = lastTransferCycles / cyclesPerUs;
+	time->idleUs = lastIdleCycles / cyclesPerUs;
+	__enable_irq();
+}
+
+/*!
+ * @brief Handles the tearing effect signal of the LCD
+ *
+ * The frame is started from the Timer 10 interrupt so it runs at the same
+ * priority as without vsync.
+ *
+ * @note Called by the EXTI line 8 interrupt
+ */
+void videoTearingEffect(void)
+{
+	if (vsyncMode != VSYNC_TE) return;
+
+	tearingEffects++;
+	NVIC_SetPendingIRQ(TIM1_UP_TIM10_IRQn);
+}
+
+/*!
+ * @brief Counts LCD refreshes and starts a frame every vsyncDivisor of them
+ *
+ * @param count Number of LCD refreshes since the last call
+ */
+static void vsync(uint16_t count)
+{
+	vsyncCount = (vsyncCount + count > 0xFF) ? 0xFF : vsyncCount + count;
+	if (vsyncCount < vsyncDivisor) return;
+
+	// Still sending the last frame, start on the next refresh instead
+	if (!frameComplete) {
+		missedVsyncs++;
+		vsyncCount = vsyncDivisor - 1;
+		return;
+	}
+
+	// Deadlines that passed while the scanline could not be polled
+	missedVsyncs += (vsyncCount - 1) / vsyncDivisor;
+	vsyncCount = 0;
+
+	if (frameUpdate) updateFrame();
+}
+
+/*!
+ * @brief Polls the LCD scanline and detects the start of a refresh
+ *
+ * The scanline going back down means a new refresh started. While a frame is
+ * being sent the LCD cannot be polled, so refreshes in that time are counted
+ * from the time spent.
+ */
+static void pollScanline(void)
+{
+	uint16_t line;
+	uint16_t count;
+
+	if (scanlinePolls < 0xFFFF) scanlinePolls++;
+
+	// The FSMC is busy with the frame
+	if (!frameComplete) return;
+
+	line = LcdGetScanline();
+
+	// Past one and a half refreshes a wrap may have been hidden by a frame
+	if (line < lastScanline || (uint32_t)scanlinePolls * VSYNC_PANEL_HZ * 2
+	                           >= VSYNC_POLL_HZ * 3) {
+		// Round the time spent to a number of refreshes
+		count = ((uint32_t)scanlinePolls * VSYNC_PANEL_HZ + VSYNC_POLL_HZ / 2)
+		        / VSYNC_POLL_HZ;
+		scanlinePolls = 0;
+		lastScanline = line;
+		vsync(count ? count : 1);
+		return;
+	}
+
+	lastScanline = line;
+}
+
+/*!
+ * @brief Turn on damage tracking
+ *
+ * While damage tracking is on, each frame only sends the rectangles of the
+ * LCD that changed since the previous frame instead of the full screen. The
+ * whole screen is redrawn on the next frame.
+ */
+void videoDamageOn(void)
+{
+	damageTracking = 1;
+	videoDamageAll();
+}
+
+/*!
+ * @brief Turn off damage tracking
+ *
+ * Every frame sends the full screen to the LCD
+ */
+void videoDamageOff(void)
+{
+	damageTracking = 0;
+}
+
+/*!
+ * @brief Checks if two rectangles overlap or touch
+ *
+ * @return 1 if the rectangles overlap or touch, 0 otherwise
+ */
+static uint8_t rectsTouch(const videoRect *a, const videoRect *b)
+{
+	return (a->x0 <= b->x1 && b->x0 <= a->x1 &&
+	        a->y0 <= b->y1 && b->y0 <= a->y1);
+}
+
+/*!
+ * @brief Grows rectangle a to also cover rectangle b
+ */
+static void rectUnion(videoRect *a, const videoRect *b)
+{
+	if (b->x0 < a->x0) a->x0 = b->x0;
+	if (b->y0 < a->y0) a->y0 = b->y0;
+	if (b->x1 > a->x1) a->x1 = b->x1;
+	if (b->y1 > a->y1) a->y1 = b->y1;
+}
+
+/*!
+ * @brief Area of the union of two rectangles
+ */
+static uint32_t rectUnionArea(const videoRect *a, const videoRect *b)
+{
+	videoRect u = *a;
+
+	rectUnion(&u, b);
+	return (uint32_t)(u.x1 - u.x0) * (uint32_t)(u.y1 - u.y0);
+}
+
+/*!
+ * @brief Mark an area of the LCD to be redrawn on the next frame
+ *
+ * The area is clipped to the LCD and merged with any damaged rectangle it
+ * overlaps. If the list of rectangles is full, it is merged with the
+ * rectangle that grows the least.
+ *
+ * @param x x position of the left side of the area
+ * @param y y position of the top side of the area
+ * @param width Width of the area in pixels
+ * @param height Height of the area in pixels
+ */
+void videoAddDamage(int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+	videoRect r;
+	uint8_t i;
+	uint8_t best;
+	uint32_t area;
+	uint32_t bestArea;
+	uint32_t primask;
+
+	// Clip the area to the LCD
+	r.x0 = (x < 0) ? 0 : x;
+	r.y0 = (y < 0) ? 0 : y;
+	r.x1 = (x + width > LCD_WIDTH) ? LCD_WIDTH : x + width;
+	r.y1 = (y + height > LCD_HEIGHT) ? LCD_HEIGHT : y + height;
+	if (r.x0 >= r.x1 || r.y0 >= r.y1) return;
+
+	// The list is shared with the frame update interrupt
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	i = 0;
+	while (1) {
+		// Absorb every rectangle touching the new one
+		if (i < numDamage) {
+			if (rectsTouch(&r, &damage[i])) {
+				rectUnion(&r, &damage[i]);
+				damage[i] = damage[--numDamage];
+				i = 0;
+			} else {
+				i++;
+			}
+			continue;
+		}
+
+		if (numDamage < MAX_DAMAGE_RECTS) break;
+
+		// List is full, merge with the rectangle that grows the least
+		best = 0;
+		bestArea = 0xFFFFFFFF;
+		for (i = 0; i < numDamage; i++) {
+			area = rectUnionArea(&r, &damage[i]);
+			if (area < bestArea) {
+				bestArea = area;
+				best = i;
+			}
+		}
+		rectUnion(&r, &damage[best]);
+		damage[best] = damage[--numDamage];
+		i = 0;
+	}
+
+	damage[numDamage++] = r;
+
+	__set_PRIMASK(primask);
+}
+
+/*!
+ * @brief Mark the whole LCD to be redrawn on the next frame
+ */
+void videoDamageAll(void)
+{
+	videoAddDamage(0, 0, LCD_WIDTH, LCD_HEIGHT);
+}
+
+/*!
+ * @brief Sets the tilemap drawn under the sprites
+ *
+ * @param map Pointer to the tilemap to draw, NULL for the plain VIDEO_BG
+ */
+void videoSetTilemap(tilemap *map)
+{
+	if (map != NULL) {
+		map->drawnXscroll = map->xscroll;
+		map->drawnYscroll = map->yscroll;
+	}
+	background = map;
+
+	videoDamageAll();
+}
+
+/*!
+ * @brief Composite rows of the LCD without sending them
+ *
+ * Runs the compositor used by updateFrame() on its own, so its cost can be
+ * measured apart from the LCD bus. The rows are written to a strip of the
+ * ring, LCD_WIDTH pixels per row.
+ *
+ * @note Frame updating must be off and no frame may be in progress
+ *
+ * @param y First LCD row to composite
+ * @param rows Number of rows, at most LCD_TRANSFER_ROWS
+ *
+ * @return Pointer to the composited pixels
+ */
+const uint16_t *videoComposeRows(int16_t y, uint8_t rows)
+{
+	if (rows > LCD_TRANSFER_ROWS) rows = LCD_TRANSFER_ROWS;
+
+	getNextRows(0, LCD_WIDTH, y, rows);
+
+	return READ_BUFFER;
+}
+
+/*!
+ * @brief Applies the scroll of the background tilemap for the next frame
+ *
+ * Horizontal scrolling with damage tracking on moves the LCD contents with the
+ * hardware scroll, so only the newly exposed columns are drawn. Any other
+ * scroll redraws the whole LCD.
+ */
+static void scrollBackground(void)
+{
+	int16_t dx;
+	int16_t dy;
+	uint16_t i;
+	uint8_t n;
+	videoRect old[MAX_DAMAGE_RECTS];
+	sprite *spr;
+
+	if (background == NULL) return;
+
+	dx = background->xscroll - background->drawnXscroll;
+	dy = background->yscroll - background->drawnYscroll;
+	if (!dx && !dy) return;
+
+	background->drawnXscroll = background->xscroll;
+	background->drawnYscroll = background->yscroll;
+
+	// Without damage tracking the whole LCD is drawn anyway
+	if (!damageTracking) return;
+
+	// Only the x axis of the LCD can be scrolled in hardware
+	if (dy || dx >= LCD_WIDTH || dx <= -LCD_WIDTH) {
+		videoDamageAll();
+		return;
+	}
+
+	// Move everything on the LCD left by dx
+	hwScroll = (hwScroll + LCD_WIDTH + dx) % LCD_WIDTH;
+	LcdSetScrollStart(hwScroll);
+
+	// Damaged areas moved with the LCD contents
+	__disable_irq();
+	n = numDamage;
+	for (i = 0; i < n; i++) old[i] = damage[i];
+	numDamage = 0;
+	for (i = 0; i < n; i++) {
+		videoAddDamage(old[i].x0 - dx, old[i].y0,
+		               old[i].x1 - old[i].x0, old[i].y1 - old[i].y0);
+	}
+	__enable_irq();
+
+	// So did the sprites, redraw them where they should be
+	for (i = 0; i < layers.size; i++) {
+		spr = layers.spr[i];
+		if (spr->prevFrame != SPRITE_NOT_DRAWN) spr->prevXpos -= dx;
+	}
+
+	// Draw the columns scrolled into view
+	if (dx > 0) {
+		videoAddDamage(LCD_WIDTH - dx, 0, dx, LCD_HEIGHT);
+	} else {
+		videoAddDamage(0, 0, -dx, LCD_HEIGHT);
+	}
+}
+
+/*!
+ * @brief Adds a rectangle to the list of rectangles to send this frame
+ *
+ * The rectangle is split in two if its LCD memory columns wrap around the
+ * hardware scroll.
+ *
+ * @param r Rectangle to add, in LCD coordinates
  */
-static FRESULT readToVideoBuffer(void)
+static void addFrameRect(const videoRect *r)
 {
-	// Signal read not complete
-	readComplete = 0;
+	int16_t split;
+
+	frameRects[numFrameRects] = *r;
+
+	// LCD column at which the memory column wraps back to 0
+	split = r->x0 + LCD_WIDTH - (r->x0 + hwScroll) % LCD_WIDTH;
+	if (split < r->x1) {
+		frameRects[numFrameRects++].x1 = split;
+		frameRects[numFrameRects] = *r;
+		frameRects[numFrameRects].x0 = split;
+	}
+
+	numFrameRects++;
+}
+
+/*!
+ * @brief Fills the strip at the head of the ring using the getNextRows
+ * function
+ *
+ * The rectangles of the frame are read from top to bottom. Each strip holds
+ * as many full rows of the current rectangle as fit in VID_BUF_BYTES.
+ *
+ * @return 0 on success, 1 if every rectangle of the frame has been read
+ */
+static uint8_t readToVideoBuffer(void)
+{
+	videoRect *r;
+	videoStrip *strip;
+	uint16_t width;
+	uint16_t rows;
+	uint32_t start;
+
+	// Nothing left to read in this frame
+	if (rectIndex >= numFrameRects) return 1;
+
+	strip = &strips[stripHead];
+	r = &frameRects[rectIndex];
+	width = r->x1 - r->x0;
+
+	// Starting a new rectangle, the LCD window changes with this strip
+	if (rectRow == r->y0) {
+		strip->window = rectIndex;
+	} else {
+		strip->window = -1;
+	}
+
+	// Fit as many rows as possible in the strip
+	rows = (VID_BUF_BYTES / 2) / width;
+	if (rows > r->y1 - rectRow) rows = r->y1 - rectRow;
 
 	// Read
-	getNextRows();
-	
-	// Signal read complete
-	readComplete = 1;
+	start = PROFILE_START();
+	getNextRows(r->x0, r->x1, rectRow, rows);
+	PROFILE_END(PROFILE_GET_NEXT_ROWS, start);
+	strip->length = width * rows;
+
+	// Move on to the next rectangle when this one is done
+	rectRow += rows;
+	if (rectRow >= r->y1) {
+		rectIndex++;
+		if (rectIndex < numFrameRects) rectRow = frameRects[rectIndex].y0;
+	}
+
+	// Hand the strip to the DMA
+	stripHead = (stripHead + 1) % VIDEO_RING_SLOTS;
+	__disable_irq();
+	stripsReady++;
+	if (stripsReady > ringStats.highWater) ringStats.highWater = stripsReady;
+	__enable_irq();
+
+	return 0;
+}
+
+/*!
+ * @brief Fills every free strip of the ring, starting the DMA if it ran dry
+ *
+ * The first strip of a frame also starts the DMA, so the DMA is only idle
+ * when the renderer falls behind.
+ */
+static void fillRing(void)
+{
+	uint32_t idle;
+
+	while (!frameRead && stripsReady < VIDEO_RING_SLOTS) {
+		if (readToVideoBuffer()) {
+			frameRead = 1;
+			break;
+		}
 
-	return FR_OK;
+		// Start the DMA if it is waiting on this strip
+		__disable_irq();
+		if (transferComplete) {
+			idle = DWT->CYCCNT - idleStartCycles;
+			idleCycles += idle;
+			PROFILE_ADD(PROFILE_DMA_WAIT, idle);
+			startTransfer();
+		}
+		__enable_irq();
+	}
+
+	// The DMA may have sent the last strip before the frame was known read
+	__disable_irq();
+	if (frameRead && transferComplete && !stripsReady && !frameComplete) {
+		finishFrame();
+	}
+	__enable_irq();
 }
 
 /*!
  * @brief Updates a frame using sprite data and reading from FatFs file system
  *
- * This function is used to update the frame on screen using two buffers.
- * While one buffer is filling with new pixel data, the other is sent with DMA
- * to the LCD. Timer 7 is used to generate interrupts that will read new data if
- * neccessary.
+ * This function is used to update the frame on screen using a ring of
+ * VIDEO_RING_SLOTS strips. The compositor fills strips at the head of the ring
+ * while the DMA sends them to the LCD from the tail, so the compositor can run
+ * several strips ahead and absorb slow reads. Each finished DMA transfer
+ * starts the next strip right away and wakes the renderer, which runs in the
+ * PendSV interrupt below every other interrupt, to fill the freed strip.
+ *
+ * When damage tracking is on, only the rectangles damaged since the last frame
+ * are read and sent to the LCD.
  *
  * @note This function will set up interrupts to trigger that will periodically
  * read from the FatFs file system. The user should not be accessing the FatFs
@@ -228,192 +967,477 @@ static FRESULT readToVideoBuffer(void)
  */
 void updateFrame(void)
 {
+	uint8_t i;
+	videoRect full;
+	uint32_t start;
+	uint32_t spritesStart;
+
 	// Do not update new frame until old is completely written
 	if (!frameComplete) return;
 
+	start = PROFILE_START();
+
+	// Scroll the background before the sprites are drawn on it
+	scrollBackground();
+
+	// Move sprites, recording the areas they leave and cover
+	spritesStart = PROFILE_START();
+	updateSprites();
+	PROFILE_END(PROFILE_UPDATE_SPRITES, spritesStart);
+
+	// Take the rectangles to send this frame
+	__disable_irq();
+	numFrameRects = 0;
+	if (damageTracking) {
+		for (i = 0; i < numDamage; i++) addFrameRect(&damage[i]);
+	} else {
+		full.x0 = 0;
+		full.y0 = 0;
+		full.x1 = LCD_WIDTH;
+		full.y1 = LCD_HEIGHT;
+		addFrameRect(&full);
+	}
+	numDamage = 0;
+	__enable_irq();
+
+	// Nothing changed, the LCD is already up to date
+	if (numFrameRects == 0) return;
+
 	// Frame update is beginning, set FPS pin high
 	LCD_FPS_HIGH;
+	frameComplete = 0;
 
-	// Stop old DMA transfers
-	HAL_DMA_Abort_IT(&hdma_memtomem_dma2_stream5);
+	// Start reading from the top of the first rectangle
+	rectIndex = 0;
+	rectRow = frameRects[0].y0;
 
-	// Reset completed number of transfers
-	bufferTransfers = 0;
-	
-	// Reset file pointers of sprites
-	updateSprites();
-	seekStartOfFrames();
+	// Empty the ring
+	stripHead = 0;
+	stripTail = 0;
+	stripsReady = 0;
+	frameRead = 0;
 
-	// read new frame into one videoBuffer
-	readToVideoBuffer();
+	// The DMA waits for the first strip
+	frameStartCycles = DWT->CYCCNT;
+	idleStartCycles = frameStartCycles;
+	idleCycles = 0;
 
-	// Swap read and play buffers
-	toggleVideoBuffers();
-	
-	// Enable timer 7
-	HAL_TIM_Base_Start_IT(&htim7);
-	// Initialize LCD to be ready for continuous data
-	LcdSetPos(0, 0, LCD_WIDTH, LCD_HEIGHT);
-    LcdWriteCmd(MEMORY_WRITE);
-	
-	// Start new transfer, configuring DMA user callbacks
-	HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream5, 
-	(uint32_t)PLAY_BUFFER, (uint32_t)(fsmc_data),
-	(uint32_t)(VID_BUF_BYTES / 2));
+	// Render the frame, the DMA starts with the first strip
+	wakeRenderer();
 
-	// Indicate current transfer is not complete
-	transferComplete = 0;
+	PROFILE_END(PROFILE_UPDATE_FRAME, start);
+
+}
 
-	// Increment number of transfers that have started
-    bufferTransfers++;
+/*!
+ * @brief Sets the LCD window if needed and starts the DMA transfer of the
+ * strip at the tail of the ring
+ */
+static void startTransfer(void)
+{
+	videoStrip *strip = &strips[stripTail];
+	videoRect *r;
+	uint16_t x;
+
+	// Initialize LCD to be ready for continuous data in a new rectangle
+	if (strip->window >= 0) {
+		r = &frameRects[(uint8_t)strip->window];
+		x = (r->x0 + hwScroll) % LCD_WIDTH;	// LCD memory column
+		LcdSetPos(x, r->y0, x + (r->x1 - r->x0) - 1, r->y1 - 1);
+		LcdWriteCmd(MEMORY_WRITE);
+	}
 
-	// Read to the other video buffer
-	readToVideoBuffer();
+	// Indicate current transfer is not complete
+	transferComplete = 0;
 
+	HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream5,
+	(uint32_t)(uintptr_t)strip->pixels, (uint32_t)(uintptr_t)fsmc_data,
+	(uint32_t)strip->length);
 }
 
 /*!
- * @brief Toggles the video buffers currently playing and reading
+ * @brief Stops the frame once every strip has been sent
  */
-static void toggleVideoBuffers(void)
+static void finishFrame(void)
 {
-    videoBuffer = !videoBuffer;
+	// Time the whole frame
+	lastTransferCycles = DWT->CYCCNT - frameStartCycles;
+	lastIdleCycles = idleCycles;
+
+	// Indicate frame is complete
+	frameComplete = 1;
+
+	// Done updating frame, set FPS pin low
+	LCD_FPS_LOW;
 }
 
 /*!
  * @brief DMA transfer complete
+ *
+ * Frees the strip that was sent and starts sending the next one
  */
 void DMA2_Stream5_IRQHandler(void)
 {
 	// Use HAL library to handle lower level interrupt
 	HAL_DMA_IRQHandler(&hdma_memtomem_dma2_stream5);
 
-	// Signal that the transfer is complete
+	// Only a running transfer frees a strip
+	if (transferComplete) return;
+
+	// Signal that the transfer is complete and free its strip
 	transferComplete = 1;
+	stripTail = (stripTail + 1) % VIDEO_RING_SLOTS;
+	stripsReady--;
+	ringStats.strips++;
+
+	// Chain the next strip, or end the frame if none are left to read
+	if (stripsReady) {
+		startTransfer();
+	} else if (frameRead) {
+		finishFrame();
+		return;
+	} else {
+		// Renderer fell behind, the LCD bus is idle until it catches up
+		idleStartCycles = DWT->CYCCNT;
+		if (rectIndex < numFrameRects) ringStats.underruns++;
+	}
+
+	// Refill the freed strip
+	wakeRenderer();
 }
 
 /*!
- * @brief Timer 7 interrupt handler
+ * @brief Renderer of the video ring
+ *
+ * PendSV has the lowest priority, so the DMA interrupt can always preempt the
+ * renderer to chain strips.
  */
-void TIM7_IRQHandler(void)
+void PendSV_Handler(void)
 {
-	HAL_TIM_IRQHandler(&htim7);
+	// Keep the compositor ahead of the DMA
+	fillRing();
+}
 
-	// If the previous transfer is not done, do not do anything
-	if (!transferComplete || !readComplete) return;
+/*!
+ * @brief Asks the renderer to fill the free strips of the ring
+ */
+static void wakeRenderer(void)
+{
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
 
-	// Reset transferComplete flag
-	transferComplete = 0;
+/*!
+ * @brief Fills a video buffer with data to be sent to the LCD
+ *
+ * The buffer is first filled with the background color two pixels at a time.
+ * Then, for every row, the sprites of the bucket holding that row are painted
+ * back to front over their clipped x-span only, so the work scales with the
+ * sprites on the row and the pixels they cover instead of LCD_WIDTH * layers.
+ * The transparent runs of v2 sprites are skipped without being read.
+ *
+ * Rows are packed in the buffer with a stride of the window width.
+ *
+ * @note Sprites that are not cached are read from the FatFs file system.
+ * On a read fail, the error LED on the Sparkbox turns on and this program
+ * hangs in a dead loop
+ *
+ * @return 0 on success
+ */
+static uint8_t getNextRows(int16_t x0, int16_t x1, int16_t y, uint8_t rows) {
+	uint8_t row;
+	uint16_t l;
+	spriteList rowSprites;
+	int16_t lcdRow;
+	int16_t x;
+	int16_t xEnd;
+	uint16_t col;
+	uint16_t first;
+	uint16_t width;
+	uint16_t runBytes;
+	const uint8_t *src;
+	uint16_t *dst;
+	uint32_t *fill;
+	uint32_t *fillEnd;
+	sprite *spr;
+
+	width = x1 - x0;
+
+	// Fill the whole strip with the background using 32-bit stores
+	if (background == NULL) {
+		fill = (uint32_t *)READ_BUFFER;
+		fillEnd = fill + (width * rows + 1) / 2;
+		while (fill < fillEnd) *fill++ = VIDEO_BG_WORD;
+	}
 
-	// Toggle read and play buffers
-	toggleVideoBuffers();
+	for (row = 0; row < rows; row++) {
 	
-	// Start the new transfer before reading
-	HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream5,
-	(uint32_t)PLAY_BUFFER, (uint32_t)(fsmc_data),
-	(uint32_t)(VID_BUF_BYTES / 2));
-
-	// Increment number of transfers that have started
-    bufferTransfers++;
+		lcdRow = y + row;
+		dst = READ_BUFFER + width*row;
+
+		// Draw the tiles under the sprites
+		if (background != NULL) tilemapDrawRow(background, dst, x0, x1, lcdRow);
+
+		// Only the sprites in the bucket of this row can cover it
+		rowSprites = spriteGetRowSprites(lcdRow);
+
+		// Paint back to front so the lowest layer index ends up on top,
+		// sprites without pixels in this row of the window are never read
+		for (l = rowSprites.size; l--; ) {
+			spr = rowSprites.spr[l];
+			if ((spr->flags & HIDE)
+			    || (lcdRow < spr->ypos)
+			    || (lcdRow >= (int32_t)spr->ypos + spr->height)
+			    || (spr->xpos >= x1)
+			    || ((int32_t)spr->xpos + spr->width <= x0)) continue;
+
+			// Clip the sprite span to the window
+			x = (spr->xpos < x0) ? x0 : spr->xpos;
+			xEnd = ((int32_t)spr->xpos + spr->width > x1)
+			       ? x1 : spr->xpos + spr->width;
+
+			// Column of the sprite corresponding to the first visible pixel
+			col = x - spr->xpos;
+
+			// Get the whole row of runs, or only the bytes holding the visible
+			// pixels, from the cache or the file
+			first = ((uint32_t)col * SPRITE_BPP(spr)) >> 3;
+			if (spr->frameStarts != NULL) {
+				src = spriteReadRuns(spr, lcdRow - spr->ypos, fetched, &runBytes);
+			} else {
+				src = spriteReadRow(spr, lcdRow - spr->ypos, first,
+				                    ((((uint32_t)xEnd - spr->xpos) * SPRITE_BPP(spr)
+				                      + 7) >> 3) - first,
+				                    fetched);
+			}
+			// A row that cannot be read is left out, the frame goes on
+			if (src == NULL) {
+				spr->flags |= READ_ERROR;
+				continue;
+			}
 
-	// Determine if we need to read more data or if we are done
-    if (bufferTransfers <= NUM_TRANSFERS) {
-		if (bufferTransfers != NUM_TRANSFERS) {
-        	// Read new data into other buffer
-        	readToVideoBuffer();
+			if (spr->frameStarts != NULL) {
+				paintRuns(spr, src, runBytes, col, xEnd - spr->xpos,
+				          &dst[x - x0]);
+			} else {
+				paintPixels(spr, src, col - (first << 3) / SPRITE_BPP(spr),
+				            &dst[x - x0], xEnd - x);
+			}
 		}
-    } else {
-        // Frame is completely written to LCD, get ready for next transfer
-        // Reset buffer transfer counter
-        bufferTransfers = 0;
 
-		// Stop timer to not trigger this interrupt again
-		HAL_TIM_Base_Stop_IT(&htim7);
+	}
 
-		// Indicate frame is complete
-		frameComplete = 1;
+	return 0;
 
-        // Done updating frame, set FPS pin low
-        LCD_FPS_LOW;
-    }
+}
 
+/*!
+ * @brief Paints packed pixels of a sprite over a row of the buffer with the
+ * loop of its depth
+ *
+ * Only 4bpp is checked for nothing when the other depths are not compiled in.
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low bits first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels(sprite *spr, const uint8_t *src, uint16_t col,
+                        uint16_t *dst, uint16_t count) {
+#if SPRITE_2BPP
+	if (spr->bpp == 2) {
+		paintPixels2(spr, src, col, dst, count);
+		return;
+	}
+#endif
+#if SPRITE_8BPP
+	if (spr->bpp == 8) {
+		paintPixels8(spr, src, col, dst, count);
+		return;
+	}
+#endif
+	paintPixels4(spr, src, col, dst, count);
 }
 
 /*!
- * @brief Fills a video buffer with data to be sent to the LCD
+ * @brief Paints 4bpp pixels of a sprite over a row of the buffer
  *
- * @note This function reads from the FatFs file system. On a read fail,
- * the error LED on the Sparkbox turns on and this program hangs in a 
- * dead loop
+ * Transparent pixels are skipped and two opaque pixels of a byte take a single
+ * store.
  *
- * @return 0 on success
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low nibble first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
  */
-static uint8_t getNextRows(void) {
-	uint8_t row;
-	uint8_t l;
-	uint16_t pixel;
-	uint8_t lcdRow;
-	uint8_t paletteIndex;
+static void paintPixels4(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count) {
+	uint16_t x = 0;
+	uint8_t packed;
+
+	// Leading pixel stored in the high nibble of a byte
+	if (col & 1) {
+		packed = src[col >> 1];
+		if (spr->pairMasks[packed] & SPRITE_PAIR_HIGH)
+			dst[x] = spr->pairs[packed] >> 16;
+		x++;
+		col++;
+	}
 
-	// Do 2 rows at a time
-	for (row = 0; row < LCD_TRANSFER_ROWS; row++) {
-	
-		lcdRow = bufferTransfers*LCD_TRANSFER_ROWS + row;
-
-		// Read a row of pixels for all sprites with a row on this row
-		for (l = 0; l<layers.size; l++) {		
-			if ((lcdRow >= layers.spr[l]->ypos) &&
-		 	 (lcdRow < layers.spr[l]->ypos + layers.spr[l]->height)) {
-				if (f_read(&layers.spr[l]->file, fetched[l], 
-				           layers.spr[l]->width / 2, NULL)) {
-					ledError(LED_ERROR);
-					while(1);
-				}
-			}
-		}
+	// Two pixels per byte, both opaque pixels take a single store
+	for (; x + 1 < count; x += 2, col += 2) {
+		paintPair(spr, src[col >> 1], &dst[x]);
+	}
 
-		// Iterate through finding the value for each pixel in the row
-		for (pixel = 0; pixel < LCD_WIDTH; pixel++) {
-
-			// Check each layer for a valid pixel
-			for (l = 0; l < layers.size; l++) {
-
-				// Check bounds of the sprite
-				if ((lcdRow >= layers.spr[l]->ypos) &&
-				 (lcdRow < layers.spr[l]->ypos + layers.spr[l]->height) &&
-				 (pixel >= layers.spr[l]->xpos) &&
-				 (pixel < layers.spr[l]->xpos + layers.spr[l]->width)) {
-
-					// Find pallette index from previously read values
-					paletteIndex = (fetched[l][(pixel-(layers.spr[l]->xpos))/8] >> 
-					               (((pixel-layers.spr[l]->xpos) % 8)*4)) & 0x000F;
-
-					// Check the alpha value of the pixel
-					if (paletteIndex) {
-
-						// Pixel is valid, get the color
-						READ_BUFFER[pixel+LCD_WIDTH*row] = 	
-						  layers.spr[l]->palette[paletteIndex-1];
-
-						// Found a non transparent pixel, skip to next pixel
-						break;
-					} else {
-						// Default background color
-						READ_BUFFER[pixel + LCD_WIDTH*row] = VIDEO_BG;
-					}
-
-				} else {
-					// Default background color
-					READ_BUFFER[pixel + LCD_WIDTH*row] = VIDEO_BG;
-				}
-				
-			
-			}
+	// Trailing pixel stored in the low nibble of a byte
+	if (x < count) {
+		packed = src[col >> 1];
+		if (spr->pairMasks[packed] & SPRITE_PAIR_LOW)
+			dst[x] = spr->pairs[packed];
+	}
+}
 
+#if SPRITE_2BPP
+/*!
+ * @brief Paints 2bpp pixels of a sprite over a row of the buffer
+ *
+ * Each nibble is a pair code, so pixels are painted two at a time like at
+ * 4bpp.
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src Packed pixels, low bits first
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels2(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count) {
+	uint16_t x = 0;
+	uint8_t code;
+
+	// Leading pixel stored in the high half of a nibble
+	if (col & 1) {
+		code = (src[col >> 2] >> ((col & 2) << 1)) & 0x0F;
+		if (spr->pairMasks[code] & SPRITE_PAIR_HIGH)
+			dst[x] = spr->pairs[code] >> 16;
+		x++;
+		col++;
+	}
+
+	// Two pixels per nibble
+	for (; x + 1 < count; x += 2, col += 2) {
+		paintPair(spr, (src[col >> 2] >> ((col & 2) << 1)) & 0x0F, &dst[x]);
+	}
+
+	// Trailing pixel stored in the low half of a nibble
+	if (x < count) {
+		code = (src[col >> 2] >> ((col & 2) << 1)) & 0x0F;
+		if (spr->pairMasks[code] & SPRITE_PAIR_LOW)
+			dst[x] = spr->pairs[code];
+	}
+}
+#endif
+
+#if SPRITE_8BPP
+/*!
+ * @brief Paints 8bpp pixels of a sprite over a row of the buffer
+ *
+ * Index 0 is the only transparent one, so no mask is looked up. Two opaque
+ * pixels next to each other still take a single store.
+ *
+ * @param spr Sprite the pixels belong to
+ * @param src One palette index per byte
+ * @param col Index of the first pixel to paint in src
+ * @param dst Pixel of the buffer to paint the first pixel on
+ * @param count Number of pixels to paint
+ */
+static void paintPixels8(sprite *spr, const uint8_t *src, uint16_t col,
+                         uint16_t *dst, uint16_t count) {
+	uint16_t x;
+	uint8_t first;
+	uint8_t second;
+
+	src += col;
+	for (x = 0; x + 1 < count; x += 2) {
+		first = src[x];
+		second = src[x + 1];
+		if (first && second) {
+			SPRITE_STORE_PAIR(&dst[x], (spr->pairs[second] << 16)
+			                           | (spr->pairs[first] & 0xFFFF));
+		} else if (first) {
+			dst[x] = spr->pairs[first];
+		} else if (second) {
+			dst[x + 1] = spr->pairs[second];
 		}
+	}
+
+	// Odd pixel left over
+	if (x < count && src[x]) dst[x] = spr->pairs[src[x]];
+}
+#endif
 
+/*!
+ * @brief Paints the opaque pixels of a pair code on two pixels of the buffer
+ *
+ * Both opaque pixels take a single store.
+ *
+ * @param spr Sprite the pair code belongs to
+ * @param code Pair code of the two pixels
+ * @param dst Pixel of the buffer to paint the first pixel on
+ */
+static inline void paintPair(sprite *spr, uint8_t code, uint16_t *dst) {
+	switch (spr->pairMasks[code]) {
+	case SPRITE_PAIR_BOTH:
+		SPRITE_STORE_PAIR(dst, spr->pairs[code]);
+		break;
+	case SPRITE_PAIR_LOW:
+		dst[0] = spr->pairs[code];
+		break;
+	case SPRITE_PAIR_HIGH:
+		dst[1] = spr->pairs[code] >> 16;
+		break;
+	default:	// Both transparent
+		break;
 	}
+}
 
-	return 0;
+/*!
+ * @brief Paints the runs of a row of a v2 sprite over a row of the buffer
+ *
+ * Transparent runs only move the column. Runs of pixels are clipped to the
+ * visible columns and painted like a v1 row.
+ *
+ * @param spr Sprite the runs belong to
+ * @param runs Runs of the row
+ * @param bytes Number of bytes of runs
+ * @param col First column of the sprite to paint
+ * @param colEnd Column of the sprite past the last one to paint
+ * @param dst Pixel of the buffer to paint column col on
+ */
+static void paintRuns(sprite *spr, const uint8_t *runs, uint16_t bytes,
+                      uint16_t col, uint16_t colEnd, uint16_t *dst) {
+	const uint8_t *end = runs + bytes;
+	uint16_t runCol = 0;	// Column of the sprite the run starts at
+	uint16_t length;
+	uint16_t skip;
+	uint8_t control;
+
+	while (runs < end && runCol < colEnd) {
+		control = *runs++;
+		length = (control & SPRITE_RUN_LENGTH) + 1;
+
+		if (control & SPRITE_RUN_PIXELS) {
+			// Paint only the part of the run that is visible
+			if (runCol + length > col) {
+				skip = (runCol < col) ? col - runCol : 0;
+				paintPixels(spr, runs, skip, &dst[runCol + skip - col],
+				            ((runCol + length > colEnd) ? colEnd - runCol : length)
+				            - skip);
+			}
+			runs += ((uint32_t)length * SPRITE_BPP(spr) + 7) >> 3;
+		}
 
+		runCol += length;
+	}
 }
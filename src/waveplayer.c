@@ -6,44 +6,140 @@
  *
  * @brief Functions to control audio
  *
- * These functions import and play audio files from the SD card
+ * These functions import and play audio files from the SD card, or stream
+ * them from it while they play, mixing every file playing into the DAC
  */
 
 #include "waveplayer.h"
+#include "fastseek.h"
 
 /*!
  * @name Private functions provided with STM32072B Demo
  *
  * These functions were not written by Sparkbox employees, and are included
- * to properly read information from .WAV file headers and convert data from
- * signed to unsigned
+ * to properly read information from .WAV file headers
  *
  * @{
  */
 static void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format);
-static void ToggleBufferSign(uint32_t* pBuffer, uint32_t BufferSize);
 static uint32_t ReadUnit(uint8_t *buffer, uint8_t idx, uint8_t NbrOfBytes, Endianness BytesFormat);
 /* @} */
 
-// Number of bits per DMA transfer
+/*!
+ * @brief Kinds of commands queued to the DMA interrupt
+ */
+typedef enum {
+	COMMAND_PLAY,	// Start a file on a voice, value is its number of plays
+	COMMAND_STOP,	// Stop the voices of a file, every voice for NULL
+	COMMAND_VOLUME,	// Set the volume of the voices of a file to value
+	COMMAND_RELEASE	// Stop the voices playing from the audio buffer
+} commandType;
+
+/*!
+ * @brief A command queued to the DMA interrupt
+ */
+typedef struct {
+	WAV_Format *wav;	// File the command is for
+	int32_t value;	// Number of plays or volume
+	commandType type;	// What to do
+} wavCommand;
+
+/*!
+ * @brief Decoding of the IMA ADPCM data of a file as it plays
+ */
+typedef struct {
+	adpcmState adpcm;	// Block being decoded
+	WAV_Format *wav;	// File decoded
+	uint32_t offset;	// Bytes of data of the current play decoded
+	int32_t plays;	// Plays left, counting the one being decoded
+	uint8_t rewind;	// Whether the next block is the first of the data
+	volatile uint8_t end;	// Half the last play ends in, bit 0 for the first
+} wavDecoder;
+
+// Static function prototypes
+static void commandPush(commandType type, WAV_Format *W, int32_t value);
+static void commandWait(void);
+static uint8_t commandDrain(void);
+static mixVoice *commandPlay(WAV_Format *W, int32_t numPlays);
+static void outputHalfPlayed(uint8_t half);
+static void outputPlayNow(void);
+static void outputAdd(uint8_t voices, uint32_t from, uint32_t to);
+static void importRelease(void);
+static void streamClose(void);
+static uint8_t streamRead(uint8_t *dst, uint32_t bytes);
+static void streamSilence(uint8_t *dst, uint32_t bytes);
+static void streamFill(uint8_t half);
+static void streamHalfPlayed(mixVoice *voice, uint8_t half);
+static void decodeStart(wavDecoder *decoder, WAV_Format *W, int32_t numPlays);
+static uint32_t decodeSamples(wavDecoder *decoder, int16_t *dst,
+                              uint32_t count);
+static uint8_t decodeNextBlock(wavDecoder *decoder);
+static void decodeFill(uint8_t voice, uint8_t half);
+static void decodeHalfPlayed(mixVoice *voice, uint8_t half);
+
+// Number of bits per DMA transfer, the output ring is 16 bit
 uint8_t transferSize = 16;
 // Buffers for playing from SD card
 uint16_t *audioBuffer;
+// Bytes of the audio buffer taken by imported files
+static uint32_t audioUsed;
 
 // Handles for initialization
 DAC_HandleTypeDef hdac;
 DMA_HandleTypeDef hdma_dac1;
 TIM_HandleTypeDef htim6;
 
-// Globally keep track of the number of plays
-volatile int32_t numberPlays;
-// Store pointer to the currently playing WAV file struct
-WAV_Format *playingWav;
 // One global variable to make successive file reads faster
 FIL F;
 
+// Commands from the functions below to the DMA interrupt, one writer each
+static wavCommand commandQueue[WAV_COMMANDS];
+// Commands ever queued, only written by commandPush()
+static volatile uint8_t commandHead;
+// Commands ever applied, only written by the DMA interrupt
+static volatile uint8_t commandTail;
+
+// Ring the DAC plays in a loop, each half mixed again once it was played
+static int16_t outputRing[WAV_MIX_SAMPLES] __attribute__((aligned(4)));
+// Whether WAV_Pause() holds the voices, the DAC then plays silence
+static volatile uint8_t outputPaused;
+// Halves mixed in a row with no voice playing, the amp is off after two
+static volatile uint8_t outputQuiet;
+// Half of the ring mixed last, the DAC plays the other one until its interrupt
+static uint8_t outputMixed;
+
+// Ring the mixer plays streamed files from, two halves refilled in turn
+static uint8_t streamRing[WAV_STREAM_BYTES] __attribute__((aligned(4)));
+// File streamed and its WAV_Format struct, NULL if none is open
+static FIL streamFile;
+static WAV_Format *streamWav;
+// Plays of the streamed file left, counting the one being read
+static volatile int32_t streamPlays;
+// Bytes of data of the current play not read yet
+static uint32_t streamLeft;
+// Halves of the ring played and waiting to be read again, bit 0 for the first
+static volatile uint8_t streamFree;
+// Half of the ring the last play ends in, bit 0 for the first, 0 until read
+static volatile uint8_t streamEnd;
+// Whether the ring holds the start of the data, else it is read once playing
+static uint8_t streamPrimed;
+// Whether the next refill starts from the start of the data
+static uint8_t streamRewind;
+// Decoding of the streamed file if it is ADPCM, and the block read from it
+static wavDecoder streamDecoder;
+static uint8_t streamBlock[WAV_ADPCM_BLOCK_BYTES];
+
+// Decoding of the imported ADPCM file each voice plays, into its own ring
+static wavDecoder decoders[MIX_VOICES];
+static int16_t decodeRing[MIX_VOICES][WAV_DECODE_SAMPLES]
+	__attribute__((aligned(4)));
+
 /*!
  * @brief Initializes wave player and allocates memory for audio buffer
+ *
+ * The DAC, TIM6 and the DMA are set up once, at MIX_RATE, and play the
+ * output ring from then on. Playing a file only hands it to a voice of the
+ * mixer.
  */
 void WAV_Init(void)
 {
@@ -55,6 +151,7 @@ void WAV_Init(void)
 
 	// If memory allocation failed, stop here and return
 	if (audioBuffer == NULL) return;
+	audioUsed = 0;
 
 	// Clock enable to PORTA and DMA1
 	__HAL_RCC_GPIOA_CLK_ENABLE();
@@ -66,6 +163,10 @@ void WAV_Init(void)
 	NVIC_SetPriority(DMA1_Stream5_IRQn, 0x40);
 	NVIC_EnableIRQ(DMA1_Stream5_IRQn);
 
+	// The DMA interrupt pends TIM6_DAC to refill the ring of a streamed file
+	NVIC_SetPriority(TIM6_DAC_IRQn, WAV_STREAM_PRIORITY);
+	NVIC_EnableIRQ(TIM6_DAC_IRQn);
+
 	// Initialize DAC channel 1
 	hdac.Instance = DAC;
 	HAL_DAC_Init(&hdac);
@@ -78,8 +179,8 @@ void WAV_Init(void)
 	htim6.Instance = TIM6;
 	htim6.Init.Prescaler = 0;
 	htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
-	// Arbitrary period, will change with WAV file
-	htim6.Init.Period = 4353;
+	// Fs = Ftimer / (ARR+1), every file is mixed to the same rate
+	htim6.Init.Period = TIM6FREQ / MIX_RATE - 1;
 	HAL_TIM_Base_Init(&htim6);
 	// Configure Timer 6 update event to trigger DAC DMA request
 	sMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
@@ -94,6 +195,21 @@ void WAV_Init(void)
 	HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 	// Set to output high to turn off amplifier
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_9, GPIO_PIN_SET);
+
+	// The ring starts silent, with no voice playing
+	mixerInit();
+	outputPaused = 0;
+	outputQuiet = 2;
+	outputMixed = 1;
+	memset(outputRing, 0, sizeof(outputRing));
+	mixerToDac(outputRing, WAV_MIX_SAMPLES);
+
+	// Start DAC with DMA (12 Bit DAC), it never stops
+	// 12 bit left alignment ignores 4 lsb of 16 bit data
+	HAL_DAC_Start(&hdac, DAC_CHANNEL_1);
+	HAL_DAC_Start_DMA(&hdac, DAC_CHANNEL_1, (uint32_t*)outputRing,
+	                  WAV_MIX_SAMPLES, DAC_ALIGN_12B_L);
+	HAL_TIM_Base_Start(&htim6);
 }
 
 
@@ -101,8 +217,10 @@ void WAV_Init(void)
  * @brief Import a .WAV file from a FatFs file system
  *
  * This function reads a .WAV file header into WAVE_Format struct
- * to which W points. With no errors and a size of less than 25 kB,
- * the full audio data is read into memory
+ * to which W points. With no errors and a size of at most AUD_BUF_BYTES,
+ * the full audio data is read into memory, after the files imported before.
+ * Once the audio buffer is full, the next file is read to its start again,
+ * and every file imported until then stops and must be imported again.
  *
  * @param FileName Full path to the specified .WAV file
  * @param W Pointer to corresponding WAVE_Format struct
@@ -113,49 +231,169 @@ uint8_t WAV_Import(const char* FileName, WAV_Format* W)
 {
 	UINT BytesRead;
 	FRESULT res;
+	uint32_t size;
+	uint32_t start;
 
 	// Check for Null struct
 	if (FileName == NULL || W == NULL) return -1;
 
-	// Make sure video does not read from SD
+	// Make sure video and the refills of a stream do not read from SD, a
+	// stream played last enables its refills once its command is applied
 	frameUpdateOff();
+	commandWait();
+	NVIC_DisableIRQ(TIM6_DAC_IRQn);
 	
 	delayms(50);
 
+	// The struct may have been streamed or imported before
+	if (W == streamWav) streamClose();
+	WAV_Stop(W);
+
 	// Copy Filename to WAV_Format struct
 	strcpy(W->Filename, FileName);
+	W->Streamed = 0;
+	W->Volume = MIX_VOLUME_MAX;
 
 	/* Read the Speech wave file status */
 	WavePlayer_ReadAndParse(W);
+	if (W->Error == Valid_WAVE_File && W->DataSize > AUD_BUF_BYTES) {
+		W->Error = Bad_DataSize;
+	}
 	if (W->Error != Valid_WAVE_File) {
+		NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		frameUpdateOn();
 		return W->Error;
 	}
 
+	// Files after the first keep their word alignment
+	size = (W->DataSize + 3) & ~3UL;
+	if (audioUsed + size > AUD_BUF_BYTES) importRelease();
+	W->Data = (uint8_t*)audioBuffer + audioUsed;
+
+	// No voice plays the data about to be overwritten
+	commandWait();
+
 	// Open file and error check
 	res = f_open(&F, W->Filename, FA_READ);
 	if (res != FR_OK) {
+		NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		frameUpdateOn();
 		W->Error = Bad_FileRead;
 		return W->Error;
 	}
 
+	// Map the clusters, reads cross clusters without walking the FAT
+	fastSeekMap(&F);
+
 	// Set file pointer to correct position
 	f_lseek(&F, W->SpeechDataOffset);
 
 	// Read WAV data and error check
-	res = f_read(&F, audioBuffer, (uint32_t)(W->DataSize), &BytesRead);
+	start = PROFILE_START();
+	res = f_read(&F, W->Data, (uint32_t)(W->DataSize), &BytesRead);
+	PROFILE_END(PROFILE_SD_READ, start);
 	if (res != FR_OK) {
+		f_close(&F);
+		fastSeekFree(&F);
+		NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		frameUpdateOn();
 		W->Error = Bad_FileRead;
 		return W->Error;
 	}
+	audioUsed += size;
 
 	// Close file
 	f_close(&F);
+	fastSeekFree(&F);
 
-	// Video can now read from SD
+	// Video and streams can now read from SD
+	NVIC_EnableIRQ(TIM6_DAC_IRQn);
 	frameUpdateOn();
 
-	// Convert 16 bit signed to 16 bit unsigned
-	ToggleBufferSign((uint32_t*)audioBuffer, W->DataSize / 4);
+	// The data stays signed, the mixer converts its output for the DAC
+	return 0;
+}
+
+/*!
+ * @brief Open a .WAV file from a FatFs file system to be streamed
+ *
+ * This function reads a .WAV file header into the WAVE_Format struct to
+ * which W points, and the start of its data into the ring, so WAV_Play()
+ * starts right away. The file stays open and is read while it plays, so its
+ * data may be of any size, at a rate up to WAV_STREAM_RATE_MAX, or twice
+ * that for 8 bit samples. Only one file is streamed at a time, opening
+ * another one closes the previous one.
+ *
+ * @param FileName Full path to the specified .WAV file
+ * @param W Pointer to corresponding WAVE_Format struct
+ *
+ * @return Error code specified by the ErrorCode enum
+ */
+uint8_t WAV_Stream(const char* FileName, WAV_Format* W)
+{
+	// Check for Null struct
+	if (FileName == NULL || W == NULL) return -1;
+
+	// Make sure video and the refills do not read from SD
+	frameUpdateOff();
+	commandWait();
+	NVIC_DisableIRQ(TIM6_DAC_IRQn);
+
+	delayms(50);
+
+	// Stops the file streamed until now, and W if it was imported
+	streamClose();
+	WAV_Stop(W);
+	commandWait();
+
+	// Copy Filename to WAV_Format struct
+	strcpy(W->Filename, FileName);
+	W->Streamed = 1;
+	W->Volume = MIX_VOLUME_MAX;
+	W->Data = NULL;
+
+	// Read the header, any data size fits
+	WavePlayer_ReadAndParse(W);
+	if (W->Error == Valid_WAVE_File
+	    && W->SampleRate > (W->BitsPerSample == BITS_PER_SAMPLE_8
+	                        ? 2 * WAV_STREAM_RATE_MAX : WAV_STREAM_RATE_MAX)) {
+		W->Error = Bad_Sample_Rate;
+	}
+	if (W->Error == Valid_WAVE_File
+	    && f_open(&streamFile, W->Filename, FA_READ) != FR_OK) {
+		W->Error = Bad_FileRead;
+	}
+	if (W->Error != Valid_WAVE_File) {
+		NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		frameUpdateOn();
+		return W->Error;
+	}
+
+	// Refills cross clusters without walking the FAT
+	fastSeekMap(&streamFile);
+	streamWav = W;
+
+	// Read the start of the data, a file shorter than the ring is read on play
+	streamRewind = 0;
+	streamLeft = W->DataSize;
+	if (W->FormatTag == WAVE_FORMAT_IMA_ADPCM) {
+		// The ring holds decoded samples, the plays are set on play
+		decodeStart(&streamDecoder, W, 1);
+		streamPrimed = W->DataSize / W->BlockAlign * W->SamplesPerBlock
+		               > WAV_STREAM_BYTES / 2
+		               && decodeSamples(&streamDecoder, (int16_t*)streamRing,
+		                                WAV_STREAM_BYTES / 2)
+		                  == WAV_STREAM_BYTES / 2;
+	} else {
+		streamPrimed = W->DataSize > WAV_STREAM_BYTES
+		               && f_lseek(&streamFile, W->SpeechDataOffset) == FR_OK
+		               && !streamRead(streamRing, WAV_STREAM_BYTES);
+		if (streamPrimed) streamLeft -= WAV_STREAM_BYTES;
+	}
+
+	// Video and refills can now read from SD
+	NVIC_EnableIRQ(TIM6_DAC_IRQn);
+	frameUpdateOn();
 
 	return 0;
 }
@@ -165,29 +403,32 @@ uint8_t WAV_Import(const char* FileName, WAV_Format* W)
  */
 void DMA1_Stream5_IRQHandler(void)
 {
-	// Max DMA transfer size 65535 samples > 25
+	uint32_t start = PROFILE_START();
 
+	// Calls the DAC callbacks, which mix the half of the ring played
 	HAL_DMA_IRQHandler(&hdma_dac1);
 
-	// Update the correct number of plays left
-	if (numberPlays == 1) {
-		// Done playing,
-		WAV_Pause();
-		numberPlays = 0;
-	} else if (numberPlays <= REPEAT_ALWAYS) {
-		numberPlays = REPEAT_ALWAYS;
-	} else {
-		numberPlays--;
-	}
+	// Pended by WAV_Play() for the files played since
+	if (commandTail != commandHead) outputPlayNow();
 
+	PROFILE_END(PROFILE_AUDIO, start);
 }
 
 /*!
  * @brief Play a .WAV file that has been successfully imported
  *
- * This function plays a .WAV file imported with WAV_Import(). If numPlays is
- * 0, nothing will happen. If numPlays is negative, the .WAV file will repeat
- * until WAV_Pause() or WAV_Destroy() are called.
+ * This function plays a .WAV file imported with WAV_Import() or opened with
+ * WAV_Stream() on a voice of the mixer, over the files already playing. If
+ * numPlays is 0, nothing will happen. If numPlays is negative, the .WAV file
+ * will repeat until WAV_Stop() or WAV_Destroy() are called.
+ *
+ * A file already playing starts again. With every voice busy, the one
+ * closest to its end is taken, never one that repeats, streams or decodes
+ * ADPCM. It only queues a command, applied as the DMA interrupt mixes the
+ * next half of the output ring, so it can be called as often as needed.
+ *
+ * A streamed file played again starts once half the ring has played, while
+ * its start is read in the background.
  *
  * @param W Pointer to a WAVE_Format previously imported
  * @param numPlays Number of times to repeat the .WAV file
@@ -195,81 +436,92 @@ void DMA1_Stream5_IRQHandler(void)
  */
 void WAV_Play(WAV_Format* W, int numPlays)
 {
-	// Pause old WAV file
-	WAV_Pause();
-
 	// Do not play if number of plays is 0 or error
 	if (numPlays == 0 || W == NULL || W->Error != Valid_WAVE_File) return;
 
+	// A streamed file must still be open
+	if (W->Streamed && W != streamWav) return;
+
 	// If numPlays is negative, set it to REPEAT_ALWAYS (-1)
-	// This allows interrupt to call this function with a decrement
 	if (numPlays < 0) numPlays = REPEAT_ALWAYS;
 
-	// Save the currently playing WAV file
-	playingWav = W;
-
-	/* Save data for DMA interrupt */
-	numberPlays = numPlays;
+	// No refill runs until the stream is set up by the DMA interrupt
+	if (W->Streamed) NVIC_DisableIRQ(TIM6_DAC_IRQn);
 
-	/* Save the transfer size of the current WAV file */
-	transferSize = playingWav->BitsPerSample;
+	commandPush(COMMAND_PLAY, W, numPlays);
 
-	/* Deinitialize everything */
-	HAL_DAC_Stop(&hdac, DAC_CHANNEL_1);
-	HAL_DAC_Stop_DMA(&hdac, DAC_CHANNEL_1);
-	HAL_DAC_DeInit(&hdac);
-
-	// Set period based on sample rate
-	HAL_TIM_Base_DeInit(&htim6); // deinit
-	htim6.Init.Period = W->TIM6ARRValue; // set ARR value
-	HAL_TIM_Base_Init(&htim6); // init
+	outputPaused = 0;
+	outputQuiet = 0;
+	/* Set to output low to turn on amplifier */
+	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_9, GPIO_PIN_RESET);
 
-	// Initialize DAC with correct transfer size
-	HAL_DAC_Init(&hdac);
+	// The DMA interrupt mixes the file in right away
+	NVIC_SetPendingIRQ(DMA1_Stream5_IRQn);
+}
 
-	// Start TIM6 and turn on amplifier
-	WAV_Resume();
+/*!
+ * @brief Stops playing a .WAV file
+ *
+ * @param W Pointer to the WAVE_Format to stop, NULL to stop every file
+ */
+void WAV_Stop(WAV_Format* W)
+{
+	commandPush(COMMAND_STOP, W, 0);
+}
 
-	// Start DAC
-	HAL_DAC_Start(&hdac, DAC_CHANNEL_1);
+/*!
+ * @brief Sets the volume a .WAV file plays at
+ *
+ * @param W Pointer to a WAVE_Format previously imported
+ * @param volume Volume, from 0 to MIX_VOLUME_MAX for the file as it is
+ */
+void WAV_SetVolume(WAV_Format* W, uint16_t volume)
+{
+	if (W == NULL) return;
+	if (volume > MIX_VOLUME_MAX) volume = MIX_VOLUME_MAX;
+	W->Volume = volume;
 
-	// Start DAC with DMA (12 Bit DAC)
-	// 12 bit left alignment ignores 4 lsb of 16 bit data
-	HAL_DAC_Start_DMA(&hdac, DAC_CHANNEL_1, (uint32_t*)audioBuffer,
-		playingWav->DataSize / 2, DAC_ADDR);
+	// Voices already playing the file change as well
+	commandPush(COMMAND_VOLUME, W, volume);
 }
 
 /*!
- * @brief Pauses the currently playing .WAV file and turns off the audio amp
+ * @brief Pauses every playing .WAV file and turns off the audio amp
  */
 void WAV_Pause(void)
 {
-	/* Disable TIM6 */
-	HAL_TIM_Base_Stop(&htim6);
+	outputPaused = 1;
 	/* Set to output high to turn off amplifier */
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_9, GPIO_PIN_SET);
 }
 
 /*!
- * @brief Resumes playing the imported .WAV file and turns on the audio amp
+ * @brief Resumes playing the paused .WAV files and turns on the audio amp
  */
 void WAV_Resume(void)
 {
-	/* Enable TIM6 */
-	HAL_TIM_Base_Start(&htim6);
+	outputPaused = 0;
+	outputQuiet = 0;
 	/* Set to output low to turn on amplifier */
 	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_9, GPIO_PIN_RESET);
 }
 
 /*!
- * @brief Stops playing the .WAV file and deinitializes the .WAV peripherals
+ * @brief Stops playing the .WAV files and deinitializes the .WAV peripherals
  */
 void WAV_Destroy(void)
 {
-	// Pause the currently playing WAV file
+	// Stop every file and turn off the amplifier
+	WAV_Stop(NULL);
+	commandWait();
 	WAV_Pause();
 
+	// Close the streamed file, no more refills
+	streamClose();
+	NVIC_DisableIRQ(TIM6_DAC_IRQn);
+
 	// Deinitialize Timer 6
+	HAL_TIM_Base_Stop(&htim6);
 	HAL_TIM_Base_DeInit(&htim6);
 
 	// Deinitialize DAC
@@ -284,6 +536,615 @@ void WAV_Destroy(void)
 
 	// Free previously allocated audio buffer
 	free(audioBuffer);
+	audioUsed = 0;
+}
+
+/*!
+ * @brief Refills the halves of the ring of a streamed file that were played
+ *
+ * TIM6 never raises its update interrupt, the vector is pended by the mixer
+ * instead. It runs at the priority of the video renderer, so the two never
+ * read the SD card at the same time.
+ */
+void TIM6_DAC_IRQHandler(void)
+{
+	uint8_t half;
+
+	// Clears a DMA underrun of the DAC
+	HAL_DAC_IRQHandler(&hdac);
+
+	while (streamWav != NULL && streamFree) {
+		// The first half is played before the second
+		half = (streamFree & 0x01) ? 0 : 1;
+		streamFill(half);
+
+		__disable_irq();
+		streamFree &= ~(1 << half);
+		__enable_irq();
+	}
+}
+
+/*!
+ * @brief The first half of the buffer of the DAC was played
+ *
+ * @param hdac Handle of the DAC
+ */
+void HAL_DAC_ConvHalfCpltCallbackCh1(DAC_HandleTypeDef *hdac)
+{
+	outputHalfPlayed(0);
+}
+
+/*!
+ * @brief The second half of the buffer of the DAC was played
+ *
+ * @param hdac Handle of the DAC
+ */
+void HAL_DAC_ConvCpltCallbackCh1(DAC_HandleTypeDef *hdac)
+{
+	outputHalfPlayed(1);
+}
+
+/*!
+ * @brief Queues a command to the DMA interrupt
+ *
+ * Waits for room if the queue is full, which lasts until the next half of
+ * the output ring at most.
+ *
+ * @param type What to do
+ * @param W File the command is for
+ * @param value Number of plays or volume
+ */
+static void commandPush(commandType type, WAV_Format *W, int32_t value)
+{
+	uint8_t head = commandHead;
+	wavCommand *command = &commandQueue[head % WAV_COMMANDS];
+
+	while ((uint8_t)(head - commandTail) >= WAV_COMMANDS);
+
+	command->type = type;
+	command->wav = W;
+	command->value = value;
+
+	// The command is written before the interrupt can see it
+	__DMB();
+	commandHead = head + 1;
+}
+
+/*!
+ * @brief Waits until the DMA interrupt applied every command queued
+ */
+static void commandWait(void)
+{
+	while (commandTail != commandHead);
+}
+
+/*!
+ * @brief Applies the commands queued, from the DMA interrupt
+ *
+ * @return Voices the files played were started on, bit 0 for the first
+ */
+static uint8_t commandDrain(void)
+{
+	wavCommand *command;
+	mixVoice *voice;
+	uint8_t tail = commandTail;
+	uint8_t started = 0;
+	uint8_t i;
+
+	while (tail != commandHead) {
+		// The command is read after its head
+		__DMB();
+		command = &commandQueue[tail % WAV_COMMANDS];
+
+		switch (command->type) {
+		case COMMAND_PLAY:
+			voice = commandPlay(command->wav, command->value);
+			if (voice != NULL) started |= 1 << (voice - mixVoices);
+			break;
+		case COMMAND_STOP:
+			mixerStop(command->wav);
+			break;
+		case COMMAND_VOLUME:
+			for (i = 0; i < MIX_VOICES; i++) {
+				if (mixVoices[i].owner == command->wav) {
+					mixVoices[i].volume = command->value;
+				}
+			}
+			break;
+		case COMMAND_RELEASE:
+			// Imported ADPCM files are decoded from the buffer
+			for (i = 0; i < MIX_VOICES; i++) {
+				if ((mixVoices[i].data >= (const void*)audioBuffer
+				     && mixVoices[i].data < (const void*)
+				        ((const uint8_t*)audioBuffer + AUD_BUF_BYTES))
+				    || mixVoices[i].halfPlayed == decodeHalfPlayed) {
+					mixVoices[i].active = 0;
+				}
+			}
+			break;
+		}
+
+		// The slot is read before it is handed back
+		__DMB();
+		commandTail = ++tail;
+	}
+
+	return started;
+}
+
+/*!
+ * @brief Starts a file on a voice of the mixer, from the DMA interrupt
+ *
+ * @param W Pointer to a WAVE_Format previously imported
+ * @param numPlays Number of times to repeat the .WAV file, or REPEAT_ALWAYS
+ *
+ * @return The voice playing the file, NULL if none could be taken
+ */
+static mixVoice *commandPlay(WAV_Format *W, int32_t numPlays)
+{
+	mixVoice *voice = mixerTake(W);
+	uint8_t i;
+
+	// Every voice repeats, streams or decodes, none of them is cut
+	if (voice == NULL) {
+		// Refills were held for this play, the stream is not playing
+		if (W->Streamed) NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		return NULL;
+	}
+	i = voice - mixVoices;
+
+	voice->owner = W;
+	// ADPCM data is decoded to 16 bit samples before it is mixed
+	voice->bits = W->FormatTag == WAVE_FORMAT_IMA_ADPCM ? BITS_PER_SAMPLE_16
+	                                                   : W->BitsPerSample;
+	voice->volume = W->Volume;
+	voice->position = 0;
+	voice->phase = 0;
+	voice->step = W->Step;
+
+	if (W->Streamed) {
+		// Refills left from the previous play are dropped, WAV_Play()
+		// disabled them so none is running
+		streamPlays = numPlays;
+		streamDecoder.plays = numPlays;
+		streamFree = 0;
+		streamEnd = 0;
+
+		// The start is read while the first half plays silence
+		if (!streamPrimed) {
+			streamSilence(streamRing, WAV_STREAM_BYTES);
+			streamRewind = 1;
+			decodeStart(&streamDecoder, W, numPlays);
+			streamFree = 0x02;
+		}
+		streamPrimed = 0;
+
+		// The voice goes around the ring until the last play ends
+		voice->data = streamRing;
+		voice->length = WAV_STREAM_BYTES / (voice->bits / 8);
+		voice->loops = MIX_LOOP_ALWAYS;
+		voice->halfPlayed = streamHalfPlayed;
+
+		// Refills go on in the background
+		NVIC_EnableIRQ(TIM6_DAC_IRQn);
+		if (streamFree) NVIC_SetPendingIRQ(TIM6_DAC_IRQn);
+	} else if (W->FormatTag == WAVE_FORMAT_IMA_ADPCM) {
+		// The voice goes around its ring until the last play ends
+		decodeStart(&decoders[i], W, numPlays);
+		decodeFill(i, 0);
+		decodeFill(i, 1);
+		voice->data = decodeRing[i];
+		voice->length = WAV_DECODE_SAMPLES;
+		voice->loops = MIX_LOOP_ALWAYS;
+		voice->halfPlayed = decodeHalfPlayed;
+	} else {
+		voice->data = W->Data;
+		voice->length = W->DataSize / (voice->bits / 8);
+		voice->loops = numPlays == REPEAT_ALWAYS ? MIX_LOOP_ALWAYS
+		                                         : numPlays - 1;
+		voice->halfPlayed = NULL;
+	}
+
+	voice->active = 1;
+	return voice;
+}
+
+/*!
+ * @brief Mixes the voices into the half of the output ring the DAC played
+ *
+ * The commands queued are applied first. The half plays once the DAC is done
+ * with the other one, so a file started now is heard within WAV_MIX_SAMPLES
+ * samples. The amp is turned off once both halves are silent.
+ *
+ * @param half Half of the ring played, 0 for the first
+ */
+static void outputHalfPlayed(uint8_t half)
+{
+	int16_t *out = outputRing + half * (WAV_MIX_SAMPLES / 2);
+
+	commandDrain();
+
+	if (outputPaused) {
+		memset(out, 0, WAV_MIX_SAMPLES / 2 * sizeof(int16_t));
+	} else if (mixerRender(out, WAV_MIX_SAMPLES / 2)) {
+		outputQuiet = 0;
+	} else if (outputQuiet < 2 && ++outputQuiet == 2) {
+		/* Set to output high to turn off amplifier */
+		HAL_GPIO_WritePin(GPIOA, GPIO_PIN_9, GPIO_PIN_SET);
+	}
+
+	// Convert 16 bit signed to 12 bit unsigned, left aligned
+	mixerToDac(out, WAV_MIX_SAMPLES / 2);
+	outputMixed = half;
+}
+
+/*!
+ * @brief Applies the commands queued and mixes the files started into the
+ * ring, from the DMA interrupt pended by WAV_Play()
+ *
+ * The ring is mixed up to the end of the half after the one playing, so a
+ * file left to the next half would be heard one to two halves later. The
+ * voices started are added to the samples mixed instead, from WAV_PLAY_LEAD
+ * samples past the one the DAC plays, and go on from there.
+ */
+static void outputPlayNow(void)
+{
+	uint8_t started = commandDrain();
+	uint8_t half;
+	uint32_t from;
+	uint32_t to;
+
+	if (!started || outputPaused) return;
+
+	// The DMA counts down the samples left until the end of the ring
+	from = WAV_MIX_SAMPLES - __HAL_DMA_GET_COUNTER(&hdma_dac1);
+	half = from >= WAV_MIX_SAMPLES / 2;
+	to = (half + 1) * (WAV_MIX_SAMPLES / 2);
+	// The next half is mixed already, unless its interrupt is still pending
+	if (half != outputMixed) to += WAV_MIX_SAMPLES / 2;
+	// Samples are converted two at a time
+	from = (from + WAV_PLAY_LEAD + 1) & ~1UL;
+
+	if (from < WAV_MIX_SAMPLES) {
+		outputAdd(started, from, to < WAV_MIX_SAMPLES ? to : WAV_MIX_SAMPLES);
+		from = WAV_MIX_SAMPLES;
+	}
+	if (to > WAV_MIX_SAMPLES) {
+		outputAdd(started, from - WAV_MIX_SAMPLES, to - WAV_MIX_SAMPLES);
+	}
+}
+
+/*!
+ * @brief Adds voices to samples of the ring already mixed and converted
+ *
+ * The samples are done a few at a time in the order the DAC plays them, so
+ * the first ones are ready long before the DAC gets to them.
+ *
+ * @param voices Voices added, bit 0 for the first
+ * @param from First sample of the ring, even
+ * @param to Sample of the ring after the last one, even
+ */
+static void outputAdd(uint8_t voices, uint32_t from, uint32_t to)
+{
+	int16_t *out;
+	uint32_t count;
+	uint8_t i;
+
+	for (; from < to; from += count) {
+		out = outputRing + from;
+		count = to - from < WAV_PLAY_BLOCK ? to - from : WAV_PLAY_BLOCK;
+
+		// Converting again gives back signed samples, short of 4 bits
+		mixerToDac(out, count);
+		for (i = 0; i < MIX_VOICES; i++) {
+			if (voices & (1 << i)) mixerAdd(&mixVoices[i], out, count);
+		}
+		mixerToDac(out, count);
+	}
+}
+
+/*!
+ * @brief Frees the audio buffer for the next files imported
+ *
+ * Files imported until now are overwritten, so the voices playing them are
+ * stopped by the DMA interrupt.
+ */
+static void importRelease(void)
+{
+	commandPush(COMMAND_RELEASE, NULL, 0);
+	audioUsed = 0;
+}
+
+/*!
+ * @brief Stops the streamed file and closes it
+ */
+static void streamClose(void)
+{
+	if (streamWav == NULL) return;
+
+	// Its voice stops before the ring is used again
+	WAV_Stop(streamWav);
+	commandWait();
+
+	f_close(&streamFile);
+	fastSeekFree(&streamFile);
+	streamWav = NULL;
+	streamFree = 0;
+	streamEnd = 0;
+	streamPrimed = 0;
+}
+
+/*!
+ * @brief Reads data of the streamed file for the mixer
+ *
+ * @param dst Where to read the data
+ * @param bytes Number of bytes to read, even for 16 bit data
+ *
+ * @return 0 on success, !0 on failure
+ */
+static uint8_t streamRead(uint8_t *dst, uint32_t bytes)
+{
+	UINT bytesRead;
+	uint32_t start = PROFILE_START();
+	FRESULT result;
+
+	result = f_read(&streamFile, dst, bytes, &bytesRead);
+	PROFILE_END(PROFILE_SD_READ, start);
+	if (result != FR_OK || bytesRead != bytes) {
+		return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief Fills part of the ring with silence
+ *
+ * @param dst First byte to fill
+ * @param bytes Number of bytes to fill, even
+ */
+static void streamSilence(uint8_t *dst, uint32_t bytes)
+{
+	// 8 bit data is unsigned, 16 bit and decoded data signed
+	if (streamWav->BitsPerSample == BITS_PER_SAMPLE_8) {
+		memset(dst, 0x80, bytes);
+	} else {
+		memset(dst, 0, bytes);
+	}
+}
+
+/*!
+ * @brief Reads the next data of the streamed file into half of the ring
+ *
+ * The file is read again from the start of its data for each play left.
+ * After the last play, or a failed read, the rest is silence and playing
+ * stops once the half the data ends in was played.
+ *
+ * @param half Half of the ring to fill, 0 for the first
+ */
+static void streamFill(uint8_t half)
+{
+	uint8_t *dst = streamRing + half * (WAV_STREAM_BYTES / 2);
+	uint32_t left = WAV_STREAM_BYTES / 2;
+	uint32_t bytes;
+
+	// ADPCM blocks are read and decoded into the half
+	if (streamWav->FormatTag == WAVE_FORMAT_IMA_ADPCM) {
+		bytes = decodeSamples(&streamDecoder, (int16_t*)dst, left / 2) * 2;
+		if (bytes < left) {
+			if (!streamEnd) streamEnd = 1 << half;
+			streamSilence(dst + bytes, left - bytes);
+		}
+		return;
+	}
+
+	while (left) {
+		if (streamLeft == 0) {
+			if (!streamRewind && streamPlays != REPEAT_ALWAYS
+			    && streamPlays <= 1) {
+				// The first half filled with silence is where the data ends
+				if (!streamEnd) streamEnd = 1 << half;
+				streamSilence(dst, left);
+				return;
+			}
+
+			// Next play
+			if (!streamRewind && streamPlays > 1) streamPlays--;
+			streamRewind = 0;
+			if (f_lseek(&streamFile, streamWav->SpeechDataOffset) != FR_OK) {
+				streamWav->Error = Bad_FileRead;
+				streamPlays = 1;
+				continue;
+			}
+			streamLeft = streamWav->DataSize;
+
+			// Data with nothing to read ends the plays
+			if (streamLeft == 0) streamPlays = 1;
+		}
+
+		bytes = left < streamLeft ? left : streamLeft;
+		if (streamRead(dst, bytes)) {
+			// Stop after what was read
+			streamWav->Error = Bad_FileRead;
+			streamLeft = 0;
+			streamPlays = 1;
+			continue;
+		}
+
+		dst += bytes;
+		left -= bytes;
+		streamLeft -= bytes;
+	}
+}
+
+/*!
+ * @brief Frees half of the ring of a streamed file once the mixer played it
+ *
+ * @param voice Voice playing the streamed file
+ * @param half Half of the ring played, 0 for the first
+ */
+static void streamHalfPlayed(mixVoice *voice, uint8_t half)
+{
+	// The last play ended in this half
+	if (streamEnd & (1 << half)) {
+		voice->active = 0;
+		streamEnd = 0;
+		return;
+	}
+
+	streamFree |= 1 << half;
+	NVIC_SetPendingIRQ(TIM6_DAC_IRQn);
+}
+
+/*!
+ * @brief Starts decoding an ADPCM file from the start of its data
+ *
+ * @param decoder Decoding state
+ * @param W File to decode
+ * @param numPlays Number of times to decode the data, or REPEAT_ALWAYS
+ */
+static void decodeStart(wavDecoder *decoder, WAV_Format *W, int32_t numPlays)
+{
+	decoder->adpcm.left = 0;
+	decoder->wav = W;
+	decoder->offset = 0;
+	decoder->plays = numPlays;
+	decoder->rewind = 1;
+	decoder->end = 0;
+}
+
+/*!
+ * @brief Decodes the next samples of an ADPCM file
+ *
+ * The data is decoded again from its start for each play left.
+ *
+ * @param decoder Decoding state
+ * @param dst Decoded samples
+ * @param count Number of samples to decode
+ *
+ * @return Number of samples decoded, less than count after the last play
+ * or a failed read
+ */
+static uint32_t decodeSamples(wavDecoder *decoder, int16_t *dst,
+                              uint32_t count)
+{
+	uint32_t done = 0;
+
+	while (done < count) {
+		if (!decoder->adpcm.left && decodeNextBlock(decoder)) break;
+		done += adpcmDecode(&decoder->adpcm, dst + done, count - done);
+	}
+	return done;
+}
+
+/*!
+ * @brief Starts decoding the next block of an ADPCM file
+ *
+ * Blocks of imported files are decoded in the audio buffer, blocks of the
+ * streamed file are read from it whole. The last block may be short.
+ *
+ * @param decoder Decoding state
+ *
+ * @return 0 on success, !0 after the last play or a failed read
+ */
+static uint8_t decodeNextBlock(wavDecoder *decoder)
+{
+	WAV_Format *W = decoder->wav;
+	const uint8_t *block;
+	uint32_t bytes;
+	UINT bytesRead;
+	uint32_t start;
+	FRESULT result;
+
+	// Data left shorter than a header ends the play
+	if (decoder->rewind || W->DataSize - decoder->offset <= ADPCM_HEADER_BYTES) {
+		if (!decoder->rewind && decoder->plays != REPEAT_ALWAYS
+		    && decoder->plays <= 1) {
+			return 1;
+		}
+
+		// Next play
+		if (!decoder->rewind && decoder->plays > 1) decoder->plays--;
+		decoder->rewind = 0;
+		decoder->offset = 0;
+		if (W->DataSize <= ADPCM_HEADER_BYTES) {
+			decoder->plays = 1;
+			return 1;
+		}
+		if (W->Streamed
+		    && f_lseek(&streamFile, W->SpeechDataOffset) != FR_OK) {
+			W->Error = Bad_FileRead;
+			decoder->plays = 1;
+			return 1;
+		}
+	}
+
+	bytes = W->DataSize - decoder->offset;
+	if (bytes > W->BlockAlign) bytes = W->BlockAlign;
+
+	if (W->Streamed) {
+		start = PROFILE_START();
+		result = f_read(&streamFile, streamBlock, bytes, &bytesRead);
+		PROFILE_END(PROFILE_SD_READ, start);
+		if (result != FR_OK || bytesRead != bytes) {
+			// Stop after what was decoded
+			W->Error = Bad_FileRead;
+			decoder->offset = W->DataSize;
+			decoder->plays = 1;
+			return 1;
+		}
+		block = streamBlock;
+	} else {
+		block = W->Data + decoder->offset;
+	}
+
+	adpcmBlock(&decoder->adpcm, block, bytes);
+	decoder->offset += bytes;
+	return 0;
+}
+
+/*!
+ * @brief Decodes the next samples of an imported ADPCM file into half of
+ * the ring of its voice
+ *
+ * After the last play the rest is silence, and the voice stops once the
+ * half the data ends in was played.
+ *
+ * @param voice Index of the voice
+ * @param half Half of the ring to fill, 0 for the first
+ */
+static void decodeFill(uint8_t voice, uint8_t half)
+{
+	wavDecoder *decoder = &decoders[voice];
+	int16_t *dst = decodeRing[voice] + half * (WAV_DECODE_SAMPLES / 2);
+	uint32_t count;
+
+	count = decodeSamples(decoder, dst, WAV_DECODE_SAMPLES / 2);
+	if (count < WAV_DECODE_SAMPLES / 2) {
+		if (!decoder->end) decoder->end = 1 << half;
+		memset(dst + count, 0,
+		       (WAV_DECODE_SAMPLES / 2 - count) * sizeof(int16_t));
+	}
+}
+
+/*!
+ * @brief Decodes the next samples of an imported ADPCM file into the half
+ * of the ring of its voice the mixer played
+ *
+ * @param voice Voice playing the file
+ * @param half Half of the ring played, 0 for the first
+ */
+static void decodeHalfPlayed(mixVoice *voice, uint8_t half)
+{
+	uint8_t i = voice - mixVoices;
+
+	// The last play ended in this half
+	if (decoders[i].end & (1 << half)) {
+		voice->active = 0;
+		decoders[i].end = 0;
+		return;
+	}
+
+	decodeFill(i, half);
 }
 
 
@@ -350,9 +1211,10 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 	if(temp != 0x10){
 		extraformatbytes = 1;
 	}
-	/* Read the audio format, must be 0x01 (PCM) -------------------------------*/
+	/* Read the audio format, must be 0x01 (PCM) or 0x11 (IMA ADPCM) ----------*/
 	WAVE_Format->FormatTag = ReadUnit((uint8_t*)TempBuffer, 20, 2, LittleEndian);
-	if(WAVE_Format->FormatTag != WAVE_FORMAT_PCM){
+	if(WAVE_Format->FormatTag != WAVE_FORMAT_PCM &&
+		WAVE_Format->FormatTag != WAVE_FORMAT_IMA_ADPCM){
 		f_close(&F);
 		WAVE_Format->Error = Bad_FormatTag;
 		return;
@@ -369,8 +1231,7 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 
 	/* Read the Sample Rate ----------------------------------------------------*/
 	WAVE_Format->SampleRate = ReadUnit((uint8_t*)TempBuffer, 24, 4, LittleEndian);
-	/* Update the OCA value according to the .WAV file Sample Rate */
-	// Only allow up to 50 ksps rate to ensure buffer has enough time to update
+	// Any rate in range is resampled to MIX_RATE by the mixer
 	if (WAVE_Format->SampleRate < SAMPLE_RATE_MIN ||
 		WAVE_Format->SampleRate > SAMPLE_RATE_MAX) {
 			f_close(&F);
@@ -378,8 +1239,8 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 			return;
 	}
 
-	/* Fs = Ftimer / (ARR+1); ARR = Ftimer / Fs - 1 */
-	WAVE_Format->TIM6ARRValue = (uint32_t)(TIM6FREQ / WAVE_Format->SampleRate - 1);
+	/* Step = Fs / Fmix, 16.16 fixed point */
+	WAVE_Format->Step = (uint32_t)(((uint64_t)WAVE_Format->SampleRate << 16) / MIX_RATE);
 
 	/* Read the Byte Rate ------------------------------------------------------*/
 	WAVE_Format->ByteRate = ReadUnit((uint8_t*)TempBuffer, 28, 4, LittleEndian);
@@ -390,15 +1251,52 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 	/* Read the number of bits per sample --------------------------------------*/
 	WAVE_Format->BitsPerSample = ReadUnit((uint8_t*)TempBuffer, 34, 2, LittleEndian);
 
-	if (WAVE_Format->BitsPerSample != BITS_PER_SAMPLE_16 &&
+	if (WAVE_Format->FormatTag == WAVE_FORMAT_IMA_ADPCM) {
+		if (WAVE_Format->BitsPerSample != BITS_PER_SAMPLE_4) {
+			f_close(&F);
+			WAVE_Format->Error = Bad_Bits_Per_Sample;
+			return;
+		}
+	} else if (WAVE_Format->BitsPerSample != BITS_PER_SAMPLE_16 &&
 		WAVE_Format->BitsPerSample != BITS_PER_SAMPLE_8) {
 		f_close(&F);
 		WAVE_Format->Error = Bad_Bits_Per_Sample;
 		return;
 	}
+	WAVE_Format->SamplesPerBlock = 1;
 	WAVE_Format->SpeechDataOffset = 36;
+	if (WAVE_Format->FormatTag == WAVE_FORMAT_IMA_ADPCM) {
+		/* Blocks hold their header and codes, and are read whole ---------------*/
+		if (WAVE_Format->BlockAlign <= ADPCM_HEADER_BYTES ||
+			WAVE_Format->BlockAlign > WAV_ADPCM_BLOCK_BYTES) {
+			f_close(&F);
+			WAVE_Format->Error = Bad_BlockAlign;
+			return;
+		}
+		/* Read the Extra format bytes, must be 0x02 ------------------------------*/
+		temp = ReadUnit((uint8_t*)TempBuffer, 36, 2, LittleEndian);
+		if(extraformatbytes != 1 || temp != 0x02){
+			f_close(&F);
+			WAVE_Format->Error = Bad_ExtraFormatBytes;
+			return;
+		}
+		/* Read the samples per block, must fill the block ------------------------*/
+		WAVE_Format->SamplesPerBlock = ReadUnit((uint8_t*)TempBuffer, 38, 2, LittleEndian);
+		if(WAVE_Format->SamplesPerBlock != ADPCM_BLOCK_SAMPLES(WAVE_Format->BlockAlign)){
+			f_close(&F);
+			WAVE_Format->Error = Bad_BlockAlign;
+			return;
+		}
+		WAVE_Format->SpeechDataOffset = 40;
+		/* Skip the Fact chunk holding the number of samples, if any -------------*/
+		temp = ReadUnit((uint8_t*)TempBuffer, 40, 4, BigEndian);
+		if(temp == FACT_ID){
+			temp = ReadUnit((uint8_t*)TempBuffer, 44, 4, LittleEndian);
+			WAVE_Format->SpeechDataOffset += 8 + temp;
+		}
+	}
 	/* If there is Extra format bytes, these bytes will be defined in "Fact Chunk" */
-	if(extraformatbytes == 1){
+	else if(extraformatbytes == 1){
 		/* Read th Extra format bytes, must be 0x00 ------------------------------*/
 		temp = ReadUnit((uint8_t*)TempBuffer, 36, 2, LittleEndian);
 		if(temp != 0x00){
@@ -429,11 +1327,15 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 	/* Read the number of sample data ------------------------------------------*/
 	temp = ReadUnit((uint8_t*)TempBuffer, WAVE_Format->SpeechDataOffset, 4, LittleEndian);
 
-	if (temp > 50000 || temp < 0) {
+	/* The data must hold a sample, or a block of IMA ADPCM --------------------*/
+	if ((WAVE_Format->FormatTag == WAVE_FORMAT_IMA_ADPCM && temp <= ADPCM_HEADER_BYTES) ||
+		(WAVE_Format->FormatTag == WAVE_FORMAT_PCM && temp < WAVE_Format->BitsPerSample / 8)) {
 		f_close(&F);
 		WAVE_Format->Error = Bad_DataSize;
 		return;
 	}
+
+	/* The size of imported data is checked by WAV_Import ---------------------*/
 	WAVE_Format->DataSize = temp;
 
 	WAVE_Format->SpeechDataOffset += 4;
@@ -442,24 +1344,6 @@ void WavePlayer_ReadAndParse(WAV_Format* WAVE_Format)
 	return;
 }
 
-/*!
- * @brief  Toggles sign bit of input buffer.
- * @param  pBuffer: pointer to the input buffer
- * @param  BufferSize: the size of the buffer in words
- * @retval None
- */
-static void ToggleBufferSign(uint32_t* pBuffer, uint32_t BufferSize)
-{
-	volatile uint32_t readdata = (uint32_t)pBuffer;
-	volatile uint32_t loopcnt = 0;
-
-	/* Invert sign bit: PCM format is 16-bit signed and DAC is 12-bit unsigned */
-	for(loopcnt = 0; loopcnt < BufferSize; loopcnt++){
-		*(uint32_t*)readdata ^= 0x80008000;
-		readdata+=4;
-	}
-}
-
 /*!
  * @brief  Reads a number of bytes from the SPI Flash and reorder them in Big
  *         or little endian.